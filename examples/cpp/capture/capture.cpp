@@ -4,23 +4,233 @@
 #include "pch.h"
 #include <iostream>
 
-int main()
+// Flight recorder trigger rule: IPv4 TCP segment with RST flag to or from the port
+bool is_tcp_reset(const INTERMEDIATE_BUFFER& buffer, const uint16_t port)
 {
+	const auto* const ether_header = reinterpret_cast<const ::ether_header*>(buffer.m_IBuffer);
+
+	if (buffer.m_Length < ETHER_HEADER_LENGTH + sizeof(iphdr) || ntohs(ether_header->h_proto) != ETH_P_IP)
+		return false;
+
+	const auto* const ip_header = reinterpret_cast<const iphdr*>(ether_header + 1);
+	const auto tcp_offset = ETHER_HEADER_LENGTH + sizeof(DWORD) * ip_header->ip_hl;
+
+	if (ip_header->ip_p != IPPROTO_TCP || buffer.m_Length < tcp_offset + sizeof(tcphdr))
+		return false;
+
+	const auto* const tcp_header = reinterpret_cast<const tcphdr*>(buffer.m_IBuffer + tcp_offset);
+
+	return (tcp_header->th_flags & TH_RST) && (ntohs(tcp_header->th_sport) == port || ntohs(tcp_header->
+		th_dport) == port);
+}
+
+// Conversation endpoint of the flow index key
+std::string format_endpoint(const uint8_t* address, const uint16_t port, const uint8_t ip_version)
+{
+	std::string result;
+
+	if (ip_version == 4)
+	{
+		in_addr ip{};
+		std::memcpy(&ip, address, sizeof(ip));
+		result = std::string(net::ip_address_v4(ip));
+	}
+	else
+	{
+		uint8_t ip[16];
+		std::memcpy(ip, address, sizeof(ip));
+		result = "[" + std::string(net::ip_address_v6(ip)) + "]";
+	}
+
+	return result + ":" + std::to_string(port);
+}
+
+// Reads the capture back through its flow index and prints the largest conversations
+void print_top_flows(const std::string& file_name, const size_t count = 5)
+{
+	pcap::capture_file_reader reader(file_name);
+	const pcap::flow_index_reader index(file_name + pcap::flow_index_extension);
+
+	if (!reader || !index)
+	{
+		std::cout << "Failed to read " << file_name << " back with its flow index" << std::endl;
+		return;
+	}
+
+	std::vector<const pcap::flow_index_flow*> flows;
+	flows.reserve(index.flow_count());
+
+	for (size_t i = 0; i < index.flow_count(); ++i)
+	{
+		if (index.flows()[i].key.ip_version != 0)
+			flows.push_back(&index.flows()[i]);
+	}
+
+	const auto top = flows.begin() + static_cast<std::ptrdiff_t>((std::min)(count, flows.size()));
+
+	std::partial_sort(flows.begin(), top, flows.end(), [](auto lhs, auto rhs)
+	{
+		return lhs->bytes > rhs->bytes;
+	});
+
+	std::cout << "Largest of " << index.flow_count() << " conversations:" << std::endl;
+
+	for (auto it = flows.begin(); it != top; ++it)
+	{
+		const auto& flow = **it;
+		const auto& key = flow.key;
+
+		// the packets are read straight from the file offsets in the index
+		const auto read_back = pcap::read_flow(reader, index, flow, [](const pcap::packet_view&)
+		{
+		});
+
+		std::cout << format_endpoint(key.lower_address, key.lower_port, key.ip_version) << " <-> " <<
+			format_endpoint(key.upper_address, key.upper_port, key.ip_version) << " protocol " <<
+			static_cast<uint32_t>(key.protocol);
+
+		if (key.vlan != 0)
+			std::cout << " VLAN " << key.vlan;
+
+		std::cout << ": " << flow.packets << " packets, " << flow.bytes << " bytes, " << read_back <<
+			" packets read back" << std::endl;
+	}
+}
+
+// Writes the frames of the given length from the producer threads for one second (unpaced if
+// packets_per_second is zero) and prints the offered and written rates and the drop rate
+bool measure_async_writer(const std::string& file_name, const size_t threads, const uint32_t frame_length,
+                          const uint64_t packets_per_second = 0)
+{
+	constexpr auto duration = std::chrono::seconds(1);
+	constexpr uint64_t batch_size = 256;
+
+	pcap::pcap_async_writer writer;
+
+	if (!writer.open(file_name))
+	{
+		std::cout << "Failed to open " << file_name << std::endl;
+		return false;
+	}
+
+	std::atomic_bool stop{false};
+	std::vector<std::thread> producers;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+		producers.emplace_back([&writer, &stop, start, frame_length, packets_per_second, threads]
+		{
+			std::vector<char> frame(frame_length, 0x5a);
+			auto next_batch = start;
+
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				for (uint64_t j = 0; j < batch_size; ++j)
+					writer.write(frame.data(), frame_length, pcap::timestamp_now());
+
+				if (packets_per_second == 0)
+					continue;
+
+				// the offered rate is shared between the producer threads
+				next_batch += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::nanoseconds(1000000000ull * batch_size * threads / packets_per_second));
+
+				while (std::chrono::steady_clock::now() < next_batch && !stop.load(std::memory_order_relaxed))
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(duration);
+	stop = true;
+
+	for (auto& producer : producers)
+		producer.join();
+
+	const auto produced = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// the rest of the staged packets is written out before the file is closed
+	writer.close();
+
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const auto [packets_queued, bytes_queued, packets_dropped, bytes_dropped, bytes_written, write_errors,
+		segments_completed] = writer.get_statistics();
+	const auto packets_offered = packets_queued + packets_dropped;
+
+	std::remove(file_name.c_str());
+
+	std::cout << std::setw(8) << threads << std::setw(8) << frame_length << std::fixed << std::setprecision(2) <<
+		std::setw(12);
+
+	if (packets_per_second != 0)
+		std::cout << static_cast<double>(packets_per_second) / 1000000.0;
+	else
+		std::cout << "max";
+
+	std::cout << std::setw(12) << static_cast<double>(packets_offered) / produced / 1000000.0 << std::setw(12) <<
+		static_cast<double>(packets_queued) / elapsed / 1000000.0 << std::setw(10) << static_cast<double>(
+			bytes_written) / elapsed / 1000000.0 << std::setw(10) << (packets_offered
+			? 100.0 * static_cast<double>(packets_dropped) / static_cast<double>(packets_offered)
+			: 0.0) << std::setw(8) << write_errors << std::endl;
+
+	return write_errors == 0;
+}
+
+// Measures the pcap_async_writer throughput and drop rate: unpaced producers with small and
+// full-size frames, then one producer of full-size frames at fixed offered rates
+int run_benchmark()
+{
+	const std::string file_name = "capture_benchmark.pcap";
+	auto result = true;
+
+	std::cout << std::setw(8) << "threads" << std::setw(8) << "frame" << std::setw(12) << "target Mpps" <<
+		std::setw(12) << "offered" << std::setw(12) << "written" << std::setw(10) << "MB/s" << std::setw(10) <<
+		"drop %" << std::setw(8) << "errors" << std::endl;
+
+	for (const size_t threads : { 1, 4 })
+	{
+		for (const uint32_t frame_length : { 64, 1514 })
+			result = measure_async_writer(file_name, threads, frame_length) && result;
+	}
+
+	for (const uint64_t packets_per_second : { 100000, 250000, 500000, 1000000 })
+		result = measure_async_writer(file_name, 1, 1514, packets_per_second) && result;
+
+	return result ? 0 : 1;
+}
+
+int main(const int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "benchmark")
+		return run_benchmark();
+
 	try
 	{
 		std::string file_name;
-		pcap::pcap_file_storage file_stream;
+		pcap::pcap_async_writer file_stream;
+		std::unique_ptr<pcap::flight_recorder> recorder;
+
+		// Packets go either to the file or to the flight recorder, which also checks its trigger rule
+		auto capture = [&file_stream, &recorder](const INTERMEDIATE_BUFFER& buffer)
+		{
+			if (recorder)
+				recorder->record_and_match(buffer, pcap::timestamp_now());
+			else
+				file_stream.write(buffer, pcap::timestamp_now());
+		};
 
 		auto ndis_api = std::make_unique<ndisapi::fastio_packet_filter>(
-			[&file_stream](HANDLE, INTERMEDIATE_BUFFER& buffer)
+			[&capture](HANDLE, INTERMEDIATE_BUFFER& buffer)
 			{
-				file_stream << buffer;
+				capture(buffer);
 
 				return ndisapi::fastio_packet_filter::packet_action::pass;
 			},
-			[&file_stream](HANDLE, INTERMEDIATE_BUFFER& buffer)
+			[&capture](HANDLE, INTERMEDIATE_BUFFER& buffer)
 			{
-				file_stream << buffer;
+				capture(buffer);
 
 				return ndisapi::fastio_packet_filter::packet_action::pass;
 			}, true);
@@ -51,10 +261,113 @@ int main()
 			return 0;
 		}
 
+		char mode = 'f';
+
+		std::cout << std::endl << "Write capture to file or keep it in flight recorder (f/r):";
+		std::cin >> mode;
+
+		if (mode == 'r' || mode == 'R')
+		{
+			uint32_t ring_size = 0;
+			uint32_t window = 0;
+			uint16_t port = 0;
+
+			std::cout << std::endl << "Enter dump file name prefix:";
+			std::cin >> file_name;
+
+			std::cout << std::endl << "Enter flight recorder memory per filter thread in MB:";
+			std::cin >> ring_size;
+
+			std::cout << std::endl << "Enter dump time window in seconds (0 - everything recorded):";
+			std::cin >> window;
+
+			std::cout << std::endl << "Enter TCP port to dump on connection reset (0 - no trigger rule):";
+			std::cin >> port;
+
+			recorder = std::make_unique<pcap::flight_recorder>(
+				(std::max)(ring_size, 1u) * 1024 * 1024, MAX_ETHER_FRAME,
+				(std::max)(std::thread::hardware_concurrency(), 1u));
+
+			const pcap::flight_recorder::dump_request request{file_name, std::chrono::seconds(window)};
+
+			if (port != 0)
+			{
+				recorder->set_trigger_rule([port](const INTERMEDIATE_BUFFER& buffer)
+				{
+					return is_tcp_reset(buffer, port);
+				}, request);
+			}
+
+			if (!recorder->set_trigger_event("capture_flight_recorder", request))
+				std::cout << "Failed to create capture_flight_recorder event" << std::endl;
+
+			ndis_api->start_filter(index - 1);
+
+			std::cout << "Recording " << recorder->memory_budget() / (1024 * 1024) <<
+				" MB at most. Press 'd' to dump, any other key to stop filtering" << std::endl;
+
+			while (tolower(_getch()) == 'd')
+			{
+				auto dump = request;
+				dump.file_name += "_" + pcap::format_timestamp(pcap::timestamp_now()) + ".pcap";
+
+				if (!recorder->trigger(std::move(dump)))
+					std::cout << "Too many pending dumps" << std::endl;
+			}
+
+			ndis_api->stop_filter();
+
+			const auto [packets_recorded, bytes_recorded, packets_dropped, packets_dumped, dumps_completed,
+				dumps_failed] = recorder->get_statistics();
+
+			std::cout << "Recorded " << packets_recorded << " packets (" << bytes_recorded << " bytes), dropped " <<
+				packets_dropped << " packets, dumps " << dumps_completed << " (" << packets_dumped <<
+				" packets), failed dumps " << dumps_failed << std::endl;
+
+			// pending dumps are discarded
+			recorder.reset();
+
+			std::cout << "Exiting..." << std::endl;
+
+			return 0;
+		}
+
 		std::cout << std::endl << "Enter filename to save the capture:";
 		std::cin >> file_name;
 
-		file_stream.open(file_name);
+		uint64_t segment_size = 0;
+		uint32_t segment_duration = 0;
+
+		std::cout << std::endl << "Enter capture segment size in MB (0 - no size limit):";
+		std::cin >> segment_size;
+
+		std::cout << std::endl << "Enter capture segment duration in seconds (0 - no time limit):";
+		std::cin >> segment_duration;
+
+		char flow_index = 'n';
+
+		std::cout << std::endl << "Write flow index next to the capture file (y/n):";
+		std::cin >> flow_index;
+
+		if (flow_index == 'y' || flow_index == 'Y')
+			file_stream.enable_flow_index();
+
+		if (segment_size != 0 || segment_duration != 0)
+		{
+			// rotating capture: file_name is used as the segment name prefix
+			size_t retention_count = 0;
+
+			std::cout << std::endl << "Enter number of capture segments to keep (0 - keep all):";
+			std::cin >> retention_count;
+
+			file_stream.open(pcap::pcap_async_writer::rotation_policy{
+				file_name, segment_size * 1024 * 1024, std::chrono::seconds(segment_duration), retention_count
+			});
+		}
+		else
+		{
+			file_stream.open(file_name);
+		}
 
 		if (!file_stream)
 		{
@@ -68,6 +381,19 @@ int main()
 
 		std::ignore = _getch();
 
+		ndis_api->stop_filter();
+		file_stream.close();
+
+		const auto [packets_queued, bytes_queued, packets_dropped, bytes_dropped, bytes_written, write_errors,
+			segments_completed] = file_stream.get_statistics();
+
+		std::cout << "Captured " << packets_queued << " packets (" << bytes_queued << " bytes), dropped " <<
+			packets_dropped << " packets (" << bytes_dropped << " bytes), written " << bytes_written <<
+			" bytes, write errors " << write_errors << ", segments " << segments_completed << std::endl;
+
+		if ((flow_index == 'y' || flow_index == 'Y') && segment_size == 0 && segment_duration == 0)
+			print_top_flows(file_name);
+
 		std::cout << "Exiting..." << std::endl;
 	}
 	catch (const std::exception& ex)
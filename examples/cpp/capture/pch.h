@@ -31,6 +31,8 @@
 #include <cassert>
 #include <array>
 #include <map>
+#include <unordered_map>
+#include <deque>
 #include <cctype>
 #include <shared_mutex>
 #include <variant>
@@ -38,14 +40,23 @@
 #include <optional>
 #include <algorithm>
 #include <fstream>
+#include <mutex>
 #include <charconv>
+#include <cstdio>
 #include <gsl/gsl>
 
 #include "../../../include/common.h"
 #include "../../../include/ndisapi.h"
+#include "../common/iphlp.h"
+#include "../common/net/vlan.h"
+#include "../common/net/ipv6_helper.h"
 #include "../common/pcap/pcap.h"
 #include "../common/pcap/pcap_file_storage.h"
-#include "../common/iphlp.h"
+#include "../common/pcap/async_file_writer.h"
+#include "../common/pcap/pcap_async_writer.h"
+#include "../common/pcap/flight_recorder.h"
+#include "../common/pcap/capture_file_reader.h"
+#include "../common/pcap/flow_index_reader.h"
 #include "../common/winsys/object.h"
 #include "../common/winsys/event.h"
 #include "../common/net/mac_address.h"
@@ -35,6 +35,11 @@ typedef struct in_addr IN_ADDR, *PIN_ADDR;
 #define ETH_P_IPV6		0x86dd 			/* Internet Protocol V6 packet	*/
 #define ETH_P_IPV6_NET	0xdd86 			/* Internet Protocol V6 packet network order*/
 
+#define ETH_P_8021Q		0x8100			/* 802.1Q VLAN tagged frame	*/
+#define ETH_P_8021AD	0x88a8			/* 802.1ad service VLAN tagged frame	*/
+#define VLAN_TAG_LENGTH			4		/* 802.1Q tag length */
+#define VLAN_VID_MASK			0x0fff	/* VLAN identifier bits of the tag control information */
+
 /// <summary>Protocols</summary>
 
 #define IPPROTO_IP              0               /* dummy for IP */
@@ -64,6 +69,21 @@ typedef struct ether_header
 	unsigned short	h_proto;		/* packet type ID field	*/
 } ether_header, *ether_header_ptr;
 
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Ethernet Header with 802.1Q tag
+/// </summary>
+// --------------------------------------------------------------------------------
+
+typedef struct vlan_ether_header
+{
+	unsigned char	h_dest[ETH_ALEN];	/* destination eth addr	*/
+	unsigned char	h_source[ETH_ALEN];	/* source ether addr	*/
+	unsigned short	h_vlan_proto;	/* ETH_P_8021Q			*/
+	unsigned short	h_vlan_tci;		/* priority, DEI and VLAN identifier	*/
+	unsigned short	h_proto;		/* encapsulated packet type ID field	*/
+} vlan_ether_header, *vlan_ether_header_ptr;
+
 // --------------------------------------------------------------------------------
 /// <summary>
 /// Address Resolution Protocol (ARP)
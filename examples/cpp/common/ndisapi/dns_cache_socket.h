@@ -0,0 +1,260 @@
+#pragma once
+
+namespace ndisapi
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// UDP proxy socket answering DNS queries from the net::dns_cache shared by all
+	/// sockets of the udp_proxy_server. A query hitting the cache is turned into the
+	/// response in the same packet buffer and reverted to the stack, so it never
+	/// leaves the host. Responses relayed from the upstream server fill the cache and
+	/// answer the identical queries which were held while the first one was in flight.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	template <typename T>
+	class dns_cache_socket : public udp_proxy_socket<T>
+	{
+	public:
+		using address_type_t = T;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Query held until the response to the identical query arrives
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct waiter
+		{
+			/// <summary>copy of the outgoing query packet</summary>
+			std::unique_ptr<INTERMEDIATE_BUFFER> packet;
+			/// <summary>DNS server the query was originally sent to</summary>
+			address_type_t original_peer_address;
+			/// <summary>original destination port</summary>
+			uint16_t original_peer_port;
+		};
+
+		using cache_t = net::dns_cache<waiter>;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Negotiate context carrying the shared cache to the socket
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct negotiate_context_t : proxy::negotiate_context<T>
+		{
+			negotiate_context_t(const T& remote_address, const uint16_t remote_port, std::shared_ptr<cache_t> cache)
+				: proxy::negotiate_context<T>(remote_address, remote_port),
+				  cache(std::move(cache))
+			{
+			}
+
+			std::shared_ptr<cache_t> cache;
+		};
+
+		dns_cache_socket(
+			CNdisApi* ndis_api,
+			const uint16_t local_port,
+			address_type_t remote_peer_address,
+			const uint16_t remote_peer_port,
+			address_type_t original_peer_address,
+			const uint16_t original_peer_port,
+			std::unique_ptr<negotiate_context_t> negotiate_ctx)
+			: udp_proxy_socket<T>(ndis_api, local_port, remote_peer_address, remote_peer_port, original_peer_address,
+			                      original_peer_port, std::move(negotiate_ctx))
+		{
+			if (const auto context = static_cast<negotiate_context_t*>(this->get_negotiate_ctx()); context)
+				cache_ = context->cache;
+		}
+
+	protected:
+		// ********************************************************************************
+		/// <summary>
+		/// Answers the query from the cache or holds it while the identical query is in
+		/// flight. Called after the destination was changed to the upstream server, the
+		/// checksums are recalculated by the caller.
+		/// </summary>
+		/// <param name="packet">outgoing query packet</param>
+		/// <returns>revert on cache hit, drop if the query was held, pass otherwise</returns>
+		// ********************************************************************************
+		simple_packet_filter::packet_action process_out_packet_internal(INTERMEDIATE_BUFFER& packet) override
+		{
+			if (!cache_)
+				return simple_packet_filter::packet_action::pass;
+
+			const auto [payload, length] = get_udp_payload(packet);
+
+			if (payload == nullptr)
+				return simple_packet_filter::packet_action::pass;
+
+			size_t response_length = 0;
+
+			switch (cache_->query(payload, length, payload, MAX_ETHER_FRAME - (payload - packet.m_IBuffer),
+			                      response_length, [this, &packet]
+			                      {
+				                      return waiter{
+					                      std::make_unique<INTERMEDIATE_BUFFER>(packet), this->original_peer_address_,
+					                      this->original_peer_port_
+				                      };
+			                      }))
+			{
+			case net::dns_cache_status::hit:
+				forge_response(packet, this->original_peer_address_, this->original_peer_port_, response_length);
+				return simple_packet_filter::packet_action::revert;
+			case net::dns_cache_status::collapsed:
+				return simple_packet_filter::packet_action::drop;
+			default:
+				return simple_packet_filter::packet_action::pass;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stores the response in the cache and answers the held identical queries
+		/// </summary>
+		/// <param name="packet">incoming response packet with the original source restored</param>
+		/// <returns>pass</returns>
+		// ********************************************************************************
+		simple_packet_filter::packet_action process_in_packet_internal(INTERMEDIATE_BUFFER& packet) override
+		{
+			if (!cache_)
+				return simple_packet_filter::packet_action::pass;
+
+			const auto [payload, length] = get_udp_payload(packet);
+
+			if (payload == nullptr)
+				return simple_packet_filter::packet_action::pass;
+
+			for (auto& held : cache_->update(payload, length))
+			{
+				const auto [query, query_length] = get_udp_payload(*held.packet);
+
+				if (size_t response_length = 0; query != nullptr && cache_t::make_response(
+					payload, length, query, query_length, 0, query,
+					MAX_ETHER_FRAME - (query - held.packet->m_IBuffer), response_length))
+				{
+					forge_response(*held.packet, held.original_peer_address, held.original_peer_port,
+					               response_length);
+
+					if constexpr (std::is_same_v<address_type_t, net::ip_address_v4>)
+					{
+						CNdisApi::RecalculateUDPChecksum(held.packet.get());
+						CNdisApi::RecalculateIPChecksum(held.packet.get());
+					}
+					else
+					{
+						net::ipv6_helper::recalculate_tcp_udp_checksum(held.packet.get());
+					}
+
+					ETH_REQUEST request = {this->adapter_handle_, held.packet.get()};
+					this->ndis_api_->SendPacketToMstcp(&request);
+				}
+			}
+
+			return simple_packet_filter::packet_action::pass;
+		}
+
+	private:
+		// ********************************************************************************
+		/// <summary>
+		/// Locates the UDP payload of the packet
+		/// </summary>
+		/// <param name="packet">UDP packet</param>
+		/// <returns>payload pointer (nullptr if not a UDP packet) and length</returns>
+		// ********************************************************************************
+		static std::pair<uint8_t*, size_t> get_udp_payload(INTERMEDIATE_BUFFER& packet)
+		{
+			const auto ether_header = reinterpret_cast<ether_header_ptr>(packet.m_IBuffer);
+			udphdr_ptr udp_header = nullptr;
+
+			if constexpr (std::is_same_v<address_type_t, net::ip_address_v4>)
+			{
+				if (ntohs(ether_header->h_proto) == ETH_P_IP)
+				{
+					if (const auto ip_header = reinterpret_cast<iphdr_ptr>(ether_header + 1); ip_header->ip_p ==
+						IPPROTO_UDP)
+					{
+						udp_header = reinterpret_cast<udphdr_ptr>(reinterpret_cast<PUCHAR>(ip_header) +
+							sizeof(DWORD) * ip_header->ip_hl);
+					}
+				}
+			}
+			else if constexpr (std::is_same_v<address_type_t, net::ip_address_v6>)
+			{
+				if (ntohs(ether_header->h_proto) == ETH_P_IPV6)
+				{
+					if (auto [header, protocol] = net::ipv6_helper::find_transport_header(
+						reinterpret_cast<ipv6hdr_ptr>(ether_header + 1), packet.m_Length - ETHER_HEADER_LENGTH);
+						header != nullptr && protocol == IPPROTO_UDP)
+					{
+						udp_header = static_cast<udphdr_ptr>(header);
+					}
+				}
+			}
+
+			if (udp_header == nullptr)
+				return {nullptr, 0};
+
+			const auto payload = reinterpret_cast<uint8_t*>(udp_header + 1);
+			const auto offset = static_cast<size_t>(payload - packet.m_IBuffer);
+			const auto udp_length = static_cast<size_t>(ntohs(udp_header->length));
+
+			if (offset > packet.m_Length || udp_length < sizeof(udphdr))
+				return {nullptr, 0};
+
+			return {payload, (std::min)(udp_length - sizeof(udphdr), packet.m_Length - offset)};
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Turns the outgoing query packet carrying the DNS response as the UDP payload
+		/// into the incoming response from the original DNS server. Checksums are not
+		/// recalculated.
+		/// </summary>
+		/// <param name="packet">query packet</param>
+		/// <param name="peer_address">DNS server the query was sent to</param>
+		/// <param name="peer_port">DNS server port</param>
+		/// <param name="payload_length">DNS response length</param>
+		// ********************************************************************************
+		static void forge_response(INTERMEDIATE_BUFFER& packet, const address_type_t& peer_address,
+		                           const uint16_t peer_port, const size_t payload_length)
+		{
+			const auto ether_header = reinterpret_cast<ether_header_ptr>(packet.m_IBuffer);
+
+			std::swap_ranges(ether_header->h_source, ether_header->h_source + ETHER_ADDR_LENGTH, ether_header->h_dest);
+
+			udphdr_ptr udp_header;
+
+			if constexpr (std::is_same_v<address_type_t, net::ip_address_v4>)
+			{
+				const auto ip_header = reinterpret_cast<iphdr_ptr>(ether_header + 1);
+				udp_header = reinterpret_cast<udphdr_ptr>(reinterpret_cast<PUCHAR>(ip_header) + sizeof(DWORD) *
+					ip_header->ip_hl);
+
+				ip_header->ip_dst = ip_header->ip_src;
+				ip_header->ip_src = peer_address;
+				ip_header->ip_len = htons(static_cast<u_short>(sizeof(DWORD) * ip_header->ip_hl + sizeof(udphdr) +
+					payload_length));
+			}
+			else
+			{
+				const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(ether_header + 1);
+				udp_header = static_cast<udphdr_ptr>(net::ipv6_helper::find_transport_header(
+					ip_header, packet.m_Length - ETHER_HEADER_LENGTH).first);
+
+				ip_header->ip6_dst = ip_header->ip6_src;
+				ip_header->ip6_src = peer_address;
+				ip_header->ip6_len = htons(static_cast<u_short>(reinterpret_cast<PUCHAR>(udp_header + 1) -
+					reinterpret_cast<PUCHAR>(ip_header + 1) + payload_length));
+			}
+
+			udp_header->th_dport = udp_header->th_sport;
+			udp_header->th_sport = htons(peer_port);
+			udp_header->length = htons(static_cast<u_short>(sizeof(udphdr) + payload_length));
+
+			packet.m_Length = static_cast<ULONG>(reinterpret_cast<PUCHAR>(udp_header + 1) - packet.m_IBuffer +
+				payload_length);
+		}
+
+		/// <summary>cache shared by the sockets of the proxy server</summary>
+		std::shared_ptr<cache_t> cache_;
+	};
+}
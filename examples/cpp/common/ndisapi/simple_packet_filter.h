@@ -24,6 +24,12 @@ namespace ndisapi
 			revert
 		};
 
+		/// <summary>
+		/// Batch classifier routine: receives the packets of one ReadPackets call and marks
+		/// the packets to be handled by the filter routines, the rest is passed as is
+		/// </summary>
+		using batch_classifier_t = std::function<void(const INTERMEDIATE_BUFFER*, size_t, net::packet_batch_mask&)>;
+
 	private:
 		static constexpr size_t maximum_packet_block = 510;
 
@@ -116,6 +122,20 @@ namespace ndisapi
 			return filter_state_.load();
 		}
 
+		// ********************************************************************************
+		/// <summary>
+		/// Sets the batch classifier. Packets it does not mark bypass the incoming and
+		/// outgoing packet routines, so the common "is this one of my flows" test runs
+		/// once per ReadPackets block (e.g. net::packet_batch_classifier) instead of per
+		/// packet. Should be called when the filter is inactive.
+		/// </summary>
+		/// <param name="classifier">batch classifier routine, nullptr to handle every packet</param>
+		// ********************************************************************************
+		void set_batch_classifier(batch_classifier_t classifier)
+		{
+			batch_classifier_ = std::move(classifier);
+		}
+
 	private:
 		// ********************************************************************************
 		/// <summary>
@@ -147,6 +167,10 @@ namespace ndisapi
 		std::function<packet_action(HANDLE, INTERMEDIATE_BUFFER&)> filter_outgoing_packet_ = nullptr;
 		/// <summary>incoming packet processing functor</summary>
 		std::function<packet_action(HANDLE, INTERMEDIATE_BUFFER&)> filter_incoming_packet_ = nullptr;
+		/// <summary>batch classifier selecting the packets for the processing functors</summary>
+		batch_classifier_t batch_classifier_ = nullptr;
+		/// <summary>packets of the current block selected by the batch classifier</summary>
+		net::packet_batch_mask batch_mask_;
 		/// <summary>working thread running status</summary>
 		std::atomic<filter_state> filter_state_ = filter_state::stopped;
 		/// <summary>list of available network interfaces</summary>
@@ -333,11 +357,22 @@ namespace ndisapi
 
 			while (filter_state_ == filter_state::running && ReadPackets(read_request))
 			{
+				if (batch_classifier_ != nullptr)
+				{
+					// the classifier only sets the bits of the selected packets
+					batch_mask_.resize(read_request->dwPacketsSuccess);
+					batch_classifier_(packet_buffer_.get(), read_request->dwPacketsSuccess, batch_mask_);
+				}
+
 				for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
 				{
 					auto packet_action = packet_action::pass;
 
-					if (packet_buffer_[i].m_dwDeviceFlags == PACKET_FLAG_ON_SEND)
+					if (batch_classifier_ != nullptr && !batch_mask_.test(i))
+					{
+						// not selected by the batch classifier, pass as is
+					}
+					else if (packet_buffer_[i].m_dwDeviceFlags == PACKET_FLAG_ON_SEND)
 					{
 						if (filter_outgoing_packet_ != nullptr)
 							packet_action = filter_outgoing_packet_(read_request->hAdapterHandle, packet_buffer_[i]);
@@ -177,7 +177,7 @@ namespace ndisapi
 					auto [header, protocol] = net::ipv6_helper::find_transport_header(
 						ip_header, packet.m_Length - ETHER_HEADER_LENGTH);
 
-					if (protocol == IPPROTO_UDP)
+					if (header != nullptr && protocol == IPPROTO_UDP)
 					{
 						const auto udp_header = reinterpret_cast<udphdr_ptr>(header);
 						local_ip_address_ = ip_header->ip6_src;
@@ -241,7 +241,8 @@ namespace ndisapi
 					const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(ether_header + 1);
 
 					if (auto [header, protocol] = net::ipv6_helper::find_transport_header(
-						ip_header, packet.m_Length - ETHER_HEADER_LENGTH); protocol == IPPROTO_UDP)
+						ip_header, packet.m_Length - ETHER_HEADER_LENGTH);
+						header != nullptr && protocol == IPPROTO_UDP)
 					{
 						const auto udp_header = static_cast<udphdr_ptr>(header);
 
@@ -311,7 +312,8 @@ namespace ndisapi
 					const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(ether_header + 1);
 
 					if (auto [header, protocol] = net::ipv6_helper::find_transport_header(
-						ip_header, packet.m_Length - ETHER_HEADER_LENGTH); protocol == IPPROTO_UDP)
+						ip_header, packet.m_Length - ETHER_HEADER_LENGTH);
+						header != nullptr && protocol == IPPROTO_UDP)
 					{
 						const auto udp_header = static_cast<udphdr_ptr>(header);
 
@@ -766,7 +768,8 @@ namespace ndisapi
 							const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(ether_header + 1);
 
 							if (auto [header, protocol] = net::ipv6_helper::find_transport_header(
-								ip_header, buffer.m_Length - ETHER_HEADER_LENGTH); protocol == IPPROTO_UDP)
+								ip_header, buffer.m_Length - ETHER_HEADER_LENGTH);
+								header != nullptr && protocol == IPPROTO_UDP)
 							{
 								const auto udp_header = static_cast<udphdr_ptr>(header);
 
@@ -842,7 +845,8 @@ namespace ndisapi
 							const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(ether_header + 1);
 
 							if (auto [header, protocol] = net::ipv6_helper::find_transport_header(
-								ip_header, buffer.m_Length - ETHER_HEADER_LENGTH); protocol == IPPROTO_UDP)
+								ip_header, buffer.m_Length - ETHER_HEADER_LENGTH);
+								header != nullptr && protocol == IPPROTO_UDP)
 							{
 								const auto udp_header = static_cast<udphdr_ptr>(header);
 
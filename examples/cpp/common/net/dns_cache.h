@@ -0,0 +1,586 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "dns_message.h"
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Size and lifetime caps of the dns_cache
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct dns_cache_limits
+	{
+		/// <summary>maximum number of cached responses</summary>
+		size_t max_entries{4096};
+		/// <summary>maximum total size of the cached responses in bytes</summary>
+		size_t max_bytes{4 * 1024 * 1024};
+		/// <summary>upper bound for the TTL of the positive answers in seconds</summary>
+		uint32_t max_ttl{86400};
+		/// <summary>upper bound for the TTL of the negative answers in seconds (RFC 2308)</summary>
+		uint32_t max_negative_ttl{900};
+		/// <summary>identical queries are collapsed into the forwarded one for this long</summary>
+		std::chrono::steady_clock::duration pending_timeout{std::chrono::seconds(2)};
+		/// <summary>maximum number of queries collapsed into one forwarded query</summary>
+		size_t max_waiters{64};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of the dns_cache::query
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class dns_cache_status
+	{
+		/// <summary>response was synthesized from the cache</summary>
+		hit,
+		/// <summary>query must be forwarded, its response is expected in dns_cache::update</summary>
+		miss,
+		/// <summary>identical query is in flight, the waiter is released by dns_cache::update</summary>
+		collapsed,
+		/// <summary>query is not cacheable (not a standard query with a single question)</summary>
+		bypass
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// DNS response cache keyed by the question (name compared case-insensitively, type
+	/// and class). Responses are stored as received and turned into the answer for the
+	/// particular query by patching the ID, the question and the decremented TTLs in
+	/// place, so the hit path does not allocate. Positive answers live for the smallest
+	/// record TTL, NXDOMAIN and NODATA answers for the SOA negative TTL (RFC 2308); the
+	/// least recently used responses are evicted when the limits are exceeded.
+	///
+	/// Queries missing the cache while an identical query is in flight are kept as
+	/// Waiter objects (e.g. the query packet) and returned by update together with the
+	/// response, so only one of them reaches the upstream server.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	template <typename Waiter>
+	class dns_cache
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Cache counters
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>queries answered from the cache</summary>
+			uint64_t hits;
+			/// <summary>hits answered with a cached NXDOMAIN or NODATA response</summary>
+			uint64_t negative_hits;
+			/// <summary>queries forwarded to the upstream server</summary>
+			uint64_t misses;
+			/// <summary>queries collapsed into the identical query in flight</summary>
+			uint64_t collapsed;
+			/// <summary>queries which were not cacheable</summary>
+			uint64_t bypassed;
+			/// <summary>responses stored</summary>
+			uint64_t inserted;
+			/// <summary>responses evicted by the entries or bytes limit</summary>
+			uint64_t evicted;
+			/// <summary>responses removed after the TTL expired</summary>
+			uint64_t expired;
+		};
+
+		explicit dns_cache(const dns_cache_limits& limits = {})
+			: limits_(limits)
+		{
+		}
+
+		dns_cache(const dns_cache& other) = delete;
+		dns_cache(dns_cache&& other) = delete;
+		dns_cache& operator=(const dns_cache& other) = delete;
+		dns_cache& operator=(dns_cache&& other) = delete;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Looks up the response for the query. On hit the response is written into the
+		/// buffer, which may be the query itself (in-place answer).
+		/// </summary>
+		/// <param name="query">DNS query message</param>
+		/// <param name="length">query length</param>
+		/// <param name="buffer">receives the response on hit</param>
+		/// <param name="capacity">buffer size</param>
+		/// <param name="response_length">receives the response length on hit</param>
+		/// <param name="make_waiter">called to create the Waiter when the query is collapsed</param>
+		/// <param name="now">current time</param>
+		/// <returns>lookup status</returns>
+		// ********************************************************************************
+		template <typename F>
+		dns_cache_status query(const uint8_t* query, const size_t length, uint8_t* buffer, const size_t capacity,
+		                       size_t& response_length, F&& make_waiter, const clock::time_point now = clock::now())
+		{
+			dns_message message;
+			cache_key key;
+
+			if (message.parse(query, length) != dns_parse_result::success || message.is_response() || !make_key(
+				message, key))
+			{
+				std::lock_guard<std::mutex> lock(lock_);
+				++statistics_.bypassed;
+				return dns_cache_status::bypass;
+			}
+
+			std::lock_guard<std::mutex> lock(lock_);
+
+			if (const auto it = index_.find(key); it != index_.end())
+			{
+				auto& entry = *it->second;
+				const auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+					now - entry.stored).count());
+
+				if (elapsed >= entry.ttl)
+				{
+					bytes_ -= entry.response.size();
+					entries_.erase(it->second);
+					index_.erase(it);
+					++statistics_.expired;
+				}
+				else if (make_response(entry.response.data(), entry.response.size(), query, length,
+				                       static_cast<uint32_t>(elapsed), buffer, capacity, response_length))
+				{
+					entries_.splice(entries_.begin(), entries_, it->second);
+
+					++statistics_.hits;
+
+					if (entry.negative)
+						++statistics_.negative_hits;
+
+					return dns_cache_status::hit;
+				}
+			}
+
+			if (pending_.size() >= limits_.max_entries)
+				expire_pending(now);
+
+			auto& pending = pending_[key];
+
+			if (pending.started != clock::time_point{} && now - pending.started < limits_.pending_timeout)
+			{
+				if (pending.waiters.size() < limits_.max_waiters)
+				{
+					pending.waiters.emplace_back(make_waiter());
+					++statistics_.collapsed;
+					return dns_cache_status::collapsed;
+				}
+
+				++statistics_.misses;
+				return dns_cache_status::miss;
+			}
+
+			// the forwarded query is considered lost, its waiters are expected to retry
+			pending.waiters.clear();
+			pending.started = now;
+			pending.id = message.id();
+			++statistics_.misses;
+
+			return dns_cache_status::miss;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stores the cacheable response and releases the queries collapsed into the
+		/// query it answers. The waiters may be answered with make_response from this
+		/// response whether it was cached or not. The response is keyed as the forwarded
+		/// query, found by the ID, since the server may drop the OPT record (and so the
+		/// EDNS and DO bits) from the response.
+		/// </summary>
+		/// <param name="response">DNS response message</param>
+		/// <param name="length">response length</param>
+		/// <param name="now">current time</param>
+		/// <returns>waiters of the answered question</returns>
+		// ********************************************************************************
+		std::vector<Waiter> update(const uint8_t* response, const size_t length, const clock::time_point now = clock::now())
+		{
+			dns_message message;
+			cache_key key;
+
+			if (message.parse(response, length) != dns_parse_result::success || !message.is_response() || !make_key(
+				message, key))
+				return {};
+
+			bool negative = false;
+			const auto ttl = response_ttl(message, negative);
+
+			std::lock_guard<std::mutex> lock(lock_);
+
+			std::vector<Waiter> waiters;
+
+			if (const auto it = find_pending(key, message.id()); it != pending_.end())
+			{
+				key = it->first;
+				waiters = std::move(it->second.waiters);
+				pending_.erase(it);
+			}
+
+			if (ttl == 0 || length > limits_.max_bytes || limits_.max_entries == 0)
+				return waiters;
+
+			if (const auto it = index_.find(key); it != index_.end())
+			{
+				bytes_ -= it->second->response.size();
+				entries_.erase(it->second);
+				index_.erase(it);
+			}
+
+			entries_.push_front({key, std::vector<uint8_t>(response, response + length), now, ttl, negative});
+			index_.emplace(key, entries_.begin());
+			bytes_ += length;
+			++statistics_.inserted;
+
+			while (entries_.size() > limits_.max_entries || bytes_ > limits_.max_bytes)
+			{
+				bytes_ -= entries_.back().response.size();
+				index_.erase(entries_.back().key);
+				entries_.pop_back();
+				++statistics_.evicted;
+			}
+
+			return waiters;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the answer to the query from the response to the identical question:
+		/// takes the ID, the RD flag and the question spelling from the query and reduces
+		/// the record TTLs by the elapsed time. The buffer may overlap the query.
+		/// </summary>
+		/// <param name="response">DNS response message</param>
+		/// <param name="response_length">response length</param>
+		/// <param name="query">DNS query message</param>
+		/// <param name="query_length">query length</param>
+		/// <param name="elapsed">seconds since the response was received</param>
+		/// <param name="buffer">receives the answer</param>
+		/// <param name="capacity">buffer size</param>
+		/// <param name="length">receives the answer length</param>
+		/// <returns>false if the answer does not fit the buffer or the query UDP payload size</returns>
+		// ********************************************************************************
+		static bool make_response(const uint8_t* response, const size_t response_length, const uint8_t* query,
+		                          const size_t query_length, const uint32_t elapsed, uint8_t* buffer,
+		                          const size_t capacity, size_t& length) noexcept
+		{
+			dns_message query_message;
+			dns_message response_message;
+			dns_question query_question;
+			dns_question response_question;
+
+			if (query_message.parse(query, query_length) != dns_parse_result::success ||
+				!query_message.first_question(query_question) ||
+				response_message.parse(response, response_length) != dns_parse_result::success ||
+				!response_message.first_question(response_question))
+				return false;
+
+			if (response_length > capacity || response_length > max_udp_payload(query_message))
+				return false;
+
+			// the query is saved before the buffer is overwritten, it may be the same memory
+			std::array<uint8_t, dns_message::header_size + dns_name::max_wire_length + 4> saved{};
+			const auto question_length = query_question.length;
+			const auto keep_question = question_length == response_question.length && question_length <= saved.size() -
+				dns_message::header_size;
+
+			std::memcpy(saved.data(), query, dns_message::header_size);
+
+			if (keep_question)
+				std::memcpy(saved.data() + dns_message::header_size, query + query_question.offset, question_length);
+
+			std::memmove(buffer, response, response_length);
+
+			// ID and the RD flag of the query
+			buffer[0] = saved[0];
+			buffer[1] = saved[1];
+			buffer[2] = static_cast<uint8_t>((buffer[2] & ~0x01) | (saved[2] & 0x01));
+
+			// question as spelled in the query (e.g. randomized case)
+			if (keep_question)
+				std::memcpy(buffer + response_question.offset, saved.data() + dns_message::header_size,
+				            question_length);
+
+			if (elapsed != 0)
+			{
+				dns_message answer;
+				answer.parse(buffer, response_length);
+
+				answer.for_each_record([buffer, elapsed](dns_section, const dns_resource_record& record)
+				{
+					// OPT record keeps the extended RCODE and flags in the TTL field
+					if (record.type == dns_message::type_opt)
+						return;
+
+					const auto ttl = record.ttl > elapsed ? record.ttl - elapsed : 0;
+
+					buffer[record.ttl_offset] = static_cast<uint8_t>(ttl >> 24);
+					buffer[record.ttl_offset + 1] = static_cast<uint8_t>(ttl >> 16);
+					buffer[record.ttl_offset + 2] = static_cast<uint8_t>(ttl >> 8);
+					buffer[record.ttl_offset + 3] = static_cast<uint8_t>(ttl);
+				});
+			}
+
+			length = response_length;
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the cache counters
+		/// </summary>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics() const
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			return statistics_;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the number of cached responses
+		/// </summary>
+		// ********************************************************************************
+		[[nodiscard]] size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			return entries_.size();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Removes all cached responses and pending queries
+		/// </summary>
+		// ********************************************************************************
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			index_.clear();
+			entries_.clear();
+			pending_.clear();
+			bytes_ = 0;
+		}
+
+	private:
+		/// <summary>checking disabled bit of the cache key</summary>
+		static constexpr uint8_t key_checking_disabled = 0x01;
+		/// <summary>DNSSEC OK bit of the cache key</summary>
+		static constexpr uint8_t key_dnssec_ok = 0x02;
+		/// <summary>EDNS (OPT record present) bit of the cache key</summary>
+		static constexpr uint8_t key_edns = 0x04;
+		/// <summary>all bits of the cache key flags</summary>
+		static constexpr uint8_t key_flags_mask = key_checking_disabled | key_dnssec_ok | key_edns;
+
+		/// <summary>
+		/// Question with the name lowercased and the flags which change the response:
+		/// DO adds the signatures, CD asks the validating resolver to answer the data it
+		/// could not validate (RFC 4035 3.2), and only the EDNS query may get the OPT
+		/// record in the response (RFC 6891 7)
+		/// </summary>
+		struct cache_key
+		{
+			std::array<char, dns_name::max_length> name;
+			size_t length;
+			uint16_t type;
+			uint16_t klass;
+			uint8_t flags;
+
+			bool operator==(const cache_key& other) const noexcept
+			{
+				return length == other.length && type == other.type && klass == other.klass &&
+					flags == other.flags && std::memcmp(name.data(), other.name.data(), length) == 0;
+			}
+		};
+
+		struct key_hash
+		{
+			size_t operator()(const cache_key& key) const noexcept
+			{
+				// FNV-1a
+				uint64_t hash = 0xcbf29ce484222325ull ^ (static_cast<uint64_t>(key.flags) << 32 |
+					static_cast<uint64_t>(key.type) << 16 | key.klass);
+
+				for (size_t i = 0; i < key.length; ++i)
+				{
+					hash ^= static_cast<uint8_t>(key.name[i]);
+					hash *= 0x100000001b3ull;
+				}
+
+				return static_cast<size_t>(hash);
+			}
+		};
+
+		struct entry
+		{
+			cache_key key;
+			std::vector<uint8_t> response;
+			clock::time_point stored;
+			uint32_t ttl;
+			bool negative;
+		};
+
+		struct pending_query
+		{
+			clock::time_point started{};
+			/// <summary>ID of the forwarded query</summary>
+			uint16_t id{0};
+			std::vector<Waiter> waiters;
+		};
+
+		/// <summary>
+		/// Standard query with a single question of the cacheable type. The response
+		/// normally gets the same key: it copies CD from the query (RFC 4035 3.1.6), has
+		/// the OPT record if the query had one and copies DO into it (RFC 3225 3).
+		/// </summary>
+		static bool make_key(const dns_message& message, cache_key& key) noexcept
+		{
+			dns_question question;
+
+			if (message.opcode() != 0 || message.question_count() != 1 || !message.first_question(question) ||
+				question.type == dns_message::type_any)
+				return false;
+
+			key.length = question.name.decode(key.name.data(), key.name.size());
+
+			if (key.length == 0)
+				return false;
+
+			for (size_t i = 0; i < key.length; ++i)
+			{
+				if (key.name[i] >= 'A' && key.name[i] <= 'Z')
+					key.name[i] = static_cast<char>(key.name[i] | 0x20);
+			}
+
+			key.type = question.type;
+			key.klass = question.klass;
+			key.flags = (message.flags() & 0x0010) != 0 ? key_checking_disabled : 0;
+
+			// DO is the top bit of the OPT record extended flags, kept in the TTL field
+			message.for_each_record([&key](const dns_section section, const dns_resource_record& record)
+			{
+				if (section == dns_section::additional && record.type == dns_message::type_opt)
+					key.flags |= (record.ttl & 0x8000) ? key_edns | key_dnssec_ok : key_edns;
+			});
+
+			return true;
+		}
+
+		/// <summary>
+		/// Returns the cache lifetime of the response or 0 if it must not be cached
+		/// </summary>
+		[[nodiscard]] uint32_t response_ttl(const dns_message& message, bool& negative) const noexcept
+		{
+			if (message.is_truncated() || message.opcode() != 0 || (message.rcode() != dns_message::rcode_no_error &&
+				message.rcode() != dns_message::rcode_name_error))
+				return 0;
+
+			negative = message.rcode() == dns_message::rcode_name_error || message.answer_count() == 0;
+
+			auto ttl = UINT32_MAX;
+			auto soa_found = false;
+
+			message.for_each_record([negative, &ttl, &soa_found](const dns_section section, const dns_resource_record& record)
+			{
+				if (record.type == dns_message::type_opt || section == dns_section::additional)
+					return;
+
+				if (!negative)
+				{
+					ttl = (std::min)(ttl, record.ttl);
+				}
+				else if (section == dns_section::authority && record.type == dns_message::type_soa && record.data_length
+					>= 20)
+				{
+					// negative TTL is the smaller of the SOA TTL and the SOA MINIMUM field
+					const auto minimum = dns_message::read_uint32(record.data + record.data_length - 4);
+					ttl = (std::min)({ttl, record.ttl, minimum});
+					soa_found = true;
+				}
+			});
+
+			// negative answers without the SOA are not cached (RFC 2308 5)
+			if (ttl == UINT32_MAX || (negative && !soa_found))
+				return 0;
+
+			return (std::min)(ttl, negative ? limits_.max_negative_ttl : limits_.max_ttl);
+		}
+
+		/// <summary>
+		/// Finds the forwarded query answered by the response: the pending query of the
+		/// same question with the response ID under any key flags, otherwise the one
+		/// with the response key
+		/// </summary>
+		typename std::unordered_map<cache_key, pending_query, key_hash>::iterator find_pending(
+			const cache_key& key, const uint16_t id)
+		{
+			auto variant = key;
+
+			for (uint8_t flags = 0; flags <= key_flags_mask; ++flags)
+			{
+				variant.flags = flags;
+
+				if (const auto it = pending_.find(variant); it != pending_.end() && it->second.id == id)
+					return it;
+			}
+
+			return pending_.find(key);
+		}
+
+		/// <summary>
+		/// Removes the questions whose responses were lost
+		/// </summary>
+		void expire_pending(const clock::time_point now)
+		{
+			for (auto it = pending_.begin(); it != pending_.end();)
+			{
+				if (now - it->second.started >= limits_.pending_timeout)
+					it = pending_.erase(it);
+				else
+					++it;
+			}
+		}
+
+		/// <summary>
+		/// UDP payload size the client accepts: 512 bytes or the EDNS size (RFC 6891)
+		/// </summary>
+		static size_t max_udp_payload(const dns_message& query) noexcept
+		{
+			size_t size = 512;
+
+			query.for_each_record([&size](const dns_section section, const dns_resource_record& record)
+			{
+				if (section == dns_section::additional && record.type == dns_message::type_opt)
+					size = (std::max)(size, static_cast<size_t>(record.klass));
+			});
+
+			return size;
+		}
+
+		dns_cache_limits limits_;
+
+		/// <summary>guards the cache state, the cache may be shared by several packet filter threads</summary>
+		mutable std::mutex lock_;
+
+		/// <summary>cached responses, most recently used first</summary>
+		std::list<entry> entries_;
+		/// <summary>question to the cached response</summary>
+		std::unordered_map<cache_key, typename std::list<entry>::iterator, key_hash> index_;
+		/// <summary>forwarded questions waiting for the response</summary>
+		std::unordered_map<cache_key, pending_query, key_hash> pending_;
+		/// <summary>total size of the cached responses</summary>
+		size_t bytes_{0};
+
+		statistics statistics_{};
+	};
+}
@@ -0,0 +1,717 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of the dns_message::parse
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class dns_parse_result
+	{
+		/// <summary>all sections announced in the header were parsed</summary>
+		success,
+		/// <summary>data ended inside a section, the complete records before it are available</summary>
+		truncated,
+		/// <summary>invalid label type or oversized name</summary>
+		malformed
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Message section of the resource record
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class dns_section
+	{
+		answer,
+		authority,
+		additional
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Domain name inside the DNS message. The name is not copied: labels and
+	/// compression pointers are followed in the message on each access.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class dns_name
+	{
+	public:
+		/// <summary>maximum name length on the wire (RFC 1035 2.3.4)</summary>
+		static constexpr size_t max_wire_length = 255;
+		/// <summary>buffer size sufficient for any decoded name including the terminating zero</summary>
+		static constexpr size_t max_length = max_wire_length;
+		/// <summary>compression pointers followed before the name is considered a loop</summary>
+		static constexpr unsigned max_pointer_hops = 128;
+
+		dns_name() = default;
+
+		dns_name(const uint8_t* message, const size_t message_length, const size_t offset) noexcept
+			: message_(message), message_length_(message_length), offset_(offset)
+		{
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the dotted name (e.g. www.example.com, "." for the root) into the caller
+		/// buffer and terminates it with zero. Each compression pointer must point before
+		/// the previous one, so crafted pointer loops are rejected.
+		/// </summary>
+		/// <param name="buffer">destination buffer</param>
+		/// <param name="size">destination buffer size, max_length is always sufficient</param>
+		/// <returns>name length without the terminating zero, 0 if the name is invalid or
+		/// the buffer is too small</returns>
+		// ********************************************************************************
+		size_t decode(char* buffer, const size_t size) const noexcept
+		{
+			if (size < 2)
+				return 0;
+
+			size_t written = 0;
+
+			const auto result = for_each_label([buffer, size, &written](const char* label, const size_t length) noexcept
+			{
+				const auto separator = written != 0 ? 1 : 0;
+
+				if (written + separator + length + 1 > size)
+					return false;
+
+				if (separator)
+					buffer[written++] = '.';
+
+				std::memcpy(buffer + written, label, length);
+				written += length;
+
+				return true;
+			});
+
+			if (!result)
+				return 0;
+
+			if (written == 0)
+				buffer[written++] = '.';
+
+			buffer[written] = 0;
+
+			return written;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Calls handler(const char* label, size_t length) for each label of the name,
+		/// handler returns false to stop the walk
+		/// </summary>
+		/// <param name="handler">label handler</param>
+		/// <returns>true if all labels were visited, false if the name is invalid or the
+		/// handler stopped the walk</returns>
+		// ********************************************************************************
+		template <typename F>
+		bool for_each_label(F&& handler) const
+		{
+			if (message_ == nullptr)
+				return false;
+
+			auto offset = offset_;
+			auto limit = offset_;
+			size_t wire_length = 1;
+			unsigned hops = 0;
+
+			for (;;)
+			{
+				if (offset >= message_length_)
+					return false;
+
+				const auto label = message_[offset];
+
+				if ((label & 0xC0) == 0xC0)
+				{
+					if (offset + 1 >= message_length_)
+						return false;
+
+					const auto target = static_cast<size_t>(label & 0x3F) << 8 | message_[offset + 1];
+
+					if (target >= limit || ++hops > max_pointer_hops)
+						return false;
+
+					offset = limit = target;
+					continue;
+				}
+
+				if (label & 0xC0)
+					return false;
+
+				if (label == 0)
+					return true;
+
+				wire_length += label + 1;
+
+				if (wire_length > max_wire_length || offset + 1 + label > message_length_)
+					return false;
+
+				if (!handler(reinterpret_cast<const char*>(message_ + offset + 1), static_cast<size_t>(label)))
+					return false;
+
+				offset += label + 1;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Compares the name with the dotted name ignoring the ASCII case
+		/// </summary>
+		/// <param name="name">dotted name without the trailing dot</param>
+		/// <param name="length">name length</param>
+		/// <returns>true if the names are equal</returns>
+		// ********************************************************************************
+		bool equals(const char* name, const size_t length) const noexcept
+		{
+			size_t position = 0;
+
+			const auto result = for_each_label([name, length, &position](const char* label, const size_t size) noexcept
+			{
+				if (position != 0)
+				{
+					if (position >= length || name[position] != '.')
+						return false;
+
+					++position;
+				}
+
+				if (position + size > length)
+					return false;
+
+				for (size_t i = 0; i < size; ++i)
+				{
+					if (to_lower(label[i]) != to_lower(name[position + i]))
+						return false;
+				}
+
+				position += size;
+
+				return true;
+			});
+
+			return result && position == length;
+		}
+
+		/// <summary>
+		/// Offset of the name in the message
+		/// </summary>
+		[[nodiscard]] size_t offset() const noexcept { return offset_; }
+
+		/// <summary>
+		/// Checks if the name refers to a message
+		/// </summary>
+		[[nodiscard]] bool empty() const noexcept { return message_ == nullptr; }
+
+	private:
+		static constexpr char to_lower(const char c) noexcept
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+		}
+
+		const uint8_t* message_{nullptr};
+		size_t message_length_{0};
+		size_t offset_{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Question section entry
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct dns_question
+	{
+		/// <summary>queried name</summary>
+		dns_name name;
+		/// <summary>QTYPE</summary>
+		uint16_t type{0};
+		/// <summary>QCLASS</summary>
+		uint16_t klass{0};
+		/// <summary>offset of the entry in the message</summary>
+		size_t offset{0};
+		/// <summary>entry length in the message (name in place, type and class)</summary>
+		size_t length{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// SRV record data (RFC 2782)
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct dns_srv_data
+	{
+		uint16_t priority{0};
+		uint16_t weight{0};
+		uint16_t port{0};
+		dns_name target;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// MX record data
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct dns_mx_data
+	{
+		uint16_t preference{0};
+		dns_name exchange;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Resource record, the record data is a view into the message
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct dns_resource_record
+	{
+		/// <summary>owner name</summary>
+		dns_name name;
+		/// <summary>TYPE</summary>
+		uint16_t type{0};
+		/// <summary>CLASS</summary>
+		uint16_t klass{0};
+		/// <summary>TTL in seconds</summary>
+		uint32_t ttl{0};
+		/// <summary>RDATA</summary>
+		const uint8_t* data{nullptr};
+		/// <summary>RDLENGTH</summary>
+		uint16_t data_length{0};
+		/// <summary>offset of the record in the message</summary>
+		size_t offset{0};
+		/// <summary>offset of the TTL field in the message (for the in-place rewrite)</summary>
+		size_t ttl_offset{0};
+		/// <summary>message the record was parsed from, the names in the data refer to it</summary>
+		const uint8_t* message{nullptr};
+		/// <summary>message length</summary>
+		size_t message_length{0};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the address of the A (4 bytes) or AAAA (16 bytes) record in network
+		/// byte order
+		/// </summary>
+		/// <returns>pointer to the address or nullptr for the other types</returns>
+		// ********************************************************************************
+		[[nodiscard]] const uint8_t* address() const noexcept;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the name of the CNAME, NS, PTR or DNAME record
+		/// </summary>
+		/// <param name="target">receives the name</param>
+		/// <returns>true if the record has a single name as data</returns>
+		// ********************************************************************************
+		bool target(dns_name& target) const noexcept;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the data of the SRV record
+		/// </summary>
+		/// <param name="srv">receives the data</param>
+		/// <returns>true if the record is a valid SRV record</returns>
+		// ********************************************************************************
+		bool srv(dns_srv_data& srv) const noexcept;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the data of the MX record
+		/// </summary>
+		/// <param name="mx">receives the data</param>
+		/// <returns>true if the record is a valid MX record</returns>
+		// ********************************************************************************
+		bool mx(dns_mx_data& mx) const noexcept;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Bounds-checked DNS message (RFC 1035) parser. The header and the layout of all
+	/// sections are validated once by parse, questions and records are then returned as
+	/// views into the message without copying or allocating.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class dns_message
+	{
+	public:
+		/// <summary>DNS header size</summary>
+		static constexpr size_t header_size = 12;
+
+		static constexpr uint16_t type_a = 1;
+		static constexpr uint16_t type_ns = 2;
+		static constexpr uint16_t type_cname = 5;
+		static constexpr uint16_t type_soa = 6;
+		static constexpr uint16_t type_wks = 11;
+		static constexpr uint16_t type_ptr = 12;
+		static constexpr uint16_t type_mx = 15;
+		static constexpr uint16_t type_txt = 16;
+		static constexpr uint16_t type_aaaa = 28;
+		static constexpr uint16_t type_srv = 33;
+		static constexpr uint16_t type_dname = 39;
+		static constexpr uint16_t type_opt = 41;
+		static constexpr uint16_t type_https = 65;
+		static constexpr uint16_t type_any = 255;
+
+		static constexpr uint16_t class_in = 1;
+
+		static constexpr uint8_t rcode_no_error = 0;
+		static constexpr uint8_t rcode_server_failure = 2;
+		static constexpr uint8_t rcode_name_error = 3;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Parses the message. The data must stay valid while the message, its names and
+		/// records are used.
+		/// </summary>
+		/// <param name="data">start of the DNS header (e.g. UDP payload)</param>
+		/// <param name="length">message length</param>
+		/// <returns>parse result</returns>
+		// ********************************************************************************
+		dns_parse_result parse(const uint8_t* data, const size_t length) noexcept
+		{
+			*this = {};
+
+			if (length < header_size)
+				return dns_parse_result::truncated;
+
+			data_ = data;
+			length_ = length;
+
+			size_t offset = header_size;
+
+			for (uint16_t i = 0; i < question_count(); ++i)
+			{
+				dns_question question;
+
+				if (const auto result = read_question(offset, question); result != dns_parse_result::success)
+					return result;
+
+				offset += question.length;
+				++questions_;
+			}
+
+			for (size_t section = 0; section < 3; ++section)
+			{
+				section_offset_[section] = offset;
+
+				for (uint16_t i = 0; i < header_field(6 + section * 2); ++i)
+				{
+					dns_resource_record record;
+					size_t next;
+
+					if (const auto result = read_record(offset, record, next); result != dns_parse_result::success)
+						return result;
+
+					offset = next;
+					++records_[section];
+				}
+			}
+
+			return dns_parse_result::success;
+		}
+
+		[[nodiscard]] uint16_t id() const noexcept { return header_field(0); }
+		[[nodiscard]] uint16_t flags() const noexcept { return header_field(2); }
+		[[nodiscard]] bool is_response() const noexcept { return (flags() & 0x8000) != 0; }
+		[[nodiscard]] uint8_t opcode() const noexcept { return static_cast<uint8_t>(flags() >> 11 & 0x0F); }
+		[[nodiscard]] bool is_truncated() const noexcept { return (flags() & 0x0200) != 0; }
+		[[nodiscard]] uint8_t rcode() const noexcept { return static_cast<uint8_t>(flags() & 0x0F); }
+
+		/// <summary>
+		/// Section counts as announced in the header
+		/// </summary>
+		[[nodiscard]] uint16_t question_count() const noexcept { return header_field(4); }
+		[[nodiscard]] uint16_t answer_count() const noexcept { return header_field(6); }
+		[[nodiscard]] uint16_t authority_count() const noexcept { return header_field(8); }
+		[[nodiscard]] uint16_t additional_count() const noexcept { return header_field(10); }
+
+		/// <summary>
+		/// Number of the complete entries available in the section
+		/// </summary>
+		[[nodiscard]] size_t parsed_questions() const noexcept { return questions_; }
+		[[nodiscard]] size_t parsed_records(const dns_section section) const noexcept
+		{
+			return records_[static_cast<size_t>(section)];
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the first question (queries normally carry exactly one)
+		/// </summary>
+		/// <param name="question">receives the question</param>
+		/// <returns>true if the message has a question</returns>
+		// ********************************************************************************
+		bool first_question(dns_question& question) const noexcept
+		{
+			return questions_ != 0 && read_question(header_size, question) == dns_parse_result::success;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Calls handler(const dns_question&) for each parsed question
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void for_each_question(F&& handler) const
+		{
+			size_t offset = header_size;
+
+			for (size_t i = 0; i < questions_; ++i)
+			{
+				dns_question question;
+				read_question(offset, question);
+				offset += question.length;
+
+				handler(question);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Calls handler(dns_section, const dns_resource_record&) for each parsed record of
+		/// the answer, authority and additional sections
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void for_each_record(F&& handler) const
+		{
+			for (size_t section = 0; section < 3; ++section)
+			{
+				auto offset = section_offset_[section];
+
+				for (size_t i = 0; i < records_[section]; ++i)
+				{
+					dns_resource_record record;
+					read_record(offset, record, offset);
+
+					handler(static_cast<dns_section>(section), record);
+				}
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the mnemonic of the record type
+		/// </summary>
+		// ********************************************************************************
+		static const char* type_name(const uint16_t type) noexcept
+		{
+			switch (type)
+			{
+			case type_a: return "A";
+			case type_ns: return "NS";
+			case type_cname: return "CNAME";
+			case type_soa: return "SOA";
+			case type_wks: return "WKS";
+			case type_ptr: return "PTR";
+			case type_mx: return "MX";
+			case type_txt: return "TXT";
+			case type_aaaa: return "AAAA";
+			case type_srv: return "SRV";
+			case type_dname: return "DNAME";
+			case type_opt: return "OPT";
+			case type_https: return "HTTPS";
+			case type_any: return "ANY";
+			default: return "UNKNOWN";
+			}
+		}
+
+		/// <summary>
+		/// Validates the name stored in place at [offset, end) without following the
+		/// compression pointer
+		/// </summary>
+		/// <returns>offset past the name or 0 if the name is invalid or exceeds end</returns>
+		static size_t skip_name(const uint8_t* data, size_t offset, const size_t end) noexcept
+		{
+			for (size_t wire_length = 1; offset < end;)
+			{
+				const auto label = data[offset];
+
+				if ((label & 0xC0) == 0xC0)
+					return offset + 2 <= end ? offset + 2 : 0;
+
+				if (label & 0xC0)
+					return 0;
+
+				if (label == 0)
+					return offset + 1;
+
+				wire_length += label + 1;
+
+				if (wire_length > dns_name::max_wire_length)
+					return 0;
+
+				offset += label + 1;
+			}
+
+			return 0;
+		}
+
+		/// <summary>
+		/// Reads the big-endian 16 bit value
+		/// </summary>
+		static constexpr uint16_t read_uint16(const uint8_t* data) noexcept
+		{
+			return static_cast<uint16_t>(data[0] << 8 | data[1]);
+		}
+
+		/// <summary>
+		/// Reads the big-endian 32 bit value
+		/// </summary>
+		static constexpr uint32_t read_uint32(const uint8_t* data) noexcept
+		{
+			return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+				static_cast<uint32_t>(data[2]) << 8 | data[3];
+		}
+
+	private:
+		[[nodiscard]] uint16_t header_field(const size_t offset) const noexcept
+		{
+			return data_ != nullptr ? read_uint16(data_ + offset) : 0;
+		}
+
+		dns_parse_result read_question(const size_t offset, dns_question& question) const noexcept
+		{
+			const auto name_end = skip_name(data_, offset, length_);
+
+			if (name_end == 0)
+				return in_place_name_error(offset);
+
+			if (name_end + 4 > length_)
+				return dns_parse_result::truncated;
+
+			question.name = dns_name(data_, length_, offset);
+			question.type = read_uint16(data_ + name_end);
+			question.klass = read_uint16(data_ + name_end + 2);
+			question.offset = offset;
+			question.length = name_end + 4 - offset;
+
+			return dns_parse_result::success;
+		}
+
+		dns_parse_result read_record(const size_t offset, dns_resource_record& record, size_t& next) const noexcept
+		{
+			const auto name_end = skip_name(data_, offset, length_);
+
+			if (name_end == 0)
+				return in_place_name_error(offset);
+
+			if (name_end + 10 > length_)
+				return dns_parse_result::truncated;
+
+			const auto data_length = read_uint16(data_ + name_end + 8);
+
+			if (name_end + 10 + data_length > length_)
+				return dns_parse_result::truncated;
+
+			record.name = dns_name(data_, length_, offset);
+			record.type = read_uint16(data_ + name_end);
+			record.klass = read_uint16(data_ + name_end + 2);
+			record.ttl = read_uint32(data_ + name_end + 4);
+			record.data = data_ + name_end + 10;
+			record.data_length = data_length;
+			record.offset = offset;
+			record.ttl_offset = name_end + 4;
+			record.message = data_;
+			record.message_length = length_;
+
+			next = name_end + 10 + data_length;
+
+			return dns_parse_result::success;
+		}
+
+		/// <summary>
+		/// Name that does not fit the message is truncated if its labels are valid up to
+		/// the end of the data, otherwise malformed
+		/// </summary>
+		[[nodiscard]] dns_parse_result in_place_name_error(size_t offset) const noexcept
+		{
+			for (size_t wire_length = 1; offset < length_;)
+			{
+				const auto label = data_[offset];
+
+				if ((label & 0xC0) == 0xC0)
+					return dns_parse_result::truncated;
+
+				if (label & 0xC0)
+					return dns_parse_result::malformed;
+
+				wire_length += label + 1;
+
+				if (wire_length > dns_name::max_wire_length)
+					return dns_parse_result::malformed;
+
+				offset += label + 1;
+			}
+
+			return dns_parse_result::truncated;
+		}
+
+		const uint8_t* data_{nullptr};
+		size_t length_{0};
+		size_t questions_{0};
+		size_t records_[3]{};
+		size_t section_offset_[3]{};
+	};
+
+	inline const uint8_t* dns_resource_record::address() const noexcept
+	{
+		if ((type == dns_message::type_a && data_length == 4) || (type == dns_message::type_aaaa && data_length == 16))
+			return data;
+
+		return nullptr;
+	}
+
+	inline bool dns_resource_record::target(dns_name& target) const noexcept
+	{
+		if (type != dns_message::type_cname && type != dns_message::type_ns && type != dns_message::type_ptr && type !=
+			dns_message::type_dname)
+			return false;
+
+		const auto offset = static_cast<size_t>(data - message);
+
+		if (dns_message::skip_name(message, offset, offset + data_length) != offset + data_length)
+			return false;
+
+		target = dns_name(message, message_length, offset);
+
+		return true;
+	}
+
+	inline bool dns_resource_record::srv(dns_srv_data& srv) const noexcept
+	{
+		if (type != dns_message::type_srv || data_length < 7)
+			return false;
+
+		const auto offset = static_cast<size_t>(data - message);
+
+		if (dns_message::skip_name(message, offset + 6, offset + data_length) != offset + data_length)
+			return false;
+
+		srv.priority = dns_message::read_uint16(data);
+		srv.weight = dns_message::read_uint16(data + 2);
+		srv.port = dns_message::read_uint16(data + 4);
+		srv.target = dns_name(message, message_length, offset + 6);
+
+		return true;
+	}
+
+	inline bool dns_resource_record::mx(dns_mx_data& mx) const noexcept
+	{
+		if (type != dns_message::type_mx || data_length < 3)
+			return false;
+
+		const auto offset = static_cast<size_t>(data - message);
+
+		if (dns_message::skip_name(message, offset + 2, offset + data_length) != offset + data_length)
+			return false;
+
+		mx.preference = dns_message::read_uint16(data);
+		mx.exchange = dns_name(message, message_length, offset + 2);
+
+		return true;
+	}
+}
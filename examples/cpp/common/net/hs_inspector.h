@@ -0,0 +1,731 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// What happens to the flow when the pattern matches
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class hs_action
+	{
+		/// <summary>match is reported and the inspection continues</summary>
+		report,
+		/// <summary>inspection of the flow stops, its payload goes to the payload handler</summary>
+		stop,
+		/// <summary>packet and the rest of the flow are blocked</summary>
+		block
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Pattern of the hs_inspector database
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct hs_pattern
+	{
+		/// <summary>Hyperscan regular expression</summary>
+		std::string expression;
+		/// <summary>HS_FLAG_* compile flags</summary>
+		unsigned int flags{HS_FLAG_CASELESS};
+		/// <summary>action taken on match</summary>
+		hs_action action{hs_action::report};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Direction of the inspected packet
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class hs_direction
+	{
+		outbound,
+		inbound
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Verdict for the inspected packet
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class hs_verdict
+	{
+		pass,
+		block
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Flow 5-tuple as seen from the local host, so both directions share the key.
+	/// IPv4 addresses are stored in the first 4 bytes of the address fields.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct hs_flow_key
+	{
+		std::array<uint8_t, 16> local_address{};
+		std::array<uint8_t, 16> remote_address{};
+		uint16_t local_port{};
+		uint16_t remote_port{};
+		uint8_t protocol{};
+		uint8_t ip_version{};
+
+		bool operator==(const hs_flow_key& other) const noexcept
+		{
+			return local_port == other.local_port && remote_port == other.remote_port && protocol == other.protocol &&
+				ip_version == other.ip_version && local_address == other.local_address && remote_address == other.
+				remote_address;
+		}
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Hash of the hs_flow_key (FNV-1a over the fields)
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct hs_flow_key_hash
+	{
+		size_t operator()(const hs_flow_key& key) const noexcept
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+
+			const auto add = [&hash](const uint8_t* data, const size_t length)
+			{
+				for (size_t i = 0; i < length; ++i)
+				{
+					hash ^= data[i];
+					hash *= 0x100000001b3ull;
+				}
+			};
+
+			add(key.local_address.data(), key.local_address.size());
+			add(key.remote_address.data(), key.remote_address.size());
+			add(reinterpret_cast<const uint8_t*>(&key.local_port), sizeof(key.local_port));
+			add(reinterpret_cast<const uint8_t*>(&key.remote_port), sizeof(key.remote_port));
+			add(&key.protocol, sizeof(key.protocol));
+
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Pattern match passed to the match handler
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct hs_match
+	{
+		/// <summary>index of the pattern in the list passed to the hs_inspector</summary>
+		unsigned int id;
+		/// <summary>action of the pattern</summary>
+		hs_action action;
+		/// <summary>direction of the matched data</summary>
+		hs_direction direction;
+		/// <summary>end offset of the match in the flow direction (in the datagram for UDP)</summary>
+		unsigned long long to;
+		/// <summary>flow of the match</summary>
+		const hs_flow_key& flow;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// hs_inspector settings
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct hs_inspector_options
+	{
+		/// <summary>number of independently locked session table shards</summary>
+		size_t shards{16};
+		/// <summary>sessions without packets for this long are closed</summary>
+		std::chrono::steady_clock::duration idle_timeout{std::chrono::minutes(5)};
+		/// <summary>scan each UDP datagram with the block mode database</summary>
+		bool udp_block_mode{false};
+		/// <summary>TCP reassembly caps of each session direction</summary>
+		tcp_reassembly_limits reassembly{};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Streaming content-inspection stage built on Hyperscan. All patterns are compiled
+	/// into one database with hs_compile_multi, the pattern index is the match id and
+	/// selects the per-pattern action. TCP sessions are keyed by the full 5-tuple in a
+	/// sharded table and own one Hyperscan stream per direction, fed with the in-order
+	/// data of the tcp_connection_reassembler, so retransmitted, overlapping and
+	/// reordered segments don't disturb the streaming match state. Streams are closed
+	/// when the data up to FIN is delivered, on RST or when the session stays idle.
+	/// UDP datagrams can optionally be scanned
+	/// one by one in block mode. Each thread scans with its own clone of the scratch
+	/// space, so several packet filter threads can inspect concurrently.
+	///
+	/// Context is the per-session user state (e.g. application protocol parsers),
+	/// default-constructed when the session opens.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	template <typename Context>
+	class hs_inspector
+	{
+	public:
+		/// <summary>
+		/// Called as handler(Context* context, const hs_match& match) for each match;
+		/// context is nullptr for the UDP datagrams
+		/// </summary>
+		using match_handler_t = std::function<void(Context*, const hs_match&)>;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Compiles the patterns and allocates the prototype scratch space
+		/// </summary>
+		/// <param name="patterns">patterns, the index in the list is the match id</param>
+		/// <param name="options">inspector settings</param>
+		/// <param name="match_handler">match handler</param>
+		/// <exception cref="std::runtime_error">pattern compilation or scratch allocation failed</exception>
+		// ********************************************************************************
+		hs_inspector(std::vector<hs_pattern> patterns, const hs_inspector_options& options,
+		             match_handler_t match_handler)
+			: patterns_(std::move(patterns)),
+			  options_(options),
+			  match_handler_(std::move(match_handler)),
+			  shards_((std::max)(options.shards, static_cast<size_t>(1)))
+		{
+			stream_database_ = compile(HS_MODE_STREAM);
+
+			if (hs_alloc_scratch(stream_database_, &prototype_scratch_) != HS_SUCCESS)
+			{
+				hs_free_database(stream_database_);
+				throw std::runtime_error("hs_inspector: unable to allocate scratch space");
+			}
+
+			if (options_.udp_block_mode)
+			{
+				block_database_ = compile(HS_MODE_BLOCK);
+
+				if (hs_alloc_scratch(block_database_, &prototype_scratch_) != HS_SUCCESS)
+				{
+					hs_free_scratch(prototype_scratch_);
+					hs_free_database(block_database_);
+					hs_free_database(stream_database_);
+					throw std::runtime_error("hs_inspector: unable to allocate scratch space");
+				}
+			}
+		}
+
+		~hs_inspector()
+		{
+			// sessions close their streams before the databases are released
+			for (auto& shard : shards_)
+				shard.sessions.clear();
+
+			for (const auto scratch : scratches_)
+				hs_free_scratch(scratch);
+
+			hs_free_scratch(prototype_scratch_);
+
+			if (block_database_ != nullptr)
+				hs_free_database(block_database_);
+
+			hs_free_database(stream_database_);
+		}
+
+		hs_inspector(const hs_inspector& other) = delete;
+		hs_inspector(hs_inspector&& other) = delete;
+		hs_inspector& operator=(const hs_inspector& other) = delete;
+		hs_inspector& operator=(hs_inspector&& other) = delete;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Inspects the packet. New TCP sessions are opened on SYN or, for the connections
+		/// established before the inspection started, on the first data segment.
+		/// Reassembled payload of the sessions whose inspection was stopped is passed to
+		/// payload_handler(Context&, hs_direction, const char* data, size_t length).
+		/// The verdict of the out-of-order segment is decided when the hole before it is
+		/// filled, i.e. it applies to the packet which completes the in-order data.
+		/// </summary>
+		/// <param name="direction">packet direction</param>
+		/// <param name="buffer">packet</param>
+		/// <param name="payload_handler">handler of the payload of the stopped sessions</param>
+		/// <returns>block if the packet belongs to the blocked flow or matched the block pattern</returns>
+		// ********************************************************************************
+		template <typename F>
+		hs_verdict inspect(const hs_direction direction, const INTERMEDIATE_BUFFER& buffer, F&& payload_handler)
+		{
+			packet_info packet;
+
+			if (!parse(direction, buffer, packet))
+				return hs_verdict::pass;
+
+			const auto now = std::chrono::steady_clock::now();
+
+			if (packet.key.protocol == IPPROTO_UDP)
+			{
+				if (block_database_ == nullptr || packet.length == 0)
+					return hs_verdict::pass;
+
+				scan_context context{this, nullptr, packet.key, direction, hs_verdict::pass};
+
+				hs_scan(block_database_, packet.payload, static_cast<unsigned int>(packet.length), 0, get_scratch(),
+				        on_match, &context);
+
+				return context.verdict;
+			}
+
+			auto& shard = shards_[hs_flow_key_hash()(packet.key) % shards_.size()];
+			std::shared_ptr<session> flow;
+
+			{
+				std::lock_guard<std::mutex> lock(shard.lock);
+
+				if (now - shard.last_sweep > (std::min)(options_.idle_timeout, std::chrono::steady_clock::duration(
+					std::chrono::seconds(1))))
+				{
+					sweep(shard, now);
+				}
+
+				if (const auto it = shard.sessions.find(packet.key); it != shard.sessions.end())
+				{
+					flow = it->second;
+				}
+				else if ((packet.tcp_flags & TH_SYN) || (packet.length != 0 && options_.reassembly.allow_midstream))
+				{
+					flow = std::make_shared<session>(pool_, options_.reassembly);
+
+					if (hs_open_stream(stream_database_, 0, &flow->streams[0]) != HS_SUCCESS ||
+						hs_open_stream(stream_database_, 0, &flow->streams[1]) != HS_SUCCESS)
+						return hs_verdict::pass;
+
+					shard.sessions.emplace(packet.key, flow);
+				}
+				else
+				{
+					return hs_verdict::pass;
+				}
+
+				flow->last_seen = now;
+
+				if (packet.tcp_flags & TH_RST)
+					shard.sessions.erase(packet.key);
+			}
+
+			std::lock_guard<std::mutex> lock(flow->lock);
+
+			auto verdict = flow->state == session_state::blocked ? hs_verdict::block : hs_verdict::pass;
+
+			if (flow->state == session_state::blocked)
+				return verdict;
+
+			flow->reassembler.segment(
+				static_cast<size_t>(direction), packet.sequence, reinterpret_cast<const uint8_t*>(packet.payload),
+				static_cast<uint32_t>(packet.length), (packet.tcp_flags & TH_SYN) != 0,
+				(packet.tcp_flags & TH_FIN) != 0, (packet.tcp_flags & TH_RST) != 0,
+				[&](const size_t index, const uint8_t* data, const uint32_t length)
+				{
+					if (scan(*flow, packet.key, static_cast<hs_direction>(index), data, length, payload_handler) ==
+						hs_verdict::block)
+						verdict = hs_verdict::block;
+				});
+
+			// end of data: end-anchored patterns are matched when the stream is closed
+			for (size_t index = 0; index < flow->streams.size(); ++index)
+			{
+				if (auto& stream = flow->streams[index]; stream != nullptr && flow->reassembler.stream(index).
+					is_finished())
+				{
+					scan_context context{this, &flow->context, packet.key, static_cast<hs_direction>(index),
+					                     hs_verdict::pass};
+					hs_close_stream(stream, get_scratch(), on_match, &context);
+					stream = nullptr;
+				}
+			}
+
+			if (flow->reassembler.is_closed() && flow->state != session_state::blocked)
+			{
+				std::lock_guard<std::mutex> shard_lock(shard.lock);
+				shard.sessions.erase(packet.key);
+			}
+
+			return verdict;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the number of tracked TCP sessions
+		/// </summary>
+		// ********************************************************************************
+		[[nodiscard]] size_t session_count()
+		{
+			size_t count = 0;
+
+			for (auto& shard : shards_)
+			{
+				std::lock_guard<std::mutex> lock(shard.lock);
+				count += shard.sessions.size();
+			}
+
+			return count;
+		}
+
+	private:
+		enum class session_state
+		{
+			inspecting,
+			stopped,
+			blocked
+		};
+
+		struct session
+		{
+			session(tools::buffer_pool& pool, const tcp_reassembly_limits& limits)
+				: reassembler(pool, limits)
+			{
+			}
+
+			session(const session& other) = delete;
+			session(session&& other) = delete;
+			session& operator=(const session& other) = delete;
+			session& operator=(session&& other) = delete;
+
+			~session()
+			{
+				close_streams();
+			}
+
+			void close_streams()
+			{
+				for (auto& stream : streams)
+				{
+					if (stream != nullptr)
+						hs_close_stream(stream, nullptr, nullptr, nullptr);
+
+					stream = nullptr;
+				}
+			}
+
+			std::mutex lock;
+			/// <summary>in-order data of both directions, indexed by hs_direction</summary>
+			tcp_connection_reassembler reassembler;
+			std::array<hs_stream_t*, 2> streams{};
+			session_state state{session_state::inspecting};
+			std::chrono::steady_clock::time_point last_seen;
+			Context context{};
+		};
+
+		struct shard
+		{
+			std::mutex lock;
+			std::unordered_map<hs_flow_key, std::shared_ptr<session>, hs_flow_key_hash> sessions;
+			std::chrono::steady_clock::time_point last_sweep;
+		};
+
+		struct packet_info
+		{
+			hs_flow_key key;
+			const char* payload{nullptr};
+			size_t length{0};
+			uint32_t sequence{0};
+			uint8_t tcp_flags{0};
+		};
+
+		struct scan_context
+		{
+			hs_inspector* inspector;
+			Context* context;
+			const hs_flow_key& key;
+			hs_direction direction;
+			hs_verdict verdict;
+		};
+
+		/// <summary>
+		/// Scratch cached by the thread: the inspector id guards against the scratch of
+		/// another (or destroyed) inspector
+		/// </summary>
+		struct thread_scratch
+		{
+			uint64_t owner{0};
+			hs_scratch_t* scratch{nullptr};
+		};
+
+		hs_database_t* compile(const unsigned int mode) const
+		{
+			std::vector<const char*> expressions;
+			std::vector<unsigned int> flags;
+			std::vector<unsigned int> ids;
+
+			expressions.reserve(patterns_.size());
+			flags.reserve(patterns_.size());
+			ids.reserve(patterns_.size());
+
+			for (size_t i = 0; i < patterns_.size(); ++i)
+			{
+				expressions.push_back(patterns_[i].expression.c_str());
+				flags.push_back(patterns_[i].flags);
+				ids.push_back(static_cast<unsigned int>(i));
+			}
+
+			hs_database_t* database = nullptr;
+			hs_compile_error_t* compile_error = nullptr;
+
+			if (hs_compile_multi(expressions.data(), flags.data(), ids.data(), static_cast<unsigned int>(patterns_.
+				size()), mode, nullptr, &database, &compile_error) != HS_SUCCESS)
+			{
+				std::stringstream ss;
+				ss << "hs_inspector: unable to compile pattern";
+
+				if (compile_error != nullptr)
+				{
+					if (compile_error->expression >= 0 && static_cast<size_t>(compile_error->expression) < patterns_.
+						size())
+						ss << " " << patterns_[compile_error->expression].expression;
+
+					ss << " : " << compile_error->message;
+					hs_free_compile_error(compile_error);
+				}
+
+				throw std::runtime_error(ss.str());
+			}
+
+			return database;
+		}
+
+		/// <summary>
+		/// Returns the scratch of the calling thread, cloning the prototype on first use
+		/// </summary>
+		hs_scratch_t* get_scratch()
+		{
+			thread_local thread_scratch cached;
+
+			if (cached.owner == id_)
+				return cached.scratch;
+
+			std::lock_guard<std::mutex> lock(scratch_lock_);
+
+			auto& scratch = thread_scratches_[std::this_thread::get_id()];
+
+			if (scratch == nullptr)
+			{
+				if (hs_clone_scratch(prototype_scratch_, &scratch) != HS_SUCCESS)
+					throw std::runtime_error("hs_inspector: unable to clone scratch space");
+
+				scratches_.push_back(scratch);
+			}
+
+			cached = {id_, scratch};
+
+			return scratch;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Scans the in-order data of the session direction, passes it to the payload
+		/// handler once the inspection is stopped. Called with the session lock held.
+		/// </summary>
+		/// <param name="flow">session</param>
+		/// <param name="key">flow key</param>
+		/// <param name="direction">data direction</param>
+		/// <param name="data">in-order data, nullptr if the length bytes were skipped as a hole</param>
+		/// <param name="length">data length</param>
+		/// <param name="payload_handler">handler of the payload of the stopped sessions</param>
+		/// <returns>block if the data matched the block pattern</returns>
+		// ********************************************************************************
+		template <typename F>
+		hs_verdict scan(session& flow, const hs_flow_key& key, const hs_direction direction, const uint8_t* data,
+		                const uint32_t length, F& payload_handler)
+		{
+			const auto index = static_cast<size_t>(direction);
+
+			if (data == nullptr)
+			{
+				// the stream restarts after the given up hole, matches spanning it are lost
+				if (flow.streams[index] != nullptr)
+					hs_reset_stream(flow.streams[index], 0, nullptr, nullptr, nullptr);
+
+				return hs_verdict::pass;
+			}
+
+			auto verdict = hs_verdict::pass;
+
+			if (flow.state == session_state::inspecting)
+			{
+				scan_context context{this, &flow.context, key, direction, hs_verdict::pass};
+
+				if (flow.streams[index] != nullptr && hs_scan_stream(
+					flow.streams[index], reinterpret_cast<const char*>(data), length, 0, get_scratch(), on_match,
+					&context) == HS_SCAN_TERMINATED)
+				{
+					flow.close_streams();
+					flow.state = context.verdict == hs_verdict::block ? session_state::blocked : session_state::stopped;
+				}
+
+				verdict = context.verdict;
+			}
+
+			if (flow.state == session_state::stopped)
+				payload_handler(flow.context, direction, reinterpret_cast<const char*>(data), length);
+
+			return verdict;
+		}
+
+		static int on_match(const unsigned int id, unsigned long long /*from*/, const unsigned long long to,
+		                    unsigned int /*flags*/, void* ctx)
+		{
+			const auto context = static_cast<scan_context*>(ctx);
+			const auto action = context->inspector->patterns_[id].action;
+
+			if (context->inspector->match_handler_)
+				context->inspector->match_handler_(context->context, {id, action, context->direction, to, context->key});
+
+			switch (action)
+			{
+			case hs_action::block:
+				context->verdict = hs_verdict::block;
+				return 1;
+			case hs_action::stop:
+				return 1;
+			default:
+				return 0;
+			}
+		}
+
+		/// <summary>
+		/// Removes the idle sessions, called with the shard lock held
+		/// </summary>
+		void sweep(shard& shard, const std::chrono::steady_clock::time_point now) const
+		{
+			shard.last_sweep = now;
+
+			for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+			{
+				if (now - it->second->last_seen > options_.idle_timeout)
+					it = shard.sessions.erase(it);
+				else
+					++it;
+			}
+		}
+
+		static bool parse(const hs_direction direction, const INTERMEDIATE_BUFFER& buffer, packet_info& packet)
+		{
+			const auto* const ether_header = reinterpret_cast<const ether_header_ptr>(const_cast<PUCHAR>(buffer.
+				m_IBuffer));
+			const auto* const frame_end = buffer.m_IBuffer + buffer.m_Length;
+			const uint8_t* transport = nullptr;
+			const uint8_t* end = nullptr;
+			const uint8_t* source = nullptr;
+			const uint8_t* destination = nullptr;
+			size_t address_length = 0;
+
+			if (buffer.m_Length < ETHER_HEADER_LENGTH)
+				return false;
+
+			if (ntohs(ether_header->h_proto) == ETH_P_IP)
+			{
+				const auto* const ip_header = reinterpret_cast<const iphdr*>(ether_header + 1);
+
+				if (buffer.m_Length < ETHER_HEADER_LENGTH + sizeof(iphdr) || (ntohs(ip_header->ip_off) & 0x1FFF) != 0)
+					return false;
+
+				transport = reinterpret_cast<const uint8_t*>(ip_header) + sizeof(DWORD) * ip_header->ip_hl;
+				end = (std::min)(reinterpret_cast<const uint8_t*>(ip_header) + ntohs(ip_header->ip_len), frame_end);
+				source = reinterpret_cast<const uint8_t*>(&ip_header->ip_src);
+				destination = reinterpret_cast<const uint8_t*>(&ip_header->ip_dst);
+				address_length = 4;
+				packet.key.protocol = ip_header->ip_p;
+				packet.key.ip_version = 4;
+			}
+			else if (ntohs(ether_header->h_proto) == ETH_P_IPV6)
+			{
+				const auto* const ip_header = reinterpret_cast<const ipv6hdr*>(ether_header + 1);
+
+				if (ipv6_packet_info info; ipv6_helper::parse(buffer, info) && info.transport != nullptr)
+				{
+					transport = static_cast<const uint8_t*>(info.transport);
+					end = transport + info.transport_length;
+					packet.key.protocol = info.protocol;
+				}
+				else
+				{
+					return false;
+				}
+
+				source = reinterpret_cast<const uint8_t*>(&ip_header->ip6_src);
+				destination = reinterpret_cast<const uint8_t*>(&ip_header->ip6_dst);
+				address_length = 16;
+				packet.key.ip_version = 6;
+			}
+			else
+			{
+				return false;
+			}
+
+			uint16_t source_port;
+			uint16_t destination_port;
+
+			if (packet.key.protocol == IPPROTO_TCP)
+			{
+				const auto* const tcp_header = reinterpret_cast<const tcphdr*>(transport);
+
+				if (transport + sizeof(tcphdr) > end)
+					return false;
+
+				const auto* const payload = transport + tcp_header->th_off * sizeof(uint32_t);
+
+				if (payload > end)
+					return false;
+
+				source_port = ntohs(tcp_header->th_sport);
+				destination_port = ntohs(tcp_header->th_dport);
+				packet.tcp_flags = tcp_header->th_flags;
+				packet.sequence = ntohl(tcp_header->th_seq);
+				packet.payload = reinterpret_cast<const char*>(payload);
+				packet.length = static_cast<size_t>(end - payload);
+			}
+			else if (packet.key.protocol == IPPROTO_UDP)
+			{
+				const auto* const udp_header = reinterpret_cast<const udphdr*>(transport);
+
+				if (transport + sizeof(udphdr) > end)
+					return false;
+
+				source_port = ntohs(udp_header->th_sport);
+				destination_port = ntohs(udp_header->th_dport);
+				packet.payload = reinterpret_cast<const char*>(udp_header + 1);
+				packet.length = static_cast<size_t>(end - transport - sizeof(udphdr));
+			}
+			else
+			{
+				return false;
+			}
+
+			const auto outbound = direction == hs_direction::outbound;
+
+			std::memcpy(packet.key.local_address.data(), outbound ? source : destination, address_length);
+			std::memcpy(packet.key.remote_address.data(), outbound ? destination : source, address_length);
+			packet.key.local_port = outbound ? source_port : destination_port;
+			packet.key.remote_port = outbound ? destination_port : source_port;
+
+			return true;
+		}
+
+		/// <summary>source of the unique inspector ids</summary>
+		static inline std::atomic<uint64_t> next_id_{1};
+
+		/// <summary>identifies the scratch spaces cached by the threads</summary>
+		const uint64_t id_{next_id_++};
+
+		std::vector<hs_pattern> patterns_;
+		hs_inspector_options options_;
+		match_handler_t match_handler_;
+
+		hs_database_t* stream_database_{nullptr};
+		hs_database_t* block_database_{nullptr};
+
+		/// <summary>scratch allocated for both databases, cloned for each scanning thread</summary>
+		hs_scratch_t* prototype_scratch_{nullptr};
+
+		/// <summary>guards thread_scratches_ and scratches_</summary>
+		std::mutex scratch_lock_;
+		std::unordered_map<std::thread::id, hs_scratch_t*> thread_scratches_;
+		std::vector<hs_scratch_t*> scratches_;
+
+		/// <summary>reassembly windows of the sessions, outlives the shards</summary>
+		tools::buffer_pool pool_;
+
+		std::vector<shard> shards_;
+	};
+}
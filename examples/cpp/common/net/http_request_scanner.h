@@ -0,0 +1,342 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of the http_request_scanner::scan
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class http_scan_result
+	{
+		/// <summary>complete request head (terminated by the empty line) was scanned</summary>
+		success,
+		/// <summary>head is not complete, the fields found so far are set</summary>
+		incomplete,
+		/// <summary>data does not start with the HTTP/1.x request line</summary>
+		not_http,
+		/// <summary>header line without the colon or with the invalid name</summary>
+		malformed
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// HTTP/1.x request head fields, views into the scanned data
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct http_request_head
+	{
+		/// <summary>request method (e.g. GET)</summary>
+		std::string_view method;
+		/// <summary>request target as sent</summary>
+		std::string_view uri;
+		/// <summary>protocol version (e.g. HTTP/1.1)</summary>
+		std::string_view version;
+		/// <summary>Host header value without the surrounding whitespace</summary>
+		std::string_view host;
+		/// <summary>User-Agent header value without the surrounding whitespace</summary>
+		std::string_view user_agent;
+		/// <summary>length of the head including the terminating empty line (0 if incomplete)</summary>
+		size_t length{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// HTTP/1.x request line and header scanner. Line feeds, spaces and colons are
+	/// located 32 (AVX2) or 16 (SSE2) bytes at a time, header names are compared
+	/// case-insensitively in place, and all results are views into the scanned data,
+	/// so nothing is copied or allocated.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class http_request_scanner
+	{
+	public:
+		// ********************************************************************************
+		/// <summary>
+		/// Scans the request head
+		/// </summary>
+		/// <param name="data">start of the request (e.g. TCP payload)</param>
+		/// <param name="length">available data length</param>
+		/// <param name="head">receives the request fields</param>
+		/// <returns>scan result</returns>
+		// ********************************************************************************
+		static http_scan_result scan(const char* data, const size_t length, http_request_head& head) noexcept
+		{
+			return scan(data, length, head, [](std::string_view, std::string_view) noexcept
+			{
+			});
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Scans the request head and calls handler(std::string_view name, std::string_view
+		/// value) for each header line
+		/// </summary>
+		/// <param name="data">start of the request (e.g. TCP payload)</param>
+		/// <param name="length">available data length</param>
+		/// <param name="head">receives the request fields</param>
+		/// <param name="handler">header handler</param>
+		/// <returns>scan result</returns>
+		// ********************************************************************************
+		template <typename F>
+		static http_scan_result scan(const char* data, const size_t length, http_request_head& head, F&& handler)
+		{
+			head = {};
+
+			const auto* const end = data + length;
+			const auto* line_end = find_byte(data, end, '\n');
+
+			// request line: method SP request-target SP HTTP-version
+			const auto* const request_line_end = line_end != end ? trim_cr(data, line_end) : end;
+			const auto* const method_end = find_byte(data, request_line_end, ' ');
+
+			if (method_end == data || method_end == request_line_end || !is_method(data, method_end))
+				return method_scan_result(data, end, method_end);
+
+			head.method = {data, static_cast<size_t>(method_end - data)};
+
+			const auto* const uri_start = method_end + 1;
+			const auto* const uri_end = find_byte(uri_start, request_line_end, ' ');
+
+			if (line_end == end)
+			{
+				head.uri = {uri_start, static_cast<size_t>(uri_end - uri_start)};
+				return http_scan_result::incomplete;
+			}
+
+			if (uri_end == uri_start || uri_end == request_line_end)
+				return http_scan_result::not_http;
+
+			head.uri = {uri_start, static_cast<size_t>(uri_end - uri_start)};
+			head.version = {uri_end + 1, static_cast<size_t>(request_line_end - uri_end - 1)};
+
+			if (constexpr std::string_view http_prefix = "HTTP/1."; head.version.substr(0, http_prefix.size()) !=
+				http_prefix)
+				return http_scan_result::not_http;
+
+			// header fields
+			for (const auto* line = line_end + 1; line < end; line = line_end + 1)
+			{
+				line_end = find_byte(line, end, '\n');
+
+				if (line_end == end)
+					return http_scan_result::incomplete;
+
+				const auto* const content_end = trim_cr(line, line_end);
+
+				if (content_end == line)
+				{
+					head.length = static_cast<size_t>(line_end + 1 - data);
+					return http_scan_result::success;
+				}
+
+				const auto* const colon = find_byte(line, content_end, ':');
+
+				if (colon == content_end || colon == line || is_whitespace(colon[-1]))
+					return http_scan_result::malformed;
+
+				const std::string_view name{line, static_cast<size_t>(colon - line)};
+				const auto value = trim({colon + 1, static_cast<size_t>(content_end - colon - 1)});
+
+				if (equals_lowercase(name, "host"))
+				{
+					if (head.host.empty())
+						head.host = value;
+				}
+				else if (equals_lowercase(name, "user-agent"))
+				{
+					if (head.user_agent.empty())
+						head.user_agent = value;
+				}
+
+				handler(name, value);
+			}
+
+			return http_scan_result::incomplete;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Compares the header name with the lowercase known name (letters, digits and '-')
+		/// ignoring the case
+		/// </summary>
+		/// <param name="name">header name from the request</param>
+		/// <param name="lowercase">known header name in lowercase</param>
+		/// <returns>true if the names are equal</returns>
+		// ********************************************************************************
+		static bool equals_lowercase(const std::string_view name, const std::string_view lowercase) noexcept
+		{
+			if (name.size() != lowercase.size())
+				return false;
+
+			// only 'A'..'Z' are lowercased by setting 0x20, any other byte must match exactly
+			// ('\r' | 0x20 is '-', '@' | 0x20 is '`')
+			size_t i = 0;
+
+			for (; i + sizeof(uint64_t) <= name.size(); i += sizeof(uint64_t))
+			{
+				uint64_t lhs;
+				uint64_t rhs;
+				std::memcpy(&lhs, name.data() + i, sizeof(lhs));
+				std::memcpy(&rhs, lowercase.data() + i, sizeof(rhs));
+
+				// the high bit of the byte is set in above_a if it is 'A' or above and in above_z
+				// if it is above 'Z', the low 7 bits can't carry into the next byte
+				const auto low = lhs & 0x7f7f7f7f7f7f7f7full;
+				const auto above_a = low + 0x3f3f3f3f3f3f3f3full;
+				const auto above_z = low + 0x2525252525252525ull;
+				const auto upper = above_a & ~above_z & ~lhs & 0x8080808080808080ull;
+
+				if ((lhs | upper >> 2) != rhs)
+					return false;
+			}
+
+			for (; i < name.size(); ++i)
+			{
+				const auto c = name[i];
+
+				if ((c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c) != lowercase[i])
+					return false;
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the host name of the Host header value without the port
+		/// </summary>
+		/// <param name="host">Host header value, e.g. example.com:8080 or [::1]:80</param>
+		/// <returns>host name</returns>
+		// ********************************************************************************
+		static constexpr std::string_view strip_port(std::string_view host) noexcept
+		{
+			if (!host.empty() && host.front() == '[')
+			{
+				const auto bracket = host.find(']');
+				return bracket == std::string_view::npos ? host : host.substr(0, bracket + 1);
+			}
+
+			if (const auto colon = host.rfind(':'); colon != std::string_view::npos)
+				host = host.substr(0, colon);
+
+			return host;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the pointer to the first occurrence of the byte in [begin, end) or end
+		/// </summary>
+		// ********************************************************************************
+		static const char* find_byte(const char* begin, const char* const end, const char value) noexcept
+		{
+#if defined(__AVX2__)
+			const auto pattern = _mm256_set1_epi8(value);
+
+			for (; end - begin >= 32; begin += 32)
+			{
+				const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+
+				if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern)));
+					mask != 0)
+					return begin + first_bit(mask);
+			}
+#endif
+#if defined(__AVX2__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+			const auto pattern16 = _mm_set1_epi8(value);
+
+			for (; end - begin >= 16; begin += 16)
+			{
+				const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+
+				if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern16)));
+					mask != 0)
+					return begin + first_bit(mask);
+			}
+#endif
+			for (; begin != end; ++begin)
+			{
+				if (*begin == value)
+					return begin;
+			}
+
+			return end;
+		}
+
+	private:
+		static uint32_t first_bit(const uint32_t mask) noexcept
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+		}
+
+		static constexpr bool is_whitespace(const char c) noexcept
+		{
+			return c == ' ' || c == '\t';
+		}
+
+		static const char* trim_cr(const char* begin, const char* end) noexcept
+		{
+			return end != begin && end[-1] == '\r' ? end - 1 : end;
+		}
+
+		static constexpr std::string_view trim(std::string_view value) noexcept
+		{
+			while (!value.empty() && is_whitespace(value.front()))
+				value.remove_prefix(1);
+
+			while (!value.empty() && is_whitespace(value.back()))
+				value.remove_suffix(1);
+
+			return value;
+		}
+
+		/// <summary>
+		/// Method is the token of the uppercase letters (GET, POST, M-SEARCH...)
+		/// </summary>
+		static bool is_method(const char* begin, const char* end) noexcept
+		{
+			if (end - begin > 16)
+				return false;
+
+			for (; begin != end; ++begin)
+			{
+				if ((*begin < 'A' || *begin > 'Z') && *begin != '-')
+					return false;
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Request line without the method terminator is incomplete only if the data seen
+		/// so far may still be the method
+		/// </summary>
+		static http_scan_result method_scan_result(const char* data, const char* end, const char* method_end) noexcept
+		{
+			if (method_end == end && is_method(data, end))
+				return http_scan_result::incomplete;
+
+			return http_scan_result::not_http;
+		}
+	};
+}
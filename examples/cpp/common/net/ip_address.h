@@ -10,6 +10,13 @@
 #include <in6addr.h>
 #include <ip2string.h>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#include <intrin.h>
+#endif
 
 #pragma comment(lib, "ntdll.lib")
 
@@ -402,6 +409,82 @@ namespace net
 	/// Zero value IPv6 address
 	/// </summary>
 	static constexpr ip_address_v6 zero_ip_address_v6;
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// wyhash-style 64 bit mixing primitives used by the address, endpoint and session
+	/// hashes. All std::hash specializations are seeded with the per-process random seed
+	/// to make hash flooding of the connection tables impractical.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	namespace hashing
+	{
+		/// <summary>wyhash secret constants</summary>
+		constexpr uint64_t secret0 = 0xa0761d6478bd642full;
+		constexpr uint64_t secret1 = 0xe7037ed1a0b428dbull;
+
+		/// <summary>
+		/// Multiplies two 64 bit values and folds 128 bit product into 64 bits (high ^ low)
+		/// </summary>
+		/// <param name="a">first operand</param>
+		/// <param name="b">second operand</param>
+		/// <returns>folded product</returns>
+		inline uint64_t multiply_fold(const uint64_t a, const uint64_t b) noexcept
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			uint64_t high;
+			const auto low = _umul128(a, b, &high);
+			return high ^ low;
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+			return __umulh(a, b) ^ (a * b);
+#elif defined(__SIZEOF_INT128__)
+			const auto product = static_cast<unsigned __int128>(a) * b;
+			return static_cast<uint64_t>(product >> 64) ^ static_cast<uint64_t>(product);
+#else
+			const uint64_t a_lo = a & 0xffffffff, a_hi = a >> 32;
+			const uint64_t b_lo = b & 0xffffffff, b_hi = b >> 32;
+			const uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+			const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+			const uint64_t high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+			const uint64_t low = (cross << 32) | (lo_lo & 0xffffffff);
+			return high ^ low;
+#endif
+		}
+
+		/// <summary>
+		/// Returns per-process random hash seed
+		/// </summary>
+		/// <returns>hash seed</returns>
+		inline uint64_t seed() noexcept
+		{
+			static const uint64_t seed_value = []() noexcept
+			{
+				try
+				{
+					std::random_device rd;
+					return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+				}
+				catch (...)
+				{
+					return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&secret0)) * secret1;
+				}
+			}();
+
+			return seed_value;
+		}
+
+		/// <summary>
+		/// Mixes two 64 bit values into the well distributed 64 bit hash
+		/// </summary>
+		/// <param name="a">first value</param>
+		/// <param name="b">second value</param>
+		/// <param name="seed_value">hash seed</param>
+		/// <returns>hash value</returns>
+		inline uint64_t mix(const uint64_t a, const uint64_t b, const uint64_t seed_value = seed()) noexcept
+		{
+			return multiply_fold(a ^ secret0 ^ seed_value, b ^ secret1);
+		}
+	}
 }
 
 namespace std
@@ -417,9 +500,12 @@ namespace std
 
 		result_type operator()(const argument_type& ip) const noexcept
 		{
-			const auto h1(std::hash<uint32_t>{}(static_cast<uint32_t>(ip)));
+			uint64_t high;
+			uint64_t low;
+			std::memcpy(&high, &ip.u.Byte[0], sizeof(uint64_t));
+			std::memcpy(&low, &ip.u.Byte[8], sizeof(uint64_t));
 
-			return h1;
+			return static_cast<result_type>(net::hashing::mix(high, low));
 		}
 	};
 
@@ -434,9 +520,7 @@ namespace std
 
 		result_type operator()(const argument_type& ip) const noexcept
 		{
-			const auto h1(std::hash<uint32_t>{}(ip.S_un.S_addr));
-
-			return h1;
+			return static_cast<result_type>(net::hashing::mix(ip.S_un.S_addr, AF_INET));
 		}
 	};
 }
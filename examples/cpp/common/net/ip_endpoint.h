@@ -147,12 +147,7 @@ namespace std
 
 		result_type operator()(const argument_type& endpoint) const noexcept
 		{
-			const auto h1(std::hash<std::size_t>{}(
-				std::hash<T>{}(endpoint.ip) ^
-				static_cast<unsigned long>(endpoint.port)
-			));
-
-			return h1;
+			return static_cast<result_type>(net::hashing::mix(std::hash<T>{}(endpoint.ip), endpoint.port));
 		}
 	};
 
@@ -168,14 +163,10 @@ namespace std
 
 		result_type operator()(const argument_type& endpoint) const noexcept
 		{
-			const auto h1(std::hash<std::size_t>{}(
-				std::hash<net::ip_endpoint<T>>{}(endpoint.local) ^
-				static_cast<unsigned long>(endpoint.local.port) ^
-				std::hash<net::ip_endpoint<T>>{}(endpoint.remote) ^
-				static_cast<unsigned long>(endpoint.remote.port)
-			));
-
-			return h1;
+			// mix is not commutative, so swapped endpoints hash differently
+			return static_cast<result_type>(net::hashing::mix(
+				std::hash<net::ip_endpoint<T>>{}(endpoint.local),
+				std::hash<net::ip_endpoint<T>>{}(endpoint.remote)));
 		}
 	};
 }
@@ -0,0 +1,503 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Longest prefix match table for the ip_subnet sets. Prefixes are stored in the
+	/// leaf-pushed multibit trie with 16 bit root stride followed by 8 bit strides
+	/// (DIR-16-8-8 for IPv4, at most 15 node visits for IPv6), so the lookup is a short
+	/// chain of array reads with no comparisons against the individual subnets.
+	/// IPv4 nodes are plain 256 entry arrays. IPv6 prefixes are long and sparse, most
+	/// nodes have a single child, so below the root the IPv6 trie is compressed
+	/// poptrie-style: the node keeps the bitmaps of its children and of its distinct
+	/// leaf runs and finds the entry by the population count (88 bytes per node instead
+	/// of 1 KB).
+	/// The trie is built once into an immutable snapshot, updates build a new snapshot
+	/// and atomically replace the current one, lookups never take a lock.
+	/// </summary>
+	/// <typeparam name="T">net::ip_address_v4 or net::ip_address_v6</typeparam>
+	/// <typeparam name="V">value associated with the prefix (e.g. rule or route identifier)</typeparam>
+	// --------------------------------------------------------------------------------
+	template <typename T, typename V = uint32_t>
+	class ip_prefix_table
+	{
+	public:
+		using address_type_t = T;
+		using value_type_t = V;
+		using prefix_list_t = std::vector<std::pair<ip_subnet<T>, V>>;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Immutable trie built from the prefix list
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class snapshot
+		{
+			friend ip_prefix_table;
+
+			/// <summary>address length in bytes</summary>
+			static constexpr size_t address_length = sizeof(T);
+			/// <summary>root node stride in bits</summary>
+			static constexpr uint32_t root_stride = 16;
+			/// <summary>number of entries in the root node</summary>
+			static constexpr uint32_t root_size = 1u << root_stride;
+			/// <summary>number of entries in the non-root node (8 bit stride)</summary>
+			static constexpr uint32_t node_size = 256;
+			/// <summary>entry flag: low bits hold the child node offset instead of the value index</summary>
+			static constexpr uint32_t child_flag = 0x80000000;
+
+			static_assert(address_length == 4 || address_length == 16);
+
+			// --------------------------------------------------------------------------------
+			/// <summary>
+			/// Compressed IPv6 trie node. Children of the node are stored next to each other
+			/// in nodes_, the entries of the leaf runs (consecutive indexes with the same
+			/// entry) next to each other in leaves_. Bit i of child_bits is set if index i
+			/// leads to a child, bit i of leaf_bits is set if a new leaf run starts at i;
+			/// the ranks hold the number of bits set in the preceding 64 bit words.
+			/// </summary>
+			// --------------------------------------------------------------------------------
+			struct compressed_node
+			{
+				std::array<uint64_t, 4> child_bits;
+				std::array<uint64_t, 4> leaf_bits;
+				std::array<uint16_t, 4> child_rank;
+				std::array<uint16_t, 4> leaf_rank;
+				/// <summary>index of the first child in nodes_</summary>
+				uint32_t child_base;
+				/// <summary>index of the first leaf run entry in leaves_</summary>
+				uint32_t leaf_base;
+
+				// ********************************************************************************
+				/// <summary>
+				/// Returns the entry of the index: child_flag | child node index or the leaf entry
+				/// </summary>
+				// ********************************************************************************
+				[[nodiscard]] uint32_t entry(const uint8_t index, const std::vector<uint32_t>& leaves) const noexcept
+				{
+					const auto word = index >> 6;
+					const auto bit = uint64_t{1} << (index & 63);
+
+					if (child_bits[word] & bit)
+					{
+						return child_flag | (child_base + child_rank[word] +
+							static_cast<uint32_t>(std::bitset<64>(child_bits[word] & (bit - 1)).count()));
+					}
+
+					// the leaf run containing the index starts at or below it
+					return leaves[leaf_base + leaf_rank[word] +
+						static_cast<uint32_t>(std::bitset<64>(leaf_bits[word] & (bit | (bit - 1))).count()) - 1];
+				}
+			};
+
+			/// <summary>
+			/// Trie entries: root node followed by 256 entry nodes (IPv6: root node only once
+			/// built). Entry is either 0 (no match), value index + 1 or child_flag | offset of
+			/// the child node (IPv6: index of the child in nodes_).
+			/// </summary>
+			std::vector<uint32_t> entries_;
+			/// <summary>compressed IPv6 nodes below the root</summary>
+			std::vector<compressed_node> nodes_;
+			/// <summary>leaf run entries of the compressed IPv6 nodes</summary>
+			std::vector<uint32_t> leaves_;
+			/// <summary>prefix length of the entry value, used to keep the longest prefix while building</summary>
+			std::vector<uint8_t> entry_prefix_;
+			/// <summary>values referenced by the entries</summary>
+			std::vector<V> values_;
+
+		public:
+			snapshot() : entries_(root_size, 0), entry_prefix_(root_size, 0)
+			{
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Finds the value of the longest prefix containing the address
+			/// </summary>
+			/// <param name="address">IP address to look up</param>
+			/// <returns>pointer to the value or nullptr if no prefix matches</returns>
+			// ********************************************************************************
+			[[nodiscard]] const V* lookup(const T& address) const noexcept
+			{
+				const auto* bytes = reinterpret_cast<const uint8_t*>(&address);
+
+				auto entry = entries_[(static_cast<uint32_t>(bytes[0]) << 8) | bytes[1]];
+
+				for (size_t i = 2; (entry & child_flag) && i < address_length; ++i)
+				{
+					entry = child_entry(entry, bytes[i]);
+				}
+
+				return entry ? &values_[entry - 1] : nullptr;
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Looks up the batch of addresses. The root entries of the whole batch are read
+			/// first, so the independent cache misses overlap instead of being serialized.
+			/// </summary>
+			/// <param name="addresses">addresses to look up</param>
+			/// <param name="count">number of addresses</param>
+			/// <param name="results">receives value pointer (or nullptr) per address</param>
+			// ********************************************************************************
+			void lookup_batch(const T* addresses, const size_t count, const V** results) const noexcept
+			{
+				constexpr size_t batch_size = 16;
+
+				for (size_t base = 0; base < count; base += batch_size)
+				{
+					const auto batch_count = (std::min)(batch_size, count - base);
+					std::array<uint32_t, batch_size> entry{};
+
+					for (size_t j = 0; j < batch_count; ++j)
+					{
+						const auto* bytes = reinterpret_cast<const uint8_t*>(&addresses[base + j]);
+						entry[j] = entries_[(static_cast<uint32_t>(bytes[0]) << 8) | bytes[1]];
+					}
+
+					for (size_t i = 2; i < address_length; ++i)
+					{
+						auto pending = false;
+
+						for (size_t j = 0; j < batch_count; ++j)
+						{
+							if (entry[j] & child_flag)
+							{
+								const auto* bytes = reinterpret_cast<const uint8_t*>(&addresses[base + j]);
+								entry[j] = child_entry(entry[j], bytes[i]);
+								pending = true;
+							}
+						}
+
+						if (!pending)
+							break;
+					}
+
+					for (size_t j = 0; j < batch_count; ++j)
+					{
+						results[base + j] = entry[j] ? &values_[entry[j] - 1] : nullptr;
+					}
+				}
+			}
+
+			/// <summary>
+			/// Checks if the address belongs to any of the prefixes
+			/// </summary>
+			/// <param name="address">IP address to check</param>
+			/// <returns>true if any prefix matches</returns>
+			[[nodiscard]] bool contains(const T& address) const noexcept { return lookup(address) != nullptr; }
+
+			/// <summary>
+			/// Number of prefixes in the snapshot
+			/// </summary>
+			[[nodiscard]] size_t size() const noexcept { return values_.size(); }
+
+			/// <summary>
+			/// Approximate memory used by the trie in bytes
+			/// </summary>
+			[[nodiscard]] size_t memory_usage() const noexcept
+			{
+				return entries_.capacity() * sizeof(uint32_t) + nodes_.capacity() * sizeof(compressed_node) +
+					leaves_.capacity() * sizeof(uint32_t) + values_.capacity() * sizeof(V);
+			}
+
+		private:
+			/// <summary>
+			/// Returns the entry of the child node referenced by the entry
+			/// </summary>
+			[[nodiscard]] uint32_t child_entry(const uint32_t entry, const uint8_t index) const noexcept
+			{
+				if constexpr (address_length == 4)
+					return entries_[(entry & ~child_flag) + index];
+				else
+					return nodes_[entry & ~child_flag].entry(index, leaves_);
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Replaces the IPv6 nodes below the root with the compressed nodes
+			/// </summary>
+			// ********************************************************************************
+			void compress()
+			{
+				const auto trie = std::move(entries_);
+
+				entries_.assign(trie.cbegin(), trie.cbegin() + root_size);
+
+				for (auto& entry : entries_)
+				{
+					if (entry & child_flag)
+					{
+						const auto slot = static_cast<uint32_t>(nodes_.size());
+
+						nodes_.emplace_back();
+						compress_node(trie, entry & ~child_flag, slot);
+						entry = child_flag | slot;
+					}
+				}
+
+				nodes_.shrink_to_fit();
+				leaves_.shrink_to_fit();
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Compresses the 256 entry node of the trie into the nodes_ slot, the children
+			/// are compressed into the consecutive slots appended to nodes_
+			/// </summary>
+			/// <param name="trie">uncompressed trie entries</param>
+			/// <param name="node">offset of the node in the trie</param>
+			/// <param name="slot">index of the compressed node in nodes_</param>
+			// ********************************************************************************
+			void compress_node(const std::vector<uint32_t>& trie, const uint32_t node, const uint32_t slot)
+			{
+				compressed_node result{};
+				uint16_t children = 0;
+				uint16_t runs = 0;
+
+				result.leaf_base = static_cast<uint32_t>(leaves_.size());
+
+				for (uint32_t i = 0; i < node_size; ++i)
+				{
+					if (i % 64 == 0)
+					{
+						result.child_rank[i / 64] = children;
+						result.leaf_rank[i / 64] = runs;
+					}
+
+					const auto entry = trie[node + i];
+
+					if (entry & child_flag)
+					{
+						result.child_bits[i / 64] |= uint64_t{1} << (i % 64);
+						++children;
+					}
+					else if (runs == 0 || leaves_.back() != entry)
+					{
+						result.leaf_bits[i / 64] |= uint64_t{1} << (i % 64);
+						leaves_.push_back(entry);
+						++runs;
+					}
+				}
+
+				result.child_base = static_cast<uint32_t>(nodes_.size());
+
+				if (nodes_.size() + children >= child_flag)
+					throw std::length_error("ip_prefix_table: trie is too large");
+
+				nodes_.resize(nodes_.size() + children);
+				nodes_[slot] = result;
+
+				for (uint32_t i = 0, child = result.child_base; i < node_size; ++i)
+				{
+					if (trie[node + i] & child_flag)
+						compress_node(trie, trie[node + i] & ~child_flag, child++);
+				}
+			}
+
+			void insert(const uint8_t* prefix, const uint8_t prefix_length, const uint32_t value_entry)
+			{
+				auto entry_index = (static_cast<uint32_t>(prefix[0]) << 8) | prefix[1];
+
+				// root node covers the first 16 bits
+				if (prefix_length <= root_stride)
+				{
+					fill(0, entry_index, root_stride, prefix_length, value_entry, prefix_length);
+					return;
+				}
+
+				for (size_t i = 2, covered = root_stride + 8;; ++i, covered += 8)
+				{
+					const auto node = child_node(entry_index);
+
+					if (prefix_length <= covered)
+					{
+						fill(node, prefix[i], 8, static_cast<uint8_t>(prefix_length + 8 - covered), value_entry,
+						     prefix_length);
+						return;
+					}
+
+					entry_index = node + prefix[i];
+				}
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Returns the child node of the entry, creating it (and pushing the entry value
+			/// down to it) if the entry is a leaf
+			/// </summary>
+			// ********************************************************************************
+			uint32_t child_node(const uint32_t entry_index)
+			{
+				if (entries_[entry_index] & child_flag)
+					return entries_[entry_index] & ~child_flag;
+
+				const auto child = static_cast<uint32_t>(entries_.size());
+
+				if (child >= child_flag)
+					throw std::length_error("ip_prefix_table: trie is too large");
+
+				// leaf pushing: the child inherits the value of the shorter prefix
+				const auto value_entry = entries_[entry_index];
+				const auto length = entry_prefix_[entry_index];
+
+				entries_.resize(entries_.size() + node_size, value_entry);
+				entry_prefix_.resize(entry_prefix_.size() + node_size, length);
+
+				entries_[entry_index] = child_flag | child;
+
+				return child;
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Writes the value to the entries expanded from the prefix bits within the node.
+			/// Longer prefixes already stored below are kept (leaf pushing into child nodes).
+			/// </summary>
+			// ********************************************************************************
+			void fill(const uint32_t node, const uint32_t index, const uint32_t stride, const uint8_t bits,
+			          const uint32_t value_entry, const uint8_t length)
+			{
+				const auto span = 1u << (stride - bits);
+				const auto first = index & ~(span - 1);
+
+				for (auto i = first; i < first + span; ++i)
+				{
+					push(node + i, value_entry, length);
+				}
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Stores the value in the entry unless a longer prefix is already there
+			/// </summary>
+			// ********************************************************************************
+			void push(const uint32_t entry_index, const uint32_t value_entry, const uint8_t length)
+			{
+				if (entries_[entry_index] & child_flag)
+				{
+					const auto child = entries_[entry_index] & ~child_flag;
+
+					for (uint32_t i = 0; i < node_size; ++i)
+					{
+						push(child + i, value_entry, length);
+					}
+				}
+				else if (entry_prefix_[entry_index] <= length)
+				{
+					entries_[entry_index] = value_entry;
+					entry_prefix_[entry_index] = length;
+				}
+			}
+		};
+
+		using snapshot_ptr_t = std::shared_ptr<const snapshot>;
+
+		ip_prefix_table() : snapshot_(std::make_shared<const snapshot>())
+		{
+		}
+
+		explicit ip_prefix_table(const prefix_list_t& prefixes) : snapshot_(build(prefixes))
+		{
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the immutable snapshot from the prefix list. Host bits of the subnet
+		/// addresses are ignored, for the duplicate prefixes the last value wins.
+		/// </summary>
+		/// <param name="prefixes">list of subnets with the associated values</param>
+		/// <returns>snapshot pointer</returns>
+		// ********************************************************************************
+		static snapshot_ptr_t build(const prefix_list_t& prefixes)
+		{
+			auto result = std::make_shared<snapshot>();
+
+			// shorter prefixes first, so the longer ones overwrite the expanded entries
+			std::vector<std::pair<uint8_t, size_t>> order;
+			order.reserve(prefixes.size());
+
+			for (size_t i = 0; i < prefixes.size(); ++i)
+			{
+				order.emplace_back(prefixes[i].first.get_prefix(), i);
+			}
+
+			std::stable_sort(order.begin(), order.end(), [](const auto& lhs, const auto& rhs)
+			{
+				return lhs.first < rhs.first;
+			});
+
+			result->values_.reserve(prefixes.size());
+
+			for (const auto& [prefix_length, i] : order)
+			{
+				std::array<uint8_t, sizeof(T)> prefix{};
+				const auto* address = reinterpret_cast<const uint8_t*>(&prefixes[i].first.address);
+				const auto* mask = reinterpret_cast<const uint8_t*>(&prefixes[i].first.mask);
+
+				for (size_t j = 0; j < sizeof(T); ++j)
+				{
+					prefix[j] = address[j] & mask[j];
+				}
+
+				result->values_.push_back(prefixes[i].second);
+				result->insert(prefix.data(), prefix_length, static_cast<uint32_t>(result->values_.size()));
+			}
+
+			result->entry_prefix_ = {};
+
+			if constexpr (sizeof(T) == 16)
+				result->compress();
+			else
+				result->entries_.shrink_to_fit();
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the new snapshot and atomically replaces the current one. Lookups in
+		/// progress keep using the snapshot they have loaded.
+		/// </summary>
+		/// <param name="prefixes">list of subnets with the associated values</param>
+		// ********************************************************************************
+		void update(const prefix_list_t& prefixes)
+		{
+			std::atomic_store(&snapshot_, build(prefixes));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the current snapshot. Holding the snapshot is the cheapest way to run
+		/// many lookups (e.g. per packet batch) without touching the shared pointer.
+		/// </summary>
+		/// <returns>snapshot pointer</returns>
+		// ********************************************************************************
+		[[nodiscard]] snapshot_ptr_t get_snapshot() const
+		{
+			return std::atomic_load(&snapshot_);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the value of the longest prefix containing the address in the current snapshot
+		/// </summary>
+		/// <param name="address">IP address to look up</param>
+		/// <returns>value or std::nullopt if no prefix matches</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<V> lookup(const T& address) const
+		{
+			const auto current = get_snapshot();
+
+			if (const auto* value = current->lookup(address); value)
+				return *value;
+
+			return std::nullopt;
+		}
+
+	private:
+		/// <summary>current snapshot, accessed with std::atomic_load/std::atomic_store</summary>
+		snapshot_ptr_t snapshot_;
+	};
+}
@@ -5,6 +5,35 @@
 
 namespace net
 {
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// IPv6 header chain summary filled by ipv6_helper::parse
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct ipv6_packet_info
+	{
+		/// <summary>upper layer header, nullptr if the chain is malformed or the packet is not the first fragment</summary>
+		void* transport{nullptr};
+		/// <summary>upper layer protocol, the last next header value reached</summary>
+		uint8_t protocol{0};
+		/// <summary>all extension headers fit into the packet</summary>
+		bool valid{false};
+		/// <summary>fragment header is present</summary>
+		bool fragmented{false};
+		/// <summary>fragment header is present and the fragment offset is zero</summary>
+		bool first_fragment{false};
+		/// <summary>more fragments flag of the fragment header</summary>
+		bool more_fragments{false};
+		/// <summary>routing header is present</summary>
+		bool routing_header{false};
+		/// <summary>fragment offset in octets</summary>
+		uint16_t fragment_offset{0};
+		/// <summary>offset of the upper layer header from the IPv6 header</summary>
+		uint16_t transport_offset{0};
+		/// <summary>upper layer octets available in the packet (limited by the IPv6 payload length)</summary>
+		uint16_t transport_length{0};
+	};
+
 	/// <summary>
 	/// IPv6 helper functions for parsing IPv6 headers, checksum and etc..
 	/// </summary>
@@ -12,89 +41,162 @@ namespace net
 	{
 		// ********************************************************************************
 		/// <summary>
-		/// Parses IP headers until the transport payload
+		/// Walks the IPv6 extension header chain. Every extension header length is checked
+		/// against the packet size and the IPv6 payload length, so a malformed chain never
+		/// reads past the packet.
 		/// </summary>
 		/// <param name="ip_header">pointer to IP header</param>
 		/// <param name="packet_size">size of IP packet in octets</param>
-		/// <returns>pointer to IP packet payload (TCP, UDP, ICMPv6 and etc..) and protocol value</returns>
+		/// <param name="info">receives the header chain summary</param>
+		/// <returns>true if the packet is IPv6 and the header chain is valid</returns>
 		// ********************************************************************************
-		static std::pair<void*, unsigned char> find_transport_header(
-			const ipv6hdr* ip_header,
-			const unsigned packet_size
-		) noexcept
+		static bool parse(const ipv6hdr* ip_header, const unsigned packet_size, ipv6_packet_info& info) noexcept
 		{
-			unsigned char next_proto = 0;
-			void* the_header = nullptr;
+			info = {};
 
-			//
-			// Parse IPv6 headers
-			//
+			if (packet_size < sizeof(ipv6hdr) || ip_header->ip6_v != 6)
+				return false;
 
-			// Check if this IPv6 packet
-			if (ip_header->ip6_v != 6)
-			{
-				return {nullptr, next_proto};
-			}
+			const auto* const begin = reinterpret_cast<const uint8_t*>(ip_header);
+
+			// Ethernet padding is not a part of the packet, zero payload length means jumbogram
+			auto limit = static_cast<size_t>(packet_size);
+
+			if (ip_header->ip6_len != 0)
+				limit = (std::min)(limit, sizeof(ipv6hdr) + ntohs(ip_header->ip6_len));
 
-			// Find the first header
-			next_proto = ip_header->ip6_next;
-			auto* next_header = reinterpret_cast<const ipv6ext*>(ip_header + 1);
+			auto offset = sizeof(ipv6hdr);
+			auto next_proto = ip_header->ip6_next;
 
-			// Loop until we find the last IP header
-			while (true)
+			for (auto header = extension_header(next_proto); header.shift != 0; header = extension_header(next_proto))
 			{
-				// Ensure that current header is still within the packet
-				if (reinterpret_cast<const char*>(next_header) > reinterpret_cast<const char*>(ip_header) + packet_size - sizeof(
-					ipv6ext))
+				// every extension header is at least 8 octets long
+				if (offset + 8 > limit)
+				{
+					info.protocol = next_proto;
+					return false;
+				}
+
+				const auto* const extension = begin + offset;
+				const auto length = (static_cast<size_t>(extension[1] & header.length_mask) + header.length_bias) <<
+					header.shift;
+
+				if (offset + length > limit)
 				{
-					return {nullptr, next_proto};
+					info.protocol = next_proto;
+					return false;
 				}
 
-				switch (next_proto)
+				if (next_proto == IPPROTO_FRAGMENT)
 				{
-					// Fragmentation
-				case IPPROTO_FRAGMENT:
+					const auto offset_flags = ntohs(reinterpret_cast<const ipv6ext_frag*>(extension)->ip6_offlg);
+
+					info.fragmented = true;
+					info.fragment_offset = static_cast<uint16_t>(offset_flags & 0xFFF8);
+					info.first_fragment = info.fragment_offset == 0;
+					info.more_fragments = (offset_flags & 0x0001) != 0;
+
+					// If this isn't the FIRST fragment, there won't be an upper layer header
+					if (!info.first_fragment)
 					{
-						const auto frag = reinterpret_cast<const ipv6ext_frag*>(next_header);
+						info.protocol = extension[0];
+						info.valid = true;
+						return true;
+					}
+				}
 
-						// If this isn't the FIRST fragment, there won't be a TCP/UDP header anyway
-						if ((frag->ip6_offlg & 0xFC) != 0)
-						{
-							// The offset is non-zero
-							next_proto = frag->ip6_next;
+				info.routing_header |= next_proto == IPPROTO_ROUTING;
+				next_proto = extension[0];
+				offset += length;
+			}
 
-							return {nullptr, next_proto};
-						}
+			info.protocol = next_proto;
+			info.valid = true;
+			info.transport_offset = static_cast<uint16_t>(offset);
+			info.transport_length = static_cast<uint16_t>(limit - offset);
+			info.transport = const_cast<uint8_t*>(begin + offset);
 
-						// Otherwise it's either an entire segment or the first fragment
-						next_proto = frag->ip6_next;
+			return true;
+		}
 
-						// Return next octet following the fragmentation header
-						next_header = reinterpret_cast<const ipv6ext*>(reinterpret_cast<const char*>(next_header) + sizeof(
-							ipv6ext_frag));
+		// ********************************************************************************
+		/// <summary>
+		/// Walks the header chains of the IPv6 packets read by ReadPackets, so the packet
+		/// metadata of the whole block is available before the packets are processed
+		/// </summary>
+		/// <param name="request">packets read by ReadPackets</param>
+		/// <param name="info">array of at least request.dwPacketsSuccess entries, non-IPv6 packets are reset</param>
+		/// <returns>number of valid IPv6 packets</returns>
+		// ********************************************************************************
+		static size_t parse(const ETH_M_REQUEST& request, ipv6_packet_info* info) noexcept
+		{
+			size_t result = 0;
 
-						return { const_cast<void*>(static_cast<const void*>(next_header)), next_proto };
-					}
+			for (unsigned i = 0; i < request.dwPacketsSuccess; ++i)
+				result += parse(*request.EthPacket[i].Buffer, info[i]) ? 1 : 0;
 
-					// Headers we just skip over
-				case IPPROTO_HOPOPTS:
-				case IPPROTO_ROUTING:
-				case IPPROTO_DSTOPTS:
-					next_proto = next_header->ip6_next;
+			return result;
+		}
 
-					// As per RFC 2460 : ip6ext_len specifies the extended
-					// header length, in units of 8 octets *not including* the
-					// first 8 octets.
+		// ********************************************************************************
+		/// <summary>
+		/// Walks the header chains of the IPv6 packets read by ReadPacketsUnsorted (or
+		/// passed to the fast I/O callbacks)
+		/// </summary>
+		/// <param name="packets">packets</param>
+		/// <param name="count">number of packets</param>
+		/// <param name="info">array of at least count entries, non-IPv6 packets are reset</param>
+		/// <returns>number of valid IPv6 packets</returns>
+		// ********************************************************************************
+		static size_t parse(const PINTERMEDIATE_BUFFER* packets, const size_t count, ipv6_packet_info* info) noexcept
+		{
+			size_t result = 0;
 
-					next_header = reinterpret_cast<const ipv6ext*>(reinterpret_cast<const char*>(next_header) + 8 + static_cast<ULONG_PTR>(next_header
-						->ip6_len) * 8);
-					break;
+			for (size_t i = 0; i < count; ++i)
+				result += parse(*packets[i], info[i]) ? 1 : 0;
 
-				default:
-					// No more IPv6 headers to skip
-					return { const_cast<void*>(static_cast<const void*>(next_header)), next_proto };
-				}
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Walks the header chain of the IPv6 packet in the INTERMEDIATE_BUFFER
+		/// </summary>
+		/// <param name="packet">Ethernet frame</param>
+		/// <param name="info">receives the header chain summary</param>
+		/// <returns>true if the frame carries IPv6 and the header chain is valid</returns>
+		// ********************************************************************************
+		static bool parse(const INTERMEDIATE_BUFFER& packet, ipv6_packet_info& info) noexcept
+		{
+			if (const auto* const ethernet_header = reinterpret_cast<const ether_header*>(packet.m_IBuffer);
+				packet.m_Length < ETHER_HEADER_LENGTH || ntohs(ethernet_header->h_proto) != ETH_P_IPV6)
+			{
+				info = {};
+				return false;
 			}
+
+			return parse(reinterpret_cast<const ipv6hdr*>(packet.m_IBuffer + ETHER_HEADER_LENGTH),
+			             packet.m_Length - ETHER_HEADER_LENGTH, info);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Parses IP headers until the transport payload
+		/// </summary>
+		/// <param name="ip_header">pointer to IP header</param>
+		/// <param name="packet_size">size of IP packet in octets</param>
+		/// <returns>pointer to IP packet payload (TCP, UDP, ICMPv6 and etc..) and protocol value,
+		/// the pointer is nullptr for the malformed packets and non-first fragments</returns>
+		// ********************************************************************************
+		static std::pair<void*, unsigned char> find_transport_header(
+			const ipv6hdr* ip_header,
+			const unsigned packet_size
+		) noexcept
+		{
+			ipv6_packet_info info;
+			parse(ip_header, packet_size, info);
+
+			return {info.transport, info.protocol};
 		}
 
 		// ********************************************************************************
@@ -153,6 +255,40 @@ namespace net
 		}
 
 	private:
+		/// <summary>
+		/// Extension header length encoding: the length octet is masked with length_mask,
+		/// length_bias is added and the sum is shifted left by shift. Zero shift marks
+		/// the upper layer protocols.
+		/// </summary>
+		struct extension_header_format
+		{
+			uint8_t length_mask;
+			uint8_t length_bias;
+			uint8_t shift;
+		};
+
+		static constexpr std::array<extension_header_format, 256> make_extension_headers() noexcept
+		{
+			std::array<extension_header_format, 256> formats{};
+
+			// As per RFC 8200 : 8-octet units, not including the first 8 octets
+			formats[IPPROTO_HOPOPTS] = {0xFF, 1, 3};
+			formats[IPPROTO_ROUTING] = {0xFF, 1, 3};
+			formats[IPPROTO_DSTOPTS] = {0xFF, 1, 3};
+			// fixed 8 octets
+			formats[IPPROTO_FRAGMENT] = {0x00, 1, 3};
+			// As per RFC 4302 : 4-octet units minus 2
+			formats[IPPROTO_AH] = {0xFF, 2, 2};
+
+			return formats;
+		}
+
+		static extension_header_format extension_header(const uint8_t next_header) noexcept
+		{
+			static constexpr auto formats = make_extension_headers();
+			return formats[next_header];
+		}
+
 		/// <summary>
 		/// Calculates partial IP checksum
 		/// </summary>
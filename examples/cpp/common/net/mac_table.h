@@ -0,0 +1,348 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of mac_table::learn
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class mac_learn_result
+	{
+		/// <summary>address is known on the same port, the entry was fresh enough to be left untouched</summary>
+		unchanged,
+		/// <summary>address is known on the same port, the timestamp was refreshed</summary>
+		refreshed,
+		/// <summary>new entry was created (or the aged one was reused)</summary>
+		learned,
+		/// <summary>address was known on the other port and has moved to the new one</summary>
+		moved,
+		/// <summary>no free slot in the probe range, the address was not learned</summary>
+		full
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// MAC learning table of the software bridge keyed by MAC address and VLAN
+	/// identifier, stored in tools::seqlock_table: lookups never block or write
+	/// shared memory, learning locks only the slot it modifies. Entries older than
+	/// the aging time are treated as absent and their slots are reused by the new
+	/// addresses, so a host moved to another segment is forwarded correctly as soon
+	/// as it sends a frame (the move is reported) or its old entry ages out.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class mac_table
+	{
+	public:
+		using clock_t = std::chrono::steady_clock;
+		using time_point_t = clock_t::time_point;
+
+		/// <summary>largest port index the table can store</summary>
+		static constexpr size_t max_port = 0xFFFE;
+		/// <summary>largest VLAN identifier</summary>
+		static constexpr uint16_t max_vlan = 0x0FFF;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Per-thread direct-mapped cache of the recently looked up addresses. An entry
+		/// remembers the slot and its sequence number, so a hit costs one atomic load
+		/// and any update of the slot (refresh, move, reuse) invalidates it.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class lookup_cache
+		{
+			friend mac_table;
+
+			/// <summary>number of cached addresses</summary>
+			static constexpr size_t cache_size = 64;
+
+			struct entry
+			{
+				uint64_t key{0};
+				uint64_t value{0};
+				uint32_t slot{0};
+				uint32_t sequence{0};
+			};
+
+			std::array<entry, cache_size> entries_{};
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Learning statistics
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>new entries created</summary>
+			uint64_t learned;
+			/// <summary>addresses moved between ports</summary>
+			uint64_t moved;
+			/// <summary>addresses not learned because the probe range was occupied</summary>
+			uint64_t full;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the table
+		/// </summary>
+		/// <param name="capacity">expected number of addresses, the table keeps at least twice as many slots</param>
+		/// <param name="aging_time">time after the last frame from the address the entry expires</param>
+		// ********************************************************************************
+		explicit mac_table(const size_t capacity = 4096,
+		                   const std::chrono::milliseconds aging_time = std::chrono::minutes(5))
+			: aging_time_(static_cast<uint64_t>((std::max)(aging_time.count(), std::chrono::milliseconds::rep{1}))),
+			  refresh_interval_(aging_time_ / 32),
+			  slots_(capacity)
+		{
+		}
+
+		mac_table(const mac_table& other) = delete;
+		mac_table(mac_table&& other) noexcept = delete;
+		mac_table& operator=(const mac_table& other) = delete;
+		mac_table& operator=(mac_table&& other) noexcept = delete;
+
+		~mac_table() = default;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the port the address was learned on
+		/// </summary>
+		/// <param name="address">destination MAC address</param>
+		/// <param name="vlan">VLAN identifier (0 for the untagged frames)</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <returns>port index or std::nullopt if the address is unknown or aged out</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<size_t> lookup(const mac_address& address, const uint16_t vlan,
+		                                           const time_point_t now) const noexcept
+		{
+			const auto [index, current] = find_slot(make_key(address, vlan));
+
+			if (index == table_t::npos || is_expired(current.words[1], to_ticks(now)))
+				return {};
+
+			return port_of(current.words[1]);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the port the address was learned on through the per-thread cache
+		/// </summary>
+		/// <param name="address">destination MAC address</param>
+		/// <param name="vlan">VLAN identifier (0 for the untagged frames)</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <param name="cache">cache owned by the calling thread</param>
+		/// <returns>port index or std::nullopt if the address is unknown or aged out</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<size_t> lookup(const mac_address& address, const uint16_t vlan,
+		                                           const time_point_t now, lookup_cache& cache) const noexcept
+		{
+			const auto key = make_key(address, vlan);
+			const auto ticks = to_ticks(now);
+			auto& cached = cache.entries_[hash(key) % lookup_cache::cache_size];
+
+			if (cached.key != key || slots_.sequence(cached.slot) != cached.sequence)
+			{
+				const auto [index, current] = find_slot(key);
+
+				if (index == table_t::npos)
+					return {};
+
+				cached = {key, current.words[1], static_cast<uint32_t>(index), current.sequence};
+			}
+
+			if (is_expired(cached.value, ticks))
+				return {};
+
+			return port_of(cached.value);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Learns the source address of the frame received on the port. The entry of
+		/// the known address on the same port is only rewritten when its timestamp is
+		/// older than 1/32 of the aging time, so the steady stream of frames from the
+		/// host does not write the shared table.
+		/// </summary>
+		/// <param name="address">source MAC address</param>
+		/// <param name="vlan">VLAN identifier (0 for the untagged frames)</param>
+		/// <param name="port">port index the frame was received on</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <returns>learning result</returns>
+		// ********************************************************************************
+		mac_learn_result learn(const mac_address& address, const uint16_t vlan, const size_t port,
+		                       const time_point_t now) noexcept
+		{
+			if (port > max_port || address.is_multicast())
+				return mac_learn_result::unchanged;
+
+			const auto key = make_key(address, vlan);
+			const auto ticks = to_ticks(now);
+
+			const auto [result, previous] = slots_.insert_or_update(
+				hash(key) & slots_.mask(), {key, make_value(port, ticks)},
+				[this, key, ticks](const table_t::entry& current)
+				{
+					return classify(current, key, ticks);
+				},
+				[this, port, ticks](const table_t::entry& current)
+				{
+					const auto value = current.words[1];
+					return port_of(value) != port || is_expired(value, ticks) ||
+						ticks - ticks_of(value) >= refresh_interval_;
+				});
+
+			switch (result)
+			{
+			case tools::seqlock_insert_result::unchanged:
+				return mac_learn_result::unchanged;
+
+			case tools::seqlock_insert_result::full:
+				full_.fetch_add(1, std::memory_order_relaxed);
+				return mac_learn_result::full;
+
+			case tools::seqlock_insert_result::updated:
+				if (!is_expired(previous.words[1], ticks))
+				{
+					if (port_of(previous.words[1]) == port)
+						return mac_learn_result::refreshed;
+
+					moved_.fetch_add(1, std::memory_order_relaxed);
+					return mac_learn_result::moved;
+				}
+				[[fallthrough]];
+
+			case tools::seqlock_insert_result::inserted:
+			default:
+				learned_.fetch_add(1, std::memory_order_relaxed);
+				return mac_learn_result::learned;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Expires all addresses learned on the port (e.g. the network interface went down)
+		/// </summary>
+		/// <param name="port">port index</param>
+		// ********************************************************************************
+		void flush_port(const size_t port) noexcept
+		{
+			for (size_t index = 0; index <= slots_.mask(); ++index)
+			{
+				for (;;)
+				{
+					const auto [words, sequence] = slots_.read(index);
+					const auto [key, value] = words;
+
+					if (key == 0 || (value & 0xFFFF) == 0 || port_of(value) != port ||
+						slots_.write(index, sequence, {key, 0}))
+						break;
+				}
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the learning statistics
+		/// </summary>
+		/// <returns>statistics snapshot</returns>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics() const noexcept
+		{
+			return {
+				learned_.load(std::memory_order_relaxed), moved_.load(std::memory_order_relaxed),
+				full_.load(std::memory_order_relaxed)
+			};
+		}
+
+	private:
+		/// <summary>slots of the VLAN and MAC address with the occupied bit (0 for the empty slot),
+		/// and the timestamp in milliseconds with the port index + 1</summary>
+		using table_t = tools::seqlock_table<2>;
+
+		static uint64_t make_key(const mac_address& address, const uint16_t vlan) noexcept
+		{
+			uint64_t key = 0;
+
+			for (const auto byte : address.data)
+				key = key << 8 | byte;
+
+			return key | static_cast<uint64_t>(vlan & max_vlan) << 48 | 1ull << 63;
+		}
+
+		static uint64_t hash(const uint64_t key) noexcept
+		{
+			return (key * 0x9E3779B97F4A7C15ull) >> 32;
+		}
+
+		static uint64_t make_value(const size_t port, const uint64_t ticks) noexcept
+		{
+			return ticks << 16 | (port + 1);
+		}
+
+		static size_t port_of(const uint64_t value) noexcept { return static_cast<size_t>(value & 0xFFFF) - 1; }
+
+		static uint64_t ticks_of(const uint64_t value) noexcept { return value >> 16; }
+
+		static uint64_t to_ticks(const time_point_t now) noexcept
+		{
+			return static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count());
+		}
+
+		/// <summary>
+		/// Checks if the entry has aged out or was flushed (value without the port)
+		/// </summary>
+		[[nodiscard]] bool is_expired(const uint64_t value, const uint64_t ticks) const noexcept
+		{
+			return (value & 0xFFFF) == 0 || ticks >= ticks_of(value) + aging_time_;
+		}
+
+		/// <summary>
+		/// Classifies the slot for the key
+		/// </summary>
+		[[nodiscard]] tools::seqlock_slot_state classify(const table_t::entry& current, const uint64_t key,
+		                                                 const uint64_t ticks) const noexcept
+		{
+			const auto [current_key, value] = current.words;
+
+			if (current_key == key)
+				return tools::seqlock_slot_state::match;
+
+			if (current_key == 0)
+				return tools::seqlock_slot_state::empty;
+
+			return is_expired(value, ticks) ? tools::seqlock_slot_state::expired : tools::seqlock_slot_state::occupied;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Locates the slot holding the key
+		/// </summary>
+		/// <param name="key">table key</param>
+		/// <returns>slot index (npos if not found) and the slot entry</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::pair<size_t, table_t::entry> find_slot(const uint64_t key) const noexcept
+		{
+			return slots_.find(hash(key) & slots_.mask(), [key](const table_t::entry& current)
+			{
+				return current.words[0] == key
+					       ? tools::seqlock_slot_state::match
+					       : current.words[0] == 0
+					       ? tools::seqlock_slot_state::empty
+					       : tools::seqlock_slot_state::occupied;
+			});
+		}
+
+		/// <summary>entry lifetime in milliseconds</summary>
+		uint64_t aging_time_;
+		/// <summary>minimal age of the entry before learning rewrites its timestamp</summary>
+		uint64_t refresh_interval_;
+		/// <summary>slots</summary>
+		table_t slots_;
+
+		std::atomic<uint64_t> learned_{0};
+		std::atomic<uint64_t> moved_{0};
+		std::atomic<uint64_t> full_{0};
+	};
+}
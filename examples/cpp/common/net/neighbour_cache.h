@@ -0,0 +1,269 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// IP to MAC address cache filled from the snooped ARP (ip_address_v4) or NDP
+	/// (ip_address_v6) traffic, stored in tools::seqlock_table: lookups never block or
+	/// write shared memory, learning locks only the slot it modifies. Entries not
+	/// confirmed within the aging time are treated as absent and their slots are reused.
+	/// </summary>
+	/// <typeparam name="T">ip_address_v4 or ip_address_v6</typeparam>
+	// --------------------------------------------------------------------------------
+	template <typename T>
+	class neighbour_cache
+	{
+		static_assert(std::is_same_v<T, ip_address_v4> || std::is_same_v<T, ip_address_v6>,
+			"neighbour_cache supports ip_address_v4 and ip_address_v6 only");
+
+	public:
+		using address_type_t = T;
+		using clock_t = std::chrono::steady_clock;
+		using time_point_t = clock_t::time_point;
+
+		/// <summary>number of addresses resolved between the prefetch and the slot reads of the batch lookup</summary>
+		static constexpr size_t lookup_batch_size = 16;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the cache
+		/// </summary>
+		/// <param name="capacity">expected number of neighbours, the cache keeps at least twice as many slots</param>
+		/// <param name="aging_time">time after the last confirmation the entry expires</param>
+		// ********************************************************************************
+		explicit neighbour_cache(const size_t capacity = 1024,
+		                         const std::chrono::milliseconds aging_time = std::chrono::minutes(10))
+			: aging_time_(static_cast<uint64_t>((std::max)(aging_time.count(), std::chrono::milliseconds::rep{1}))),
+			  refresh_interval_(aging_time_ / 32),
+			  seed_(hashing::seed()),
+			  slots_(capacity)
+		{
+		}
+
+		neighbour_cache(const neighbour_cache& other) = delete;
+		neighbour_cache(neighbour_cache&& other) noexcept = delete;
+		neighbour_cache& operator=(const neighbour_cache& other) = delete;
+		neighbour_cache& operator=(neighbour_cache&& other) noexcept = delete;
+
+		~neighbour_cache() = default;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the MAC address of the neighbour
+		/// </summary>
+		/// <param name="address">neighbour IP address</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <returns>MAC address or std::nullopt if the neighbour is unknown or aged out</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<mac_address> lookup(const address_type_t& address,
+		                                                const time_point_t now) const noexcept
+		{
+			const auto key = make_key(address);
+
+			return resolve(key, hash(key) & slots_.mask(), to_ticks(now));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the MAC addresses of the neighbours of the whole packet block. The home
+		/// slots of a group of addresses are prefetched before any of them is read, so
+		/// the cache misses of the group overlap.
+		/// </summary>
+		/// <param name="addresses">neighbour IP addresses</param>
+		/// <param name="count">number of addresses</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <param name="macs">array of at least count entries receiving the MAC addresses,
+		/// std::nullopt for the unknown or aged out neighbours</param>
+		/// <returns>number of neighbours found</returns>
+		// ********************************************************************************
+		size_t lookup(const address_type_t* addresses, const size_t count, const time_point_t now,
+		              std::optional<mac_address>* macs) const noexcept
+		{
+			const auto ticks = to_ticks(now);
+			std::array<key_t, lookup_batch_size> keys;
+			std::array<size_t, lookup_batch_size> homes;
+			size_t result = 0;
+
+			for (size_t first = 0; first < count; first += lookup_batch_size)
+			{
+				const auto group = (std::min)(lookup_batch_size, count - first);
+
+				for (size_t i = 0; i < group; ++i)
+				{
+					keys[i] = make_key(addresses[first + i]);
+					homes[i] = hash(keys[i]) & slots_.mask();
+					PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, slots_.address(homes[i]));
+				}
+
+				for (size_t i = 0; i < group; ++i)
+				{
+					macs[first + i] = resolve(keys[i], homes[i], ticks);
+					result += macs[first + i] ? 1 : 0;
+				}
+			}
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stores the MAC address of the neighbour. The entry with the same MAC address
+		/// is only rewritten when its timestamp is older than 1/32 of the aging time, so
+		/// the steady stream of packets from the neighbour does not write the shared cache.
+		/// </summary>
+		/// <param name="address">neighbour IP address</param>
+		/// <param name="mac">neighbour MAC address</param>
+		/// <param name="now">current time (usually taken once per packet block)</param>
+		/// <returns>true if the neighbour was added or its MAC address has changed</returns>
+		// ********************************************************************************
+		bool learn(const address_type_t& address, const mac_address& mac, const time_point_t now) noexcept
+		{
+			if (mac.is_multicast() || mac == mac_address{})
+				return false;
+
+			const auto key = make_key(address);
+			const auto ticks = to_ticks(now);
+			const auto new_mac = make_mac(mac);
+
+			words_t words{};
+			std::copy(key.begin(), key.end(), words.begin());
+			words[mac_word] = new_mac;
+			words[updated_word] = ticks;
+
+			const auto [result, previous] = slots_.insert_or_update(
+				hash(key) & slots_.mask(), words,
+				[this, &key, ticks](const typename table_t::entry& current)
+				{
+					if (current.words[mac_word] == 0)
+						return tools::seqlock_slot_state::empty;
+
+					if (key_of(current) == key)
+						return tools::seqlock_slot_state::match;
+
+					return is_expired(current, ticks)
+						       ? tools::seqlock_slot_state::expired
+						       : tools::seqlock_slot_state::occupied;
+				},
+				[this, new_mac, ticks](const typename table_t::entry& current)
+				{
+					return current.words[mac_word] != new_mac || is_expired(current, ticks) ||
+						ticks - current.words[updated_word] >= refresh_interval_;
+				});
+
+			switch (result)
+			{
+			case tools::seqlock_insert_result::inserted:
+				return true;
+
+			case tools::seqlock_insert_result::updated:
+				return previous.words[mac_word] != new_mac || is_expired(previous, ticks);
+
+			default:
+				return false;
+			}
+		}
+
+	private:
+		/// <summary>number of 64 bit words holding the address</summary>
+		static constexpr size_t key_words = (sizeof(address_type_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+		using key_t = std::array<uint64_t, key_words>;
+
+		/// <summary>slot words: IP address, MAC address with the occupied bit (0 for the empty
+		/// slot) and the time of the last confirmation in milliseconds</summary>
+		using table_t = tools::seqlock_table<key_words + 2>;
+		using words_t = typename table_t::words_t;
+
+		static constexpr size_t mac_word = key_words;
+		static constexpr size_t updated_word = key_words + 1;
+
+		static key_t make_key(const address_type_t& address) noexcept
+		{
+			key_t key{};
+			std::memcpy(key.data(), &address, sizeof(address_type_t));
+			return key;
+		}
+
+		static key_t key_of(const typename table_t::entry& current) noexcept
+		{
+			key_t key;
+			std::copy_n(current.words.begin(), key_words, key.begin());
+			return key;
+		}
+
+		[[nodiscard]] size_t hash(const key_t& key) const noexcept
+		{
+			if constexpr (key_words == 1)
+				return static_cast<size_t>(hashing::mix(key[0], address_type_t::af_type, seed_));
+			else
+				return static_cast<size_t>(hashing::mix(key[0], key[1], seed_));
+		}
+
+		static uint64_t make_mac(const mac_address& mac) noexcept
+		{
+			uint64_t value = 0;
+
+			for (const auto byte : mac.data)
+				value = value << 8 | byte;
+
+			return value | 1ull << 63;
+		}
+
+		static mac_address mac_of(uint64_t value) noexcept
+		{
+			mac_address mac;
+
+			for (auto i = mac.data.size(); i-- > 0; value >>= 8)
+				mac.data[i] = static_cast<unsigned char>(value);
+
+			return mac;
+		}
+
+		static uint64_t to_ticks(const time_point_t now) noexcept
+		{
+			return static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count());
+		}
+
+		[[nodiscard]] bool is_expired(const typename table_t::entry& current, const uint64_t ticks) const noexcept
+		{
+			return ticks >= current.words[updated_word] + aging_time_;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Looks up the key starting from its home slot
+		/// </summary>
+		/// <param name="key">cache key</param>
+		/// <param name="home">home slot index</param>
+		/// <param name="ticks">current time in milliseconds</param>
+		/// <returns>MAC address or std::nullopt if not found or aged out</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<mac_address> resolve(const key_t& key, const size_t home,
+		                                                 const uint64_t ticks) const noexcept
+		{
+			const auto [index, current] = slots_.find(home, [&key](const typename table_t::entry& entry)
+			{
+				if (entry.words[mac_word] == 0)
+					return tools::seqlock_slot_state::empty;
+
+				return key_of(entry) == key ? tools::seqlock_slot_state::match : tools::seqlock_slot_state::occupied;
+			});
+
+			if (index == table_t::npos || is_expired(current, ticks))
+				return {};
+
+			return mac_of(current.words[mac_word]);
+		}
+
+		/// <summary>entry lifetime in milliseconds</summary>
+		uint64_t aging_time_;
+		/// <summary>minimal age of the entry before learning rewrites its timestamp</summary>
+		uint64_t refresh_interval_;
+		/// <summary>per-process hash seed</summary>
+		uint64_t seed_;
+		/// <summary>slots</summary>
+		table_t slots_;
+	};
+}
@@ -0,0 +1,1048 @@
+#pragma once
+
+#if defined(__AVX2__) || (defined(_MSC_VER) && defined(_M_X64))
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// MSVC compiles the AVX2 intrinsics without /arch:AVX2: the x64 builds include the
+// AVX2 paths and take them when CPUID and the OS report the AVX2 support
+#if defined(__AVX2__)
+#define PACKET_BATCH_AVX2 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define PACKET_BATCH_AVX2 1
+#define PACKET_BATCH_AVX2_CPUID 1
+#endif
+
+#pragma warning( push )
+#pragma warning( disable : 26490 ) // disable reinterpret_cast warning
+
+namespace net
+{
+#if defined(PACKET_BATCH_AVX2)
+	/// <summary>
+	/// Cleared to take the scalar paths on the AVX2 capable CPU (e.g. to compare both)
+	/// </summary>
+	inline std::atomic<bool> packet_batch_avx2_enabled{true};
+
+	// ********************************************************************************
+	/// <summary>
+	/// Checks if the AVX2 paths of the packet batch can be used
+	/// </summary>
+	// ********************************************************************************
+	inline bool packet_batch_avx2() noexcept
+	{
+		if (!packet_batch_avx2_enabled.load(std::memory_order_relaxed))
+			return false;
+
+#if defined(PACKET_BATCH_AVX2_CPUID)
+		static const bool result = []
+		{
+			constexpr int osxsave_avx = 1 << 27 | 1 << 28;
+			int info[4];
+
+			// the OS must save the YMM registers
+			__cpuid(info, 1);
+			if ((info[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6)
+				return false;
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & 1 << 5) != 0;
+		}();
+
+		return result;
+#else
+		return true;
+#endif
+	}
+#endif
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// One bit per packet of the batch, set for the packets selected by the
+	/// packet_batch_classifier
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class packet_batch_mask
+	{
+	public:
+		// ********************************************************************************
+		/// <summary>
+		/// Sets the number of packets and clears all bits
+		/// </summary>
+		/// <param name="size">number of packets in the batch</param>
+		// ********************************************************************************
+		void resize(const size_t size)
+		{
+			size_ = size;
+			words_.assign((size + 63) / 64, 0);
+		}
+
+		/// <summary>
+		/// Number of packets in the batch
+		/// </summary>
+		[[nodiscard]] size_t size() const noexcept { return size_; }
+
+		/// <summary>
+		/// Checks if the packet is selected
+		/// </summary>
+		/// <param name="index">packet index in the batch</param>
+		[[nodiscard]] bool test(const size_t index) const noexcept
+		{
+			return (words_[index / 64] >> (index % 64) & 1) != 0;
+		}
+
+		/// <summary>
+		/// Selects the packet
+		/// </summary>
+		/// <param name="index">packet index in the batch</param>
+		void set(const size_t index) noexcept { words_[index / 64] |= 1ull << (index % 64); }
+
+		/// <summary>
+		/// Deselects the packet
+		/// </summary>
+		/// <param name="index">packet index in the batch</param>
+		void reset(const size_t index) noexcept { words_[index / 64] &= ~(1ull << (index % 64)); }
+
+		/// <summary>
+		/// Bit words, packet i is bit i % 64 of the word i / 64
+		/// </summary>
+		[[nodiscard]] const std::vector<uint64_t>& words() const noexcept { return words_; }
+
+		/// <summary>
+		/// Bit words, packet i is bit i % 64 of the word i / 64
+		/// </summary>
+		[[nodiscard]] std::vector<uint64_t>& words() noexcept { return words_; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Counts the selected packets
+		/// </summary>
+		/// <returns>number of the selected packets</returns>
+		// ********************************************************************************
+		[[nodiscard]] size_t count() const noexcept
+		{
+			size_t result = 0;
+
+			for (const auto word : words_)
+				result += std::bitset<64>(word).count();
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Checks if any packet is selected
+		/// </summary>
+		/// <returns>true if at least one packet is selected</returns>
+		// ********************************************************************************
+		[[nodiscard]] bool any() const noexcept
+		{
+			return std::any_of(words_.cbegin(), words_.cend(), [](const uint64_t word) { return word != 0; });
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Calls the handler for each selected packet in the ascending order
+		/// </summary>
+		/// <param name="handler">void(size_t index)</param>
+		// ********************************************************************************
+		template <typename F>
+		void for_each(F&& handler) const
+		{
+			for (size_t i = 0; i < words_.size(); ++i)
+			{
+				for (auto word = words_[i]; word != 0; word &= word - 1)
+					handler(i * 64 + first_bit(word));
+			}
+		}
+
+		/// <summary>
+		/// Keeps the packets selected by both masks, masks must be of the same size
+		/// </summary>
+		packet_batch_mask& operator&=(const packet_batch_mask& other) noexcept
+		{
+			for (size_t i = 0; i < words_.size(); ++i)
+				words_[i] &= other.words_[i];
+
+			return *this;
+		}
+
+		/// <summary>
+		/// Selects the packets selected by either mask, masks must be of the same size
+		/// </summary>
+		packet_batch_mask& operator|=(const packet_batch_mask& other) noexcept
+		{
+			for (size_t i = 0; i < words_.size(); ++i)
+				words_[i] |= other.words_[i];
+
+			return *this;
+		}
+
+	private:
+		static size_t first_bit(const uint64_t word) noexcept
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanForward64(&index, word);
+			return index;
+#elif defined(_MSC_VER)
+			unsigned long index;
+			if (_BitScanForward(&index, static_cast<uint32_t>(word)))
+				return index;
+			_BitScanForward(&index, static_cast<uint32_t>(word >> 32));
+			return index + 32;
+#else
+			return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+		}
+
+		/// <summary>number of packets in the batch</summary>
+		size_t size_{0};
+		/// <summary>selection bits</summary>
+		std::vector<uint64_t> words_;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Structure-of-arrays view of the packets returned by one ReadPackets call. The
+	/// ethertype, IP protocol, addresses and ports of every packet are gathered into
+	/// the separate columns, so the predicates of packet_batch_classifier run over
+	/// the whole batch at once instead of parsing the headers packet by packet.
+	/// With AVX2 the IPv4 fields of 8 packets are fetched by the hardware gathers,
+	/// IPv6 packets walk the extension header chain with ipv6_helper::parse.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class packet_batch
+	{
+	public:
+		/// <summary>packet was read on the send path (PACKET_FLAG_ON_SEND)</summary>
+		static constexpr uint32_t flag_outbound = 0x01;
+		/// <summary>valid IPv4 header, protocol and IPv4 address columns are set</summary>
+		static constexpr uint32_t flag_ipv4 = 0x02;
+		/// <summary>valid IPv6 header chain, protocol and IPv6 address columns are set</summary>
+		static constexpr uint32_t flag_ipv6 = 0x04;
+		/// <summary>TCP or UDP header is present, port columns are set</summary>
+		static constexpr uint32_t flag_ports = 0x08;
+		/// <summary>packet is the fragment of the IP datagram</summary>
+		static constexpr uint32_t flag_fragment = 0x10;
+		/// <summary>packet carries the 802.1Q tag (in-band or in m_8021q), VLAN column is set</summary>
+		static constexpr uint32_t flag_vlan = 0x20;
+		/// <summary>fragment offset bits of the IPv4 ip_off field</summary>
+		static constexpr uint16_t fragment_offset_mask = 0x1FFF;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Loads the batch from the contiguous packet array (e.g. the buffers of
+		/// simple_packet_filter)
+		/// </summary>
+		/// <param name="packets">packet array</param>
+		/// <param name="count">number of packets</param>
+		// ********************************************************************************
+		void load(const INTERMEDIATE_BUFFER* packets, const size_t count)
+		{
+			prepare(count);
+
+			for (size_t i = 0; i < count; ++i)
+				offset_[i] = static_cast<int32_t>(i * sizeof(INTERMEDIATE_BUFFER));
+
+			load_columns(reinterpret_cast<const uint8_t*>(packets));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Loads the batch from the packet pointer array. The packets are gathered
+		/// relative to the first one, if they are spread wider than the 32 bit offset
+		/// allows each packet is loaded separately.
+		/// </summary>
+		/// <param name="packets">packet pointers</param>
+		/// <param name="count">number of packets</param>
+		// ********************************************************************************
+		void load(const PINTERMEDIATE_BUFFER* packets, const size_t count)
+		{
+			prepare(count);
+
+			if (count == 0)
+				return;
+
+			const auto* const base = reinterpret_cast<const uint8_t*>(packets[0]);
+			auto in_range = true;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				const auto distance = reinterpret_cast<intptr_t>(packets[i]) - reinterpret_cast<intptr_t>(base);
+
+				in_range = in_range && distance >= (std::numeric_limits<int32_t>::min)() &&
+					distance <= (std::numeric_limits<int32_t>::max)() - static_cast<intptr_t>(sizeof(
+						INTERMEDIATE_BUFFER));
+
+				offset_[i] = static_cast<int32_t>(distance);
+			}
+
+			if (in_range)
+			{
+				load_columns(base);
+				return;
+			}
+
+			for (size_t i = 0; i < count; ++i)
+				load_row(*packets[i], i);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Loads the batch from the packets read by ReadPackets
+		/// </summary>
+		/// <param name="request">completed read request</param>
+		// ********************************************************************************
+		void load(const ETH_M_REQUEST& request)
+		{
+			buffers_.resize(request.dwPacketsSuccess);
+
+			for (size_t i = 0; i < buffers_.size(); ++i)
+				buffers_[i] = request.EthPacket[i].Buffer;
+
+			load(buffers_.data(), buffers_.size());
+		}
+
+		/// <summary>
+		/// Number of packets in the batch
+		/// </summary>
+		[[nodiscard]] size_t size() const noexcept { return size_; }
+
+		/// <summary>
+		/// Column capacity, the columns are padded with zero rows to the multiple of 8
+		/// </summary>
+		[[nodiscard]] size_t capacity() const noexcept { return flags_.size(); }
+
+		/// <summary>flag_* bits per packet</summary>
+		[[nodiscard]] const uint32_t* flags() const noexcept { return flags_.data(); }
+		/// <summary>ethertype in host byte order (following the in-band 802.1Q tag), 0 for the runt frames</summary>
+		[[nodiscard]] const uint32_t* ethertype() const noexcept { return ethertype_.data(); }
+		/// <summary>IP protocol (upper layer protocol for IPv6)</summary>
+		[[nodiscard]] const uint32_t* protocol() const noexcept { return protocol_.data(); }
+		/// <summary>IPv4 source address in network byte order</summary>
+		[[nodiscard]] const uint32_t* source_v4() const noexcept { return source_v4_.data(); }
+		/// <summary>IPv4 destination address in network byte order</summary>
+		[[nodiscard]] const uint32_t* destination_v4() const noexcept { return destination_v4_.data(); }
+		/// <summary>IPv6 source address (set for the flag_ipv6 packets only)</summary>
+		[[nodiscard]] const ip_address_v6* source_v6() const noexcept { return source_v6_.data(); }
+		/// <summary>IPv6 destination address (set for the flag_ipv6 packets only)</summary>
+		[[nodiscard]] const ip_address_v6* destination_v6() const noexcept { return destination_v6_.data(); }
+		/// <summary>TCP/UDP source port in host byte order</summary>
+		[[nodiscard]] const uint32_t* source_port() const noexcept { return source_port_.data(); }
+		/// <summary>TCP/UDP destination port in host byte order</summary>
+		[[nodiscard]] const uint32_t* destination_port() const noexcept { return destination_port_.data(); }
+		/// <summary>VLAN identifier of the in-band tag or m_8021q, 0 for the untagged packets</summary>
+		[[nodiscard]] const uint32_t* vlan() const noexcept { return vlan_.data(); }
+
+	private:
+		// ********************************************************************************
+		/// <summary>
+		/// Sizes the columns for the batch and clears them
+		/// </summary>
+		/// <param name="count">number of packets</param>
+		// ********************************************************************************
+		void prepare(const size_t count)
+		{
+			const auto capacity = (count + 7) & ~static_cast<size_t>(7);
+
+			size_ = count;
+
+			// every row is overwritten by the load, only the padding rows are cleared
+			offset_.resize(capacity);
+			flags_.resize(capacity);
+			ethertype_.resize(capacity);
+			protocol_.resize(capacity);
+			source_v4_.resize(capacity);
+			destination_v4_.resize(capacity);
+			source_port_.resize(capacity);
+			destination_port_.resize(capacity);
+			vlan_.resize(capacity);
+			source_v6_.resize(capacity);
+			destination_v6_.resize(capacity);
+
+			for (auto i = count; i < capacity; ++i)
+			{
+				offset_[i] = 0;
+				clear_row(i);
+			}
+		}
+
+		/// <summary>
+		/// Resets the IPv4 columns of the row
+		/// </summary>
+		/// <param name="i">row</param>
+		void clear_row(const size_t i) noexcept
+		{
+			flags_[i] = ethertype_[i] = protocol_[i] = source_v4_[i] = destination_v4_[i] = 0;
+			source_port_[i] = destination_port_[i] = vlan_[i] = 0;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Fills the columns of the packets located at base + offset_[i]
+		/// </summary>
+		/// <param name="base">address the packet offsets are relative to</param>
+		// ********************************************************************************
+		void load_columns(const uint8_t* base)
+		{
+			size_t i = 0;
+
+#if defined(PACKET_BATCH_AVX2)
+			if (packet_batch_avx2())
+			{
+				for (; i + 8 <= capacity(); i += 8)
+					gather_ipv4(base, i);
+
+				// padding rows were gathered from the first packet
+				for (auto j = size_; j < capacity(); ++j)
+					clear_row(j);
+
+				// IPv6 and the frames tagged in-band are parsed per packet
+				for (size_t j = 0; j < size_; ++j)
+				{
+					if (ethertype_[j] == ETH_P_IPV6 || ethertype_[j] == ETH_P_8021Q)
+						load_row(*reinterpret_cast<const INTERMEDIATE_BUFFER*>(base + offset_[j]), j);
+				}
+			}
+#endif
+			for (; i < size_; ++i)
+				load_row(*reinterpret_cast<const INTERMEDIATE_BUFFER*>(base + offset_[i]), i);
+		}
+
+#if defined(PACKET_BATCH_AVX2)
+		// ********************************************************************************
+		/// <summary>
+		/// Gathers the IPv4 fields and the out-of-band VLAN of 8 packets. All reads are at
+		/// the fixed offsets within the first 78 octets of the frame buffer, the packet
+		/// length is only used to validate the fields, so no read ever leaves
+		/// INTERMEDIATE_BUFFER.
+		/// </summary>
+		/// <param name="base">address the packet offsets are relative to</param>
+		/// <param name="i">first row</param>
+		// ********************************************************************************
+		void gather_ipv4(const uint8_t* base, const size_t i) noexcept
+		{
+			const auto* const frame = base + offsetof(INTERMEDIATE_BUFFER, m_IBuffer);
+			const auto offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&offset_[i]));
+
+			const auto gather = [&offsets](const uint8_t* address)
+			{
+				return _mm256_i32gather_epi32(reinterpret_cast<const int*>(address), offsets, 1);
+			};
+
+			const auto ge = [](const __m256i a, const __m256i b)
+			{
+				return _mm256_cmpeq_epi32(_mm256_max_epu32(a, b), a);
+			};
+
+			const auto byte_mask = _mm256_set1_epi32(0xFF);
+			const auto zero = _mm256_setzero_si256();
+
+			const auto length = gather(base + offsetof(INTERMEDIATE_BUFFER, m_Length));
+			const auto device_flags = gather(base + offsetof(INTERMEDIATE_BUFFER, m_dwDeviceFlags));
+			const auto info_8021q = gather(base + offsetof(INTERMEDIATE_BUFFER, m_8021q));
+			// ethertype, version/header length and type of service
+			const auto word_12 = gather(frame + 12);
+			// fragment offset, time to live and protocol
+			const auto word_20 = gather(frame + 20);
+			const auto source = gather(frame + 26);
+			const auto destination = gather(frame + 30);
+
+			const auto has_ethertype = ge(length, _mm256_set1_epi32(ETHER_HEADER_LENGTH));
+			const auto ethertype = _mm256_and_si256(has_ethertype, _mm256_or_si256(
+				                                        _mm256_slli_epi32(_mm256_and_si256(word_12, byte_mask), 8),
+				                                        _mm256_and_si256(_mm256_srli_epi32(word_12, 8), byte_mask)));
+
+			const auto header_length = _mm256_slli_epi32(
+				_mm256_and_si256(_mm256_srli_epi32(word_12, 16), _mm256_set1_epi32(0x0F)), 2);
+			const auto transport_offset = _mm256_add_epi32(header_length, _mm256_set1_epi32(ETHER_HEADER_LENGTH));
+
+			auto ipv4 = _mm256_cmpeq_epi32(ethertype, _mm256_set1_epi32(ETH_P_IP));
+			ipv4 = _mm256_and_si256(ipv4, ge(length, _mm256_set1_epi32(ETHER_HEADER_LENGTH + sizeof(iphdr))));
+			ipv4 = _mm256_and_si256(ipv4, _mm256_cmpeq_epi32(
+				                        _mm256_and_si256(_mm256_srli_epi32(word_12, 20), _mm256_set1_epi32(0x0F)),
+				                        _mm256_set1_epi32(4)));
+			ipv4 = _mm256_and_si256(ipv4, ge(header_length, _mm256_set1_epi32(sizeof(iphdr))));
+			ipv4 = _mm256_and_si256(ipv4, ge(length, transport_offset));
+
+			const auto protocol = _mm256_and_si256(ipv4, _mm256_srli_epi32(word_20, 24));
+
+			// ip_off in the network byte order: more fragments is 0x20 of the first octet,
+			// fragment offset is the low 5 bits of the first octet and the second octet
+			const auto fragment = _mm256_andnot_si256(
+				_mm256_cmpeq_epi32(_mm256_and_si256(word_20, _mm256_set1_epi32(0xFF3F)), zero), ipv4);
+			const auto first_fragment = _mm256_cmpeq_epi32(_mm256_and_si256(word_20, _mm256_set1_epi32(0xFF1F)), zero);
+
+			auto ports = _mm256_or_si256(_mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_TCP)),
+			                             _mm256_cmpeq_epi32(protocol, _mm256_set1_epi32(IPPROTO_UDP)));
+			ports = _mm256_and_si256(ports, _mm256_and_si256(ipv4, first_fragment));
+			ports = _mm256_and_si256(ports, ge(length, _mm256_add_epi32(transport_offset, _mm256_set1_epi32(4))));
+
+			const auto port_words = _mm256_and_si256(ports, _mm256_i32gather_epi32(
+				                                         reinterpret_cast<const int*>(frame), _mm256_add_epi32(
+					                                         offsets, transport_offset), 1));
+
+			const auto source_port = _mm256_or_si256(
+				_mm256_slli_epi32(_mm256_and_si256(port_words, byte_mask), 8),
+				_mm256_and_si256(_mm256_srli_epi32(port_words, 8), byte_mask));
+			const auto destination_port = _mm256_or_si256(
+				_mm256_and_si256(_mm256_srli_epi32(port_words, 8), _mm256_set1_epi32(0xFF00)),
+				_mm256_srli_epi32(port_words, 24));
+
+			auto flags = _mm256_and_si256(_mm256_cmpeq_epi32(device_flags, _mm256_set1_epi32(PACKET_FLAG_ON_SEND)),
+			                              _mm256_set1_epi32(flag_outbound));
+			flags = _mm256_or_si256(flags, _mm256_and_si256(ipv4, _mm256_set1_epi32(flag_ipv4)));
+			flags = _mm256_or_si256(flags, _mm256_and_si256(ports, _mm256_set1_epi32(flag_ports)));
+			flags = _mm256_or_si256(flags, _mm256_and_si256(fragment, _mm256_set1_epi32(flag_fragment)));
+			flags = _mm256_or_si256(flags, _mm256_andnot_si256(_mm256_cmpeq_epi32(info_8021q, zero),
+			                                                   _mm256_set1_epi32(flag_vlan)));
+
+			const auto store = [i](std::vector<uint32_t>& column, const __m256i value)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(&column[i]), value);
+			};
+
+			store(flags_, flags);
+			store(ethertype_, ethertype);
+			store(protocol_, protocol);
+			store(source_v4_, _mm256_and_si256(ipv4, source));
+			store(destination_v4_, _mm256_and_si256(ipv4, destination));
+			store(source_port_, source_port);
+			store(destination_port_, destination_port);
+			store(vlan_, _mm256_and_si256(_mm256_srli_epi32(info_8021q, 4), _mm256_set1_epi32(VLAN_VID_MASK)));
+		}
+#endif
+
+		// ********************************************************************************
+		/// <summary>
+		/// Fills the columns of one packet
+		/// </summary>
+		/// <param name="packet">packet to parse</param>
+		/// <param name="i">row</param>
+		// ********************************************************************************
+		void load_row(const INTERMEDIATE_BUFFER& packet, const size_t i) noexcept
+		{
+			auto flags = packet.m_dwDeviceFlags == PACKET_FLAG_ON_SEND ? flag_outbound : 0;
+
+			clear_row(i);
+
+			const void* transport = nullptr;
+
+			if (packet.m_8021q != 0)
+			{
+				flags |= flag_vlan;
+				vlan_[i] = packet.m_8021q >> 4 & VLAN_VID_MASK;
+			}
+
+			if (packet.m_Length >= ETHER_HEADER_LENGTH)
+			{
+				size_t header_length = ETHER_HEADER_LENGTH;
+
+				ethertype_[i] = ntohs(reinterpret_cast<const ether_header*>(packet.m_IBuffer)->h_proto);
+
+				// the in-band tag takes precedence over m_8021q
+				if (ethertype_[i] == ETH_P_8021Q && packet.m_Length >= sizeof(vlan_ether_header))
+				{
+					const auto* const vlan_header = reinterpret_cast<const vlan_ether_header*>(packet.m_IBuffer);
+
+					flags |= flag_vlan;
+					vlan_[i] = ntohs(vlan_header->h_vlan_tci) & VLAN_VID_MASK;
+					ethertype_[i] = ntohs(vlan_header->h_proto);
+					header_length = sizeof(vlan_ether_header);
+				}
+
+				const auto* const network_header = packet.m_IBuffer + header_length;
+
+				if (ethertype_[i] == ETH_P_IP && packet.m_Length >= header_length + sizeof(iphdr))
+				{
+					if (const auto* const ip_header = reinterpret_cast<const iphdr*>(network_header);
+						ip_header->ip_v == 4 && ip_header->ip_hl >= 5 &&
+						packet.m_Length >= header_length + sizeof(DWORD) * ip_header->ip_hl)
+					{
+						flags |= flag_ipv4;
+						protocol_[i] = ip_header->ip_p;
+						source_v4_[i] = ip_header->ip_src.S_un.S_addr;
+						destination_v4_[i] = ip_header->ip_dst.S_un.S_addr;
+
+						const auto fragment_field = ntohs(ip_header->ip_off);
+
+						if (fragment_field & (IP_MF | fragment_offset_mask))
+							flags |= flag_fragment;
+
+						if ((fragment_field & fragment_offset_mask) == 0 && packet.m_Length >= header_length +
+							sizeof(DWORD) * ip_header->ip_hl + sizeof(uint32_t))
+						{
+							transport = reinterpret_cast<const uint8_t*>(ip_header) + sizeof(DWORD) * ip_header->ip_hl;
+						}
+					}
+				}
+				else if (ethertype_[i] == ETH_P_IPV6)
+				{
+					const auto* const ip_header = reinterpret_cast<const ipv6hdr*>(network_header);
+
+					if (ipv6_packet_info info; ipv6_helper::parse(
+						ip_header, static_cast<unsigned>(packet.m_Length - header_length), info))
+					{
+						flags |= flag_ipv6;
+						protocol_[i] = info.protocol;
+						// IPv6 addresses in the frame are only 2 byte aligned
+						std::memcpy(&source_v6_[i], &ip_header->ip6_src, sizeof(ip_address_v6));
+						std::memcpy(&destination_v6_[i], &ip_header->ip6_dst, sizeof(ip_address_v6));
+
+						if (info.fragmented)
+							flags |= flag_fragment;
+
+						if (info.transport_length >= sizeof(uint32_t))
+							transport = info.transport;
+					}
+				}
+			}
+
+			if (transport != nullptr && (protocol_[i] == IPPROTO_TCP || protocol_[i] == IPPROTO_UDP))
+			{
+				const auto* const ports = static_cast<const uint8_t*>(transport);
+
+				flags |= flag_ports;
+				source_port_[i] = static_cast<uint32_t>(ports[0]) << 8 | ports[1];
+				destination_port_[i] = static_cast<uint32_t>(ports[2]) << 8 | ports[3];
+			}
+
+			flags_[i] = flags;
+		}
+
+		/// <summary>number of packets</summary>
+		size_t size_{0};
+		/// <summary>packet offsets relative to the load base</summary>
+		std::vector<int32_t> offset_;
+		/// <summary>packet pointers of the ETH_M_REQUEST being loaded</summary>
+		std::vector<PINTERMEDIATE_BUFFER> buffers_;
+
+		std::vector<uint32_t> flags_;
+		std::vector<uint32_t> ethertype_;
+		std::vector<uint32_t> protocol_;
+		std::vector<uint32_t> source_v4_;
+		std::vector<uint32_t> destination_v4_;
+		std::vector<uint32_t> source_port_;
+		std::vector<uint32_t> destination_port_;
+		std::vector<uint32_t> vlan_;
+		std::vector<ip_address_v6> source_v6_;
+		std::vector<ip_address_v6> destination_v6_;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Evaluates the VLAN, protocol, port and subnet sets over the packet_batch columns.
+	/// A packet is selected if it matches every configured set, within the set any entry
+	/// matches (e.g. protocol is TCP or UDP and the port is 53 or 853). VLANs, protocols
+	/// and ports are tested against the bitmaps. IPv4 subnets are compared one by one
+	/// (eight rows at once with AVX2), which suits the short "is this one of my flows"
+	/// lists; IPv6 subnets are looked up in the ip_prefix_table tries of the source and
+	/// destination addresses.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class packet_batch_classifier
+	{
+	public:
+		/// <summary>
+		/// Which address or port of the packet the entry is compared with
+		/// </summary>
+		enum class endpoint
+		{
+			source,
+			destination,
+			any
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the IP protocol to the protocol set
+		/// </summary>
+		/// <param name="protocol">IP protocol (upper layer protocol for IPv6)</param>
+		// ********************************************************************************
+		void add_protocol(const uint8_t protocol)
+		{
+			protocols_.add(protocol, 256);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the TCP/UDP port to the port set
+		/// </summary>
+		/// <param name="port">port in host byte order</param>
+		/// <param name="which">source, destination or either port</param>
+		// ********************************************************************************
+		void add_port(const uint16_t port, const endpoint which = endpoint::any)
+		{
+			if (which != endpoint::destination)
+				source_ports_.add(port, 65536);
+
+			if (which != endpoint::source)
+				destination_ports_.add(port, 65536);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the VLAN identifier to the VLAN set
+		/// </summary>
+		/// <param name="vlan">VLAN identifier, 0 selects the untagged and priority tagged packets</param>
+		// ********************************************************************************
+		void add_vlan(const uint16_t vlan)
+		{
+			vlans_.add(vlan & VLAN_VID_MASK, VLAN_VID_MASK + 1);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the IPv4 subnet to the subnet set
+		/// </summary>
+		/// <param name="subnet">IPv4 subnet</param>
+		/// <param name="which">source, destination or either address</param>
+		// ********************************************************************************
+		void add_subnet(const ip_subnet<ip_address_v4>& subnet, const endpoint which = endpoint::any)
+		{
+			const auto mask = subnet.get_mask().S_un.S_addr;
+
+			subnets_v4_.push_back({subnet.get_address().S_un.S_addr & mask, mask, which});
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the IPv6 subnet to the subnet set
+		/// </summary>
+		/// <param name="subnet">IPv6 subnet</param>
+		/// <param name="which">source, destination or either address</param>
+		// ********************************************************************************
+		void add_subnet(const ip_subnet<ip_address_v6>& subnet, const endpoint which = endpoint::any)
+		{
+			if (which != endpoint::destination)
+			{
+				source_subnets_v6_.emplace_back(subnet, static_cast<uint32_t>(source_subnets_v6_.size()));
+				source_table_v6_ = subnet_table_v6_t::build(source_subnets_v6_);
+			}
+
+			if (which != endpoint::source)
+			{
+				destination_subnets_v6_.emplace_back(subnet, static_cast<uint32_t>(destination_subnets_v6_.size()));
+				destination_table_v6_ = subnet_table_v6_t::build(destination_subnets_v6_);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Selects the packets of the batch matching the classifier. The classifier with
+		/// no sets configured selects every packet.
+		/// </summary>
+		/// <param name="batch">loaded packet batch</param>
+		/// <param name="mask">receives the selection, resized to the batch size</param>
+		// ********************************************************************************
+		void classify(const packet_batch& batch, packet_batch_mask& mask) const
+		{
+			mask.resize(batch.size());
+
+			auto& words = mask.words();
+			size_t i = 0;
+
+#if defined(PACKET_BATCH_AVX2)
+			if (packet_batch_avx2())
+			{
+				for (; i + 8 <= batch.capacity(); i += 8)
+					words[i / 64] |= static_cast<uint64_t>(classify_block(batch, i)) << (i % 64);
+			}
+#endif
+			for (; i < batch.size(); ++i)
+			{
+				if (classify_row(batch, i))
+					mask.set(i);
+			}
+
+			// padding rows of the last block
+			if (batch.size() % 64)
+				words.back() &= (1ull << (batch.size() % 64)) - 1;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Loads the packet array into the batch and selects the matching packets
+		/// </summary>
+		/// <param name="packets">contiguous packet array</param>
+		/// <param name="count">number of packets</param>
+		/// <param name="batch">batch reused between the calls</param>
+		/// <param name="mask">receives the selection</param>
+		// ********************************************************************************
+		void classify(const INTERMEDIATE_BUFFER* packets, const size_t count, packet_batch& batch,
+		              packet_batch_mask& mask) const
+		{
+			batch.load(packets, count);
+			classify(batch, mask);
+		}
+
+	private:
+		/// <summary>IPv6 subnet trie, the value is the subnet index</summary>
+		using subnet_table_v6_t = ip_prefix_table<ip_address_v6>;
+
+		/// <summary>
+		/// IPv4 subnet entry, address is masked, both in network byte order
+		/// </summary>
+		struct subnet_v4
+		{
+			uint32_t address;
+			uint32_t mask;
+			endpoint which;
+		};
+
+		/// <summary>
+		/// Protocol or port set: the bitmap for the lookup and the list of values, short
+		/// lists are compared directly instead of the bitmap gather
+		/// </summary>
+		struct value_set
+		{
+			/// <summary>lists up to this size are compared value by value</summary>
+			static constexpr size_t compare_limit = 4;
+
+			std::vector<uint32_t> bitmap;
+			std::vector<uint32_t> values;
+
+			void add(const uint32_t value, const uint32_t range)
+			{
+				if (bitmap.empty())
+					bitmap.resize(range / 32, 0);
+
+				if (!contains(value))
+				{
+					bitmap[value / 32] |= 1u << (value % 32);
+					values.push_back(value);
+				}
+			}
+
+			[[nodiscard]] bool empty() const noexcept { return values.empty(); }
+
+			[[nodiscard]] bool contains(const uint32_t value) const noexcept
+			{
+				return !bitmap.empty() && (bitmap[value / 32] >> (value % 32) & 1) != 0;
+			}
+		};
+
+		[[nodiscard]] bool has_ports() const noexcept
+		{
+			return !source_ports_.empty() || !destination_ports_.empty();
+		}
+
+		[[nodiscard]] bool has_subnets_v6() const noexcept
+		{
+			return !source_subnets_v6_.empty() || !destination_subnets_v6_.empty();
+		}
+
+		[[nodiscard]] bool has_subnets() const noexcept
+		{
+			return !subnets_v4_.empty() || has_subnets_v6();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Tests the IPv6 packet against the IPv6 subnets
+		/// </summary>
+		/// <param name="batch">packet batch</param>
+		/// <param name="i">row</param>
+		/// <returns>true if any subnet contains the packet address</returns>
+		// ********************************************************************************
+		[[nodiscard]] bool match_subnets_v6(const packet_batch& batch, const size_t i) const
+		{
+			return (source_table_v6_ && source_table_v6_->contains(batch.source_v6()[i])) ||
+				(destination_table_v6_ && destination_table_v6_->contains(batch.destination_v6()[i]));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Tests one packet of the batch
+		/// </summary>
+		/// <param name="batch">packet batch</param>
+		/// <param name="i">row</param>
+		/// <returns>true if the packet matches every configured set</returns>
+		// ********************************************************************************
+		[[nodiscard]] bool classify_row(const packet_batch& batch, const size_t i) const
+		{
+			const auto flags = batch.flags()[i];
+
+			if (!vlans_.empty() && !vlans_.contains(batch.vlan()[i]))
+				return false;
+
+			if (!protocols_.empty() && (!(flags & (packet_batch::flag_ipv4 | packet_batch::flag_ipv6)) ||
+				!protocols_.contains(batch.protocol()[i])))
+				return false;
+
+			if (has_ports() && (!(flags & packet_batch::flag_ports) || !(source_ports_.contains(batch.source_port()[i])
+				|| destination_ports_.contains(batch.destination_port()[i]))))
+				return false;
+
+			if (!has_subnets())
+				return true;
+
+			if (flags & packet_batch::flag_ipv4)
+			{
+				return std::any_of(subnets_v4_.cbegin(), subnets_v4_.cend(), [&batch, i](const subnet_v4& entry)
+				{
+					return (entry.which != endpoint::destination && (batch.source_v4()[i] & entry.mask) == entry.
+							address) ||
+						(entry.which != endpoint::source && (batch.destination_v4()[i] & entry.mask) == entry.address);
+				});
+			}
+
+			return (flags & packet_batch::flag_ipv6) && match_subnets_v6(batch, i);
+		}
+
+#if defined(PACKET_BATCH_AVX2)
+		// ********************************************************************************
+		/// <summary>
+		/// Tests 8 packets of the batch, the IPv6 subnets are tested per packet
+		/// </summary>
+		/// <param name="batch">packet batch</param>
+		/// <param name="i">first row</param>
+		/// <returns>selection bits of the 8 packets</returns>
+		// ********************************************************************************
+		[[nodiscard]] uint32_t classify_block(const packet_batch& batch, const size_t i) const
+		{
+			const auto load = [i](const uint32_t* column)
+			{
+				return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i));
+			};
+
+			// all ones in the lanes where the value belongs to the set
+			const auto match = [](const value_set& set, const __m256i value)
+			{
+				if (set.values.size() <= value_set::compare_limit)
+				{
+					auto result = _mm256_setzero_si256();
+
+					for (const auto entry : set.values)
+						result = _mm256_or_si256(result, _mm256_cmpeq_epi32(value, _mm256_set1_epi32(
+							                                                    static_cast<int>(entry))));
+
+					return result;
+				}
+
+				const auto words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(set.bitmap.data()),
+				                                          _mm256_srli_epi32(value, 5), 4);
+				const auto bits = _mm256_sllv_epi32(_mm256_set1_epi32(1),
+				                                    _mm256_and_si256(value, _mm256_set1_epi32(31)));
+				return _mm256_cmpeq_epi32(_mm256_and_si256(words, bits), bits);
+			};
+
+			const auto has_flags = [](const __m256i flags, const uint32_t flag)
+			{
+				const auto value = _mm256_set1_epi32(static_cast<int>(flag));
+				return _mm256_cmpeq_epi32(_mm256_and_si256(flags, value), value);
+			};
+
+			if (vlans_.empty() && protocols_.empty() && !has_ports() && !has_subnets())
+				return 0xFF;
+
+			const auto flags = load(batch.flags());
+			const auto ipv4 = has_flags(flags, packet_batch::flag_ipv4);
+			const auto ipv6 = has_flags(flags, packet_batch::flag_ipv6);
+			auto result = _mm256_set1_epi32(-1);
+
+			if (!vlans_.empty())
+				result = match(vlans_, load(batch.vlan()));
+
+			if (!protocols_.empty())
+				result = _mm256_and_si256(result, _mm256_and_si256(_mm256_or_si256(ipv4, ipv6),
+				                                                   match(protocols_, load(batch.protocol()))));
+
+			if (has_ports())
+			{
+				auto ports = _mm256_setzero_si256();
+
+				if (!source_ports_.empty())
+					ports = _mm256_or_si256(ports, match(source_ports_, load(batch.source_port())));
+
+				if (!destination_ports_.empty())
+					ports = _mm256_or_si256(ports, match(destination_ports_, load(batch.destination_port())));
+
+				result = _mm256_and_si256(result, _mm256_and_si256(ports, has_flags(flags, packet_batch::flag_ports)));
+			}
+
+			auto bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(result)));
+
+			if (bits == 0 || !has_subnets())
+				return bits;
+
+			auto subnets = _mm256_setzero_si256();
+
+			if (!subnets_v4_.empty())
+			{
+				const auto source = load(batch.source_v4());
+				const auto destination = load(batch.destination_v4());
+
+				for (const auto& entry : subnets_v4_)
+				{
+					const auto address = _mm256_set1_epi32(static_cast<int>(entry.address));
+					const auto mask = _mm256_set1_epi32(static_cast<int>(entry.mask));
+
+					if (entry.which != endpoint::destination)
+						subnets = _mm256_or_si256(
+							subnets, _mm256_cmpeq_epi32(_mm256_and_si256(source, mask), address));
+
+					if (entry.which != endpoint::source)
+						subnets = _mm256_or_si256(
+							subnets, _mm256_cmpeq_epi32(_mm256_and_si256(destination, mask), address));
+				}
+
+				subnets = _mm256_and_si256(subnets, ipv4);
+			}
+
+			auto subnet_bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(subnets)));
+
+			if (has_subnets_v6())
+			{
+				for (auto candidates = bits & static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(ipv6)));
+				     candidates != 0; candidates &= candidates - 1)
+				{
+					const auto row = first_bit(candidates);
+
+					if (match_subnets_v6(batch, i + row))
+						subnet_bits |= 1u << row;
+				}
+			}
+
+			return bits & subnet_bits;
+		}
+
+		static uint32_t first_bit(const uint32_t mask) noexcept
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+		}
+#endif
+
+		/// <summary>VLAN identifiers</summary>
+		value_set vlans_;
+		/// <summary>IP protocols</summary>
+		value_set protocols_;
+		/// <summary>source ports</summary>
+		value_set source_ports_;
+		/// <summary>destination ports</summary>
+		value_set destination_ports_;
+		/// <summary>IPv4 subnets</summary>
+		std::vector<subnet_v4> subnets_v4_;
+		/// <summary>IPv6 subnets compared with the source address</summary>
+		subnet_table_v6_t::prefix_list_t source_subnets_v6_;
+		/// <summary>IPv6 subnets compared with the destination address</summary>
+		subnet_table_v6_t::prefix_list_t destination_subnets_v6_;
+		/// <summary>trie of source_subnets_v6_, rebuilt by add_subnet</summary>
+		subnet_table_v6_t::snapshot_ptr_t source_table_v6_;
+		/// <summary>trie of destination_subnets_v6_, rebuilt by add_subnet</summary>
+		subnet_table_v6_t::snapshot_ptr_t destination_table_v6_;
+	};
+}
+
+#pragma warning( pop )
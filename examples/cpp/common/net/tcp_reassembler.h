@@ -0,0 +1,642 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// How the data of the overlapping out-of-order segments is resolved
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class tcp_overlap_policy
+	{
+		/// <summary>bytes already buffered are kept (Windows/BSD receiver behavior)</summary>
+		keep_first,
+		/// <summary>bytes of the newer segment replace the buffered ones</summary>
+		keep_last
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Memory and hole caps of the tcp_stream_reassembler
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct tcp_reassembly_limits
+	{
+		/// <summary>
+		/// reassembly window: bytes ahead of the next expected sequence number which can be
+		/// buffered (rounded up to the tools::buffer_pool size class, at most max_block_size)
+		/// </summary>
+		uint32_t window_size{65536};
+		/// <summary>maximum number of disjoint buffered ranges (holes between them)</summary>
+		uint32_t max_ranges{16};
+		/// <summary>
+		/// when the segment does not fit the window or the ranges cap, give up the first hole
+		/// (reported to the data handler as a gap) instead of dropping the segment
+		/// </summary>
+		bool skip_holes_on_overflow{true};
+		/// <summary>start tracking from the first data segment if SYN was not seen</summary>
+		bool allow_midstream{true};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Reassembles one direction of the TCP connection into the in-order byte stream.
+	/// In-order segments are passed to the data handler straight from the packet; only
+	/// the out-of-order data is copied into the reassembly window, a ring buffer taken
+	/// from tools::buffer_pool when the first hole appears and returned once all holes
+	/// are filled. Buffered ranges are kept in the small fixed array, so the per-segment
+	/// path never allocates.
+	///
+	/// The data handler is called as handler(const uint8_t* data, uint32_t length) with
+	/// the in-order data (possibly in several pieces) or with data == nullptr when the
+	/// length bytes were skipped (hole given up on overflow or flush).
+	///
+	/// Not thread-safe: segments of the stream are expected from a single thread.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class tcp_stream_reassembler
+	{
+	public:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Stream counters
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>segments passed to segment()</summary>
+			uint64_t segments;
+			/// <summary>bytes delivered in order</summary>
+			uint64_t delivered_bytes;
+			/// <summary>segments which were buffered out of order</summary>
+			uint64_t out_of_order_segments;
+			/// <summary>bytes received again after they were delivered</summary>
+			uint64_t retransmitted_bytes;
+			/// <summary>bytes overlapping the buffered out-of-order data</summary>
+			uint64_t overlapping_bytes;
+			/// <summary>overlapping bytes which differed from the buffered ones</summary>
+			uint64_t conflicting_bytes;
+			/// <summary>segment bytes dropped because of the window or ranges cap</summary>
+			uint64_t dropped_bytes;
+			/// <summary>bytes skipped as holes</summary>
+			uint64_t skipped_bytes;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the stream reassembler
+		/// </summary>
+		/// <param name="pool">pool of the reassembly windows, must outlive the object</param>
+		/// <param name="limits">memory and hole caps</param>
+		/// <param name="policy">overlapping data resolution</param>
+		// ********************************************************************************
+		explicit tcp_stream_reassembler(tools::buffer_pool& pool, const tcp_reassembly_limits& limits = {},
+		                                const tcp_overlap_policy policy = tcp_overlap_policy::keep_first) noexcept
+			: pool_(&pool),
+			  window_size_(tools::buffer_pool::block_size(limits.window_size)),
+			  max_ranges_(std::clamp(limits.max_ranges, 1u, static_cast<uint32_t>(max_ranges_cap))),
+			  skip_holes_on_overflow_(limits.skip_holes_on_overflow),
+			  allow_midstream_(limits.allow_midstream),
+			  policy_(policy)
+		{
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Processes the TCP segment of this direction
+		/// </summary>
+		/// <param name="sequence">segment sequence number (host byte order)</param>
+		/// <param name="data">segment payload</param>
+		/// <param name="length">payload length</param>
+		/// <param name="syn">SYN flag is set</param>
+		/// <param name="fin">FIN flag is set</param>
+		/// <param name="handler">in-order data handler</param>
+		// ********************************************************************************
+		template <typename F>
+		void segment(uint32_t sequence, const uint8_t* data, uint32_t length, const bool syn, const bool fin,
+		             F&& handler)
+		{
+			++statistics_.segments;
+
+			if (syn)
+			{
+				if (!initialized_)
+				{
+					initialized_ = true;
+					next_sequence_ = sequence + 1;
+				}
+
+				++sequence; // SYN occupies one sequence number
+			}
+
+			if (!initialized_)
+			{
+				if (!allow_midstream_ || (length == 0 && !fin))
+					return;
+
+				initialized_ = true;
+				next_sequence_ = sequence;
+			}
+
+			if (fin && !fin_seen_)
+			{
+				fin_seen_ = true;
+				fin_sequence_ = sequence + length;
+			}
+
+			auto offset = static_cast<int32_t>(sequence - next_sequence_);
+
+			if (offset < 0)
+			{
+				// retransmission of the delivered data, trim it off
+				const auto duplicate = (std::min)(static_cast<uint32_t>(-static_cast<int64_t>(offset)), length);
+
+				statistics_.retransmitted_bytes += duplicate;
+				data += duplicate;
+				length -= duplicate;
+				offset = 0;
+			}
+
+			if (length != 0)
+			{
+				if (offset == 0 && range_count_ == 0)
+				{
+					// fast path: in-order segment and nothing buffered
+					deliver(data, length, handler);
+				}
+				else
+				{
+					if (offset != 0)
+						++statistics_.out_of_order_segments;
+
+					buffer(static_cast<uint32_t>(offset), data, length, handler);
+				}
+			}
+
+			update_finished();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Delivers all buffered data giving up the holes (e.g. on connection close or idle
+		/// timeout)
+		/// </summary>
+		/// <param name="handler">in-order data handler</param>
+		// ********************************************************************************
+		template <typename F>
+		void flush(F&& handler)
+		{
+			while (range_count_ != 0)
+				skip_hole(handler);
+
+			update_finished();
+		}
+
+		/// <summary>
+		/// Drops all state and returns the window to the pool
+		/// </summary>
+		void reset() noexcept
+		{
+			release_window();
+			initialized_ = false;
+			fin_seen_ = false;
+			finished_ = false;
+			next_sequence_ = 0;
+			fin_sequence_ = 0;
+		}
+
+		/// <summary>
+		/// Returns true if the stream position is known (SYN or the first data segment seen)
+		/// </summary>
+		[[nodiscard]] bool is_initialized() const noexcept { return initialized_; }
+
+		/// <summary>
+		/// Returns true if all data up to FIN was delivered
+		/// </summary>
+		[[nodiscard]] bool is_finished() const noexcept { return finished_; }
+
+		/// <summary>
+		/// Returns the next expected sequence number
+		/// </summary>
+		[[nodiscard]] uint32_t next_sequence() const noexcept { return next_sequence_; }
+
+		/// <summary>
+		/// Returns the number of bytes waiting in the reassembly window
+		/// </summary>
+		[[nodiscard]] uint32_t buffered_bytes() const noexcept
+		{
+			uint32_t result = 0;
+
+			for (uint32_t i = 0; i < range_count_; ++i)
+				result += ranges_[i].end - ranges_[i].begin;
+
+			return result;
+		}
+
+		/// <summary>
+		/// Returns the stream counters
+		/// </summary>
+		[[nodiscard]] const statistics& get_statistics() const noexcept { return statistics_; }
+
+	private:
+		/// <summary>upper limit of tcp_reassembly_limits::max_ranges</summary>
+		static constexpr size_t max_ranges_cap = 64;
+
+		/// <summary>
+		/// Buffered range, offsets relative to next_sequence_
+		/// </summary>
+		struct range
+		{
+			uint32_t begin;
+			uint32_t end;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Places the segment into the reassembly window and delivers the completed prefix
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void buffer(uint32_t offset, const uint8_t* data, uint32_t length, F& handler)
+		{
+			while (!store(offset, data, length))
+			{
+				if (!skip_holes_on_overflow_ || range_count_ == 0)
+				{
+					statistics_.dropped_bytes += length;
+					return;
+				}
+
+				// give up the first hole and retry with the advanced window
+				const auto advanced = skip_hole(handler);
+
+				if (advanced >= offset + length)
+				{
+					// the whole segment fell into the delivered part
+					statistics_.retransmitted_bytes += length;
+					return;
+				}
+
+				if (advanced > offset)
+				{
+					const auto delivered = advanced - offset;
+					statistics_.retransmitted_bytes += delivered;
+					data += delivered;
+					length -= delivered;
+					offset = 0;
+				}
+				else
+				{
+					offset -= advanced;
+				}
+
+				if (offset == 0 && range_count_ == 0)
+				{
+					deliver(data, length, handler);
+					return;
+				}
+			}
+
+			if (ranges_[0].begin == 0)
+				deliver_prefix(handler);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Copies the segment into the window and merges its range
+		/// </summary>
+		/// <returns>false if the segment does not fit the window or the ranges cap</returns>
+		// ********************************************************************************
+		bool store(const uint32_t offset, const uint8_t* data, const uint32_t length)
+		{
+			if (static_cast<uint64_t>(offset) + length > window_size_)
+				return false;
+
+			const auto begin = offset;
+			const auto end = offset + length;
+
+			// ranges [first, last) overlap or touch the segment
+			uint32_t first = 0;
+			while (first < range_count_ && ranges_[first].end < begin)
+				++first;
+
+			auto last = first;
+			while (last < range_count_ && ranges_[last].begin <= end)
+				++last;
+
+			if (first == last && range_count_ == max_ranges_)
+				return false;
+
+			if (!window_)
+			{
+				window_ = pool_->acquire(window_size_);
+
+				if (!window_)
+					return false;
+
+				window_start_ = 0;
+			}
+
+			// copy the parts of the segment not covered by the buffered ranges, account the overlaps
+			auto position = begin;
+
+			for (auto i = first; i < last; ++i)
+			{
+				const auto overlap_begin = (std::max)(begin, ranges_[i].begin);
+				const auto overlap_end = (std::min)(end, ranges_[i].end);
+
+				if (overlap_begin > position)
+					copy_in(position, data + (position - begin), overlap_begin - position);
+
+				if (overlap_end > overlap_begin)
+				{
+					const auto overlap = overlap_end - overlap_begin;
+					statistics_.overlapping_bytes += overlap;
+					statistics_.conflicting_bytes += compare(overlap_begin, data + (overlap_begin - begin), overlap);
+
+					if (policy_ == tcp_overlap_policy::keep_last)
+						copy_in(overlap_begin, data + (overlap_begin - begin), overlap);
+				}
+
+				position = (std::max)(position, overlap_end);
+			}
+
+			if (end > position)
+				copy_in(position, data + (position - begin), end - position);
+
+			// merge the ranges
+			if (first == last)
+			{
+				std::copy_backward(ranges_.begin() + first, ranges_.begin() + range_count_,
+				                   ranges_.begin() + range_count_ + 1);
+				ranges_[first] = {begin, end};
+				++range_count_;
+			}
+			else
+			{
+				ranges_[first] = {(std::min)(begin, ranges_[first].begin), (std::max)(end, ranges_[last - 1].end)};
+				std::copy(ranges_.begin() + last, ranges_.begin() + range_count_, ranges_.begin() + first + 1);
+				range_count_ -= last - first - 1;
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Delivers the first buffered range (which starts at next_sequence_)
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void deliver_prefix(F& handler)
+		{
+			const auto length = ranges_[0].end;
+			const auto mask = window_size_ - 1;
+			const auto start = window_start_ & mask;
+			const auto* window = reinterpret_cast<const uint8_t*>(window_.data());
+			const auto first_part = (std::min)(length, window_size_ - start);
+
+			// advance before calling the handler, so it may observe the consistent state
+			consume(length);
+			statistics_.delivered_bytes += length;
+
+			handler(window + start, first_part);
+
+			if (first_part < length)
+				handler(window, length - first_part);
+
+			if (range_count_ == 0)
+				release_window();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Gives up the hole in front of the first buffered range and delivers the range
+		/// </summary>
+		/// <returns>number of bytes the stream advanced by</returns>
+		// ********************************************************************************
+		template <typename F>
+		uint32_t skip_hole(F& handler)
+		{
+			const auto hole = ranges_[0].begin;
+			const auto advanced = ranges_[0].end;
+
+			if (hole != 0)
+			{
+				for (uint32_t i = 0; i < range_count_; ++i)
+				{
+					ranges_[i].begin -= hole;
+					ranges_[i].end -= hole;
+				}
+
+				next_sequence_ += hole;
+				window_start_ += hole;
+				statistics_.skipped_bytes += hole;
+
+				handler(static_cast<const uint8_t*>(nullptr), hole);
+			}
+
+			deliver_prefix(handler);
+
+			return advanced;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Delivers the in-order segment directly from the packet
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void deliver(const uint8_t* data, const uint32_t length, F& handler)
+		{
+			next_sequence_ += length;
+			statistics_.delivered_bytes += length;
+
+			handler(data, length);
+		}
+
+		/// <summary>
+		/// Removes the first range and shifts the window by its length
+		/// </summary>
+		void consume(const uint32_t length) noexcept
+		{
+			std::copy(ranges_.begin() + 1, ranges_.begin() + range_count_, ranges_.begin());
+			--range_count_;
+
+			for (uint32_t i = 0; i < range_count_; ++i)
+			{
+				ranges_[i].begin -= length;
+				ranges_[i].end -= length;
+			}
+
+			next_sequence_ += length;
+			window_start_ += length;
+		}
+
+		void copy_in(const uint32_t offset, const uint8_t* data, const uint32_t length) noexcept
+		{
+			const auto mask = window_size_ - 1;
+			const auto start = (window_start_ + offset) & mask;
+			const auto first_part = (std::min)(length, window_size_ - start);
+
+			std::memcpy(window_.data() + start, data, first_part);
+			std::memcpy(window_.data(), data + first_part, length - first_part);
+		}
+
+		[[nodiscard]] uint32_t compare(const uint32_t offset, const uint8_t* data, const uint32_t length) const noexcept
+		{
+			const auto mask = window_size_ - 1;
+			const auto* window = reinterpret_cast<const uint8_t*>(window_.data());
+			uint32_t result = 0;
+
+			for (uint32_t i = 0; i < length; ++i)
+				result += window[(window_start_ + offset + i) & mask] != data[i];
+
+			return result;
+		}
+
+		void update_finished() noexcept
+		{
+			if (fin_seen_ && range_count_ == 0 && static_cast<int32_t>(next_sequence_ - fin_sequence_) >= 0)
+				finished_ = true;
+		}
+
+		void release_window() noexcept
+		{
+			window_.reset();
+			range_count_ = 0;
+			window_start_ = 0;
+		}
+
+		/// <summary>pool of the reassembly windows</summary>
+		tools::buffer_pool* pool_;
+		/// <summary>reassembly window size (power of two)</summary>
+		uint32_t window_size_;
+		/// <summary>maximum number of buffered ranges</summary>
+		uint32_t max_ranges_;
+		/// <summary>give up the first hole on overflow</summary>
+		bool skip_holes_on_overflow_;
+		/// <summary>start from the first data segment without SYN</summary>
+		bool allow_midstream_;
+		/// <summary>overlapping data resolution</summary>
+		tcp_overlap_policy policy_;
+
+		/// <summary>stream position is known</summary>
+		bool initialized_{false};
+		/// <summary>FIN was received</summary>
+		bool fin_seen_{false};
+		/// <summary>all data up to FIN was delivered</summary>
+		bool finished_{false};
+		/// <summary>next expected sequence number</summary>
+		uint32_t next_sequence_{0};
+		/// <summary>sequence number of FIN</summary>
+		uint32_t fin_sequence_{0};
+
+		/// <summary>reassembly window, held only while there are buffered ranges</summary>
+		tools::buffer_pool::buffer window_;
+		/// <summary>ring position of next_sequence_ in the window</summary>
+		uint32_t window_start_{0};
+		/// <summary>buffered ranges sorted by offset, disjoint and not adjacent</summary>
+		std::array<range, max_ranges_cap> ranges_{};
+		/// <summary>number of buffered ranges</summary>
+		uint32_t range_count_{0};
+
+		/// <summary>stream counters</summary>
+		statistics statistics_{};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Reassembles both directions of the TCP connection. Direction 0 is the direction
+	/// of the first segment passed (normally the client SYN), the handler is called as
+	/// handler(size_t direction, const uint8_t* data, uint32_t length).
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class tcp_connection_reassembler
+	{
+	public:
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the connection reassembler
+		/// </summary>
+		/// <param name="pool">pool of the reassembly windows, must outlive the object</param>
+		/// <param name="limits">memory and hole caps per direction</param>
+		/// <param name="policy">overlapping data resolution</param>
+		// ********************************************************************************
+		explicit tcp_connection_reassembler(tools::buffer_pool& pool, const tcp_reassembly_limits& limits = {},
+		                                    const tcp_overlap_policy policy = tcp_overlap_policy::keep_first) noexcept
+			: streams_{tcp_stream_reassembler(pool, limits, policy), tcp_stream_reassembler(pool, limits, policy)}
+		{
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Processes the TCP segment
+		/// </summary>
+		/// <param name="direction">0 - client to server, 1 - server to client</param>
+		/// <param name="sequence">segment sequence number (host byte order)</param>
+		/// <param name="data">segment payload</param>
+		/// <param name="length">payload length</param>
+		/// <param name="syn">SYN flag is set</param>
+		/// <param name="fin">FIN flag is set</param>
+		/// <param name="rst">RST flag is set: the buffered data of both directions is flushed</param>
+		/// <param name="handler">in-order data handler</param>
+		// ********************************************************************************
+		template <typename F>
+		void segment(const size_t direction, const uint32_t sequence, const uint8_t* data, const uint32_t length,
+		             const bool syn, const bool fin, const bool rst, F&& handler)
+		{
+			streams_[direction & 1].segment(sequence, data, length, syn, fin,
+			                                [direction, &handler](const uint8_t* bytes, const uint32_t size)
+			                                {
+				                                handler(direction & 1, bytes, size);
+			                                });
+
+			if (rst)
+			{
+				flush(handler);
+				reset_ = true;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Delivers the buffered data of both directions giving up the holes
+		/// </summary>
+		/// <param name="handler">in-order data handler</param>
+		// ********************************************************************************
+		template <typename F>
+		void flush(F&& handler)
+		{
+			for (size_t direction = 0; direction < streams_.size(); ++direction)
+			{
+				streams_[direction].flush([direction, &handler](const uint8_t* bytes, const uint32_t size)
+				{
+					handler(direction, bytes, size);
+				});
+			}
+		}
+
+		/// <summary>
+		/// Returns true if the connection was reset or both directions are finished
+		/// </summary>
+		[[nodiscard]] bool is_closed() const noexcept
+		{
+			return reset_ || (streams_[0].is_finished() && streams_[1].is_finished());
+		}
+
+		/// <summary>
+		/// Returns the direction stream
+		/// </summary>
+		[[nodiscard]] const tcp_stream_reassembler& stream(const size_t direction) const noexcept
+		{
+			return streams_[direction & 1];
+		}
+
+	private:
+		/// <summary>client to server and server to client streams</summary>
+		std::array<tcp_stream_reassembler, 2> streams_;
+		/// <summary>RST was seen</summary>
+		bool reset_{false};
+	};
+}
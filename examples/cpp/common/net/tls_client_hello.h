@@ -0,0 +1,661 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of the tls_client_hello::parse
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class tls_parse_result
+	{
+		/// <summary>ClientHello was parsed</summary>
+		success,
+		/// <summary>more data is needed: the record or the handshake message is truncated</summary>
+		incomplete,
+		/// <summary>data is not a TLS handshake record (or is SSL 2.0)</summary>
+		not_handshake,
+		/// <summary>handshake message is not a ClientHello</summary>
+		not_client_hello,
+		/// <summary>length fields are inconsistent</summary>
+		malformed
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Zero-copy TLS ClientHello parser. All fields are views into the parsed buffer,
+	/// which must outlive the object. Parsing and fingerprinting never allocate: the
+	/// lists are walked in place and the JA3/JA4 digests are computed over the values
+	/// streamed into tools::md5/tools::sha256.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class tls_client_hello
+	{
+	public:
+		/// <summary>TLS extension types used by the parser</summary>
+		enum extension_type : uint16_t
+		{
+			extension_server_name = 0,
+			extension_supported_groups = 10,
+			extension_ec_point_formats = 11,
+			extension_signature_algorithms = 13,
+			extension_alpn = 16,
+			extension_supported_versions = 43
+		};
+
+		/// <summary>maximum number of cipher suites or extensions accepted (JA4 sorts them on the stack)</summary>
+		static constexpr size_t max_list_entries = 512;
+
+		/// <summary>JA3 fingerprint: MD5 of the JA3 string as 32 lowercase hex digits and terminating zero</summary>
+		using ja3_fingerprint = std::array<char, 33>;
+		/// <summary>JA4 fingerprint: "t13d1516h2_8daaf6152771_b186095e22b6" and terminating zero</summary>
+		using ja4_fingerprint = std::array<char, 37>;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Parses the TLS record carrying the ClientHello (e.g. the beginning of the
+		/// client to server TCP stream). The ClientHello must fit the first record.
+		/// </summary>
+		/// <param name="data">TLS record</param>
+		/// <param name="length">available data length</param>
+		/// <returns>parse result</returns>
+		// ********************************************************************************
+		tls_parse_result parse(const uint8_t* data, const size_t length) noexcept
+		{
+			*this = {};
+
+			if (length < record_header_length)
+				return tls_parse_result::incomplete;
+
+			if (data[0] != handshake_content_type || data[1] != 3)
+				return tls_parse_result::not_handshake;
+
+			const auto record_length = read16(data + 3);
+
+			if (length < record_header_length + record_length)
+				return tls_parse_result::incomplete;
+
+			record_version_ = read16(data + 1);
+
+			return parse_handshake(data + record_header_length, record_length);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Parses the ClientHello handshake message without the record header (e.g.
+		/// reassembled from the QUIC CRYPTO frames)
+		/// </summary>
+		/// <param name="data">handshake message</param>
+		/// <param name="length">available data length</param>
+		/// <returns>parse result</returns>
+		// ********************************************************************************
+		tls_parse_result parse_handshake(const uint8_t* data, const size_t length) noexcept
+		{
+			if (length < 4)
+				return tls_parse_result::incomplete;
+
+			if (data[0] != handshake_type_client_hello)
+				return tls_parse_result::not_client_hello;
+
+			const auto message_length = static_cast<size_t>(data[1]) << 16 | static_cast<size_t>(read16(data + 2));
+
+			if (length < 4 + message_length)
+				return tls_parse_result::incomplete;
+
+			reader body{data + 4, message_length};
+
+			// legacy_version, random, session id
+			if (!body.read16(version_) || !body.skip(32) || !body.read_vector8(session_id_))
+				return tls_parse_result::malformed;
+
+			if (!body.read_vector16(cipher_suites_) || cipher_suites_.size() % 2 != 0 ||
+				cipher_suites_.size() / 2 > max_list_entries)
+				return tls_parse_result::malformed;
+
+			if (!body.read_vector8(compression_methods_))
+				return tls_parse_result::malformed;
+
+			// extensions are absent in SSL 3.0 hellos
+			if (body.remaining() == 0)
+				return tls_parse_result::success;
+
+			if (!body.read_vector16(extensions_) || body.remaining() != 0)
+				return tls_parse_result::malformed;
+
+			size_t extension_count = 0;
+			reader extensions{as_bytes(extensions_), extensions_.size()};
+
+			while (extensions.remaining() != 0)
+			{
+				uint16_t type;
+				std::string_view value;
+
+				if (!extensions.read16(type) || !extensions.read_vector16(value) ||
+					++extension_count > max_list_entries)
+					return tls_parse_result::malformed;
+
+				if (!parse_extension(type, value))
+					return tls_parse_result::malformed;
+			}
+
+			return tls_parse_result::success;
+		}
+
+		/// <summary>
+		/// Returns true for the GREASE values (RFC 8701) skipped by the fingerprints
+		/// </summary>
+		static constexpr bool is_grease(const uint16_t value) noexcept
+		{
+			return (value & 0x0F0F) == 0x0A0A && (value >> 8) == (value & 0xFF);
+		}
+
+		/// <summary>record layer version (0 if parsed with parse_handshake)</summary>
+		[[nodiscard]] uint16_t record_version() const noexcept { return record_version_; }
+
+		/// <summary>ClientHello legacy_version</summary>
+		[[nodiscard]] uint16_t legacy_version() const noexcept { return version_; }
+
+		/// <summary>legacy session ID</summary>
+		[[nodiscard]] std::string_view session_id() const noexcept { return session_id_; }
+
+		/// <summary>host_name from the server_name extension (empty if absent)</summary>
+		[[nodiscard]] std::string_view server_name() const noexcept { return server_name_; }
+
+		/// <summary>true if the server_name extension is present</summary>
+		[[nodiscard]] bool has_server_name() const noexcept { return has_server_name_; }
+
+		/// <summary>first ALPN protocol (empty if the extension is absent)</summary>
+		[[nodiscard]] std::string_view first_alpn() const noexcept
+		{
+			std::string_view result;
+			for_each_alpn([&result](const std::string_view protocol)
+			{
+				if (result.empty())
+					result = protocol;
+			});
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the highest version offered in supported_versions (GREASE skipped) or
+		/// legacy_version if the extension is absent
+		/// </summary>
+		// ********************************************************************************
+		[[nodiscard]] uint16_t max_version() const noexcept
+		{
+			uint16_t result = 0;
+
+			for_each_supported_version([&result](const uint16_t version)
+			{
+				if (!is_grease(version))
+					result = (std::max)(result, version);
+			});
+
+			return result != 0 ? result : version_;
+		}
+
+		/// <summary>
+		/// Calls f(uint16_t) for each offered cipher suite in order
+		/// </summary>
+		template <typename F>
+		void for_each_cipher_suite(F&& f) const
+		{
+			for_each_value16(cipher_suites_, f);
+		}
+
+		/// <summary>
+		/// Calls f(uint16_t type, std::string_view data) for each extension in order
+		/// </summary>
+		template <typename F>
+		void for_each_extension(F&& f) const
+		{
+			reader extensions{as_bytes(extensions_), extensions_.size()};
+			uint16_t type;
+			std::string_view value;
+
+			while (extensions.read16(type) && extensions.read_vector16(value))
+				f(type, value);
+		}
+
+		/// <summary>
+		/// Calls f(std::string_view) for each ALPN protocol name in order
+		/// </summary>
+		template <typename F>
+		void for_each_alpn(F&& f) const
+		{
+			reader list{as_bytes(alpn_), alpn_.size()};
+			std::string_view protocol;
+
+			while (list.read_vector8(protocol))
+				f(protocol);
+		}
+
+		/// <summary>
+		/// Calls f(uint16_t) for each version of supported_versions in order
+		/// </summary>
+		template <typename F>
+		void for_each_supported_version(F&& f) const
+		{
+			for_each_value16(supported_versions_, f);
+		}
+
+		/// <summary>
+		/// Calls f(uint16_t) for each group of supported_groups in order
+		/// </summary>
+		template <typename F>
+		void for_each_supported_group(F&& f) const
+		{
+			for_each_value16(supported_groups_, f);
+		}
+
+		/// <summary>
+		/// Calls f(uint16_t) for each signature algorithm in order
+		/// </summary>
+		template <typename F>
+		void for_each_signature_algorithm(F&& f) const
+		{
+			for_each_value16(signature_algorithms_, f);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Computes the JA3 fingerprint: MD5 of
+		/// "SSLVersion,Ciphers,Extensions,EllipticCurves,EllipticCurvePointFormats" with
+		/// the decimal values joined by '-' and GREASE values skipped
+		/// </summary>
+		/// <returns>zero terminated lowercase hex digest</returns>
+		// ********************************************************************************
+		[[nodiscard]] ja3_fingerprint ja3() const noexcept
+		{
+			tools::md5 digest;
+			ja3_string([&digest](const char* text, const size_t length) { digest.update(text, length); });
+
+			ja3_fingerprint result{};
+			to_hex(digest.finish().data(), 16, result.data());
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Produces the JA3 string in pieces, e.g. to log it
+		/// </summary>
+		/// <param name="output">called as output(const char* text, size_t length)</param>
+		// ********************************************************************************
+		template <typename F>
+		void ja3_string(F&& output) const
+		{
+			char number[8];
+
+			const auto put_number = [&output, &number](const uint32_t value)
+			{
+				const auto end = std::to_chars(number, number + sizeof(number), value).ptr;
+				output(number, static_cast<size_t>(end - number));
+			};
+
+			const auto put_list = [&output, &put_number](const uint16_t value, bool& first)
+			{
+				if (is_grease(value))
+					return;
+
+				if (!first)
+					output("-", 1);
+
+				first = false;
+				put_number(value);
+			};
+
+			put_number(version_);
+			output(",", 1);
+
+			auto first = true;
+			for_each_cipher_suite([&](const uint16_t value) { put_list(value, first); });
+			output(",", 1);
+
+			first = true;
+			for_each_extension([&](const uint16_t type, std::string_view) { put_list(type, first); });
+			output(",", 1);
+
+			first = true;
+			for_each_supported_group([&](const uint16_t value) { put_list(value, first); });
+			output(",", 1);
+
+			first = true;
+			for (const auto format : ec_point_formats_)
+				put_list(static_cast<uint8_t>(format), first);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Computes the JA4 fingerprint (FoxIO JA4 TLS client fingerprint)
+		/// </summary>
+		/// <param name="protocol">'t' - TLS over TCP, 'q' - QUIC, 'd' - DTLS</param>
+		/// <returns>zero terminated JA4 string</returns>
+		// ********************************************************************************
+		[[nodiscard]] ja4_fingerprint ja4(const char protocol = 't') const noexcept
+		{
+			ja4_fingerprint result{};
+			auto* position = result.data();
+
+			// JA4_a: protocol, version, SNI, cipher and extension counts, ALPN
+			*position++ = protocol;
+
+			const auto version = version_label(max_version());
+			*position++ = version[0];
+			*position++ = version[1];
+			*position++ = has_server_name_ ? 'd' : 'i';
+
+			std::array<uint16_t, max_list_entries> values; // NOLINT(cppcoreguidelines-pro-type-member-init)
+			size_t cipher_count = 0;
+
+			for_each_cipher_suite([&values, &cipher_count](const uint16_t value)
+			{
+				if (!is_grease(value))
+					values[cipher_count++] = value;
+			});
+
+			size_t extension_count = 0;
+			for_each_extension([&extension_count](const uint16_t type, std::string_view)
+			{
+				extension_count += is_grease(type) ? 0 : 1;
+			});
+
+			position = put_count(position, cipher_count);
+			position = put_count(position, extension_count);
+
+			if (const auto alpn = first_alpn(); alpn.empty())
+			{
+				*position++ = '0';
+				*position++ = '0';
+			}
+			else if (is_alphanumeric(alpn.front()) && is_alphanumeric(alpn.back()))
+			{
+				*position++ = alpn.front();
+				*position++ = alpn.back();
+			}
+			else
+			{
+				char first[2];
+				char last[2];
+				to_hex(reinterpret_cast<const uint8_t*>(&alpn.front()), 1, first);
+				to_hex(reinterpret_cast<const uint8_t*>(&alpn.back()), 1, last);
+				*position++ = first[0];
+				*position++ = last[1];
+			}
+
+			// JA4_b: truncated SHA-256 of the sorted cipher suites
+			*position++ = '_';
+			std::sort(values.begin(), values.begin() + cipher_count);
+			position = put_hash(position, values.data(), cipher_count, {});
+
+			// JA4_c: truncated SHA-256 of the sorted extensions (without SNI and ALPN) and the signature algorithms
+			*position++ = '_';
+			size_t count = 0;
+
+			for_each_extension([&values, &count](const uint16_t type, std::string_view)
+			{
+				if (!is_grease(type) && type != extension_server_name && type != extension_alpn)
+					values[count++] = type;
+			});
+
+			std::sort(values.begin(), values.begin() + count);
+			put_hash(position, values.data(), count, signature_algorithms_);
+
+			return result;
+		}
+
+	private:
+		static constexpr size_t record_header_length = 5;
+		static constexpr uint8_t handshake_content_type = 0x16;
+		static constexpr uint8_t handshake_type_client_hello = 0x01;
+		static constexpr uint8_t server_name_type_host_name = 0x00;
+		/// <summary>length of the truncated JA4 hashes in hex digits</summary>
+		static constexpr size_t ja4_hash_length = 12;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Bounds checked big-endian reader
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct reader
+		{
+			const uint8_t* data;
+			size_t length;
+
+			[[nodiscard]] size_t remaining() const noexcept { return length; }
+
+			bool skip(const size_t count) noexcept
+			{
+				if (length < count)
+					return false;
+
+				data += count;
+				length -= count;
+				return true;
+			}
+
+			bool read8(uint8_t& value) noexcept
+			{
+				if (length < 1)
+					return false;
+
+				value = data[0];
+				return skip(1);
+			}
+
+			bool read16(uint16_t& value) noexcept
+			{
+				if (length < 2)
+					return false;
+
+				value = tls_client_hello::read16(data);
+				return skip(2);
+			}
+
+			bool read_bytes(const size_t count, std::string_view& value) noexcept
+			{
+				if (length < count)
+					return false;
+
+				value = {reinterpret_cast<const char*>(data), count};
+				return skip(count);
+			}
+
+			bool read_vector8(std::string_view& value) noexcept
+			{
+				uint8_t count;
+				return read8(count) && read_bytes(count, value);
+			}
+
+			bool read_vector16(std::string_view& value) noexcept
+			{
+				uint16_t count;
+				return read16(count) && read_bytes(count, value);
+			}
+		};
+
+		static const uint8_t* as_bytes(const std::string_view view) noexcept
+		{
+			return reinterpret_cast<const uint8_t*>(view.data());
+		}
+
+		static uint16_t read16(const uint8_t* data) noexcept
+		{
+			return static_cast<uint16_t>(data[0] << 8 | data[1]);
+		}
+
+		template <typename F>
+		static void for_each_value16(const std::string_view list, F&& f)
+		{
+			const auto* data = as_bytes(list);
+
+			for (size_t i = 0; i + 1 < list.size(); i += 2)
+				f(read16(data + i));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Validates and records the extension used by the accessors and fingerprints
+		/// </summary>
+		// ********************************************************************************
+		bool parse_extension(const uint16_t type, const std::string_view value) noexcept
+		{
+			reader body{as_bytes(value), value.size()};
+
+			switch (type)
+			{
+			case extension_server_name:
+				{
+					std::string_view list;
+					has_server_name_ = true;
+
+					// an empty server_name extension is sent back by the servers only
+					if (value.empty())
+						return true;
+
+					if (!body.read_vector16(list) || body.remaining() != 0)
+						return false;
+
+					reader names{as_bytes(list), list.size()};
+
+					while (names.remaining() != 0)
+					{
+						uint8_t name_type;
+						std::string_view name;
+
+						if (!names.read8(name_type) || !names.read_vector16(name))
+							return false;
+
+						if (name_type == server_name_type_host_name && server_name_.empty())
+							server_name_ = name;
+					}
+
+					return true;
+				}
+			case extension_alpn:
+				return body.read_vector16(alpn_) && body.remaining() == 0;
+			case extension_supported_versions:
+				return body.read_vector8(supported_versions_) && body.remaining() == 0 &&
+					supported_versions_.size() % 2 == 0;
+			case extension_supported_groups:
+				return body.read_vector16(supported_groups_) && body.remaining() == 0 &&
+					supported_groups_.size() % 2 == 0;
+			case extension_ec_point_formats:
+				return body.read_vector8(ec_point_formats_) && body.remaining() == 0;
+			case extension_signature_algorithms:
+				return body.read_vector16(signature_algorithms_) && body.remaining() == 0 &&
+					signature_algorithms_.size() % 2 == 0;
+			default:
+				return true;
+			}
+		}
+
+		static constexpr std::string_view version_label(const uint16_t version) noexcept
+		{
+			switch (version)
+			{
+			case 0x0304: return "13";
+			case 0x0303: return "12";
+			case 0x0302: return "11";
+			case 0x0301: return "10";
+			case 0x0300: return "s3";
+			case 0x0002: return "s2";
+			case 0xfeff: return "d1";
+			case 0xfefd: return "d2";
+			case 0xfefc: return "d3";
+			default: return "00";
+			}
+		}
+
+		static constexpr bool is_alphanumeric(const char c) noexcept
+		{
+			return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		}
+
+		static char* put_count(char* position, const size_t count) noexcept
+		{
+			const auto value = (std::min)(count, static_cast<size_t>(99));
+			*position++ = static_cast<char>('0' + value / 10);
+			*position++ = static_cast<char>('0' + value % 10);
+			return position;
+		}
+
+		static void to_hex(const uint8_t* data, const size_t length, char* output) noexcept
+		{
+			constexpr char digits[] = "0123456789abcdef";
+
+			for (size_t i = 0; i < length; ++i)
+			{
+				*output++ = digits[data[i] >> 4];
+				*output++ = digits[data[i] & 0x0F];
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the truncated SHA-256 of "xxxx,xxxx,..." optionally followed by
+		/// "_yyyy,yyyy,..." of the signature algorithms, or zeros for the empty list
+		/// </summary>
+		// ********************************************************************************
+		static char* put_hash(char* position, const uint16_t* values, const size_t count,
+		                      const std::string_view signature_algorithms) noexcept
+		{
+			if (count == 0)
+				return std::fill_n(position, ja4_hash_length, '0');
+
+			tools::sha256 digest;
+
+			const auto put_value = [&digest](const uint16_t value, const bool first)
+			{
+				char text[5];
+				const uint8_t bytes[2] = {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+				text[0] = ',';
+				to_hex(bytes, 2, text + 1);
+				digest.update(first ? text + 1 : text, first ? 4 : 5);
+			};
+
+			for (size_t i = 0; i < count; ++i)
+				put_value(values[i], i == 0);
+
+			auto first = true;
+
+			for_each_value16(signature_algorithms, [&](const uint16_t value)
+			{
+				if (is_grease(value))
+					return;
+
+				if (first)
+					digest.update("_", 1);
+
+				put_value(value, first);
+				first = false;
+			});
+
+			char hex[64];
+			to_hex(digest.finish().data(), 32, hex);
+
+			return std::copy_n(hex, ja4_hash_length, position);
+		}
+
+		uint16_t record_version_{0};
+		uint16_t version_{0};
+		bool has_server_name_{false};
+		std::string_view session_id_;
+		/// <summary>raw cipher suite list (2 bytes per suite)</summary>
+		std::string_view cipher_suites_;
+		std::string_view compression_methods_;
+		/// <summary>raw extensions block</summary>
+		std::string_view extensions_;
+		std::string_view server_name_;
+		/// <summary>raw ProtocolNameList</summary>
+		std::string_view alpn_;
+		/// <summary>raw supported_versions list (2 bytes per version)</summary>
+		std::string_view supported_versions_;
+		/// <summary>raw supported_groups list (2 bytes per group)</summary>
+		std::string_view supported_groups_;
+		/// <summary>raw ec_point_formats list (1 byte per format)</summary>
+		std::string_view ec_point_formats_;
+		/// <summary>raw signature_algorithms list (2 bytes per algorithm)</summary>
+		std::string_view signature_algorithms_;
+	};
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Packet rate limiter. The bucket holds up to burst tokens and gains rate tokens
+	/// per second, each admitted packet takes one token. Not thread safe: the bucket is
+	/// meant to be owned by a single working thread, which refills it once per packet
+	/// block and then admits the packets of the block with a plain subtraction.
+	/// Tokens are counted in nanosecond fractions, so low rates refilled by short
+	/// intervals are not rounded away.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class token_bucket
+	{
+	public:
+		using clock_t = std::chrono::steady_clock;
+		using time_point_t = clock_t::time_point;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the bucket admitting every packet
+		/// </summary>
+		// ********************************************************************************
+		token_bucket() = default;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the full bucket
+		/// </summary>
+		/// <param name="rate">packets per second, 0 admits every packet</param>
+		/// <param name="burst">bucket size in packets, at least one</param>
+		/// <param name="now">current time</param>
+		// ********************************************************************************
+		token_bucket(const uint32_t rate, const uint32_t burst, const time_point_t now) noexcept
+			: rate_(rate),
+			  capacity_(static_cast<uint64_t>((std::max)(burst, uint32_t{1})) * token),
+			  tokens_(capacity_),
+			  last_refill_(now)
+		{
+		}
+
+		/// <summary>
+		/// Checks if the bucket limits the rate
+		/// </summary>
+		[[nodiscard]] bool is_enabled() const noexcept
+		{
+			return rate_ != 0;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Adds the tokens gained since the previous refill
+		/// </summary>
+		/// <param name="now">current time</param>
+		// ********************************************************************************
+		void refill(const time_point_t now) noexcept
+		{
+			if (!rate_ || now <= last_refill_)
+				return;
+
+			const auto elapsed = static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_refill_).count());
+
+			last_refill_ = now;
+
+			// Compare before multiplying, the long idle period would overflow
+			const auto missing = capacity_ - tokens_;
+
+			tokens_ = elapsed >= (missing + rate_ - 1) / rate_ ? capacity_ : tokens_ + elapsed * rate_;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Takes one token
+		/// </summary>
+		/// <returns>true if the packet is admitted</returns>
+		// ********************************************************************************
+		bool try_consume() noexcept
+		{
+			if (!rate_)
+				return true;
+
+			if (tokens_ < token)
+				return false;
+
+			tokens_ -= token;
+
+			return true;
+		}
+
+	private:
+		/// <summary>one token in the internal units (token-nanoseconds per second)</summary>
+		static constexpr uint64_t token = 1'000'000'000;
+
+		/// <summary>tokens gained per second, also the internal units gained per nanosecond</summary>
+		uint64_t rate_{0};
+		/// <summary>bucket size in the internal units</summary>
+		uint64_t capacity_{token};
+		/// <summary>available tokens in the internal units</summary>
+		uint64_t tokens_{token};
+		/// <summary>time of the last refill</summary>
+		time_point_t last_refill_{};
+	};
+}
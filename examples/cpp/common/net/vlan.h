@@ -0,0 +1,149 @@
+#pragma once
+
+namespace net
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// 802.1Q helpers. The tag of the packet is either in-band (ETH_P_8021Q header in
+	/// the frame) or out-of-band in INTERMEDIATE_BUFFER::m_8021q, which carries the
+	/// NDIS_NET_BUFFER_LIST_8021Q_INFO value: user priority in bits 0-2, canonical
+	/// format identifier in bit 3 and VLAN identifier in bits 4-15. The miniport with
+	/// 802.1Q offload strips the tag into m_8021q on receive and inserts it from
+	/// m_8021q on send, so tagging through m_8021q never moves the frame data.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct vlan_helper
+	{
+		/// <summary>VLAN identifier of the untagged and priority tagged frames</summary>
+		static constexpr uint16_t untagged = 0;
+		/// <summary>largest VLAN identifier</summary>
+		static constexpr uint16_t max_vlan = VLAN_VID_MASK;
+		/// <summary>number of VLAN identifiers</summary>
+		static constexpr size_t vlan_count = max_vlan + 1;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the m_8021q value
+		/// </summary>
+		/// <param name="vlan">VLAN identifier</param>
+		/// <param name="priority">802.1p user priority</param>
+		/// <returns>NDIS_NET_BUFFER_LIST_8021Q_INFO value</returns>
+		// ********************************************************************************
+		static DWORD make_8021q_info(const uint16_t vlan, const uint8_t priority) noexcept
+		{
+			return static_cast<DWORD>(vlan & VLAN_VID_MASK) << 4 | (priority & 0x07);
+		}
+
+		/// <summary>
+		/// VLAN identifier of the m_8021q value
+		/// </summary>
+		static uint16_t vlan_of_8021q_info(const DWORD info) noexcept
+		{
+			return static_cast<uint16_t>(info >> 4 & VLAN_VID_MASK);
+		}
+
+		/// <summary>
+		/// User priority of the m_8021q value
+		/// </summary>
+		static uint8_t priority_of_8021q_info(const DWORD info) noexcept
+		{
+			return static_cast<uint8_t>(info & 0x07);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Checks if the frame carries the 802.1Q header
+		/// </summary>
+		/// <param name="packet">Ethernet frame</param>
+		/// <returns>true if the frame is tagged in-band</returns>
+		// ********************************************************************************
+		static bool has_in_band_tag(const INTERMEDIATE_BUFFER& packet) noexcept
+		{
+			return packet.m_Length >= sizeof(vlan_ether_header) &&
+				ntohs(reinterpret_cast<const ether_header*>(packet.m_IBuffer)->h_proto) == ETH_P_8021Q;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the VLAN identifier of the frame, the in-band tag takes precedence
+		/// over m_8021q
+		/// </summary>
+		/// <param name="packet">Ethernet frame</param>
+		/// <returns>VLAN identifier, untagged (0) for the untagged and priority tagged frames</returns>
+		// ********************************************************************************
+		static uint16_t get_vlan(const INTERMEDIATE_BUFFER& packet) noexcept
+		{
+			if (has_in_band_tag(packet))
+				return ntohs(reinterpret_cast<const vlan_ether_header*>(packet.m_IBuffer)->h_vlan_tci) &
+					VLAN_VID_MASK;
+
+			return vlan_of_8021q_info(packet.m_8021q);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the 802.1p user priority of the frame
+		/// </summary>
+		/// <param name="packet">Ethernet frame</param>
+		/// <returns>user priority, 0 for the untagged frames</returns>
+		// ********************************************************************************
+		static uint8_t get_priority(const INTERMEDIATE_BUFFER& packet) noexcept
+		{
+			if (has_in_band_tag(packet))
+				return static_cast<uint8_t>(
+					ntohs(reinterpret_cast<const vlan_ether_header*>(packet.m_IBuffer)->h_vlan_tci) >> 13);
+
+			return priority_of_8021q_info(packet.m_8021q);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Moves the in-band tag into m_8021q. The addresses stay in place and the rest of
+		/// the frame moves over the tag, so the network layer header follows the 14 octet
+		/// Ethernet header afterwards.
+		/// </summary>
+		/// <param name="packet">Ethernet frame</param>
+		/// <returns>true if the frame was tagged in-band</returns>
+		// ********************************************************************************
+		static bool move_tag_out_of_band(INTERMEDIATE_BUFFER& packet) noexcept
+		{
+			if (!has_in_band_tag(packet))
+				return false;
+
+			const auto tci = ntohs(reinterpret_cast<const vlan_ether_header*>(packet.m_IBuffer)->h_vlan_tci);
+			constexpr auto tag_offset = 2 * ETH_ALEN;
+
+			memmove(packet.m_IBuffer + tag_offset, packet.m_IBuffer + tag_offset + VLAN_TAG_LENGTH,
+			        packet.m_Length - tag_offset - VLAN_TAG_LENGTH);
+
+			packet.m_Length -= VLAN_TAG_LENGTH;
+			packet.m_8021q = make_8021q_info(tci & VLAN_VID_MASK, static_cast<uint8_t>(tci >> 13));
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Tags the frame out-of-band, the frame data is not touched
+		/// </summary>
+		/// <param name="packet">Ethernet frame without the in-band tag</param>
+		/// <param name="vlan">VLAN identifier</param>
+		/// <param name="priority">802.1p user priority</param>
+		// ********************************************************************************
+		static void set_tag(INTERMEDIATE_BUFFER& packet, const uint16_t vlan, const uint8_t priority) noexcept
+		{
+			packet.m_8021q = make_8021q_info(vlan, priority);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Removes the out-of-band tag
+		/// </summary>
+		/// <param name="packet">Ethernet frame without the in-band tag</param>
+		// ********************************************************************************
+		static void clear_tag(INTERMEDIATE_BUFFER& packet) noexcept
+		{
+			packet.m_8021q = 0;
+		}
+	};
+}
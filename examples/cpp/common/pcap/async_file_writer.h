@@ -0,0 +1,1074 @@
+#pragma once
+
+namespace pcap
+{
+	// ********************************************************************************
+	/// <summary>
+	/// Returns current system time in nanoseconds since the Unix epoch. Intended to be
+	/// called once per packet when it is read from the driver.
+	/// </summary>
+	/// <returns>nanoseconds since 1970-01-01 00:00:00 UTC</returns>
+	// ********************************************************************************
+	inline uint64_t timestamp_now() noexcept
+	{
+		// FILETIME is the number of 100 ns intervals since 1601-01-01
+		constexpr uint64_t filetime_unix_epoch = 116444736000000000ull;
+
+		FILETIME file_time;
+		GetSystemTimePreciseAsFileTime(&file_time);
+
+		const auto ticks = (static_cast<uint64_t>(file_time.dwHighDateTime) << 32) | file_time.dwLowDateTime;
+
+		return (ticks - filetime_unix_epoch) * 100;
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Formats the timestamp for the file names as YYYYMMDDTHHMMSS.mmmZ (UTC)
+	/// </summary>
+	/// <param name="timestamp">nanoseconds since the Unix epoch</param>
+	/// <returns>formatted timestamp</returns>
+	// ********************************************************************************
+	inline std::string format_timestamp(const uint64_t timestamp)
+	{
+		constexpr uint64_t filetime_unix_epoch = 116444736000000000ull;
+
+		const auto ticks = timestamp / 100 + filetime_unix_epoch;
+
+		FILETIME file_time;
+		file_time.dwLowDateTime = static_cast<DWORD>(ticks);
+		file_time.dwHighDateTime = static_cast<DWORD>(ticks >> 32);
+
+		SYSTEMTIME system_time{};
+		FileTimeToSystemTime(&file_time, &system_time);
+
+		char result[48];
+		std::snprintf(result, sizeof(result), "%04u%02u%02uT%02u%02u%02u.%03uZ", system_time.wYear,
+		              system_time.wMonth, system_time.wDay, system_time.wHour, system_time.wMinute,
+		              system_time.wSecond, system_time.wMilliseconds);
+
+		return result;
+	}
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Buffered asynchronous capture file writer, the storage engine for the PCAP and
+	/// pcapng writers. Each producer thread gets its own lock-free single-producer/
+	/// single-consumer staging ring, so writing a record is a few memcpy calls and never
+	/// waits for the disk or for other threads. When the producer thread exits its ring
+	/// is released and, once drained, taken over by the next new producer thread, so the
+	/// thread churn (e.g. thread pool callbacks) doesn't keep allocating rings. The dedicated I/O thread drains the rings
+	/// into the page aligned block and writes it with unbuffered (FILE_FLAG_NO_BUFFERING)
+	/// I/O. If the staging ring is full the record is dropped and counted instead of
+	/// blocking the caller. Records are never split, but records written by the different
+	/// threads may appear in the file slightly out of the timestamp order.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class async_file_writer
+	{
+	public:
+		/// <summary>default per-thread staging ring size</summary>
+		static constexpr uint32_t default_staging_size = 4 * 1024 * 1024;
+		/// <summary>default size of the block written to the file</summary>
+		static constexpr uint32_t default_block_size = 1024 * 1024;
+		/// <summary>unbuffered I/O alignment (covers both 512e and 4Kn sector sizes)</summary>
+		static constexpr uint32_t io_alignment = 4096;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Writer counters snapshot
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>number of packets queued for writing</summary>
+			uint64_t packets_queued;
+			/// <summary>number of packet bytes queued for writing</summary>
+			uint64_t bytes_queued;
+			/// <summary>number of packets dropped because the staging ring was full</summary>
+			uint64_t packets_dropped;
+			/// <summary>number of packet bytes dropped because the staging ring was full</summary>
+			uint64_t bytes_dropped;
+			/// <summary>number of bytes written to the file</summary>
+			uint64_t bytes_written;
+			/// <summary>number of failed file writes</summary>
+			uint64_t write_errors;
+			/// <summary>number of completed (renamed) segments in the rotating mode</summary>
+			uint64_t segments_completed;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Segment rotation policy. The active segment is written to
+		/// base_name_NNNNNN.part, preallocated to max_segment_size. When it is completed it
+		/// is trimmed and renamed to base_name_START_END.ext, where START and END are the UTC
+		/// times the segment was opened and completed (YYYYMMDDTHHMMSS.mmmZ). Sizes are
+		/// checked between the drain passes, so a segment may exceed max_segment_size by
+		/// the data queued in one pass.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct rotation_policy
+		{
+			/// <summary>path and file name prefix of the segments</summary>
+			std::string base_name;
+			/// <summary>segment size limit in bytes, 0 - no size limit</summary>
+			uint64_t max_segment_size{0};
+			/// <summary>segment duration limit, zero - no time limit (empty segments are not rotated)</summary>
+			std::chrono::seconds max_segment_duration{0};
+			/// <summary>number of completed segments to keep, older ones are deleted, 0 - keep all</summary>
+			size_t retention_count{0};
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Part of the record, the record is the concatenation of its segments
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct segment
+		{
+			/// <summary>segment data</summary>
+			const void* data;
+			/// <summary>segment length</summary>
+			size_t length;
+		};
+
+		/// <summary>maximum length of the record tag passed to the record_observer</summary>
+		static constexpr uint32_t max_tag_length = 128;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Receives the file offsets of the written records (e.g. to build an index). The
+		/// calls are serialized: the I/O thread reports the records and the rotations, open
+		/// and close report the first and the last file from the calling thread.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class record_observer
+		{
+		public:
+			virtual ~record_observer() = default;
+
+			/// <summary>
+			/// The file (segment) was created, the following records belong to it
+			/// </summary>
+			/// <param name="file_name">file name</param>
+			virtual void on_file_opened(const std::string& file_name) noexcept = 0;
+
+			/// <summary>
+			/// The record was placed into the file
+			/// </summary>
+			/// <param name="offset">file offset of the record</param>
+			/// <param name="tag">tag passed to write along with the record</param>
+			/// <param name="tag_length">tag length</param>
+			virtual void on_record(uint64_t offset, const void* tag, uint32_t tag_length) noexcept = 0;
+
+			/// <summary>
+			/// The file (segment) is complete
+			/// </summary>
+			/// <param name="file_name">final file name</param>
+			virtual void on_file_closed(const std::string& file_name) noexcept = 0;
+
+			/// <summary>
+			/// The completed segment was deleted by the retention policy
+			/// </summary>
+			/// <param name="file_name">deleted file name</param>
+			virtual void on_file_deleted(const std::string& file_name) noexcept = 0;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the writer
+		/// </summary>
+		/// <param name="staging_size">per-thread staging ring size (rounded up to the power of two)</param>
+		/// <param name="block_size">file write block size (rounded up to io_alignment)</param>
+		/// <param name="flush_interval">maximum delay before the queued data reaches the file</param>
+		// ********************************************************************************
+		explicit async_file_writer(const uint32_t staging_size = default_staging_size,
+		                           const uint32_t block_size = default_block_size,
+		                           const std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000))
+			: staging_size_(round_up_power_of_two((std::max)(staging_size, 4u * MAX_ETHER_FRAME))),
+			  block_size_((std::max)(io_alignment, (block_size + io_alignment - 1) & ~(io_alignment - 1))),
+			  flush_interval_(flush_interval),
+			  id_(next_writer_id())
+		{
+			block_ = static_cast<char*>(VirtualAlloc(nullptr, block_size_, MEM_COMMIT | MEM_RESERVE,
+			                                         PAGE_READWRITE));
+
+			if (block_ == nullptr)
+				throw std::bad_alloc();
+		}
+
+		async_file_writer(const async_file_writer& other) = delete;
+		async_file_writer(async_file_writer&& other) noexcept = delete;
+		async_file_writer& operator=(const async_file_writer& other) = delete;
+		async_file_writer& operator=(async_file_writer&& other) noexcept = delete;
+
+		/// <summary>
+		/// Destructor: flushes the queued records and closes the file
+		/// </summary>
+		~async_file_writer()
+		{
+			close();
+
+			VirtualFree(block_, 0, MEM_RELEASE);
+		}
+
+		/// <summary>
+		/// Typecast to bool returns true is file was successfully opened
+		/// </summary>
+		explicit operator bool() const { return running_.load(std::memory_order_acquire); }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Opens (truncates) the file, writes the file preamble (e.g. file header) and
+		/// starts the I/O thread
+		/// </summary>
+		/// <param name="file_name">file name</param>
+		/// <param name="preamble">data written at the start of the file</param>
+		/// <param name="preamble_length">preamble length, must not exceed the block size</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const std::string& file_name, const void* preamble, const size_t preamble_length)
+		{
+			close();
+
+			if (preamble_length > block_size_)
+				return false;
+
+			rotation_.reset();
+
+			file_name_ = file_name;
+			file_ = create_file(file_name_, 0);
+
+			if (file_ == INVALID_HANDLE_VALUE)
+				return false;
+
+			if (observer_ != nullptr)
+				observer_->on_file_opened(file_name_);
+
+			start(preamble, preamble_length);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Starts writing the rotating set of segment files (see rotation_policy). Each
+		/// segment starts with the preamble, so every completed segment is a valid capture
+		/// file. The next segment file is created and preallocated by the I/O thread ahead
+		/// of time, so the rotation is a handle swap and producers are never involved.
+		/// </summary>
+		/// <param name="policy">rotation policy</param>
+		/// <param name="extension">extension of the completed segments (e.g. ".pcap")</param>
+		/// <param name="preamble">data written at the start of each segment</param>
+		/// <param name="preamble_length">preamble length, must not exceed the block size</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const rotation_policy& policy, const std::string& extension, const void* preamble,
+		          const size_t preamble_length)
+		{
+			close();
+
+			if (preamble_length > block_size_)
+				return false;
+
+			rotation_ = policy;
+			extension_ = extension;
+			segment_sequence_ = 0;
+			completed_segments_.clear();
+
+			file_name_ = segment_part_name(segment_sequence_);
+			file_ = create_file(file_name_, rotation_->max_segment_size);
+
+			if (file_ == INVALID_HANDLE_VALUE)
+				return false;
+
+			if (observer_ != nullptr)
+				observer_->on_file_opened(file_name_);
+
+			start(preamble, preamble_length);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stops the I/O thread, writes out all queued records and closes the file. In the
+		/// rotating mode the active segment is completed and the preallocated next segment
+		/// is deleted.
+		/// </summary>
+		// ********************************************************************************
+		void close()
+		{
+			running_.store(false, std::memory_order_release);
+
+			if (io_thread_.joinable())
+				io_thread_.join();
+
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				if (rotation_)
+				{
+					complete_segment(file_, file_name_, file_offset_ + block_used_);
+				}
+				else
+				{
+					CloseHandle(file_);
+
+					if (observer_ != nullptr)
+						observer_->on_file_closed(file_name_);
+				}
+
+				file_ = INVALID_HANDLE_VALUE;
+			}
+
+			if (next_file_ != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(next_file_);
+				next_file_ = INVALID_HANDLE_VALUE;
+				DeleteFileA(next_file_name_.c_str());
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Sets the observer notified about the record file offsets. With the observer set
+		/// the records are framed in the staging rings, so the I/O thread can tell where
+		/// each record lands in the file. Must be called while the file is closed.
+		/// </summary>
+		/// <param name="observer">observer pointer or nullptr, must outlive the writer use</param>
+		// ********************************************************************************
+		void set_record_observer(record_observer* observer) noexcept
+		{
+			if (!running_.load(std::memory_order_acquire))
+				observer_ = observer;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queues the record composed of the provided segments
+		/// </summary>
+		/// <param name="segments">record segments</param>
+		/// <param name="packet_length">length of the packet carried by the record (for statistics)</param>
+		/// <param name="tag">optional data passed to the record_observer along with the record offset</param>
+		/// <param name="tag_length">tag length, at most max_tag_length</param>
+		/// <returns>true if queued, false if dropped or the file is not open</returns>
+		// ********************************************************************************
+		bool write(const std::initializer_list<segment> segments, const uint32_t packet_length,
+		           const void* tag = nullptr, uint32_t tag_length = 0) noexcept
+		{
+			if (!running_.load(std::memory_order_acquire))
+				return false;
+
+			auto* const ring = get_staging_ring();
+
+			if (ring == nullptr)
+				return false;
+
+			size_t record_size = 0;
+
+			for (const auto& part : segments)
+				record_size += part.length;
+
+			const auto framed = observer_ != nullptr;
+
+			if (!framed || tag == nullptr)
+				tag_length = 0;
+
+			tag_length = (std::min)(tag_length, max_tag_length);
+
+			const auto head = ring->head.load(std::memory_order_relaxed);
+
+			if (const auto tail = ring->tail.load(std::memory_order_acquire); staging_size_ - (head - tail) <
+				record_size + (framed ? sizeof(record_prefix) + tag_length : 0))
+			{
+				ring->packets_dropped.store(ring->packets_dropped.load(std::memory_order_relaxed) + 1,
+				                            std::memory_order_relaxed);
+				ring->bytes_dropped.store(ring->bytes_dropped.load(std::memory_order_relaxed) + packet_length,
+				                          std::memory_order_relaxed);
+				return false;
+			}
+
+			auto position = head;
+
+			if (framed)
+			{
+				const record_prefix prefix{static_cast<uint32_t>(record_size), tag_length};
+				ring->copy_in(position, reinterpret_cast<const char*>(&prefix), sizeof(prefix));
+				position += sizeof(prefix);
+			}
+
+			for (const auto& part : segments)
+			{
+				ring->copy_in(position, static_cast<const char*>(part.data), part.length);
+				position += part.length;
+			}
+
+			if (tag_length != 0)
+			{
+				ring->copy_in(position, static_cast<const char*>(tag), tag_length);
+				position += tag_length;
+			}
+
+			ring->head.store(position, std::memory_order_release);
+
+			ring->packets_queued.store(ring->packets_queued.load(std::memory_order_relaxed) + 1,
+			                           std::memory_order_relaxed);
+			ring->bytes_queued.store(ring->bytes_queued.load(std::memory_order_relaxed) + packet_length,
+			                         std::memory_order_relaxed);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the snapshot of the writer counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics() const
+		{
+			statistics result{
+				0, 0, 0, 0, bytes_written_.load(std::memory_order_relaxed),
+				write_errors_.load(std::memory_order_relaxed), segments_completed_.load(std::memory_order_relaxed)
+			};
+
+			std::lock_guard lock(rings_lock_);
+
+			for (const auto& ring : rings_)
+			{
+				result.packets_queued += ring->packets_queued.load(std::memory_order_relaxed);
+				result.bytes_queued += ring->bytes_queued.load(std::memory_order_relaxed);
+				result.packets_dropped += ring->packets_dropped.load(std::memory_order_relaxed);
+				result.bytes_dropped += ring->bytes_dropped.load(std::memory_order_relaxed);
+			}
+
+			return result;
+		}
+
+	private:
+		// ********************************************************************************
+		/// <summary>
+		/// Resets the staging rings, places the preamble into the block and starts the I/O thread
+		/// </summary>
+		// ********************************************************************************
+		void start(const void* preamble, const size_t preamble_length)
+		{
+			{
+				// discard the leftovers of the previous file
+				std::lock_guard lock(rings_lock_);
+
+				for (const auto& ring : rings_)
+				{
+					ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+				}
+			}
+
+			preamble_.assign(static_cast<const char*>(preamble), static_cast<const char*>(preamble) + preamble_length);
+
+			std::memcpy(block_, preamble, preamble_length);
+			block_used_ = static_cast<uint32_t>(preamble_length);
+			file_offset_ = 0;
+			completed_bytes_ = 0;
+			segment_opened_ = timestamp_now();
+			segment_started_ = std::chrono::steady_clock::now();
+			bytes_written_.store(0, std::memory_order_relaxed);
+			segments_completed_.store(0, std::memory_order_relaxed);
+
+			running_.store(true, std::memory_order_release);
+			io_thread_ = std::thread(&async_file_writer::io_thread, this);
+		}
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Staging ring record frame used when the record observer is set
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct record_prefix
+		{
+			/// <summary>record length (written to the file)</summary>
+			uint32_t length;
+			/// <summary>tag length (passed to the observer only)</summary>
+			uint32_t tag_length;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Per-thread SPSC byte ring. Producer publishes complete records only, so the
+		/// consumer may copy any [tail, head) range without splitting a record between rings.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct staging_ring
+		{
+			explicit staging_ring(const uint32_t size)
+				: buffer(size), mask(size - 1)
+			{
+			}
+
+			void copy_in(const uint64_t position, const char* data, const size_t length) noexcept
+			{
+				const auto offset = static_cast<size_t>(position & mask);
+				const auto first = (std::min)(length, buffer.size() - offset);
+
+				std::memcpy(buffer.data() + offset, data, first);
+				std::memcpy(buffer.data(), data + first, length - first);
+			}
+
+			void copy_out(const uint64_t position, char* data, const size_t length) const noexcept
+			{
+				const auto offset = static_cast<size_t>(position & mask);
+				const auto first = (std::min)(length, buffer.size() - offset);
+
+				std::memcpy(data, buffer.data() + offset, first);
+				std::memcpy(data + first, buffer.data(), length - first);
+			}
+
+			std::vector<char> buffer;
+			uint64_t mask;
+			/// <summary>ring is owned by the producer thread, cleared (release) when the thread exits</summary>
+			std::atomic_bool in_use{true};
+
+			/// <summary>write position, updated by the producer</summary>
+			alignas(64) std::atomic<uint64_t> head{0};
+			/// <summary>read position, updated by the I/O thread</summary>
+			alignas(64) std::atomic<uint64_t> tail{0};
+
+			/// <summary>producer counters (single writer, relaxed)</summary>
+			alignas(64) std::atomic<uint64_t> packets_queued{0};
+			std::atomic<uint64_t> bytes_queued{0};
+			std::atomic<uint64_t> packets_dropped{0};
+			std::atomic<uint64_t> bytes_dropped{0};
+		};
+
+		static uint32_t round_up_power_of_two(const uint32_t value) noexcept
+		{
+			uint32_t result = 1;
+
+			while (result < value)
+				result <<= 1;
+
+			return result;
+		}
+
+		static uint64_t next_writer_id() noexcept
+		{
+			static std::atomic<uint64_t> writer_id{0};
+			return ++writer_id;
+		}
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Staging rings owned by the thread (one per writer it has written to), released
+		/// when the thread exits. The rings of the destroyed writers are referenced weakly.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct thread_rings
+		{
+			struct owned_ring
+			{
+				uint64_t writer_id;
+				std::weak_ptr<staging_ring> ring;
+			};
+
+			thread_rings() = default;
+			thread_rings(const thread_rings& other) = delete;
+			thread_rings(thread_rings&& other) noexcept = delete;
+			thread_rings& operator=(const thread_rings& other) = delete;
+			thread_rings& operator=(thread_rings&& other) noexcept = delete;
+
+			~thread_rings()
+			{
+				for (auto& owned : owned_rings)
+				{
+					if (const auto ring = owned.ring.lock(); ring)
+						ring->in_use.store(false, std::memory_order_release);
+				}
+			}
+
+			std::vector<owned_ring> owned_rings;
+			/// <summary>writer of the last used ring</summary>
+			uint64_t writer_id{0};
+			/// <summary>last used ring</summary>
+			staging_ring* ring{nullptr};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the staging ring of the calling thread. On the first call the thread
+		/// takes over the ring released by an exited thread and drained by the I/O thread,
+		/// or creates a new one. The last used ring is cached in the thread local storage,
+		/// so the lock is only taken on the first write.
+		/// </summary>
+		// ********************************************************************************
+		staging_ring* get_staging_ring() noexcept
+		{
+			thread_local thread_rings cache;
+
+			if (cache.writer_id == id_)
+				return cache.ring;
+
+			try
+			{
+				auto& owned_rings = cache.owned_rings;
+
+				// forget the rings of the destroyed writers
+				owned_rings.erase(std::remove_if(owned_rings.begin(), owned_rings.end(), [](auto&& owned)
+				{
+					return owned.ring.expired();
+				}), owned_rings.end());
+
+				const auto it = std::find_if(owned_rings.cbegin(), owned_rings.cend(), [this](auto&& owned)
+				{
+					return owned.writer_id == id_;
+				});
+
+				std::shared_ptr<staging_ring> ring = it != owned_rings.cend() ? it->ring.lock() : nullptr;
+
+				if (!ring)
+				{
+					std::lock_guard lock(rings_lock_);
+
+					// the previous owner has exited (acquire: its head and counters are visible)
+					const auto released = std::find_if(rings_.cbegin(), rings_.cend(), [](auto&& candidate)
+					{
+						return !candidate->in_use.load(std::memory_order_acquire) &&
+							candidate->tail.load(std::memory_order_acquire) == candidate->head.load(
+								std::memory_order_relaxed);
+					});
+
+					if (released != rings_.cend())
+					{
+						ring = *released;
+						ring->in_use.store(true, std::memory_order_relaxed);
+					}
+					else
+					{
+						ring = std::make_shared<staging_ring>(staging_size_);
+						rings_.push_back(ring);
+					}
+
+					owned_rings.push_back({id_, ring});
+				}
+
+				cache.writer_id = id_;
+				cache.ring = ring.get();
+
+				return cache.ring;
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Copies the published data of the ring into the block, writing out the full blocks
+		/// </summary>
+		/// <returns>true if any data was moved</returns>
+		// ********************************************************************************
+		bool drain(staging_ring& ring) noexcept
+		{
+			const auto head = ring.head.load(std::memory_order_acquire);
+			auto tail = ring.tail.load(std::memory_order_relaxed);
+
+			if (head == tail)
+				return false;
+
+			if (observer_ == nullptr)
+			{
+				copy_to_block(ring, tail, head - tail);
+				return true;
+			}
+
+			// framed records: report the file offset of each record along with its tag
+			std::array<char, max_tag_length> tag{};
+
+			while (tail != head)
+			{
+				record_prefix prefix{};
+				ring.copy_out(tail, reinterpret_cast<char*>(&prefix), sizeof(prefix));
+
+				const auto record_offset = file_offset_ + block_used_;
+
+				tail = copy_to_block(ring, tail + sizeof(prefix), prefix.length);
+
+				ring.copy_out(tail, tag.data(), prefix.tag_length);
+				tail += prefix.tag_length;
+				ring.tail.store(tail, std::memory_order_release);
+
+				observer_->on_record(record_offset, tag.data(), prefix.tag_length);
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Copies the ring data range into the block, writing out the full blocks. The
+		/// copied space is released to the producer chunk by chunk.
+		/// </summary>
+		/// <returns>ring position following the copied range</returns>
+		// ********************************************************************************
+		uint64_t copy_to_block(staging_ring& ring, uint64_t position, uint64_t length) noexcept
+		{
+			while (length != 0)
+			{
+				const auto offset = static_cast<size_t>(position & ring.mask);
+				const auto chunk = (std::min)({
+					static_cast<size_t>(length), ring.buffer.size() - offset,
+					static_cast<size_t>(block_size_ - block_used_)
+				});
+
+				std::memcpy(block_ + block_used_, ring.buffer.data() + offset, chunk);
+				block_used_ += static_cast<uint32_t>(chunk);
+				position += chunk;
+				length -= chunk;
+
+				// release the space to the producer as soon as possible
+				ring.tail.store(position, std::memory_order_release);
+
+				if (block_used_ == block_size_)
+				{
+					write_block(block_size_);
+					file_offset_ += block_size_;
+					block_used_ = 0;
+				}
+			}
+
+			return position;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the block to the current file offset
+		/// </summary>
+		/// <param name="length">number of bytes to write (multiple of io_alignment)</param>
+		// ********************************************************************************
+		void write_block(const uint32_t length) noexcept
+		{
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(file_offset_);
+			overlapped.OffsetHigh = static_cast<DWORD>(file_offset_ >> 32);
+
+			if (DWORD written = 0; !WriteFile(file_, block_, length, &written, &overlapped) || written != length)
+			{
+				write_errors_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the partially filled block (padded to io_alignment) and trims the file to
+		/// the actual data size. The block stays in memory and is rewritten at the same
+		/// offset once more data arrives.
+		/// </summary>
+		// ********************************************************************************
+		void flush_partial_block() noexcept
+		{
+			const auto padded = (block_used_ + io_alignment - 1) & ~(io_alignment - 1);
+
+			if (padded == 0)
+				return;
+
+			std::memset(block_ + block_used_, 0, padded - block_used_);
+			write_block(padded);
+
+			// preallocated segments keep their size until completed
+			if (!rotation_)
+			{
+				FILE_END_OF_FILE_INFO end_of_file{};
+				end_of_file.EndOfFile.QuadPart = static_cast<LONGLONG>(file_offset_ + block_used_);
+				SetFileInformationByHandle(file_, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file));
+			}
+
+			bytes_written_.store(completed_bytes_ + file_offset_ + block_used_, std::memory_order_relaxed);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Creates (truncates) the file for the unbuffered sequential writing
+		/// </summary>
+		/// <param name="file_name">file name</param>
+		/// <param name="preallocate">file size to reserve, 0 - do not preallocate</param>
+		/// <returns>file handle or INVALID_HANDLE_VALUE</returns>
+		// ********************************************************************************
+		static HANDLE create_file(const std::string& file_name, const uint64_t preallocate) noexcept
+		{
+			const auto file = CreateFileA(file_name.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+			                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN,
+			                              nullptr);
+
+			if (file != INVALID_HANDLE_VALUE && preallocate != 0)
+			{
+				// reserve the clusters and move the end of file up front, so the appending writes do not
+				// extend the file (metadata update per write); the file is trimmed when the segment completes
+				FILE_END_OF_FILE_INFO end_of_file{};
+				end_of_file.EndOfFile.QuadPart = static_cast<LONGLONG>(preallocate);
+				SetFileInformationByHandle(file, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file));
+			}
+
+			return file;
+		}
+
+		/// <summary>
+		/// Returns the name of the active (not yet completed) segment file
+		/// </summary>
+		[[nodiscard]] std::string segment_part_name(const uint64_t sequence) const
+		{
+			char number[32];
+			std::snprintf(number, sizeof(number), "_%06llu.part", static_cast<unsigned long long>(sequence));
+
+			return rotation_->base_name + number;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Trims the segment file to its data size, closes and renames it to the final name
+		/// and deletes the completed segments beyond the retention count. The rename is a
+		/// single MoveFileEx on the same volume, so the readers either see the .part file or
+		/// the complete segment.
+		/// </summary>
+		/// <param name="file">segment file handle</param>
+		/// <param name="part_name">segment file name</param>
+		/// <param name="size">segment data size</param>
+		// ********************************************************************************
+		void complete_segment(const HANDLE file, const std::string& part_name, const uint64_t size) noexcept
+		{
+			FILE_END_OF_FILE_INFO end_of_file{};
+			end_of_file.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+			SetFileInformationByHandle(file, FileEndOfFileInfo, &end_of_file, sizeof(end_of_file));
+
+			CloseHandle(file);
+
+			try
+			{
+				auto final_name = rotation_->base_name + "_" + format_timestamp(segment_opened_) + "_" +
+					format_timestamp(timestamp_now()) + extension_;
+
+				if (!MoveFileExA(part_name.c_str(), final_name.c_str(), MOVEFILE_WRITE_THROUGH))
+				{
+					// keep the data under the .part name rather than overwriting another segment
+					final_name = part_name;
+				}
+
+				if (observer_ != nullptr)
+					observer_->on_file_closed(final_name);
+
+				completed_segments_.push_back(std::move(final_name));
+
+				while (rotation_->retention_count != 0 && completed_segments_.size() > rotation_->retention_count)
+				{
+					DeleteFileA(completed_segments_.front().c_str());
+
+					if (observer_ != nullptr)
+						observer_->on_file_deleted(completed_segments_.front());
+					completed_segments_.pop_front();
+				}
+			}
+			catch (...)
+			{
+			}
+
+			completed_bytes_ += size;
+			segments_completed_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Checks the rotation policy limits for the active segment
+		/// </summary>
+		// ********************************************************************************
+		[[nodiscard]] bool is_rotation_due() const noexcept
+		{
+			const auto size = file_offset_ + block_used_;
+
+			if (rotation_->max_segment_size != 0 && size >= rotation_->max_segment_size)
+				return true;
+
+			return rotation_->max_segment_duration.count() != 0 && size > preamble_.size() &&
+				std::chrono::steady_clock::now() - segment_started_ >= rotation_->max_segment_duration;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Switches to the preallocated next segment and completes the current one. Called
+		/// by the I/O thread between the drain passes, when the block ends on the record
+		/// boundary. Producers keep queuing into the staging rings meanwhile.
+		/// </summary>
+		// ********************************************************************************
+		void rotate() noexcept
+		{
+			if (next_file_ == INVALID_HANDLE_VALUE)
+			{
+				// the next segment could not be created ahead of time, retry now
+				next_file_name_ = segment_part_name(segment_sequence_ + 1);
+				next_file_ = create_file(next_file_name_, rotation_->max_segment_size);
+
+				if (next_file_ == INVALID_HANDLE_VALUE)
+				{
+					write_errors_.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+			}
+
+			flush_partial_block();
+
+			const auto completed_file = file_;
+			const auto completed_name = std::move(file_name_);
+			const auto completed_size = file_offset_ + block_used_;
+
+			file_ = next_file_;
+			file_name_ = std::move(next_file_name_);
+			next_file_ = INVALID_HANDLE_VALUE;
+			++segment_sequence_;
+
+			complete_segment(completed_file, completed_name, completed_size);
+
+			std::memcpy(block_, preamble_.data(), preamble_.size());
+			block_used_ = static_cast<uint32_t>(preamble_.size());
+			file_offset_ = 0;
+			segment_opened_ = timestamp_now();
+			segment_started_ = std::chrono::steady_clock::now();
+
+			if (observer_ != nullptr)
+				observer_->on_file_opened(file_name_);
+
+			prepare_next_segment();
+		}
+
+		/// <summary>
+		/// Creates and preallocates the next segment file ahead of the rotation
+		/// </summary>
+		void prepare_next_segment() noexcept
+		{
+			if (!rotation_ || next_file_ != INVALID_HANDLE_VALUE)
+				return;
+
+			try
+			{
+				next_file_name_ = segment_part_name(segment_sequence_ + 1);
+				next_file_ = create_file(next_file_name_, rotation_->max_segment_size);
+			}
+			catch (...)
+			{
+			}
+		}
+
+		void io_thread()
+		{
+			using namespace std::chrono_literals;
+
+			std::vector<staging_ring*> rings;
+			auto last_flush = std::chrono::steady_clock::now();
+			auto dirty = true;
+
+			prepare_next_segment();
+
+			for (;;)
+			{
+				// read running_ before draining, so the last pass picks up everything published before close
+				const auto running = running_.load(std::memory_order_acquire);
+
+				{
+					std::lock_guard lock(rings_lock_);
+
+					rings.clear();
+
+					for (const auto& ring : rings_)
+						rings.push_back(ring.get());
+				}
+
+				auto idle = true;
+
+				for (auto* ring : rings)
+				{
+					if (drain(*ring))
+						idle = false;
+				}
+
+				dirty = dirty || !idle;
+
+				if (!running)
+					break;
+
+				// all rings are drained up to the record boundary here, the segment may be switched
+				if (rotation_ && is_rotation_due())
+				{
+					rotate();
+					last_flush = std::chrono::steady_clock::now();
+					dirty = false;
+				}
+
+				if (dirty && std::chrono::steady_clock::now() - last_flush >= flush_interval_)
+				{
+					flush_partial_block();
+					last_flush = std::chrono::steady_clock::now();
+					dirty = false;
+				}
+
+				bytes_written_.store((std::max)(bytes_written_.load(std::memory_order_relaxed),
+				                                completed_bytes_ + file_offset_), std::memory_order_relaxed);
+
+				if (idle)
+					std::this_thread::sleep_for(1ms);
+			}
+
+			flush_partial_block();
+		}
+
+		/// <summary>per-thread staging ring size (power of two)</summary>
+		uint32_t staging_size_;
+		/// <summary>file write block size (multiple of io_alignment)</summary>
+		uint32_t block_size_;
+		/// <summary>maximum delay before the queued data reaches the file</summary>
+		std::chrono::milliseconds flush_interval_;
+		/// <summary>unique writer identifier for the thread local ring cache</summary>
+		uint64_t id_;
+
+		/// <summary>protects rings_ list (not the rings content)</summary>
+		mutable std::mutex rings_lock_;
+		/// <summary>staging rings, one per live producer thread (released rings are reused)</summary>
+		std::vector<std::shared_ptr<staging_ring>> rings_;
+
+		/// <summary>page aligned block buffer, owned by the I/O thread</summary>
+		char* block_{nullptr};
+		/// <summary>number of bytes used in the block buffer</summary>
+		uint32_t block_used_{0};
+		/// <summary>file offset of the block buffer</summary>
+		uint64_t file_offset_{0};
+
+		HANDLE file_{INVALID_HANDLE_VALUE};
+		std::thread io_thread_;
+		std::atomic_bool running_{false};
+
+		/// <summary>data written at the start of each file (segment)</summary>
+		std::vector<char> preamble_;
+		/// <summary>optional record offsets observer</summary>
+		record_observer* observer_{nullptr};
+
+		/// <summary>rotation policy, empty for the single file mode</summary>
+		std::optional<rotation_policy> rotation_;
+		/// <summary>extension of the completed segments</summary>
+		std::string extension_;
+		/// <summary>file or active segment name</summary>
+		std::string file_name_;
+		/// <summary>preallocated next segment, created by the I/O thread ahead of the rotation</summary>
+		HANDLE next_file_{INVALID_HANDLE_VALUE};
+		/// <summary>next segment file name</summary>
+		std::string next_file_name_;
+		/// <summary>active segment sequence number</summary>
+		uint64_t segment_sequence_{0};
+		/// <summary>time the active segment was opened (nanoseconds since the Unix epoch)</summary>
+		uint64_t segment_opened_{0};
+		/// <summary>time the active segment was opened (for the duration limit)</summary>
+		std::chrono::steady_clock::time_point segment_started_;
+		/// <summary>completed segments retained on disk, oldest first</summary>
+		std::deque<std::string> completed_segments_;
+		/// <summary>total size of the completed segments</summary>
+		uint64_t completed_bytes_{0};
+
+		std::atomic<uint64_t> bytes_written_{0};
+		std::atomic<uint64_t> write_errors_{0};
+		std::atomic<uint64_t> segments_completed_{0};
+	};
+}
@@ -0,0 +1,861 @@
+#pragma once
+
+#include "pcap.h"
+#include "pcapng_async_writer.h"
+
+namespace pcap
+{
+	/// <summary>pcapng Simple Packet Block type</summary>
+	constexpr uint32_t pcapng_simple_packet_block = 0x00000003;
+
+	/// <summary>
+	/// Reverses the byte order of the capture file header field
+	/// </summary>
+	constexpr uint16_t byte_swap(const uint16_t value) noexcept
+	{
+		return static_cast<uint16_t>((value >> 8) | (value << 8));
+	}
+
+	/// <summary>
+	/// Reverses the byte order of the capture file header field
+	/// </summary>
+	constexpr uint32_t byte_swap(const uint32_t value) noexcept
+	{
+		return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+	}
+
+	/// <summary>
+	/// Reverses the byte order of the capture file header field
+	/// </summary>
+	constexpr uint64_t byte_swap(const uint64_t value) noexcept
+	{
+		return (static_cast<uint64_t>(byte_swap(static_cast<uint32_t>(value))) << 32) |
+			byte_swap(static_cast<uint32_t>(value >> 32));
+	}
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Capture file format detected by capture_file_reader
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class capture_file_format
+	{
+		/// <summary>classic PCAP (microsecond or nanosecond timestamps)</summary>
+		pcap,
+		/// <summary>pcapng</summary>
+		pcapng
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Packet record of the mapped capture file. The data points directly into the file
+	/// mapping and stays valid until the reader is closed.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct packet_view
+	{
+		/// <summary>packet data</summary>
+		const uint8_t* data;
+		/// <summary>number of bytes captured</summary>
+		uint32_t captured_length;
+		/// <summary>actual length of the packet</summary>
+		uint32_t original_length;
+		/// <summary>packet timestamp in nanoseconds since the Unix epoch</summary>
+		uint64_t timestamp;
+		/// <summary>pcapng interface ID (always 0 for PCAP)</summary>
+		uint32_t interface_id;
+		/// <summary>packet direction from epb_flags (unknown for PCAP)</summary>
+		packet_direction direction;
+		/// <summary>out-of-band 802.1Q information (INTERMEDIATE_BUFFER::m_8021q) recorded by pcapng_async_writer, 0 if none</summary>
+		uint32_t vlan_info;
+		/// <summary>WinpkFilter filter ID recorded by pcapng_async_writer, 0 if none</summary>
+		uint32_t filter_id;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Read-only mapping of the whole file
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+
+		mapped_file(const mapped_file& other) = delete;
+		mapped_file(mapped_file&& other) noexcept = delete;
+		mapped_file& operator=(const mapped_file& other) = delete;
+		mapped_file& operator=(mapped_file&& other) noexcept = delete;
+
+		~mapped_file()
+		{
+			close();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Maps the file, the file must be at least minimum_size bytes long and fit into
+		/// the address space
+		/// </summary>
+		/// <param name="file_name">file name</param>
+		/// <param name="minimum_size">minimum file size</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const std::string& file_name, const size_t minimum_size = 1)
+		{
+			close();
+
+			file_ = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+			                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+			if (file_ == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER file_size{};
+
+			if (!GetFileSizeEx(file_, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(
+				(std::max)(minimum_size, static_cast<size_t>(1))) || static_cast<uint64_t>(file_size.QuadPart) > (
+				std::numeric_limits<size_t>::max)())
+			{
+				close();
+				return false;
+			}
+
+			size_ = static_cast<size_t>(file_size.QuadPart);
+
+			mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+			if (mapping_ == nullptr)
+			{
+				close();
+				return false;
+			}
+
+			data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+
+			if (data_ == nullptr)
+			{
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Unmaps and closes the file
+		/// </summary>
+		void close() noexcept
+		{
+			if (data_ != nullptr)
+			{
+				UnmapViewOfFile(data_);
+				data_ = nullptr;
+			}
+
+			if (mapping_ != nullptr)
+			{
+				CloseHandle(mapping_);
+				mapping_ = nullptr;
+			}
+
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file_);
+				file_ = INVALID_HANDLE_VALUE;
+			}
+
+			size_ = 0;
+		}
+
+		/// <summary>
+		/// Returns the mapping base address (nullptr if not mapped)
+		/// </summary>
+		[[nodiscard]] const uint8_t* data() const noexcept { return data_; }
+
+		/// <summary>
+		/// Returns the mapped size
+		/// </summary>
+		[[nodiscard]] size_t size() const noexcept { return size_; }
+
+	private:
+		HANDLE file_{INVALID_HANDLE_VALUE};
+		HANDLE mapping_{nullptr};
+		const uint8_t* data_{nullptr};
+		size_t size_{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Memory mapped PCAP/pcapng file reader. The whole file is mapped read-only and the
+	/// records are parsed in place, so reading a packet is a few header loads and no
+	/// copies (packet_view) or a single memcpy (INTERMEDIATE_BUFFER). Both timestamp
+	/// resolutions and both byte orders are supported, for pcapng also multiple sections
+	/// and per-interface if_tsresol/if_tsoffset. Parsing stops at the first malformed or
+	/// truncated record (see is_truncated). The file must fit into the address space.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class capture_file_reader
+	{
+	public:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Input iterator over the remaining packets of the reader
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class iterator
+		{
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = packet_view;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const packet_view*;
+			using reference = const packet_view&;
+
+			iterator() = default;
+
+			explicit iterator(capture_file_reader* reader) : reader_(reader)
+			{
+				++*this;
+			}
+
+			reference operator*() const noexcept { return view_; }
+			pointer operator->() const noexcept { return &view_; }
+
+			iterator& operator++() noexcept
+			{
+				if (reader_ && !reader_->next(view_))
+					reader_ = nullptr;
+
+				return *this;
+			}
+
+			bool operator==(const iterator& other) const noexcept { return reader_ == other.reader_; }
+			bool operator!=(const iterator& other) const noexcept { return reader_ != other.reader_; }
+
+		private:
+			capture_file_reader* reader_{nullptr};
+			packet_view view_{};
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Range of the remaining packets, used with the range-based for loop
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class packet_range
+		{
+		public:
+			explicit packet_range(capture_file_reader* reader) : reader_(reader)
+			{
+			}
+
+			[[nodiscard]] iterator begin() const { return iterator(reader_); }
+			[[nodiscard]] static iterator end() { return {}; }
+
+		private:
+			capture_file_reader* reader_;
+		};
+
+		/// <summary>default prefetch distance of the packets range (bytes ahead of the current record)</summary>
+		static constexpr size_t default_prefetch_distance = 4096;
+
+		capture_file_reader() = default;
+
+		/// <summary>
+		/// Constructs the reader and maps the file
+		/// </summary>
+		/// <param name="file_name">capture file name</param>
+		explicit capture_file_reader(const std::string& file_name)
+		{
+			open(file_name);
+		}
+
+		capture_file_reader(const capture_file_reader& other) = delete;
+		capture_file_reader(capture_file_reader&& other) noexcept = delete;
+		capture_file_reader& operator=(const capture_file_reader& other) = delete;
+		capture_file_reader& operator=(capture_file_reader&& other) noexcept = delete;
+
+		~capture_file_reader()
+		{
+			close();
+		}
+
+		/// <summary>
+		/// Typecast to bool returns true if the file was successfully mapped
+		/// </summary>
+		explicit operator bool() const { return base_ != nullptr; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Maps the capture file and detects its format and byte order
+		/// </summary>
+		/// <param name="file_name">capture file name</param>
+		/// <returns>true if the file is mapped and has a known format</returns>
+		// ********************************************************************************
+		bool open(const std::string& file_name)
+		{
+			close();
+
+			if (!file_.open(file_name, sizeof(uint32_t)))
+				return false;
+
+			base_ = file_.data();
+			size_ = file_.size();
+
+			if (!rewind())
+			{
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Unmaps and closes the file, all packet views become invalid
+		/// </summary>
+		// ********************************************************************************
+		void close() noexcept
+		{
+			file_.close();
+			base_ = nullptr;
+			size_ = 0;
+			offset_ = 0;
+			truncated_ = false;
+			interfaces_.clear();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Restarts reading from the first packet
+		/// </summary>
+		/// <returns>true if the file header is valid</returns>
+		// ********************************************************************************
+		bool rewind() noexcept
+		{
+			truncated_ = false;
+			interfaces_.clear();
+
+			if (base_ == nullptr)
+				return false;
+
+			const auto magic = load<uint32_t>(base_, false);
+
+			switch (magic)
+			{
+			case pcap_magic_microseconds:
+			case pcap_magic_nanoseconds:
+			case byte_swap(pcap_magic_microseconds):
+			case byte_swap(pcap_magic_nanoseconds):
+				if (size_ < sizeof(pcap_hdr_t))
+					return false;
+
+				format_ = capture_file_format::pcap;
+				swapped_ = magic == byte_swap(pcap_magic_microseconds) || magic == byte_swap(pcap_magic_nanoseconds);
+				nanosecond_timestamps_ = magic == pcap_magic_nanoseconds || magic == byte_swap(pcap_magic_nanoseconds);
+				link_type_ = static_cast<link_layer_type>(load<uint32_t>(base_ + offsetof(pcap_hdr_t, network)));
+				offset_ = sizeof(pcap_hdr_t);
+				return true;
+
+			case pcapng_section_header_block:
+				// the section header is parsed by next_pcapng as any other block
+				format_ = capture_file_format::pcapng;
+				offset_ = 0;
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Positions the reader at the record starting at the file offset (e.g. taken from
+		/// the flow index). For pcapng the interfaces of the first section are loaded, the
+		/// offset must belong to that section.
+		/// </summary>
+		/// <param name="offset">file offset of the record</param>
+		/// <returns>true if the offset is within the file</returns>
+		// ********************************************************************************
+		bool seek(const uint64_t offset) noexcept
+		{
+			if (base_ == nullptr || offset >= size_)
+				return false;
+
+			if (format_ == capture_file_format::pcap && offset < sizeof(pcap_hdr_t))
+				return false;
+
+			if (format_ == capture_file_format::pcapng && interfaces_.empty())
+			{
+				// the section header and interface blocks precede the first packet
+				packet_view view{};
+				offset_ = 0;
+				next_pcapng(view);
+			}
+
+			offset_ = static_cast<size_t>(offset);
+			truncated_ = false;
+
+			return true;
+		}
+
+		/// <summary>
+		/// Returns the file offset of the next record
+		/// </summary>
+		[[nodiscard]] uint64_t tell() const noexcept { return offset_; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Reads the next packet record
+		/// </summary>
+		/// <param name="view">receives the packet view</param>
+		/// <returns>true if the packet was read, false at the end of the file or data</returns>
+		// ********************************************************************************
+		bool next(packet_view& view) noexcept
+		{
+			if (base_ == nullptr)
+				return false;
+
+			if (prefetch_distance_ != 0 && offset_ + prefetch_distance_ < size_)
+				PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, base_ + offset_ + prefetch_distance_);
+
+			return format_ == capture_file_format::pcap ? next_pcap(view) : next_pcapng(view);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Reads up to count packet views, the packet data is not copied
+		/// </summary>
+		/// <param name="views">receives the packet views</param>
+		/// <param name="count">maximum number of packets to read</param>
+		/// <returns>number of packets read, less than count only at the end of the file</returns>
+		// ********************************************************************************
+		size_t read_batch(packet_view* views, const size_t count) noexcept
+		{
+			size_t result = 0;
+
+			while (result < count && next(views[result]))
+				++result;
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Reads up to count packets into the INTERMEDIATE_BUFFER array, so the recorded
+		/// traffic can be passed to the same code as the packets read from the driver.
+		/// Packets longer than MAX_ETHER_FRAME are truncated, the direction is restored from
+		/// epb_flags (packets of unknown direction are treated as received), the
+		/// out-of-band 802.1Q information and filter ID from the pcapng_async_writer options.
+		/// </summary>
+		/// <param name="buffers">receives the packets</param>
+		/// <param name="count">maximum number of packets to read</param>
+		/// <param name="timestamps">optional array receiving the packet timestamps</param>
+		/// <returns>number of packets read, less than count only at the end of the file</returns>
+		// ********************************************************************************
+		size_t read_batch(INTERMEDIATE_BUFFER* buffers, const size_t count, uint64_t* timestamps = nullptr) noexcept
+		{
+			size_t result = 0;
+			packet_view view{};
+
+			while (result < count && next(view))
+			{
+				auto& buffer = buffers[result];
+				const auto length = (std::min)(view.captured_length, static_cast<uint32_t>(MAX_ETHER_FRAME));
+
+				buffer.m_dwDeviceFlags = view.direction == packet_direction::outbound
+					                         ? PACKET_FLAG_ON_SEND
+					                         : PACKET_FLAG_ON_RECEIVE;
+				buffer.m_Length = length;
+				buffer.m_Flags = 0;
+				buffer.m_8021q = view.vlan_info;
+				buffer.m_FilterID = view.filter_id;
+				std::memcpy(buffer.m_IBuffer, view.data, length);
+
+				if (timestamps != nullptr)
+					timestamps[result] = view.timestamp;
+
+				++result;
+			}
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the range of the remaining packets. With the non-zero prefetch distance
+		/// each step also prefetches the file data that far ahead of the current record, so
+		/// the page walk and the cache misses of the next records overlap with the
+		/// processing of the current one.
+		/// </summary>
+		/// <param name="prefetch_distance">prefetch distance in bytes, 0 - no prefetch</param>
+		/// <returns>packet range</returns>
+		// ********************************************************************************
+		packet_range packets(const size_t prefetch_distance = default_prefetch_distance) noexcept
+		{
+			prefetch_distance_ = prefetch_distance;
+			return packet_range(this);
+		}
+
+		/// <summary>
+		/// Returns the detected file format
+		/// </summary>
+		[[nodiscard]] capture_file_format get_format() const noexcept { return format_; }
+
+		/// <summary>
+		/// Returns the data link type of the interface (PCAP files have the single interface 0)
+		/// </summary>
+		[[nodiscard]] link_layer_type get_link_type(const uint32_t interface_id = 0) const noexcept
+		{
+			if (format_ == capture_file_format::pcap)
+				return link_type_;
+
+			return interface_id < interfaces_.size() ? interfaces_[interface_id].link_type : LINKTYPE_NULL;
+		}
+
+		/// <summary>
+		/// Returns true if reading stopped on a malformed or truncated record
+		/// </summary>
+		[[nodiscard]] bool is_truncated() const noexcept { return truncated_; }
+
+		/// <summary>
+		/// Sets the prefetch distance used by next and read_batch (0 - no prefetch)
+		/// </summary>
+		void set_prefetch_distance(const size_t prefetch_distance) noexcept { prefetch_distance_ = prefetch_distance; }
+
+	private:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// pcapng interface parameters needed to decode the packet blocks
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct interface_info
+		{
+			/// <summary>data link type</summary>
+			link_layer_type link_type;
+			/// <summary>decimal resolution: timestamp units are multiplied by this to get nanoseconds</summary>
+			uint64_t multiplier;
+			/// <summary>decimal resolution: timestamp units are divided by this to get nanoseconds</summary>
+			uint64_t divisor;
+			/// <summary>binary resolution exponent (2^-n), 0 for the decimal resolution</summary>
+			uint8_t binary_exponent;
+			/// <summary>if_tsoffset in nanoseconds</summary>
+			int64_t offset;
+
+			[[nodiscard]] uint64_t to_nanoseconds(const uint64_t units) const noexcept
+			{
+				uint64_t result;
+
+				if (binary_exponent != 0)
+				{
+					const auto seconds = binary_exponent < 64 ? units >> binary_exponent : 0;
+					const auto fraction = units - (binary_exponent < 64 ? seconds << binary_exponent : 0);
+
+					result = seconds * 1000000000 + static_cast<uint64_t>(
+						static_cast<double>(fraction) * 1e9 / std::ldexp(1.0, binary_exponent));
+				}
+				else
+				{
+					result = divisor == 1 ? units * multiplier : units / divisor;
+				}
+
+				return result + offset;
+			}
+		};
+
+		template <typename V>
+		static V load(const uint8_t* data, const bool swapped) noexcept
+		{
+			V value;
+			std::memcpy(&value, data, sizeof(V));
+			return swapped ? byte_swap(value) : value;
+		}
+
+		template <typename V>
+		[[nodiscard]] V load(const uint8_t* data) const noexcept
+		{
+			return load<V>(data, swapped_);
+		}
+
+		bool next_pcap(packet_view& view) noexcept
+		{
+			if (size_ - offset_ < sizeof(pcaprec_hdr_t))
+			{
+				truncated_ = offset_ != size_;
+				return false;
+			}
+
+			const auto* record = base_ + offset_;
+			const auto captured_length = load<uint32_t>(record + offsetof(pcaprec_hdr_t, incl_len));
+
+			if (size_ - offset_ - sizeof(pcaprec_hdr_t) < captured_length)
+			{
+				truncated_ = true;
+				return false;
+			}
+
+			const uint64_t seconds = load<uint32_t>(record + offsetof(pcaprec_hdr_t, ts_sec));
+			const uint64_t fraction = load<uint32_t>(record + offsetof(pcaprec_hdr_t, ts_usec));
+
+			view.data = record + sizeof(pcaprec_hdr_t);
+			view.captured_length = captured_length;
+			view.original_length = load<uint32_t>(record + offsetof(pcaprec_hdr_t, orig_len));
+			view.timestamp = seconds * 1000000000 + (nanosecond_timestamps_ ? fraction : fraction * 1000);
+			view.interface_id = 0;
+			view.direction = packet_direction::unknown;
+			view.vlan_info = 0;
+			view.filter_id = 0;
+
+			offset_ += sizeof(pcaprec_hdr_t) + captured_length;
+
+			return true;
+		}
+
+		bool next_pcapng(packet_view& view) noexcept
+		{
+			// block type, block total length and trailing block total length
+			constexpr size_t minimum_block = 3 * sizeof(uint32_t);
+
+			for (;;)
+			{
+				if (size_ - offset_ < minimum_block)
+				{
+					truncated_ = offset_ != size_;
+					return false;
+				}
+
+				const auto* block = base_ + offset_;
+				// the section header block type is a palindrome, so it matches in either byte order
+				const auto block_type = load<uint32_t>(block);
+
+				if (block_type == pcapng_section_header_block)
+				{
+					// the new section may use the other byte order, its interfaces are numbered from 0
+					const auto byte_order_magic = load<uint32_t>(block + 8, false);
+
+					if (byte_order_magic != pcapng_byte_order_magic && byte_order_magic != byte_swap(
+						pcapng_byte_order_magic))
+					{
+						truncated_ = true;
+						return false;
+					}
+
+					swapped_ = byte_order_magic != pcapng_byte_order_magic;
+					interfaces_.clear();
+				}
+
+				const auto block_length = load<uint32_t>(block + 4);
+
+				if (block_length < minimum_block || block_length % 4 != 0 || block_length > size_ - offset_)
+				{
+					truncated_ = true;
+					return false;
+				}
+
+				offset_ += block_length;
+
+				switch (block_type)
+				{
+				case pcapng_interface_description_block:
+					if (!add_interface(block, block_length))
+					{
+						// out of memory, the packets of this interface can't be parsed
+						truncated_ = true;
+						return false;
+					}
+					break;
+
+				case pcapng_enhanced_packet_block:
+					if (parse_enhanced_packet(block, block_length, view))
+						return true;
+					break;
+
+				case pcapng_simple_packet_block:
+					if (parse_simple_packet(block, block_length, view))
+						return true;
+					break;
+
+				default:
+					// section header, statistics, name resolution and custom blocks are skipped
+					break;
+				}
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Iterates over the pcapng options in [begin, end) calling handler(code, value, length)
+		/// </summary>
+		// ********************************************************************************
+		template <typename F>
+		void for_each_option(const uint8_t* begin, const uint8_t* end, F&& handler) const noexcept
+		{
+			while (end - begin >= 4)
+			{
+				const auto code = load<uint16_t>(begin);
+				const auto length = load<uint16_t>(begin + 2);
+
+				if (code == opt_endofopt || end - begin - 4 < length)
+					break;
+
+				handler(code, begin + 4, length);
+
+				begin += 4 + ((length + 3) & ~3);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Parses the Interface Description Block and appends the interface
+		/// </summary>
+		/// <returns>false if the interface list can't grow</returns>
+		// ********************************************************************************
+		bool add_interface(const uint8_t* block, const uint32_t block_length) noexcept
+		{
+			constexpr size_t options_offset = 16;
+
+			if (block_length < options_offset + sizeof(uint32_t))
+				return true;
+
+			interface_info info{
+				static_cast<link_layer_type>(load<uint16_t>(block + 8)), 1000, 1, 0, 0
+			};
+
+			for_each_option(block + options_offset, block + block_length - sizeof(uint32_t),
+			                [this, &info](const uint16_t code, const uint8_t* value, const uint16_t length)
+			                {
+				                if (code == if_tsresol && length >= 1)
+				                {
+					                if (*value & 0x80)
+					                {
+						                info.binary_exponent = static_cast<uint8_t>(*value & 0x7F);
+					                }
+					                else
+					                {
+						                // 10^-n: nanoseconds = units * 10^(9-n) or units / 10^(n-9)
+						                const auto exponent = (std::min)(static_cast<int>(*value), 27);
+						                info.multiplier = 1;
+						                info.divisor = 1;
+
+						                for (auto i = exponent; i < 9; ++i)
+							                info.multiplier *= 10;
+
+						                for (auto i = 9; i < exponent; ++i)
+							                info.divisor *= 10;
+					                }
+				                }
+				                else if (code == if_tsoffset && length >= sizeof(int64_t))
+				                {
+					                info.offset = static_cast<int64_t>(load<uint64_t>(value)) * 1000000000;
+				                }
+			                });
+
+			try
+			{
+				interfaces_.push_back(info);
+			}
+			catch (...)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		bool parse_enhanced_packet(const uint8_t* block, const uint32_t block_length, packet_view& view) const noexcept
+		{
+			constexpr size_t data_offset = 28;
+
+			if (block_length < data_offset + sizeof(uint32_t))
+				return false;
+
+			const auto interface_id = load<uint32_t>(block + 8);
+			const auto captured_length = load<uint32_t>(block + 20);
+
+			if (interface_id >= interfaces_.size() || captured_length > block_length - data_offset - sizeof(uint32_t))
+				return false;
+
+			const auto units = (static_cast<uint64_t>(load<uint32_t>(block + 12)) << 32) | load<uint32_t>(block + 16);
+
+			view.data = block + data_offset;
+			view.captured_length = captured_length;
+			view.original_length = load<uint32_t>(block + 24);
+			view.timestamp = interfaces_[interface_id].to_nanoseconds(units);
+			view.interface_id = interface_id;
+			view.direction = packet_direction::unknown;
+			view.vlan_info = 0;
+			view.filter_id = 0;
+
+			const auto options_offset = data_offset + ((captured_length + 3) & ~3u);
+
+			if (options_offset < block_length - sizeof(uint32_t))
+			{
+				for_each_option(block + options_offset, block + block_length - sizeof(uint32_t),
+				                [this, &view](const uint16_t code, const uint8_t* value, const uint16_t length)
+				                {
+					                if (code == epb_flags && length >= sizeof(uint32_t))
+						                view.direction = static_cast<packet_direction>(load<uint32_t>(value) & 0x3);
+					                else if (code == opt_custom_binary && length == sizeof(pcapng_packet_info_option) &&
+						                load<uint32_t>(value) == pcapng_custom_option_pen)
+					                {
+						                view.vlan_info = load<uint32_t>(value + offsetof(pcapng_packet_info_option,
+						                                                                 vlan_info));
+						                view.filter_id = load<uint32_t>(value + offsetof(pcapng_packet_info_option,
+						                                                                 filter_id));
+					                }
+				                });
+			}
+
+			return true;
+		}
+
+		bool parse_simple_packet(const uint8_t* block, const uint32_t block_length, packet_view& view) const noexcept
+		{
+			constexpr size_t data_offset = 12;
+
+			if (interfaces_.empty() || block_length < data_offset + sizeof(uint32_t))
+				return false;
+
+			const auto original_length = load<uint32_t>(block + 8);
+
+			view.data = block + data_offset;
+			view.captured_length = (std::min)(original_length,
+			                                  static_cast<uint32_t>(block_length - data_offset - sizeof(uint32_t)));
+			view.original_length = original_length;
+			view.timestamp = 0; // Simple Packet Block has no timestamp
+			view.interface_id = 0;
+			view.direction = packet_direction::unknown;
+			view.vlan_info = 0;
+			view.filter_id = 0;
+
+			return true;
+		}
+
+		/// <summary>capture file mapping</summary>
+		mapped_file file_;
+		/// <summary>file mapping base address</summary>
+		const uint8_t* base_{nullptr};
+		/// <summary>file size</summary>
+		size_t size_{0};
+		/// <summary>offset of the next record</summary>
+		size_t offset_{0};
+		/// <summary>prefetch distance in bytes, 0 - no prefetch</summary>
+		size_t prefetch_distance_{0};
+
+		capture_file_format format_{capture_file_format::pcap};
+		/// <summary>file (section) byte order differs from the host</summary>
+		bool swapped_{false};
+		/// <summary>reading stopped on a malformed record</summary>
+		bool truncated_{false};
+
+		/// <summary>PCAP: nanosecond timestamps</summary>
+		bool nanosecond_timestamps_{false};
+		/// <summary>PCAP: data link type</summary>
+		link_layer_type link_type_{LINKTYPE_ETHERNET};
+
+		/// <summary>pcapng: interfaces of the current section</summary>
+		std::vector<interface_info> interfaces_;
+	};
+}
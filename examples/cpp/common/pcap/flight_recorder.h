@@ -0,0 +1,800 @@
+#pragma once
+
+#include "pcap.h"
+#include "async_file_writer.h"
+
+namespace pcap
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// In-memory flight recorder: keeps the most recent packets in the circular buffers
+	/// and writes them to the PCAP file only when triggered (API call, trigger rule
+	/// matched by record_and_match in the filter callback or the named event signaled
+	/// by another process).
+	///
+	/// Each producer thread owns a ring of ring_size bytes, allocated once on its first
+	/// packet. Recording a packet is a few memcpy calls into the own ring and never waits:
+	/// the oldest records are overwritten. The memory bound is explicit:
+	/// memory_budget() = ring_size * max_producers, packets from the threads beyond
+	/// max_producers are counted as dropped. When the producer thread exits its ring
+	/// (with the recorded packets) is handed over to the next new producer thread, so
+	/// short-lived threads don't use up the producer slots.
+	///
+	/// Dumps run in the background thread while the capture continues. The dump walks
+	/// the rings backwards from the newest record (seqlock style validation against the
+	/// producer reservation, so the records overwritten during the copy are discarded),
+	/// merges the threads by timestamp and writes nanosecond PCAP. The dump temporarily
+	/// needs memory for the selected packets (bounded by the request max_bytes).
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class flight_recorder
+	{
+	public:
+		/// <summary>default per-thread ring size</summary>
+		static constexpr uint32_t default_ring_size = 16 * 1024 * 1024;
+		/// <summary>default maximum number of producer threads</summary>
+		static constexpr size_t default_max_producers = 8;
+		/// <summary>maximum number of queued dump requests</summary>
+		static constexpr size_t max_pending_dumps = 8;
+		/// <summary>maximum per-thread ring size (the largest power of two in the 32 bit size)</summary>
+		static constexpr uint32_t max_ring_size = 1u << 31;
+
+		/// <summary>trigger rule: returns true if the packet should trigger the dump</summary>
+		using trigger_rule_t = std::function<bool(const INTERMEDIATE_BUFFER&)>;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Recorder counters snapshot
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>number of packets recorded into the rings</summary>
+			uint64_t packets_recorded;
+			/// <summary>number of packet bytes recorded into the rings</summary>
+			uint64_t bytes_recorded;
+			/// <summary>number of packets not recorded (more producer threads than max_producers)</summary>
+			uint64_t packets_dropped;
+			/// <summary>number of packets written by the dumps</summary>
+			uint64_t packets_dumped;
+			/// <summary>number of successful dumps</summary>
+			uint64_t dumps_completed;
+			/// <summary>number of failed or rejected dumps</summary>
+			uint64_t dumps_failed;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Dump parameters. Both limits select the newest packets, whichever is reached first.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct dump_request
+		{
+			/// <summary>PCAP file name (for the named event trigger: prefix, the trigger time is appended)</summary>
+			std::string file_name;
+			/// <summary>dump packets recorded from this long before the trigger until the dump runs, zero - no time limit</summary>
+			std::chrono::nanoseconds duration{0};
+			/// <summary>dump at most this many bytes of the newest packet data, 0 - no size limit</summary>
+			uint64_t max_bytes{0};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the recorder and starts the dump thread
+		/// </summary>
+		/// <param name="ring_size">per-thread ring size (rounded up to the power of two)</param>
+		/// <param name="snap_len">maximum number of bytes recorded per packet</param>
+		/// <param name="max_producers">maximum number of producer threads</param>
+		/// <exception cref="std::invalid_argument">ring_size above max_ring_size or snap_len too large for it</exception>
+		// ********************************************************************************
+		explicit flight_recorder(const uint32_t ring_size = default_ring_size,
+		                         const uint32_t snap_len = MAX_ETHER_FRAME,
+		                         const size_t max_producers = default_max_producers)
+			: snap_len_(snap_len),
+			  ring_size_(checked_ring_size(ring_size, snap_len)),
+			  max_producers_(max_producers),
+			  id_(next_recorder_id())
+		{
+			rings_.reserve(max_producers_);
+
+			request_event_ = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+
+			if (request_event_ == nullptr)
+				throw std::runtime_error("flight_recorder: failed to create the request event");
+
+			dump_thread_ = std::thread(&flight_recorder::dump_thread, this);
+		}
+
+		flight_recorder(const flight_recorder& other) = delete;
+		flight_recorder(flight_recorder&& other) noexcept = delete;
+		flight_recorder& operator=(const flight_recorder& other) = delete;
+		flight_recorder& operator=(flight_recorder&& other) noexcept = delete;
+
+		/// <summary>
+		/// Destructor: stops the dump thread, the pending dumps are discarded
+		/// </summary>
+		~flight_recorder()
+		{
+			stop_.store(true, std::memory_order_release);
+			SetEvent(request_event_);
+
+			if (dump_thread_.joinable())
+				dump_thread_.join();
+
+			CloseHandle(request_event_);
+
+			if (trigger_event_ != nullptr)
+				CloseHandle(trigger_event_);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Records network packet stored in INTERMEDIATE_BUFFER
+		/// </summary>
+		/// <param name="buffer">network packet</param>
+		/// <param name="timestamp">packet timestamp (see timestamp_now)</param>
+		/// <returns>true if recorded</returns>
+		// ********************************************************************************
+		bool record(const INTERMEDIATE_BUFFER& buffer, const uint64_t timestamp) noexcept
+		{
+			return record(buffer.m_IBuffer, buffer.m_Length, timestamp);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Records Ethernet frame into the ring of the calling thread, overwriting the
+		/// oldest records
+		/// </summary>
+		/// <param name="data">frame data</param>
+		/// <param name="length">frame length</param>
+		/// <param name="timestamp">frame timestamp in nanoseconds since the Unix epoch</param>
+		/// <returns>true if recorded</returns>
+		// ********************************************************************************
+		bool record(const void* data, const uint32_t length, const uint64_t timestamp) noexcept
+		{
+			auto* const ring = get_ring();
+
+			if (ring == nullptr)
+			{
+				packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			const auto captured_length = (std::min)(length, snap_len_);
+			const auto total_length = record_size(captured_length);
+			const auto head = ring->head.load(std::memory_order_relaxed);
+
+			// announce the range being overwritten before touching it (seqlock writer)
+			ring->reserved.store(head + total_length, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			const record_header header{head, timestamp, captured_length, length};
+
+			ring->copy_in(head, &header, sizeof(header));
+			ring->copy_in(head + sizeof(header), data, captured_length);
+			ring->copy_in(head + total_length - sizeof(uint32_t), &total_length, sizeof(uint32_t));
+
+			ring->head.store(head + total_length, std::memory_order_release);
+
+			ring->packets_recorded.store(ring->packets_recorded.load(std::memory_order_relaxed) + 1,
+			                             std::memory_order_relaxed);
+			ring->bytes_recorded.store(ring->bytes_recorded.load(std::memory_order_relaxed) + length,
+			                           std::memory_order_relaxed);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Records the packet and checks it against the trigger rule. On match the dump is
+		/// queued unless the previous rule dump was queued less than holdoff ago, so a
+		/// burst of matching packets produces one dump. The trigger time is appended to
+		/// the file name prefix as for the named event trigger.
+		/// </summary>
+		/// <param name="buffer">network packet</param>
+		/// <param name="timestamp">packet timestamp (see timestamp_now)</param>
+		/// <returns>true if the packet matched the rule and the dump was queued</returns>
+		// ********************************************************************************
+		bool record_and_match(const INTERMEDIATE_BUFFER& buffer, const uint64_t timestamp)
+		{
+			record(buffer, timestamp);
+
+			if (!rule_ || !rule_(buffer))
+				return false;
+
+			// one thread wins the holdoff interval
+			auto last = last_rule_trigger_.load(std::memory_order_relaxed);
+
+			do
+			{
+				if (last != 0 && timestamp - last < rule_holdoff_)
+					return false;
+			}
+			while (!last_rule_trigger_.compare_exchange_weak(last, timestamp, std::memory_order_relaxed));
+
+			auto request = rule_request_;
+			request.file_name += "_" + format_timestamp(timestamp) + ".pcap";
+
+			return trigger(std::move(request));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Sets the trigger rule checked by record_and_match. Not synchronized with
+		/// record_and_match: set the rule before the capture starts.
+		/// </summary>
+		/// <param name="rule">packet predicate</param>
+		/// <param name="request">dump parameters, file_name is the prefix</param>
+		/// <param name="holdoff">minimum interval between the dumps triggered by the rule</param>
+		// ********************************************************************************
+		void set_trigger_rule(trigger_rule_t rule, dump_request request,
+		                      const std::chrono::nanoseconds holdoff = std::chrono::seconds(10))
+		{
+			rule_ = std::move(rule);
+			rule_request_ = std::move(request);
+			rule_holdoff_ = static_cast<uint64_t>((std::max)(holdoff.count(),
+			                                                 static_cast<std::chrono::nanoseconds::rep>(1)));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queues the dump of the recorded packets, the time window is counted back from
+		/// now. Takes a short lock, so it may be called from the filter callback on a rule
+		/// match, but not for every packet.
+		/// </summary>
+		/// <param name="request">dump parameters</param>
+		/// <returns>true if queued, false if too many dumps are pending</returns>
+		// ********************************************************************************
+		bool trigger(dump_request request)
+		{
+			{
+				std::lock_guard lock(pending_lock_);
+
+				if (pending_.size() >= max_pending_dumps)
+				{
+					dumps_failed_.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				pending_.push_back({std::move(request), timestamp_now()});
+			}
+
+			SetEvent(request_event_);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Creates the named auto-reset event, signaling it from any process (e.g. a
+		/// monitoring script) triggers the dump. The trigger time is appended to the file
+		/// name prefix: file_name_YYYYMMDDTHHMMSS.mmmZ.pcap
+		/// </summary>
+		/// <param name="event_name">event object name (e.g. "Global\\capture_dump")</param>
+		/// <param name="request">dump parameters, file_name is the prefix</param>
+		/// <returns>true on success, false if the event was already set or can't be created</returns>
+		// ********************************************************************************
+		bool set_trigger_event(const std::string& event_name, dump_request request)
+		{
+			std::lock_guard lock(pending_lock_);
+
+			if (trigger_event_ != nullptr)
+				return false;
+
+			trigger_event_ = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+
+			if (trigger_event_ == nullptr)
+				return false;
+
+			trigger_request_ = std::move(request);
+
+			// let the dump thread wait on the new event
+			SetEvent(request_event_);
+
+			return true;
+		}
+
+		/// <summary>
+		/// Returns the maximum memory used by the rings (ring_size * max_producers)
+		/// </summary>
+		[[nodiscard]] size_t memory_budget() const noexcept { return static_cast<size_t>(ring_size_) * max_producers_; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the snapshot of the recorder counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics() const
+		{
+			statistics result{
+				0, 0, packets_dropped_.load(std::memory_order_relaxed),
+				packets_dumped_.load(std::memory_order_relaxed), dumps_completed_.load(std::memory_order_relaxed),
+				dumps_failed_.load(std::memory_order_relaxed)
+			};
+
+			std::lock_guard lock(rings_lock_);
+
+			for (const auto& ring : rings_)
+			{
+				result.packets_recorded += ring->packets_recorded.load(std::memory_order_relaxed);
+				result.bytes_recorded += ring->bytes_recorded.load(std::memory_order_relaxed);
+			}
+
+			return result;
+		}
+
+	private:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Ring record header. The record is the header, captured data and the trailing
+		/// total record length (used to walk the ring backwards), padded to 8 bytes.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct record_header
+		{
+			/// <summary>ring position of the record, validates the backward walk</summary>
+			uint64_t position;
+			/// <summary>nanoseconds since the Unix epoch</summary>
+			uint64_t timestamp;
+			uint32_t captured_length;
+			uint32_t original_length;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Per-thread overwriting ring. The producer is the owner thread, the dump thread
+		/// reads concurrently and validates the copied records against reserved.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct capture_ring
+		{
+			explicit capture_ring(const uint32_t size)
+				: buffer(size), mask(size - 1)
+			{
+			}
+
+			void copy_in(const uint64_t position, const void* data, const size_t length) noexcept
+			{
+				const auto offset = static_cast<size_t>(position & mask);
+				const auto first = (std::min)(length, buffer.size() - offset);
+
+				std::memcpy(buffer.data() + offset, data, first);
+				std::memcpy(buffer.data(), static_cast<const char*>(data) + first, length - first);
+			}
+
+			void copy_out(const uint64_t position, void* data, const size_t length) const noexcept
+			{
+				const auto offset = static_cast<size_t>(position & mask);
+				const auto first = (std::min)(length, buffer.size() - offset);
+
+				std::memcpy(data, buffer.data() + offset, first);
+				std::memcpy(static_cast<char*>(data) + first, buffer.data(), length - first);
+			}
+
+			std::vector<char> buffer;
+			uint64_t mask;
+
+			/// <summary>owned by a producer thread, cleared (release) when the owner thread exits</summary>
+			std::atomic_bool in_use{true};
+
+			/// <summary>end of the last complete record, updated by the producer</summary>
+			alignas(64) std::atomic<uint64_t> head{0};
+			/// <summary>end of the record being written, the data below reserved - ring size is overwritten</summary>
+			std::atomic<uint64_t> reserved{0};
+
+			/// <summary>producer counters (single writer, relaxed)</summary>
+			alignas(64) std::atomic<uint64_t> packets_recorded{0};
+			std::atomic<uint64_t> bytes_recorded{0};
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Packet selected for the dump
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct dump_entry
+		{
+			uint64_t timestamp;
+			size_t offset;
+			uint32_t captured_length;
+			uint32_t original_length;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Queued dump request
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct pending_dump
+		{
+			dump_request request;
+			/// <summary>trigger time, the end of the time window</summary>
+			uint64_t trigger_time;
+		};
+
+		static constexpr uint32_t record_size(const uint32_t captured_length) noexcept
+		{
+			return (static_cast<uint32_t>(sizeof(record_header)) + captured_length + static_cast<uint32_t>(sizeof(
+				uint32_t)) + 7) & ~7u;
+		}
+
+		static uint32_t checked_ring_size(const uint32_t ring_size, const uint32_t snap_len)
+		{
+			// the ring holds at least four records of snap_len, computed in 64 bits as
+			// record_size would overflow for snap_len close to 4 GiB
+			const auto minimum_size = 4 * ((sizeof(record_header) + static_cast<uint64_t>(snap_len) + sizeof(uint32_t) +
+				7) & ~uint64_t{7});
+
+			if (ring_size > max_ring_size || minimum_size > max_ring_size)
+				throw std::invalid_argument("flight_recorder: ring_size or snap_len exceeds max_ring_size");
+
+			return round_up_power_of_two((std::max)(ring_size, static_cast<uint32_t>(minimum_size)));
+		}
+
+		static uint32_t round_up_power_of_two(const uint32_t value) noexcept
+		{
+			uint32_t result = 1;
+
+			while (result < value)
+				result <<= 1;
+
+			return result;
+		}
+
+		static uint64_t next_recorder_id() noexcept
+		{
+			static std::atomic<uint64_t> recorder_id{0};
+			return ++recorder_id;
+		}
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Rings owned by the thread (one per recorder it has recorded to), released when
+		/// the thread exits. The rings of the destroyed recorders are referenced weakly.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct thread_rings
+		{
+			struct owned_ring
+			{
+				uint64_t recorder_id;
+				std::weak_ptr<capture_ring> ring;
+			};
+
+			thread_rings() = default;
+			thread_rings(const thread_rings& other) = delete;
+			thread_rings(thread_rings&& other) noexcept = delete;
+			thread_rings& operator=(const thread_rings& other) = delete;
+			thread_rings& operator=(thread_rings&& other) noexcept = delete;
+
+			~thread_rings()
+			{
+				for (auto& owned : owned_rings)
+				{
+					if (const auto ring = owned.ring.lock(); ring)
+						ring->in_use.store(false, std::memory_order_release);
+				}
+			}
+
+			std::vector<owned_ring> owned_rings;
+			/// <summary>recorder of the last used ring</summary>
+			uint64_t recorder_id{0};
+			/// <summary>last used ring</summary>
+			capture_ring* ring{nullptr};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the ring of the calling thread. On the first call the thread takes over
+		/// the ring released by an exited thread or creates a new one. The last used ring
+		/// is cached in the thread local storage.
+		/// </summary>
+		// ********************************************************************************
+		capture_ring* get_ring() noexcept
+		{
+			thread_local thread_rings cache;
+
+			if (cache.recorder_id == id_)
+				return cache.ring;
+
+			try
+			{
+				auto& owned_rings = cache.owned_rings;
+
+				// forget the rings of the destroyed recorders
+				owned_rings.erase(std::remove_if(owned_rings.begin(), owned_rings.end(), [](auto&& owned)
+				{
+					return owned.ring.expired();
+				}), owned_rings.end());
+
+				const auto it = std::find_if(owned_rings.cbegin(), owned_rings.cend(), [this](auto&& owned)
+				{
+					return owned.recorder_id == id_;
+				});
+
+				std::shared_ptr<capture_ring> ring = it != owned_rings.cend() ? it->ring.lock() : nullptr;
+
+				if (!ring)
+				{
+					std::lock_guard lock(rings_lock_);
+
+					// the previous owner has exited, its records are complete (acquire)
+					const auto released = std::find_if(rings_.cbegin(), rings_.cend(), [](auto&& candidate)
+					{
+						return !candidate->in_use.load(std::memory_order_acquire);
+					});
+
+					if (released != rings_.cend())
+					{
+						ring = *released;
+						ring->in_use.store(true, std::memory_order_relaxed);
+					}
+					else
+					{
+						if (rings_.size() >= max_producers_)
+							return nullptr;
+
+						ring = std::make_shared<capture_ring>(ring_size_);
+						rings_.push_back(ring);
+					}
+
+					owned_rings.push_back({id_, ring});
+				}
+
+				cache.recorder_id = id_;
+				cache.ring = ring.get();
+
+				return cache.ring;
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Copies the newest records of the ring matching the dump limits into data,
+		/// walking backwards from the head until the limit, the start of the recorded data
+		/// or the record overwritten by the producer is reached
+		/// </summary>
+		// ********************************************************************************
+		void collect(const capture_ring& ring, const uint64_t cutoff, const uint64_t max_bytes,
+		             std::vector<char>& data, std::vector<dump_entry>& entries) const
+		{
+			constexpr auto minimum_record = record_size(0);
+			const auto maximum_record = record_size(snap_len_);
+
+			auto position = ring.head.load(std::memory_order_acquire);
+			uint64_t collected = 0;
+
+			while (position >= minimum_record && (max_bytes == 0 || collected < max_bytes))
+			{
+				uint32_t total_length = 0;
+				ring.copy_out(position - sizeof(uint32_t), &total_length, sizeof(uint32_t));
+
+				if (total_length < minimum_record || total_length > maximum_record || total_length % 8 != 0 ||
+					total_length > position)
+					break;
+
+				const auto start = position - total_length;
+
+				record_header header{};
+				ring.copy_out(start, &header, sizeof(header));
+
+				const auto captured_length = (std::min)(header.captured_length, snap_len_);
+				const auto offset = data.size();
+
+				data.resize(offset + captured_length);
+				ring.copy_out(start + sizeof(header), data.data() + offset, captured_length);
+
+				// the copy is valid only if the producer has not started overwriting it (seqlock reader)
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (const auto reserved = ring.reserved.load(std::memory_order_relaxed); reserved > ring_size_ &&
+					start < reserved - ring_size_)
+				{
+					data.resize(offset);
+					break;
+				}
+
+				if (header.position != start || header.timestamp < cutoff)
+				{
+					data.resize(offset);
+					break;
+				}
+
+				entries.push_back({header.timestamp, offset, captured_length, header.original_length});
+				collected += captured_length;
+				position = start;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the selected packets of all rings to the PCAP file, oldest first
+		/// </summary>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool dump(const pending_dump& pending)
+		{
+			const auto& request = pending.request;
+			const auto duration = static_cast<uint64_t>((std::max)(request.duration.count(),
+			                                                       static_cast<std::chrono::nanoseconds::rep>(0)));
+			const auto cutoff = duration != 0 && duration < pending.trigger_time ? pending.trigger_time - duration : 0;
+
+			std::vector<char> data;
+			std::vector<dump_entry> entries;
+
+			{
+				std::vector<capture_ring*> rings;
+
+				{
+					std::lock_guard lock(rings_lock_);
+
+					for (const auto& ring : rings_)
+						rings.push_back(ring.get());
+				}
+
+				for (const auto* ring : rings)
+				{
+					// collected newest first, restore the recording order for the stable merge below
+					const auto ring_first = entries.size();
+					collect(*ring, cutoff, request.max_bytes, data, entries);
+					std::reverse(entries.begin() + static_cast<std::ptrdiff_t>(ring_first), entries.end());
+				}
+			}
+
+			std::stable_sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs)
+			{
+				return lhs.timestamp < rhs.timestamp;
+			});
+
+			// every ring contributed up to max_bytes, keep the newest max_bytes overall
+			auto first = entries.size();
+
+			for (uint64_t selected = 0; first > 0 && (request.max_bytes == 0 || selected < request.max_bytes);)
+			{
+				selected += entries[--first].captured_length;
+			}
+
+			std::ofstream file_stream(request.file_name, std::ofstream::binary | std::ofstream::out |
+			                          std::ofstream::trunc);
+
+			if (!file_stream)
+				return false;
+
+			file_stream << pcap_file_header{
+				2, 4, 0, 0, snap_len_, LINKTYPE_ETHERNET, pcap_magic_nanoseconds
+			};
+
+			for (auto i = first; i < entries.size(); ++i)
+			{
+				const auto& entry = entries[i];
+
+				file_stream << pcap_record_header{
+					static_cast<uint32_t>(entry.timestamp / 1000000000),
+					static_cast<uint32_t>(entry.timestamp % 1000000000),
+					entry.captured_length, entry.original_length, data.data() + entry.offset
+				};
+			}
+
+			packets_dumped_.fetch_add(entries.size() - first, std::memory_order_relaxed);
+
+			return static_cast<bool>(file_stream.flush());
+		}
+
+		void dump_thread()
+		{
+			for (;;)
+			{
+				HANDLE events[2] = {request_event_, nullptr};
+				DWORD event_count = 1;
+
+				{
+					std::lock_guard lock(pending_lock_);
+
+					if (trigger_event_ != nullptr)
+						events[event_count++] = trigger_event_;
+				}
+
+				const auto wait_result = WaitForMultipleObjects(event_count, events, FALSE, INFINITE);
+
+				if (stop_.load(std::memory_order_acquire))
+					break;
+
+				if (wait_result == WAIT_OBJECT_0 + 1)
+				{
+					const auto now = timestamp_now();
+
+					try
+					{
+						std::lock_guard lock(pending_lock_);
+
+						auto request = trigger_request_;
+						request.file_name += "_" + format_timestamp(now) + ".pcap";
+						pending_.push_back({std::move(request), now});
+					}
+					catch (...)
+					{
+						dumps_failed_.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+
+				for (;;)
+				{
+					std::optional<pending_dump> pending;
+
+					{
+						std::lock_guard lock(pending_lock_);
+
+						if (pending_.empty())
+							break;
+
+						pending = std::move(pending_.front());
+						pending_.pop_front();
+					}
+
+					bool result;
+
+					try
+					{
+						result = dump(*pending);
+					}
+					catch (...)
+					{
+						result = false;
+					}
+
+					(result ? dumps_completed_ : dumps_failed_).fetch_add(1, std::memory_order_relaxed);
+
+					if (stop_.load(std::memory_order_acquire))
+						return;
+				}
+			}
+		}
+
+		/// <summary>maximum number of bytes recorded per packet</summary>
+		uint32_t snap_len_;
+		/// <summary>per-thread ring size (power of two)</summary>
+		uint32_t ring_size_;
+		/// <summary>maximum number of producer threads (rings)</summary>
+		size_t max_producers_;
+		/// <summary>unique recorder identifier for the thread local ring cache</summary>
+		uint64_t id_;
+
+		/// <summary>protects rings_ list (not the rings content)</summary>
+		mutable std::mutex rings_lock_;
+		/// <summary>producer rings, one per thread, shared weakly with the owner thread for the exit release</summary>
+		std::vector<std::shared_ptr<capture_ring>> rings_;
+
+		/// <summary>protects pending_, trigger_event_ and trigger_request_</summary>
+		std::mutex pending_lock_;
+		/// <summary>queued dumps</summary>
+		std::deque<pending_dump> pending_;
+		/// <summary>wakes the dump thread (auto-reset)</summary>
+		HANDLE request_event_{nullptr};
+		/// <summary>optional named trigger event</summary>
+		HANDLE trigger_event_{nullptr};
+		/// <summary>dump parameters for the named trigger event</summary>
+		dump_request trigger_request_;
+
+		/// <summary>trigger rule checked by record_and_match</summary>
+		trigger_rule_t rule_;
+		/// <summary>dump parameters for the trigger rule</summary>
+		dump_request rule_request_;
+		/// <summary>minimum interval between the rule dumps in nanoseconds</summary>
+		uint64_t rule_holdoff_{0};
+		/// <summary>timestamp of the last rule dump</summary>
+		std::atomic<uint64_t> last_rule_trigger_{0};
+
+		std::thread dump_thread_;
+		std::atomic_bool stop_{false};
+
+		std::atomic<uint64_t> packets_dropped_{0};
+		std::atomic<uint64_t> packets_dumped_{0};
+		std::atomic<uint64_t> dumps_completed_{0};
+		std::atomic<uint64_t> dumps_failed_{0};
+	};
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include "async_file_writer.h"
+
+namespace pcap
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Conversation key: VLAN, IP version, protocol and both endpoints ordered so that the
+	/// two directions of the conversation share the key. Non-IP frames have ip_version 0,
+	/// protocols without ports (and non-first fragments) have zero ports, untagged frames
+	/// have vlan 0.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_key
+	{
+		/// <summary>lower endpoint address (IPv4 in the first 4 bytes)</summary>
+		uint8_t lower_address[16];
+		/// <summary>upper endpoint address (IPv4 in the first 4 bytes)</summary>
+		uint8_t upper_address[16];
+		/// <summary>lower endpoint port (host byte order)</summary>
+		uint16_t lower_port;
+		/// <summary>upper endpoint port (host byte order)</summary>
+		uint16_t upper_port;
+		/// <summary>IP protocol</summary>
+		uint8_t protocol;
+		/// <summary>4, 6 or 0 for non-IP frames</summary>
+		uint8_t ip_version;
+		/// <summary>802.1Q VLAN identifier, 0 for the untagged frames</summary>
+		uint16_t vlan;
+
+		bool operator==(const flow_key& other) const noexcept { return std::memcmp(this, &other, sizeof(flow_key)) == 0; }
+		bool operator!=(const flow_key& other) const noexcept { return !(*this == other); }
+		bool operator<(const flow_key& other) const noexcept { return std::memcmp(this, &other, sizeof(flow_key)) < 0; }
+	};
+
+	static_assert(sizeof(flow_key) == 40);
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// flow_key hash for the unordered containers
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_key_hash
+	{
+		size_t operator()(const flow_key& key) const noexcept
+		{
+			uint64_t words[sizeof(flow_key) / sizeof(uint64_t)];
+			std::memcpy(words, &key, sizeof(words));
+
+			uint64_t result = 0x9E3779B97F4A7C15ull;
+
+			for (const auto word : words)
+			{
+				result = (result ^ word) * 0xBF58476D1CE4E5B9ull;
+				result ^= result >> 31;
+			}
+
+			return static_cast<size_t>(result);
+		}
+	};
+
+	// ********************************************************************************
+	/// <summary>
+	/// Builds the conversation key of the Ethernet frame. 802.1Q/802.1ad tags are skipped
+	/// and the VLAN identifier of the innermost tag goes into the key, the IPv6 extension
+	/// headers are walked by net::ipv6_helper::parse.
+	/// </summary>
+	/// <param name="frame">Ethernet frame</param>
+	/// <param name="length">frame length</param>
+	/// <param name="vlan">out-of-band VLAN identifier (m_8021q), used if the frame is not tagged in-band</param>
+	/// <returns>conversation key</returns>
+	// ********************************************************************************
+	inline flow_key make_flow_key(const uint8_t* frame, const uint32_t length, const uint16_t vlan = 0) noexcept
+	{
+		flow_key key{};
+		key.vlan = vlan;
+
+		const auto read16 = [frame](const size_t offset)
+		{
+			return static_cast<uint16_t>((frame[offset] << 8) | frame[offset + 1]);
+		};
+
+		size_t offset = 12;
+
+		if (length < offset + 2)
+			return key;
+
+		auto ether_type = read16(offset);
+		offset += 2;
+
+		while ((ether_type == 0x8100 || ether_type == 0x88A8) && length >= offset + 4)
+		{
+			key.vlan = read16(offset) & 0x0FFF;
+			ether_type = read16(offset + 2);
+			offset += 4;
+		}
+
+		const uint8_t* source = nullptr;
+		const uint8_t* destination = nullptr;
+		size_t address_length = 0;
+		size_t transport = 0;
+		auto has_ports = true;
+
+		if (ether_type == 0x0800 && length >= offset + 20)
+		{
+			const auto header_length = static_cast<size_t>(frame[offset] & 0x0F) * 4;
+
+			key.ip_version = 4;
+			key.protocol = frame[offset + 9];
+			source = frame + offset + 12;
+			destination = frame + offset + 16;
+			address_length = 4;
+			transport = offset + header_length;
+			has_ports = (read16(offset + 6) & 0x1FFF) == 0;
+		}
+		else if (ether_type == 0x86DD && length >= offset + sizeof(ipv6hdr))
+		{
+			const auto* const ip_header = reinterpret_cast<const ipv6hdr*>(frame + offset);
+			net::ipv6_packet_info info;
+			net::ipv6_helper::parse(ip_header, static_cast<unsigned>(length - offset), info);
+
+			key.ip_version = 6;
+			key.protocol = info.protocol;
+			source = frame + offset + offsetof(ipv6hdr, ip6_src);
+			destination = frame + offset + offsetof(ipv6hdr, ip6_dst);
+			address_length = 16;
+			transport = offset + info.transport_offset;
+			// non-first fragments and malformed header chains have no upper layer header
+			has_ports = info.transport != nullptr && info.transport_length >= 4;
+		}
+		else
+		{
+			return key;
+		}
+
+		uint16_t source_port = 0;
+		uint16_t destination_port = 0;
+
+		if (has_ports && (key.protocol == 6 || key.protocol == 17 || key.protocol == 132) && length >= transport + 4)
+		{
+			source_port = read16(transport);
+			destination_port = read16(transport + 2);
+		}
+
+		const auto order = std::memcmp(source, destination, address_length);
+
+		if (order < 0 || (order == 0 && source_port <= destination_port))
+		{
+			std::memcpy(key.lower_address, source, address_length);
+			std::memcpy(key.upper_address, destination, address_length);
+			key.lower_port = source_port;
+			key.upper_port = destination_port;
+		}
+		else
+		{
+			std::memcpy(key.lower_address, destination, address_length);
+			std::memcpy(key.upper_address, source, address_length);
+			key.lower_port = destination_port;
+			key.upper_port = source_port;
+		}
+
+		return key;
+	}
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Record tag passed by the capture writers to the flow_index_builder
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_index_tag
+	{
+		flow_key key;
+		/// <summary>nanoseconds since the Unix epoch</summary>
+		uint64_t timestamp;
+		/// <summary>original packet length</summary>
+		uint32_t packet_length;
+		uint32_t reserved;
+	};
+
+	static_assert(sizeof(flow_index_tag) <= async_file_writer::max_tag_length);
+
+	/// <summary>flow index sidecar file signature ("WPFI")</summary>
+	constexpr uint32_t flow_index_magic = 0x49465057;
+	/// <summary>flow index sidecar format version</summary>
+	constexpr uint32_t flow_index_version = 2;
+	/// <summary>flow index sidecar file extension, appended to the capture file name</summary>
+	constexpr char flow_index_extension[] = ".idx";
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Flow index sidecar layout: header, flows sorted by key, time buckets sorted by
+	/// time and the record offsets array referenced by the flows.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_index_header
+	{
+		uint32_t magic;
+		uint32_t version;
+		/// <summary>time bucket width in nanoseconds</summary>
+		uint64_t bucket_width;
+		uint64_t flow_count;
+		uint64_t bucket_count;
+		uint64_t offset_count;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Flow summary stored in the sidecar
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_index_flow
+	{
+		flow_key key;
+		/// <summary>first packet timestamp</summary>
+		uint64_t first_timestamp;
+		/// <summary>last packet timestamp</summary>
+		uint64_t last_timestamp;
+		uint64_t packets;
+		/// <summary>sum of the original packet lengths</summary>
+		uint64_t bytes;
+		/// <summary>index of the first record offset in the offsets array</summary>
+		uint64_t first_offset;
+		/// <summary>number of record offsets (equals packets)</summary>
+		uint64_t offset_count;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Time bucket stored in the sidecar. Records of the different producer threads may
+	/// be slightly out of the timestamp order, so the bucket keeps the offset range
+	/// covering all its records.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct flow_index_bucket
+	{
+		/// <summary>bucket start time (multiple of the bucket width)</summary>
+		uint64_t start_time;
+		/// <summary>lowest record offset in the bucket</summary>
+		uint64_t first_offset;
+		/// <summary>highest record offset in the bucket</summary>
+		uint64_t last_offset;
+		uint64_t packets;
+		uint64_t bytes;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Builds the flow index of the capture file incrementally, as the I/O thread of the
+	/// writer places the records, and writes it as file_name.idx when the file (or the
+	/// rotating segment) is complete. Memory use grows with the number of packets in the
+	/// file (8 bytes per record offset plus the per-flow and per-bucket summaries).
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class flow_index_builder final : public async_file_writer::record_observer
+	{
+	public:
+		/// <summary>default time bucket width</summary>
+		static constexpr std::chrono::nanoseconds default_bucket_width = std::chrono::seconds(1);
+
+		explicit flow_index_builder(const std::chrono::nanoseconds bucket_width = default_bucket_width)
+			: bucket_width_(static_cast<uint64_t>((std::max)(bucket_width.count(),
+			                                                 static_cast<std::chrono::nanoseconds::rep>(1))))
+		{
+		}
+
+		void on_file_opened(const std::string&) noexcept override
+		{
+			flows_.clear();
+			buckets_.clear();
+			failed_ = false;
+		}
+
+		void on_record(const uint64_t offset, const void* tag, const uint32_t tag_length) noexcept override
+		{
+			if (tag_length != sizeof(flow_index_tag) || failed_)
+				return;
+
+			flow_index_tag record{};
+			std::memcpy(&record, tag, sizeof(record));
+
+			try
+			{
+				auto& flow = flows_[record.key];
+
+				if (flow.offsets.empty())
+				{
+					flow.first_timestamp = record.timestamp;
+					flow.last_timestamp = record.timestamp;
+				}
+
+				flow.first_timestamp = (std::min)(flow.first_timestamp, record.timestamp);
+				flow.last_timestamp = (std::max)(flow.last_timestamp, record.timestamp);
+				flow.bytes += record.packet_length;
+				flow.offsets.push_back(offset);
+
+				auto& bucket = buckets_[record.timestamp / bucket_width_];
+
+				if (bucket.packets == 0)
+				{
+					bucket.first_offset = offset;
+					bucket.last_offset = offset;
+				}
+
+				bucket.first_offset = (std::min)(bucket.first_offset, offset);
+				bucket.last_offset = (std::max)(bucket.last_offset, offset);
+				++bucket.packets;
+				bucket.bytes += record.packet_length;
+			}
+			catch (...)
+			{
+				// out of memory: an incomplete index is worse than none
+				failed_ = true;
+				flows_.clear();
+				buckets_.clear();
+			}
+		}
+
+		void on_file_closed(const std::string& file_name) noexcept override
+		{
+			if (!failed_)
+			{
+				try
+				{
+					write(file_name + flow_index_extension);
+				}
+				catch (...)
+				{
+				}
+			}
+
+			flows_.clear();
+			buckets_.clear();
+		}
+
+		void on_file_deleted(const std::string& file_name) noexcept override
+		{
+			try
+			{
+				DeleteFileA((file_name + flow_index_extension).c_str());
+			}
+			catch (...)
+			{
+			}
+		}
+
+	private:
+		struct flow_state
+		{
+			uint64_t first_timestamp{0};
+			uint64_t last_timestamp{0};
+			uint64_t bytes{0};
+			std::vector<uint64_t> offsets;
+		};
+
+		struct bucket_state
+		{
+			uint64_t first_offset{0};
+			uint64_t last_offset{0};
+			uint64_t packets{0};
+			uint64_t bytes{0};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the sidecar to the temporary file and renames it, so the readers never
+		/// see the partially written index
+		/// </summary>
+		// ********************************************************************************
+		void write(const std::string& index_name) const
+		{
+			std::vector<const std::pair<const flow_key, flow_state>*> flows;
+			flows.reserve(flows_.size());
+
+			uint64_t offset_count = 0;
+
+			for (const auto& flow : flows_)
+			{
+				flows.push_back(&flow);
+				offset_count += flow.second.offsets.size();
+			}
+
+			std::sort(flows.begin(), flows.end(), [](const auto* lhs, const auto* rhs)
+			{
+				return lhs->first < rhs->first;
+			});
+
+			const auto temporary_name = index_name + ".tmp";
+
+			{
+				std::ofstream file_stream(temporary_name, std::ofstream::binary | std::ofstream::out |
+				                          std::ofstream::trunc);
+
+				if (!file_stream)
+					return;
+
+				const flow_index_header header{
+					flow_index_magic, flow_index_version, bucket_width_, flows.size(), buckets_.size(), offset_count
+				};
+
+				file_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+				uint64_t first_offset = 0;
+
+				for (const auto* flow : flows)
+				{
+					const auto& state = flow->second;
+
+					const flow_index_flow record{
+						flow->first, state.first_timestamp, state.last_timestamp, state.offsets.size(), state.bytes,
+						first_offset, state.offsets.size()
+					};
+
+					file_stream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+					first_offset += state.offsets.size();
+				}
+
+				for (const auto& [bucket, state] : buckets_)
+				{
+					const flow_index_bucket record{
+						bucket * bucket_width_, state.first_offset, state.last_offset, state.packets, state.bytes
+					};
+
+					file_stream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+				}
+
+				for (const auto* flow : flows)
+				{
+					const auto& offsets = flow->second.offsets;
+					file_stream.write(reinterpret_cast<const char*>(offsets.data()),
+					                  static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+				}
+
+				if (!file_stream.flush())
+				{
+					file_stream.close();
+					DeleteFileA(temporary_name.c_str());
+					return;
+				}
+			}
+
+			if (!MoveFileExA(temporary_name.c_str(), index_name.c_str(), MOVEFILE_REPLACE_EXISTING))
+				DeleteFileA(temporary_name.c_str());
+		}
+
+		/// <summary>time bucket width in nanoseconds</summary>
+		uint64_t bucket_width_;
+		/// <summary>flows of the current file</summary>
+		std::unordered_map<flow_key, flow_state, flow_key_hash> flows_;
+		/// <summary>time buckets of the current file (bucket number -> summary)</summary>
+		std::map<uint64_t, bucket_state> buckets_;
+		/// <summary>index of the current file is incomplete</summary>
+		bool failed_{false};
+	};
+}
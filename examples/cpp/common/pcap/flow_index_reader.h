@@ -0,0 +1,283 @@
+#pragma once
+
+#include "flow_index.h"
+#include "capture_file_reader.h"
+
+namespace pcap
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Memory mapped flow index sidecar reader. Used together with capture_file_reader
+	/// to read one conversation or a time range without scanning the whole capture.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class flow_index_reader
+	{
+	public:
+		flow_index_reader() = default;
+
+		/// <summary>
+		/// Constructs the reader and maps the index
+		/// </summary>
+		/// <param name="index_name">sidecar file name (capture file name + flow_index_extension)</param>
+		explicit flow_index_reader(const std::string& index_name)
+		{
+			open(index_name);
+		}
+
+		/// <summary>
+		/// Typecast to bool returns true if the index was successfully mapped
+		/// </summary>
+		explicit operator bool() const { return header_ != nullptr; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Maps the index and validates its layout
+		/// </summary>
+		/// <param name="index_name">sidecar file name</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const std::string& index_name)
+		{
+			close();
+
+			if (!file_.open(index_name, sizeof(flow_index_header)))
+				return false;
+
+			const auto* header = reinterpret_cast<const flow_index_header*>(file_.data());
+
+			// time_range divides by the bucket width
+			if (header->magic != flow_index_magic || header->version != flow_index_version || header->bucket_width == 0)
+			{
+				close();
+				return false;
+			}
+
+			// each table must fit into the file part left after the previous ones, the counts are compared
+			// against the remaining size divided by the entry size so the multiplication can't overflow
+			auto available = static_cast<uint64_t>(file_.size() - sizeof(flow_index_header));
+
+			if (header->flow_count > available / sizeof(flow_index_flow))
+			{
+				close();
+				return false;
+			}
+
+			available -= header->flow_count * sizeof(flow_index_flow);
+
+			if (header->bucket_count > available / sizeof(flow_index_bucket))
+			{
+				close();
+				return false;
+			}
+
+			available -= header->bucket_count * sizeof(flow_index_bucket);
+
+			if (header->offset_count > available / sizeof(uint64_t))
+			{
+				close();
+				return false;
+			}
+
+			header_ = header;
+			flows_ = reinterpret_cast<const flow_index_flow*>(header_ + 1);
+			buckets_ = reinterpret_cast<const flow_index_bucket*>(flows_ + header_->flow_count);
+			offsets_ = reinterpret_cast<const uint64_t*>(buckets_ + header_->bucket_count);
+
+			for (uint64_t i = 0; i < header_->flow_count; ++i)
+			{
+				if (flows_[i].first_offset > header_->offset_count || flows_[i].offset_count > header_->offset_count -
+					flows_[i].first_offset)
+				{
+					close();
+					return false;
+				}
+			}
+
+			// time_range binary searches the buckets by the start time
+			for (uint64_t i = 0; i < header_->bucket_count; ++i)
+			{
+				if (buckets_[i].first_offset > buckets_[i].last_offset ||
+					(i != 0 && buckets_[i - 1].start_time >= buckets_[i].start_time))
+				{
+					close();
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Unmaps the index
+		/// </summary>
+		void close() noexcept
+		{
+			file_.close();
+			header_ = nullptr;
+			flows_ = nullptr;
+			buckets_ = nullptr;
+			offsets_ = nullptr;
+		}
+
+		/// <summary>
+		/// Returns the number of flows
+		/// </summary>
+		[[nodiscard]] size_t flow_count() const noexcept { return header_ ? static_cast<size_t>(header_->flow_count) : 0; }
+
+		/// <summary>
+		/// Returns the flow summaries sorted by key
+		/// </summary>
+		[[nodiscard]] const flow_index_flow* flows() const noexcept { return flows_; }
+
+		/// <summary>
+		/// Returns the number of time buckets
+		/// </summary>
+		[[nodiscard]] size_t bucket_count() const noexcept
+		{
+			return header_ ? static_cast<size_t>(header_->bucket_count) : 0;
+		}
+
+		/// <summary>
+		/// Returns the time buckets sorted by time
+		/// </summary>
+		[[nodiscard]] const flow_index_bucket* buckets() const noexcept { return buckets_; }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the flow by its key (binary search)
+		/// </summary>
+		/// <param name="key">conversation key (see make_flow_key)</param>
+		/// <returns>flow summary or nullptr</returns>
+		// ********************************************************************************
+		[[nodiscard]] const flow_index_flow* find(const flow_key& key) const noexcept
+		{
+			if (header_ == nullptr)
+				return nullptr;
+
+			const auto* end = flows_ + header_->flow_count;
+			const auto* it = std::lower_bound(flows_, end, key, [](const flow_index_flow& flow, const flow_key& value)
+			{
+				return flow.key < value;
+			});
+
+			return it != end && it->key == key ? it : nullptr;
+		}
+
+		/// <summary>
+		/// Returns the record offsets of the flow, in the file order
+		/// </summary>
+		[[nodiscard]] const uint64_t* offsets(const flow_index_flow& flow) const noexcept
+		{
+			return offsets_ + flow.first_offset;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the file offset range of the records in the time range
+		/// </summary>
+		/// <param name="start_time">range start, nanoseconds since the Unix epoch</param>
+		/// <param name="end_time">range end (inclusive)</param>
+		/// <returns>first and last record offsets or std::nullopt if no bucket overlaps the range</returns>
+		// ********************************************************************************
+		[[nodiscard]] std::optional<std::pair<uint64_t, uint64_t>> time_range(
+			const uint64_t start_time, const uint64_t end_time) const noexcept
+		{
+			if (header_ == nullptr)
+				return std::nullopt;
+
+			const auto first_bucket = start_time - start_time % header_->bucket_width;
+			const auto* end = buckets_ + header_->bucket_count;
+			const auto* it = std::lower_bound(buckets_, end, first_bucket,
+			                                  [](const flow_index_bucket& bucket, const uint64_t value)
+			                                  {
+				                                  return bucket.start_time < value;
+			                                  });
+
+			std::optional<std::pair<uint64_t, uint64_t>> result;
+
+			for (; it != end && it->start_time <= end_time; ++it)
+			{
+				if (!result)
+					result = std::make_pair(it->first_offset, it->last_offset);
+
+				result->first = (std::min)(result->first, it->first_offset);
+				result->second = (std::max)(result->second, it->last_offset);
+			}
+
+			return result;
+		}
+
+	private:
+		/// <summary>sidecar mapping</summary>
+		mapped_file file_;
+		const flow_index_header* header_{nullptr};
+		const flow_index_flow* flows_{nullptr};
+		const flow_index_bucket* buckets_{nullptr};
+		const uint64_t* offsets_{nullptr};
+	};
+
+	// ********************************************************************************
+	/// <summary>
+	/// Reads the packets of one conversation using the flow index
+	/// </summary>
+	/// <param name="reader">capture file reader</param>
+	/// <param name="index">flow index of the capture file</param>
+	/// <param name="flow">flow summary from the index</param>
+	/// <param name="handler">called with each packet_view, in the file order</param>
+	/// <returns>number of packets read</returns>
+	// ********************************************************************************
+	template <typename F>
+	size_t read_flow(capture_file_reader& reader, const flow_index_reader& index, const flow_index_flow& flow,
+	                 F&& handler)
+	{
+		size_t result = 0;
+		const auto* offsets = index.offsets(flow);
+
+		for (uint64_t i = 0; i < flow.offset_count; ++i)
+		{
+			if (packet_view view{}; reader.seek(offsets[i]) && reader.next(view))
+			{
+				handler(view);
+				++result;
+			}
+		}
+
+		return result;
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Reads the packets with the timestamps in the range using the flow index time
+	/// buckets: only the file part covering the matching buckets is read
+	/// </summary>
+	/// <param name="reader">capture file reader</param>
+	/// <param name="index">flow index of the capture file</param>
+	/// <param name="start_time">range start, nanoseconds since the Unix epoch</param>
+	/// <param name="end_time">range end (inclusive)</param>
+	/// <param name="handler">called with each packet_view, in the file order</param>
+	/// <returns>number of packets read</returns>
+	// ********************************************************************************
+	template <typename F>
+	size_t read_time_range(capture_file_reader& reader, const flow_index_reader& index, const uint64_t start_time,
+	                       const uint64_t end_time, F&& handler)
+	{
+		const auto range = index.time_range(start_time, end_time);
+
+		if (!range || !reader.seek(range->first))
+			return 0;
+
+		size_t result = 0;
+
+		for (packet_view view{}; reader.tell() <= range->second && reader.next(view);)
+		{
+			if (view.timestamp >= start_time && view.timestamp <= end_time)
+			{
+				handler(view);
+				++result;
+			}
+		}
+
+		return result;
+	}
+}
@@ -220,6 +220,16 @@ namespace pcap
 		LINKTYPE_ISO_14443 = 264
 	};
 
+	/// <summary>
+	/// PCAP file magic number for the microsecond resolution timestamps
+	/// </summary>
+	constexpr uint32_t pcap_magic_microseconds = 0xa1b2c3d4;
+
+	/// <summary>
+	/// PCAP file magic number for the nanosecond resolution timestamps
+	/// </summary>
+	constexpr uint32_t pcap_magic_nanoseconds = 0xa1b23c4d;
+
 	/// <summary>
 	/// PCAP file header representation
 	/// </summary>
@@ -248,7 +258,7 @@ namespace pcap
 	{
 		/// <summary>timestamp seconds</summary>
 		uint32_t ts_sec;
-		/// <summary>timestamp microseconds</summary>
+		/// <summary>timestamp microseconds (nanoseconds if pcap_magic_nanoseconds is used)</summary>
 		uint32_t ts_usec;
 		/// <summary>number of octets of packet saved in file</summary>
 		uint32_t incl_len;
@@ -271,13 +281,21 @@ namespace pcap
 		/// <param name="sig_figs">accuracy of timestamps</param>
 		/// <param name="snap_len">max length of captured packets, in octets</param>
 		/// <param name="network">data link type</param>
+		/// <param name="magic_number">pcap_magic_microseconds or pcap_magic_nanoseconds</param>
 		pcap_file_header(const uint16_t version_major, const uint16_t version_minor, const int32_t this_zone,
 		                 const uint32_t sig_figs,
-		                 const uint32_t snap_len, const link_layer_type network) noexcept
-			: header_{0xa1b2c3d4, version_major, version_minor, this_zone, sig_figs, snap_len, network}
+		                 const uint32_t snap_len, const link_layer_type network,
+		                 const uint32_t magic_number = pcap_magic_microseconds) noexcept
+			: header_{magic_number, version_major, version_minor, this_zone, sig_figs, snap_len, network}
 		{
 		}
 
+		/// <summary>
+		/// Returns the PCAP header structure
+		/// </summary>
+		/// <returns>pcap_hdr_t reference</returns>
+		[[nodiscard]] const pcap_hdr_t& get_header() const noexcept { return header_; }
+
 		/// <summary>
 		/// Writes pcap_file_header into the specified stream
 		/// </summary>
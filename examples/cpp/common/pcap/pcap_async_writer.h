@@ -0,0 +1,205 @@
+#pragma once
+
+#include "pcap.h"
+#include "async_file_writer.h"
+#include "flow_index.h"
+
+namespace pcap
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// PCAP record timestamp resolution
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class timestamp_resolution
+	{
+		/// <summary>classic PCAP, microsecond timestamps</summary>
+		microseconds,
+		/// <summary>PCAP with pcap_magic_nanoseconds, nanosecond timestamps</summary>
+		nanoseconds
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Buffered asynchronous PCAP writer (see async_file_writer). Writing a packet never
+	/// blocks: if the calling thread staging ring is full the packet is dropped and
+	/// counted in the statistics.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class pcap_async_writer
+	{
+	public:
+		using statistics = async_file_writer::statistics;
+		using rotation_policy = async_file_writer::rotation_policy;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the writer
+		/// </summary>
+		/// <param name="resolution">timestamp resolution of the PCAP file</param>
+		/// <param name="staging_size">per-thread staging ring size</param>
+		/// <param name="block_size">file write block size</param>
+		/// <param name="flush_interval">maximum delay before the queued data reaches the file</param>
+		// ********************************************************************************
+		explicit pcap_async_writer(const timestamp_resolution resolution = timestamp_resolution::nanoseconds,
+		                           const uint32_t staging_size = async_file_writer::default_staging_size,
+		                           const uint32_t block_size = async_file_writer::default_block_size,
+		                           const std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000))
+			: nanosecond_timestamps_(resolution == timestamp_resolution::nanoseconds),
+			  writer_(staging_size, block_size, flush_interval)
+		{
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the writer and opens the file
+		/// </summary>
+		/// <param name="file_name">PCAP file name</param>
+		/// <param name="resolution">timestamp resolution of the PCAP file</param>
+		// ********************************************************************************
+		explicit pcap_async_writer(const std::string& file_name,
+		                           const timestamp_resolution resolution = timestamp_resolution::nanoseconds)
+			: pcap_async_writer(resolution)
+		{
+			open(file_name);
+		}
+
+		/// <summary>
+		/// Typecast to bool returns true is file was successfully opened
+		/// </summary>
+		explicit operator bool() const { return static_cast<bool>(writer_); }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Enables the flow index sidecar (see flow_index_builder): file_name.idx is written
+		/// next to each completed capture file or segment. Must be called before open.
+		/// </summary>
+		/// <param name="bucket_width">time bucket width of the index</param>
+		/// <returns>true on success, false if the file is already open</returns>
+		// ********************************************************************************
+		bool enable_flow_index(const std::chrono::nanoseconds bucket_width = flow_index_builder::default_bucket_width)
+		{
+			if (writer_)
+				return false;
+
+			flow_index_ = std::make_unique<flow_index_builder>(bucket_width);
+			writer_.set_record_observer(flow_index_.get());
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Opens (truncates) the file and writes the PCAP header
+		/// </summary>
+		/// <param name="file_name">PCAP file name</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const std::string& file_name)
+		{
+			const auto header = make_file_header();
+
+			return writer_.open(file_name, &header.get_header(), sizeof(pcap_hdr_t));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Starts writing the rotating set of PCAP segment files, each with its own header
+		/// </summary>
+		/// <param name="policy">segment size/time limits, naming and retention</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const rotation_policy& policy)
+		{
+			const auto header = make_file_header();
+
+			return writer_.open(policy, ".pcap", &header.get_header(), sizeof(pcap_hdr_t));
+		}
+
+		/// <summary>
+		/// Writes out all queued packets and closes the file
+		/// </summary>
+		void close() { writer_.close(); }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queues network packet stored in INTERMEDIATE_BUFFER
+		/// </summary>
+		/// <param name="buffer">network packet</param>
+		/// <param name="timestamp">packet timestamp (see timestamp_now)</param>
+		/// <returns>true if queued, false if dropped or the file is not open</returns>
+		// ********************************************************************************
+		bool write(const INTERMEDIATE_BUFFER& buffer, const uint64_t timestamp) noexcept
+		{
+			return write(reinterpret_cast<const char*>(buffer.m_IBuffer), buffer.m_Length, timestamp,
+			             net::vlan_helper::vlan_of_8021q_info(buffer.m_8021q));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queues Ethernet frame
+		/// </summary>
+		/// <param name="data">frame data</param>
+		/// <param name="length">frame length</param>
+		/// <param name="timestamp">frame timestamp in nanoseconds since the Unix epoch</param>
+		/// <param name="vlan">out-of-band VLAN identifier for the flow index, the in-band tag takes precedence</param>
+		/// <returns>true if queued, false if dropped or the file is not open</returns>
+		// ********************************************************************************
+		bool write(const char* data, const uint32_t length, const uint64_t timestamp, const uint16_t vlan = 0) noexcept
+		{
+			const auto incl_len = (std::min)(length, static_cast<uint32_t>(MAX_ETHER_FRAME));
+
+			const pcaprec_hdr_t record_header{
+				static_cast<uint32_t>(timestamp / 1000000000),
+				static_cast<uint32_t>(nanosecond_timestamps_
+					                      ? timestamp % 1000000000
+					                      : (timestamp % 1000000000) / 1000),
+				incl_len,
+				length
+			};
+
+			if (!flow_index_)
+				return writer_.write({{&record_header, sizeof(pcaprec_hdr_t)}, {data, incl_len}}, length);
+
+			const flow_index_tag tag{
+				make_flow_key(reinterpret_cast<const uint8_t*>(data), incl_len, vlan), timestamp, length, 0
+			};
+
+			return writer_.write({{&record_header, sizeof(pcaprec_hdr_t)}, {data, incl_len}}, length, &tag,
+			                     sizeof(tag));
+		}
+
+		/// <summary>
+		/// Queues network packet stored in INTERMEDIATE_BUFFER timestamped now
+		/// </summary>
+		/// <param name="buffer">network packet</param>
+		/// <returns>this object reference</returns>
+		pcap_async_writer& operator<<(const INTERMEDIATE_BUFFER& buffer) noexcept
+		{
+			write(buffer, timestamp_now());
+			return *this;
+		}
+
+		/// <summary>
+		/// Returns the snapshot of the writer counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		[[nodiscard]] statistics get_statistics() const { return writer_.get_statistics(); }
+
+	private:
+		[[nodiscard]] pcap_file_header make_file_header() const
+		{
+			return {
+				2, 4, 0, 0, MAX_ETHER_FRAME, LINKTYPE_ETHERNET,
+				nanosecond_timestamps_ ? pcap_magic_nanoseconds : pcap_magic_microseconds
+			};
+		}
+
+		/// <summary>use nanosecond timestamps</summary>
+		bool nanosecond_timestamps_;
+		/// <summary>flow index builder, declared before the engine which reports to it until closed</summary>
+		std::unique_ptr<flow_index_builder> flow_index_;
+		/// <summary>storage engine</summary>
+		async_file_writer writer_;
+	};
+}
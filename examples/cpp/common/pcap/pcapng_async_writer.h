@@ -0,0 +1,394 @@
+#pragma once
+
+#include "pcap.h"
+#include "async_file_writer.h"
+#include "flow_index.h"
+
+namespace pcap
+{
+	/// <summary>pcapng Section Header Block type</summary>
+	constexpr uint32_t pcapng_section_header_block = 0x0A0D0D0A;
+	/// <summary>pcapng Interface Description Block type</summary>
+	constexpr uint32_t pcapng_interface_description_block = 0x00000001;
+	/// <summary>pcapng Enhanced Packet Block type</summary>
+	constexpr uint32_t pcapng_enhanced_packet_block = 0x00000006;
+	/// <summary>pcapng byte-order magic</summary>
+	constexpr uint32_t pcapng_byte_order_magic = 0x1A2B3C4D;
+	/// <summary>
+	/// Private Enterprise Number tagging the custom options of the writer.
+	/// EXPERIMENTAL: 32473 is the RFC 5612 documentation number, not a registered PEN,
+	/// so other files may use it for unrelated data. The packet info option is
+	/// therefore only meaningful to capture_file_reader, and its layout may change
+	/// once a registered PEN is assigned.
+	/// </summary>
+	constexpr uint32_t pcapng_custom_option_pen = 32473;
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// pcapng option codes used by the writer
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum pcapng_option_code : uint16_t
+	{
+		/// <summary>end of options</summary>
+		opt_endofopt = 0,
+		/// <summary>UTF-8 comment</summary>
+		opt_comment = 1,
+		/// <summary>SHB: application that created the section</summary>
+		shb_userappl = 4,
+		/// <summary>IDB: interface name</summary>
+		if_name = 2,
+		/// <summary>IDB: interface description</summary>
+		if_description = 3,
+		/// <summary>IDB: timestamp resolution</summary>
+		if_tsresol = 9,
+		/// <summary>IDB: offset of the timestamps in seconds</summary>
+		if_tsoffset = 14,
+		/// <summary>EPB: link layer flags (direction, reception type)</summary>
+		epb_flags = 2,
+		/// <summary>custom option with the UTF-8 data, may be copied</summary>
+		opt_custom_string = 2988,
+		/// <summary>custom option with the binary data, may be copied</summary>
+		opt_custom_binary = 2989
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Enhanced Packet Block custom option (opt_custom_binary) carrying the WinpkFilter
+	/// packet fields, all values in the section byte order
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct pcapng_packet_info_option
+	{
+		/// <summary>pcapng_custom_option_pen</summary>
+		uint32_t pen;
+		/// <summary>INTERMEDIATE_BUFFER::m_8021q</summary>
+		uint32_t vlan_info;
+		/// <summary>INTERMEDIATE_BUFFER::m_FilterID</summary>
+		uint32_t filter_id;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Packet direction recorded in the epb_flags option
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class packet_direction : uint32_t
+	{
+		/// <summary>derive from INTERMEDIATE_BUFFER::m_dwDeviceFlags</summary>
+		from_device_flags = 0xFFFFFFFF,
+		/// <summary>direction is not known</summary>
+		unknown = 0,
+		/// <summary>packet was received on the interface</summary>
+		inbound = 1,
+		/// <summary>packet was sent on the interface</summary>
+		outbound = 2
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Buffered asynchronous pcapng writer (see async_file_writer). The section contains
+	/// one Interface Description Block per network adapter, so the packets of all
+	/// adapters are merged into a single file. Each packet is written as an Enhanced
+	/// Packet Block with the direction in epb_flags. Non-zero 802.1Q information and
+	/// WinpkFilter filter ID are recorded in the PEN-tagged custom option
+	/// (pcapng_packet_info_option), which the readers not knowing it skip.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class pcapng_async_writer
+	{
+	public:
+		using statistics = async_file_writer::statistics;
+		using rotation_policy = async_file_writer::rotation_policy;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Interface Description Block parameters
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct interface_description
+		{
+			/// <summary>interface name (e.g. adapter internal name)</summary>
+			std::string name;
+			/// <summary>interface description (e.g. adapter friendly name)</summary>
+			std::string description;
+			/// <summary>data link type</summary>
+			link_layer_type link_type{LINKTYPE_ETHERNET};
+			/// <summary>max length of captured packets, in octets</summary>
+			uint32_t snap_len{MAX_ETHER_FRAME};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the writer
+		/// </summary>
+		/// <param name="staging_size">per-thread staging ring size</param>
+		/// <param name="block_size">file write block size</param>
+		/// <param name="flush_interval">maximum delay before the queued data reaches the file</param>
+		// ********************************************************************************
+		explicit pcapng_async_writer(const uint32_t staging_size = async_file_writer::default_staging_size,
+		                             const uint32_t block_size = async_file_writer::default_block_size,
+		                             const std::chrono::milliseconds flush_interval =
+			                             std::chrono::milliseconds(1000))
+			: writer_(staging_size, block_size, flush_interval)
+		{
+		}
+
+		/// <summary>
+		/// Typecast to bool returns true is file was successfully opened
+		/// </summary>
+		explicit operator bool() const { return static_cast<bool>(writer_); }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Enables the flow index sidecar (see flow_index_builder): file_name.idx is written
+		/// next to each completed capture file or segment. Must be called before open.
+		/// </summary>
+		/// <param name="bucket_width">time bucket width of the index</param>
+		/// <returns>true on success, false if the file is already open</returns>
+		// ********************************************************************************
+		bool enable_flow_index(const std::chrono::nanoseconds bucket_width = flow_index_builder::default_bucket_width)
+		{
+			if (writer_)
+				return false;
+
+			flow_index_ = std::make_unique<flow_index_builder>(bucket_width);
+			writer_.set_record_observer(flow_index_.get());
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Opens (truncates) the file and writes the Section Header Block followed by the
+		/// Interface Description Blocks. Interface ID used by write is the index in the
+		/// interfaces list.
+		/// </summary>
+		/// <param name="file_name">pcapng file name</param>
+		/// <param name="interfaces">capture interfaces</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const std::string& file_name, const std::vector<interface_description>& interfaces)
+		{
+			const auto preamble = make_preamble(interfaces);
+
+			return writer_.open(file_name, preamble.data(), preamble.size());
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Starts writing the rotating set of pcapng segment files, each segment starts with
+		/// the Section Header Block and the Interface Description Blocks
+		/// </summary>
+		/// <param name="policy">segment size/time limits, naming and retention</param>
+		/// <param name="interfaces">capture interfaces</param>
+		/// <returns>true on success</returns>
+		// ********************************************************************************
+		bool open(const rotation_policy& policy, const std::vector<interface_description>& interfaces)
+		{
+			const auto preamble = make_preamble(interfaces);
+
+			return writer_.open(policy, ".pcapng", preamble.data(), preamble.size());
+		}
+
+		/// <summary>
+		/// Writes out all queued packets and closes the file
+		/// </summary>
+		void close() { writer_.close(); }
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queues network packet stored in INTERMEDIATE_BUFFER as Enhanced Packet Block
+		/// </summary>
+		/// <param name="interface_id">index of the interface passed to open</param>
+		/// <param name="buffer">network packet</param>
+		/// <param name="timestamp">packet timestamp in nanoseconds since the Unix epoch</param>
+		/// <param name="direction">packet direction, by default derived from m_dwDeviceFlags</param>
+		/// <returns>true if queued, false if dropped, the interface is unknown or the file is not open</returns>
+		// ********************************************************************************
+		bool write(const uint32_t interface_id, const INTERMEDIATE_BUFFER& buffer, const uint64_t timestamp,
+		           packet_direction direction = packet_direction::from_device_flags) noexcept
+		{
+			if (interface_id >= interface_count_)
+				return false;
+
+			if (direction == packet_direction::from_device_flags)
+			{
+				direction = buffer.m_dwDeviceFlags == PACKET_FLAG_ON_SEND
+					            ? packet_direction::outbound
+					            : buffer.m_dwDeviceFlags == PACKET_FLAG_ON_RECEIVE
+					            ? packet_direction::inbound
+					            : packet_direction::unknown;
+			}
+
+			const auto captured_length = (std::min)(buffer.m_Length, static_cast<DWORD>(MAX_ETHER_FRAME));
+			const auto padding = (4 - captured_length % 4) % 4;
+
+			// options: epb_flags, optional packet info and opt_endofopt, followed by the trailing block length
+			std::array<char, 64> trailer{};
+			auto trailer_length = padding;
+
+			const auto put = [&trailer, &trailer_length](const void* data, const size_t length)
+			{
+				std::memcpy(trailer.data() + trailer_length, data, length);
+				trailer_length += static_cast<uint32_t>(length);
+			};
+
+			const uint16_t flags_option[2] = {epb_flags, sizeof(uint32_t)};
+			const auto flags = static_cast<uint32_t>(direction);
+			put(flags_option, sizeof(flags_option));
+			put(&flags, sizeof(flags));
+
+			if (buffer.m_8021q != 0 || buffer.m_FilterID != 0)
+			{
+				const uint16_t info_option[2] = {opt_custom_binary, sizeof(pcapng_packet_info_option)};
+				const pcapng_packet_info_option info{pcapng_custom_option_pen, buffer.m_8021q, buffer.m_FilterID};
+				put(info_option, sizeof(info_option));
+				put(&info, sizeof(info));
+			}
+
+			trailer_length += sizeof(uint32_t); // opt_endofopt (code and length are zero)
+
+			const auto block_total_length = static_cast<uint32_t>(sizeof(epb_header) + captured_length +
+				trailer_length + sizeof(uint32_t));
+
+			put(&block_total_length, sizeof(block_total_length));
+
+			const epb_header header{
+				pcapng_enhanced_packet_block,
+				block_total_length,
+				interface_id,
+				static_cast<uint32_t>(timestamp >> 32),
+				static_cast<uint32_t>(timestamp),
+				captured_length,
+				buffer.m_Length
+			};
+
+			if (!flow_index_)
+			{
+				return writer_.write({
+					                     {&header, sizeof(header)},
+					                     {buffer.m_IBuffer, captured_length},
+					                     {trailer.data(), trailer_length}
+				                     }, buffer.m_Length);
+			}
+
+			const flow_index_tag tag{
+				make_flow_key(buffer.m_IBuffer, captured_length, net::vlan_helper::vlan_of_8021q_info(buffer.m_8021q)),
+				timestamp, buffer.m_Length, 0
+			};
+
+			return writer_.write({
+				                     {&header, sizeof(header)},
+				                     {buffer.m_IBuffer, captured_length},
+				                     {trailer.data(), trailer_length}
+			                     }, buffer.m_Length, &tag, sizeof(tag));
+		}
+
+		/// <summary>
+		/// Returns the snapshot of the writer counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		[[nodiscard]] statistics get_statistics() const { return writer_.get_statistics(); }
+
+	private:
+		/// <summary>
+		/// Enhanced Packet Block fixed part
+		/// </summary>
+		struct epb_header
+		{
+			uint32_t block_type;
+			uint32_t block_total_length;
+			uint32_t interface_id;
+			uint32_t timestamp_high;
+			uint32_t timestamp_low;
+			uint32_t captured_length;
+			uint32_t original_length;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the Section Header Block followed by the Interface Description Blocks
+		/// </summary>
+		// ********************************************************************************
+		std::vector<char> make_preamble(const std::vector<interface_description>& interfaces)
+		{
+			std::vector<char> preamble;
+
+			// Section Header Block
+			auto block_start = begin_block(preamble, pcapng_section_header_block);
+			append_value(preamble, pcapng_byte_order_magic);
+			append_value(preamble, static_cast<uint16_t>(1)); // major version
+			append_value(preamble, static_cast<uint16_t>(0)); // minor version
+			append_value(preamble, static_cast<int64_t>(-1)); // section length is not specified
+			append_option(preamble, shb_userappl, "Windows Packet Filter");
+			end_options(preamble);
+			end_block(preamble, block_start);
+
+			for (const auto& description : interfaces)
+			{
+				block_start = begin_block(preamble, pcapng_interface_description_block);
+				append_value(preamble, static_cast<uint16_t>(description.link_type));
+				append_value(preamble, static_cast<uint16_t>(0)); // reserved
+				append_value(preamble, description.snap_len);
+
+				if (!description.name.empty())
+					append_option(preamble, if_name, description.name);
+
+				if (!description.description.empty())
+					append_option(preamble, if_description, description.description);
+
+				constexpr uint8_t nanosecond_resolution = 9; // 10^-9
+				append_option(preamble, if_tsresol, std::string(1, static_cast<char>(nanosecond_resolution)));
+				end_options(preamble);
+				end_block(preamble, block_start);
+			}
+
+			interface_count_ = static_cast<uint32_t>(interfaces.size());
+
+			return preamble;
+		}
+
+		template <typename V>
+		static void append_value(std::vector<char>& block, const V& value)
+		{
+			const auto* const bytes = reinterpret_cast<const char*>(&value);
+			block.insert(block.end(), bytes, bytes + sizeof(V));
+		}
+
+		static size_t begin_block(std::vector<char>& block, const uint32_t block_type)
+		{
+			const auto block_start = block.size();
+			append_value(block, block_type);
+			append_value(block, static_cast<uint32_t>(0)); // patched in end_block
+			return block_start;
+		}
+
+		static void end_block(std::vector<char>& block, const size_t block_start)
+		{
+			const auto block_total_length = static_cast<uint32_t>(block.size() - block_start + sizeof(uint32_t));
+			append_value(block, block_total_length);
+			std::memcpy(block.data() + block_start + sizeof(uint32_t), &block_total_length, sizeof(uint32_t));
+		}
+
+		static void append_option(std::vector<char>& block, const uint16_t code, const std::string& value)
+		{
+			append_value(block, code);
+			append_value(block, static_cast<uint16_t>(value.size()));
+			block.insert(block.end(), value.cbegin(), value.cend());
+			block.resize(block.size() + (4 - value.size() % 4) % 4, 0);
+		}
+
+		static void end_options(std::vector<char>& block)
+		{
+			append_value(block, static_cast<uint32_t>(opt_endofopt));
+		}
+
+		/// <summary>number of interfaces described in the section</summary>
+		uint32_t interface_count_{0};
+		/// <summary>flow index builder, declared before the engine which reports to it until closed</summary>
+		std::unique_ptr<flow_index_builder> flow_index_;
+		/// <summary>storage engine</summary>
+		async_file_writer writer_;
+	};
+}
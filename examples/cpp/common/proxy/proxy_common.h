@@ -9,9 +9,12 @@ namespace proxy
 	{
 		relay_io_read,
 		relay_io_write,
+		relay_io_zero_read,
 		negotiate_io_read,
 		negotiate_io_write,
-		inject_io_write
+		inject_io_write,
+		accept_io,
+		connect_io
 	};
 
 	// --------------------------------------------------------------------------------
@@ -137,5 +137,10 @@ namespace proxy
 
 		std::optional<std::string> socks5_username{ std::nullopt };
 		std::optional<std::string> socks5_password{ std::nullopt };
+		/// <summary>send identification, authentication and CONNECT request in one go without
+		/// waiting for the intermediate responses (the single offered method is known to be accepted)</summary>
+		bool socks5_pipelining{ false };
+		/// <summary>remote socket was taken from socks5_connection_pool and is already authenticated</summary>
+		bool socks5_authenticated{ false };
 	};
 }
@@ -0,0 +1,554 @@
+#pragma once
+
+namespace proxy
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Keeps a number of TCP connections to the SOCKS5 server which have already passed
+	/// identification and USERNAME/PASSWORD authentication. A pooled connection only
+	/// needs the CONNECT request, which saves the TCP handshake and two round trips on
+	/// each proxied connection. Pool is refilled by the background thread.
+	/// </summary>
+	/// <typeparam name="T">address type (IPv4 or IPv6)</typeparam>
+	// --------------------------------------------------------------------------------
+	template <typename T>
+	class socks5_connection_pool
+	{
+	public:
+		using address_type_t = T;
+		using negotiate_context_t = socks5_negotiate_context<T>;
+
+		/// <summary>default maximum time a connection may stay idle in the pool</summary>
+		constexpr static std::chrono::seconds default_max_idle{30};
+		/// <summary>SOCKS5 server connect and handshake timeout</summary>
+		constexpr static std::chrono::milliseconds connect_timeout{5000};
+		/// <summary>delay after the first failed attempt, doubled on every next failure</summary>
+		constexpr static std::chrono::milliseconds min_backoff{1000};
+		/// <summary>maximum delay between the failed attempts</summary>
+		constexpr static std::chrono::milliseconds max_backoff{60000};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Pool usage counters snapshot
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>number of connections served from the pool</summary>
+			uint64_t hits;
+			/// <summary>number of requests which found the pool empty</summary>
+			uint64_t misses;
+			/// <summary>number of connections established and authenticated</summary>
+			uint64_t created;
+			/// <summary>number of failed connection or authentication attempts</summary>
+			uint64_t failed;
+			/// <summary>number of connections closed by the SOCKS5 server or expired in the pool</summary>
+			uint64_t expired;
+			/// <summary>number of connections currently available</summary>
+			uint64_t available;
+		};
+
+	private:
+		struct pooled_socket
+		{
+			SOCKET socket;
+			/// <summary>time the connection was put (or returned) into the pool</summary>
+			std::chrono::steady_clock::time_point idle_since;
+		};
+
+		/// <summary>SOCKS5 server address</summary>
+		address_type_t socks5_server_address_;
+		/// <summary>SOCKS5 server port</summary>
+		uint16_t socks5_server_port_;
+		/// <summary>SOCKS5 username (authentication is not used if not set)</summary>
+		std::optional<std::string> socks5_username_;
+		/// <summary>SOCKS5 password</summary>
+		std::optional<std::string> socks5_password_;
+		/// <summary>number of connections to keep ready</summary>
+		size_t pool_size_;
+		/// <summary>maximum time a connection may stay idle in the pool</summary>
+		std::chrono::steady_clock::duration max_idle_;
+
+		/// <summary>message logging function</summary>
+		std::function<void(const char*)> log_printer_;
+		/// <summary>logging level</summary>
+		netlib::log::log_level log_level_;
+
+		std::mutex lock_;
+		std::condition_variable refill_event_;
+		std::deque<pooled_socket> sockets_;
+		std::thread refill_thread_;
+		std::atomic_bool end_pool_{true};
+
+		std::atomic<uint64_t> hits_{0};
+		std::atomic<uint64_t> misses_{0};
+		std::atomic<uint64_t> created_{0};
+		std::atomic<uint64_t> failed_{0};
+		std::atomic<uint64_t> expired_{0};
+
+	public:
+		socks5_connection_pool(const address_type_t& socks5_server_address, const uint16_t socks5_server_port,
+		                       std::optional<std::string> socks5_username,
+		                       std::optional<std::string> socks5_password, const size_t pool_size,
+		                       std::function<void(const char*)> log_printer,
+		                       const netlib::log::log_level log_level,
+		                       const std::chrono::steady_clock::duration max_idle = default_max_idle)
+			: socks5_server_address_(socks5_server_address),
+			  socks5_server_port_(socks5_server_port),
+			  socks5_username_(std::move(socks5_username)),
+			  socks5_password_(std::move(socks5_password)),
+			  pool_size_(pool_size),
+			  max_idle_(max_idle),
+			  log_printer_(std::move(log_printer)),
+			  log_level_(log_level)
+		{
+		}
+
+		~socks5_connection_pool()
+		{
+			stop();
+		}
+
+		socks5_connection_pool(const socks5_connection_pool& other) = delete;
+		socks5_connection_pool(socks5_connection_pool&& other) noexcept = delete;
+		socks5_connection_pool& operator=(const socks5_connection_pool& other) = delete;
+		socks5_connection_pool& operator=(socks5_connection_pool&& other) noexcept = delete;
+
+		// ********************************************************************************
+		/// <summary>
+		/// Starts the background refill thread
+		/// </summary>
+		/// <returns>true if started</returns>
+		// ********************************************************************************
+		bool start()
+		{
+			if (end_pool_ == false || pool_size_ == 0)
+				return false;
+
+			end_pool_ = false;
+
+			refill_thread_ = std::thread(&socks5_connection_pool<T>::refill_thread, this);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stops the refill thread and closes all pooled connections
+		/// </summary>
+		// ********************************************************************************
+		void stop()
+		{
+			if (end_pool_ == true)
+				return;
+
+			{
+				std::lock_guard lock(lock_);
+				end_pool_ = true;
+			}
+
+			refill_event_.notify_all();
+
+			if (refill_thread_.joinable())
+				refill_thread_.join();
+
+			std::lock_guard lock(lock_);
+
+			for (auto& pooled : sockets_)
+				close_socket(pooled.socket);
+
+			sockets_.clear();
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Takes the authenticated connection from the pool. On success the negotiate context
+		/// is marked as authenticated, so only the CONNECT request is sent to the SOCKS5 server.
+		/// Signature matches tcp_proxy_server::connected_socket_provider_t.
+		/// </summary>
+		/// <param name="address">SOCKS5 server address the connection is requested for</param>
+		/// <param name="port">SOCKS5 server port the connection is requested for</param>
+		/// <param name="negotiate_ctx">SOCKS5 negotiate context</param>
+		/// <returns>connected socket or INVALID_SOCKET if none is available</returns>
+		// ********************************************************************************
+		SOCKET acquire(const address_type_t& address, const uint16_t port, negotiate_context_t& negotiate_ctx)
+		{
+			if (end_pool_ || address != socks5_server_address_ || port != socks5_server_port_ ||
+				negotiate_ctx.socks5_username != socks5_username_ || negotiate_ctx.socks5_password != socks5_password_)
+				return INVALID_SOCKET;
+
+			auto result = INVALID_SOCKET;
+
+			{
+				std::lock_guard lock(lock_);
+
+				while (!sockets_.empty() && result == INVALID_SOCKET)
+				{
+					auto pooled = sockets_.front();
+					sockets_.pop_front();
+
+					if (is_alive(pooled))
+					{
+						result = pooled.socket;
+					}
+					else
+					{
+						close_socket(pooled.socket);
+						++expired_;
+					}
+				}
+			}
+
+			refill_event_.notify_one();
+
+			if (result == INVALID_SOCKET)
+			{
+				++misses_;
+				return INVALID_SOCKET;
+			}
+
+			++hits_;
+			negotiate_ctx.socks5_authenticated = true;
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the connection taken by acquire but not used for the CONNECT request (and
+		/// not associated with the I/O completion port) back to the pool, its idle time
+		/// starts again. The connection is closed if the pool is full or stopped.
+		/// </summary>
+		/// <param name="socket">socket returned by acquire</param>
+		// ********************************************************************************
+		void release(SOCKET socket)
+		{
+			{
+				std::lock_guard lock(lock_);
+
+				if (!end_pool_ && sockets_.size() < pool_size_)
+				{
+					try
+					{
+						sockets_.push_front({socket, std::chrono::steady_clock::now()});
+						return;
+					}
+					catch (...)
+					{
+					}
+				}
+			}
+
+			close_socket(socket);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the snapshot of the pool usage counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics()
+		{
+			std::lock_guard lock(lock_);
+
+			return {
+				hits_.load(), misses_.load(), created_.load(), failed_.load(), expired_.load(), sockets_.size()
+			};
+		}
+
+	private:
+		void log_printer(const std::string& message) const
+		{
+			if (log_printer_)
+			{
+				log_printer_(message.c_str());
+			}
+		}
+
+		static void close_socket(SOCKET& socket)
+		{
+			if (socket != INVALID_SOCKET)
+			{
+				shutdown(socket, SD_BOTH);
+				closesocket(socket);
+				socket = INVALID_SOCKET;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Checks that the pooled connection has not been idle for too long and was not closed
+		/// by the server.
+		/// An idle authenticated SOCKS5 connection must not be readable, readability means
+		/// either FIN/RST or unexpected data.
+		/// </summary>
+		/// <param name="pooled">pooled connection</param>
+		/// <returns>true if connection can be used</returns>
+		// ********************************************************************************
+		bool is_alive(const pooled_socket& pooled) const
+		{
+			if (std::chrono::steady_clock::now() - pooled.idle_since > max_idle_)
+				return false;
+
+			fd_set read_set;
+			FD_ZERO(&read_set);
+			FD_SET(pooled.socket, &read_set);
+
+			timeval timeout{0, 0};
+
+			return select(0, &read_set, nullptr, nullptr, &timeout) == 0;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Sends the whole buffer on the blocking socket
+		/// </summary>
+		// ********************************************************************************
+		static bool send_all(const SOCKET socket, const char* buffer, const int length)
+		{
+			for (auto sent = 0; sent < length;)
+			{
+				const auto result = send(socket, buffer + sent, length - sent, 0);
+
+				if (result == SOCKET_ERROR || result == 0)
+					return false;
+
+				sent += result;
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Receives exactly length bytes on the blocking socket
+		/// </summary>
+		// ********************************************************************************
+		static bool recv_all(const SOCKET socket, char* buffer, const int length)
+		{
+			for (auto received = 0; received < length;)
+			{
+				const auto result = recv(socket, buffer + received, length - received, 0);
+
+				if (result == SOCKET_ERROR || result == 0)
+					return false;
+
+				received += result;
+			}
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Connects the socket within connect_timeout, the socket is left in blocking mode
+		/// </summary>
+		/// <returns>true if connected</returns>
+		// ********************************************************************************
+		static bool connect_with_timeout(const SOCKET socket, const sockaddr* address, const int address_length)
+		{
+			u_long non_blocking = 1;
+
+			if (ioctlsocket(socket, FIONBIO, &non_blocking) == SOCKET_ERROR)
+				return false;
+
+			if (connect(socket, address, address_length) == SOCKET_ERROR)
+			{
+				if (WSAGetLastError() != WSAEWOULDBLOCK)
+					return false;
+
+				fd_set write_set;
+				FD_ZERO(&write_set);
+				FD_SET(socket, &write_set);
+
+				// failed connect is reported in the exception set
+				fd_set except_set;
+				FD_ZERO(&except_set);
+				FD_SET(socket, &except_set);
+
+				timeval timeout{
+					static_cast<long>(connect_timeout.count() / 1000),
+					static_cast<long>(connect_timeout.count() % 1000 * 1000)
+				};
+
+				const auto result = select(0, nullptr, &write_set, &except_set, &timeout);
+
+				if (result == 0)
+					WSASetLastError(WSAETIMEDOUT);
+
+				if (result != 1 || !FD_ISSET(socket, &write_set))
+					return false;
+
+				auto error = 0;
+				auto error_length = static_cast<int>(sizeof(error));
+
+				if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &error_length) ==
+					SOCKET_ERROR || error != 0)
+				{
+					WSASetLastError(error);
+					return false;
+				}
+			}
+
+			non_blocking = 0;
+
+			return ioctlsocket(socket, FIONBIO, &non_blocking) != SOCKET_ERROR;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Connects to the SOCKS5 server and completes identification and authentication.
+		/// Both connect and handshake are limited by connect_timeout.
+		/// </summary>
+		/// <returns>authenticated socket or INVALID_SOCKET</returns>
+		// ********************************************************************************
+		SOCKET create_connection() const
+		{
+			// overlapped flag allows the socket to be associated with the I/O completion port later
+			auto socket = WSASocket(address_type_t::af_type, SOCK_STREAM, IPPROTO_TCP, nullptr, 0,
+			                        WSA_FLAG_OVERLAPPED);
+
+			if (socket == INVALID_SOCKET)
+				return INVALID_SOCKET;
+
+			DWORD timeout = static_cast<DWORD>(connect_timeout.count());
+			setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+			setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+			SOCKADDR_STORAGE sa_service{};
+			int sa_length;
+
+			if constexpr (address_type_t::af_type == AF_INET)
+			{
+				auto* sa_in = reinterpret_cast<sockaddr_in*>(&sa_service);
+				sa_in->sin_family = AF_INET;
+				sa_in->sin_addr = socks5_server_address_;
+				sa_in->sin_port = htons(socks5_server_port_);
+				sa_length = sizeof(sockaddr_in);
+			}
+			else
+			{
+				auto* sa_in6 = reinterpret_cast<sockaddr_in6*>(&sa_service);
+				sa_in6->sin6_family = AF_INET6;
+				sa_in6->sin6_addr = socks5_server_address_;
+				sa_in6->sin6_port = htons(socks5_server_port_);
+				sa_length = sizeof(sockaddr_in6);
+			}
+
+			if (!connect_with_timeout(socket, reinterpret_cast<sockaddr*>(&sa_service), sa_length) ||
+				!authenticate(socket))
+			{
+				close_socket(socket);
+				return INVALID_SOCKET;
+			}
+
+			// back to the infinite timeouts, the socket is used for the relay afterwards
+			timeout = 0;
+			setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+			setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+			return socket;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Performs RFC 1928 identification and RFC 1929 USERNAME/PASSWORD authentication
+		/// </summary>
+		/// <param name="socket">connected socket</param>
+		/// <returns>true if the connection is ready for the CONNECT request</returns>
+		// ********************************************************************************
+		bool authenticate(const SOCKET socket) const
+		{
+			const auto use_authentication = socks5_username_.has_value() && socks5_password_.has_value();
+
+			socks5_ident_req<1> ident_req{};
+			// RFC 1928: X'02' USERNAME/PASSWORD or X'00' NO AUTHENTICATION REQUIRED
+			ident_req.methods[0] = use_authentication ? 0x2 : 0x0;
+
+			socks5_ident_resp ident_resp{};
+
+			if (!send_all(socket, reinterpret_cast<const char*>(&ident_req), sizeof(ident_req)) ||
+				!recv_all(socket, reinterpret_cast<char*>(&ident_resp), sizeof(ident_resp)) ||
+				ident_resp.version != socks5_protocol_version || ident_resp.method != ident_req.methods[0])
+				return false;
+
+			if (!use_authentication)
+				return true;
+
+			socks5_username_auth username_auth{};
+			const auto auth_size = username_auth.init(socks5_username_.value(), socks5_password_.value());
+
+			return auth_size != 0 &&
+				send_all(socket, reinterpret_cast<const char*>(&username_auth), static_cast<int>(auth_size)) &&
+				recv_all(socket, reinterpret_cast<char*>(&ident_resp), sizeof(ident_resp)) &&
+				ident_resp.method == 0;
+		}
+
+		void refill_thread()
+		{
+			using namespace std::chrono_literals;
+
+			// exponential backoff between the failed attempts, reset by the successful one
+			auto backoff = min_backoff;
+			auto next_attempt = std::chrono::steady_clock::now();
+
+			while (end_pool_ == false)
+			{
+				{
+					std::unique_lock lock(lock_);
+
+					// drop connections closed by the server or idle for too long
+					sockets_.erase(std::remove_if(sockets_.begin(), sockets_.end(), [this](auto& pooled)
+					{
+						if (is_alive(pooled))
+							return false;
+
+						close_socket(pooled.socket);
+						++expired_;
+						return true;
+					}), sockets_.end());
+
+					if (sockets_.size() >= pool_size_)
+					{
+						refill_event_.wait_for(lock, 1000ms);
+						continue;
+					}
+
+					// acquire wakes the thread on every checkout, it must not shorten the backoff
+					if (std::chrono::steady_clock::now() < next_attempt)
+					{
+						refill_event_.wait_until(lock, next_attempt);
+						continue;
+					}
+				}
+
+				// connect outside the lock, acquire must not wait for the SOCKS5 handshake
+				if (auto socket = create_connection(); socket != INVALID_SOCKET)
+				{
+					std::lock_guard lock(lock_);
+
+					if (end_pool_)
+					{
+						close_socket(socket);
+						break;
+					}
+
+					sockets_.push_back({socket, std::chrono::steady_clock::now()});
+					++created_;
+					backoff = min_backoff;
+				}
+				else
+				{
+					++failed_;
+					next_attempt = std::chrono::steady_clock::now() + backoff;
+					backoff = (std::min)(backoff * 2, max_backoff);
+
+					if (log_level_ > netlib::log::log_level::debug)
+						log_printer("socks5_connection_pool: failed to establish SOCKS5 connection: " +
+							std::to_string(WSAGetLastError()));
+				}
+			}
+		}
+	};
+}
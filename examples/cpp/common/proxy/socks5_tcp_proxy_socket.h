@@ -14,7 +14,8 @@ namespace proxy
 			login_responded,
 			password_sent,
 			password_responded,
-			connect_sent
+			connect_sent,
+			pipelined_sent
 		};
 
 	public:
@@ -34,6 +35,18 @@ namespace proxy
 		{
 			if (io_context->is_local == false)
 			{
+				negotiate_received_ += io_size;
+
+				if (negotiate_received_ < negotiate_expected_)
+				{
+					// response may arrive in several segments, the state is processed once it is complete
+					io_context_recv_negotiate_.wsa_buf.buf += io_size;
+					io_context_recv_negotiate_.wsa_buf.len -= io_size;
+
+					post_negotiate_receive();
+					return;
+				}
+
 				if (current_state_ == socks5_state::login_sent)
 				{
 					current_state_ = socks5_state::login_responded;
@@ -50,17 +63,7 @@ namespace proxy
 						if (ident_resp_.method == 0x2)
 						{
 							if (auto* negotiate_context_ptr = dynamic_cast<negotiate_context_t*>(tcp_proxy_socket<
-									T>::negotiate_ctx_.get()); !negotiate_context_ptr->socks5_username.has_value() ||
-								// [SOCKS5]: associate_to_socks5_proxy: RFC 1928: X'02' USERNAME/PASSWORD is chosen but USERNAME is not provided
-								(negotiate_context_ptr->socks5_username.value().length() > socks5_username_max_length ||
-									negotiate_context_ptr->socks5_username.value().length() < 1) ||
-								// [SOCKS5]: associate_to_socks5_proxy: RFC 1928: X'02' USERNAME/PASSWORD is chosen but USERNAME exceeds maximum possible length
-								!negotiate_context_ptr->socks5_password.has_value() ||
-								// [SOCKS5]: associate_to_socks5_proxy: RFC 1928: X'02' USERNAME/PASSWORD is chosen but PASSWORD is not provided
-								(negotiate_context_ptr->socks5_password.value().length() > socks5_username_max_length ||
-									negotiate_context_ptr->socks5_password.value().length() < 1)
-								// [SOCKS5]: associate_to_socks5_proxy: RFC 1928: X'02' USERNAME/PASSWORD is chosen but USERNAME exceeds maximum possible length
-							)
+								T>::negotiate_ctx_.get()); !has_valid_credentials(*negotiate_context_ptr))
 							{
 								tcp_proxy_socket<T>::close_client(true, false);
 							}
@@ -70,81 +73,15 @@ namespace proxy
 									negotiate_context_ptr->socks5_username.value(),
 									negotiate_context_ptr->socks5_password.value()); auth_size != 0)
 								{
-									io_context_send_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&username_auth_);
-									io_context_send_negotiate_.wsa_buf.len = auth_size;
-									io_context_recv_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&ident_resp_);
-									io_context_recv_negotiate_.wsa_buf.len = sizeof(socks5_ident_resp);
-
-									DWORD flags = 0;
-
-									if ((::WSASend(
-										tcp_proxy_socket<T>::remote_socket_,
-										&io_context_send_negotiate_.wsa_buf,
-										1,
-										nullptr,
-										0,
-										&io_context_send_negotiate_,
-										nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-									{
-										tcp_proxy_socket<T>::close_client(false, false);
-									}
-
-									current_state_ = socks5_state::password_sent;
-
-									if ((::WSARecv(
-										tcp_proxy_socket<T>::remote_socket_,
-										&io_context_recv_negotiate_.wsa_buf,
-										1,
-										nullptr,
-										&flags,
-										&io_context_recv_negotiate_,
-										nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-									{
-										tcp_proxy_socket<T>::close_client(true, false);
-									}
+									post_negotiate_io(reinterpret_cast<char*>(&username_auth_), auth_size,
+									                  reinterpret_cast<char*>(&ident_resp_), sizeof(socks5_ident_resp),
+									                  socks5_state::password_sent);
 								}
 							}
 						}
 						else // NO AUTHENTICATION REQUIRED is chosen
 						{
-							connect_request_.cmd = 1;
-							connect_request_.reserved = 0;
-							connect_request_.address_type = 1;
-							connect_request_.dest_address = tcp_proxy_socket<T>::negotiate_ctx_->remote_address;
-							connect_request_.dest_port = htons(tcp_proxy_socket<T>::negotiate_ctx_->remote_port);
-
-							io_context_send_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&connect_request_);
-							io_context_send_negotiate_.wsa_buf.len = sizeof(socks5_req<T>);
-							io_context_recv_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&connect_response_);
-							io_context_recv_negotiate_.wsa_buf.len = sizeof(socks5_resp<T>);
-
-							DWORD flags = 0;
-
-							if ((::WSASend(
-								tcp_proxy_socket<T>::remote_socket_,
-								&io_context_send_negotiate_.wsa_buf,
-								1,
-								nullptr,
-								0,
-								&io_context_send_negotiate_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								tcp_proxy_socket<T>::close_client(false, false);
-							}
-
-							current_state_ = socks5_state::connect_sent;
-
-							if ((::WSARecv(
-								tcp_proxy_socket<T>::remote_socket_,
-								&io_context_recv_negotiate_.wsa_buf,
-								1,
-								nullptr,
-								&flags,
-								&io_context_recv_negotiate_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								tcp_proxy_socket<T>::close_client(true, false);
-							}
+							send_connect_request();
 						}
 					}
 				}
@@ -159,44 +96,7 @@ namespace proxy
 					}
 					else
 					{
-						connect_request_.cmd = 1;
-						connect_request_.reserved = 0;
-						connect_request_.address_type = 1;
-						connect_request_.dest_address = tcp_proxy_socket<T>::negotiate_ctx_->remote_address;
-						connect_request_.dest_port = htons(tcp_proxy_socket<T>::negotiate_ctx_->remote_port);
-
-						io_context_send_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&connect_request_);
-						io_context_send_negotiate_.wsa_buf.len = sizeof(socks5_req<T>);
-						io_context_recv_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&connect_response_);
-						io_context_recv_negotiate_.wsa_buf.len = sizeof(socks5_resp<T>);
-
-						DWORD flags = 0;
-
-						if ((::WSASend(
-							tcp_proxy_socket<T>::remote_socket_,
-							&io_context_send_negotiate_.wsa_buf,
-							1,
-							nullptr,
-							0,
-							&io_context_send_negotiate_,
-							nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-						{
-							tcp_proxy_socket<T>::close_client(false, false);
-						}
-
-						current_state_ = socks5_state::connect_sent;
-
-						if ((::WSARecv(
-							tcp_proxy_socket<T>::remote_socket_,
-							&io_context_recv_negotiate_.wsa_buf,
-							1,
-							nullptr,
-							&flags,
-							&io_context_recv_negotiate_,
-							nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-						{
-							tcp_proxy_socket<T>::close_client(true, false);
-						}
+						send_connect_request();
 					}
 				}
 				else if (current_state_ == socks5_state::connect_sent)
@@ -211,6 +111,10 @@ namespace proxy
 						tcp_proxy_socket<T>::start_data_relay();
 					}
 				}
+				else if (current_state_ == socks5_state::pipelined_sent)
+				{
+					process_pipelined_response();
+				}
 			}
 		}
 
@@ -225,6 +129,195 @@ namespace proxy
 		socks5_resp<address_type_t> connect_response_;
 		socks5_username_auth username_auth_{};
 
+		/// <summary>length of the expected negotiate response</summary>
+		uint32_t negotiate_expected_{0};
+		/// <summary>number of negotiate response bytes received so far</summary>
+		uint32_t negotiate_received_{0};
+
+		/// <summary>pipelined request (identification, authentication and CONNECT)</summary>
+		std::vector<char> pipelined_request_;
+		/// <summary>pipelined responses, received until the buffer is full</summary>
+		std::vector<char> pipelined_response_;
+		/// <summary>the only authentication method offered in the pipelined request</summary>
+		unsigned char pipelined_method_{0};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Checks RFC 1929 USERNAME/PASSWORD limits for the provided credentials
+		/// </summary>
+		/// <param name="negotiate_context">SOCKS5 negotiate context</param>
+		/// <returns>true if both username and password are present and valid</returns>
+		// ********************************************************************************
+		static bool has_valid_credentials(const negotiate_context_t& negotiate_context)
+		{
+			return negotiate_context.socks5_username.has_value() &&
+				negotiate_context.socks5_username.value().length() <= socks5_username_max_length &&
+				negotiate_context.socks5_username.value().length() >= 1 &&
+				negotiate_context.socks5_password.has_value() &&
+				negotiate_context.socks5_password.value().length() <= socks5_username_max_length &&
+				negotiate_context.socks5_password.value().length() >= 1;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Sends negotiate request to the SOCKS5 server and posts receive for the response,
+		/// the response is received until recv_length bytes arrive
+		/// </summary>
+		/// <param name="send_buffer">request buffer</param>
+		/// <param name="send_length">request length</param>
+		/// <param name="recv_buffer">response buffer</param>
+		/// <param name="recv_length">expected response length</param>
+		/// <param name="next_state">SOCKS5 state after the request is sent</param>
+		// ********************************************************************************
+		void post_negotiate_io(char* send_buffer, const uint32_t send_length, char* recv_buffer,
+		                       const uint32_t recv_length, const socks5_state next_state)
+		{
+			io_context_send_negotiate_.wsa_buf.buf = send_buffer;
+			io_context_send_negotiate_.wsa_buf.len = send_length;
+			io_context_recv_negotiate_.wsa_buf.buf = recv_buffer;
+			io_context_recv_negotiate_.wsa_buf.len = recv_length;
+			negotiate_expected_ = recv_length;
+			negotiate_received_ = 0;
+
+			if ((::WSASend(
+				tcp_proxy_socket<T>::remote_socket_,
+				&io_context_send_negotiate_.wsa_buf,
+				1,
+				nullptr,
+				0,
+				&io_context_send_negotiate_,
+				nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+			{
+				tcp_proxy_socket<T>::close_client(false, false);
+			}
+
+			current_state_ = next_state;
+
+			post_negotiate_receive();
+		}
+
+		void post_negotiate_receive()
+		{
+			DWORD flags = 0;
+
+			if ((::WSARecv(
+				tcp_proxy_socket<T>::remote_socket_,
+				&io_context_recv_negotiate_.wsa_buf,
+				1,
+				nullptr,
+				&flags,
+				&io_context_recv_negotiate_,
+				nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+			{
+				tcp_proxy_socket<T>::close_client(true, false);
+			}
+		}
+
+		void init_connect_request()
+		{
+			connect_request_.cmd = 1;
+			connect_request_.reserved = 0;
+			connect_request_.address_type = 1;
+			connect_request_.dest_address = tcp_proxy_socket<T>::negotiate_ctx_->remote_address;
+			connect_request_.dest_port = htons(tcp_proxy_socket<T>::negotiate_ctx_->remote_port);
+		}
+
+		void send_connect_request()
+		{
+			init_connect_request();
+
+			post_negotiate_io(reinterpret_cast<char*>(&connect_request_), sizeof(socks5_req<T>),
+			                  reinterpret_cast<char*>(&connect_response_), sizeof(socks5_resp<T>),
+			                  socks5_state::connect_sent);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Sends identification (with the single known method), USERNAME/PASSWORD
+		/// authentication (if credentials are provided) and CONNECT request in one send,
+		/// saving two round trips to the SOCKS5 server
+		/// </summary>
+		/// <param name="negotiate_context">SOCKS5 negotiate context</param>
+		// ********************************************************************************
+		void send_pipelined_request(const negotiate_context_t& negotiate_context)
+		{
+			const auto use_authentication = negotiate_context.socks5_username.has_value() ||
+				negotiate_context.socks5_password.has_value();
+
+			if (use_authentication && !has_valid_credentials(negotiate_context))
+			{
+				tcp_proxy_socket<T>::close_client(true, false);
+				return;
+			}
+
+			socks5_ident_req<1> ident_req{};
+			// RFC 1928: X'02' USERNAME/PASSWORD or X'00' NO AUTHENTICATION REQUIRED
+			pipelined_method_ = use_authentication ? 0x2 : 0x0;
+			ident_req.methods[0] = pipelined_method_;
+
+			const auto* ident_req_ptr = reinterpret_cast<const char*>(&ident_req);
+			pipelined_request_.assign(ident_req_ptr, ident_req_ptr + sizeof(ident_req));
+
+			if (use_authentication)
+			{
+				const auto auth_size = username_auth_.init(negotiate_context.socks5_username.value(),
+				                                           negotiate_context.socks5_password.value());
+				const auto* auth_ptr = reinterpret_cast<const char*>(&username_auth_);
+				pipelined_request_.insert(pipelined_request_.end(), auth_ptr, auth_ptr + auth_size);
+			}
+
+			init_connect_request();
+
+			const auto* connect_ptr = reinterpret_cast<const char*>(&connect_request_);
+			pipelined_request_.insert(pipelined_request_.end(), connect_ptr, connect_ptr + sizeof(socks5_req<T>));
+
+			pipelined_response_.resize(sizeof(socks5_ident_resp) +
+				(use_authentication ? sizeof(socks5_ident_resp) : 0) + sizeof(socks5_resp<T>));
+
+			post_negotiate_io(pipelined_request_.data(), static_cast<uint32_t>(pipelined_request_.size()),
+			                  pipelined_response_.data(), static_cast<uint32_t>(pipelined_response_.size()),
+			                  socks5_state::pipelined_sent);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Validates pipelined responses once all were received
+		/// </summary>
+		// ********************************************************************************
+		void process_pipelined_response()
+		{
+			const auto* ident_resp = reinterpret_cast<const socks5_ident_resp*>(pipelined_response_.data());
+			const auto* response_ptr = pipelined_response_.data() + sizeof(socks5_ident_resp);
+
+			auto success = (ident_resp->version == socks5_protocol_version) && (ident_resp->method ==
+				pipelined_method_);
+
+			if (success && pipelined_method_ == 0x2)
+			{
+				// RFC 1929: VER | STATUS, X'00' STATUS indicates success
+				success = reinterpret_cast<const socks5_ident_resp*>(response_ptr)->method == 0;
+				response_ptr += sizeof(socks5_ident_resp);
+			}
+
+			if (success)
+			{
+				success = reinterpret_cast<const socks5_resp<T>*>(response_ptr)->reply == 0;
+			}
+
+			pipelined_request_ = {};
+			pipelined_response_ = {};
+
+			if (!success)
+			{
+				// SOCKS v5 identification, authentication or connect failed
+				tcp_proxy_socket<T>::close_client(true, false);
+			}
+			else
+			{
+				tcp_proxy_socket<T>::start_data_relay();
+			}
+		}
+
 	protected:
 		bool local_negotiate() override
 		{
@@ -237,40 +330,24 @@ namespace proxy
 			{
 				if (current_state_ == socks5_state::pre_login)
 				{
-					ident_req_.methods[0] = 0x0; // RFC 1928: X'00' NO AUTHENTICATION REQUIRED
-					ident_req_.methods[1] = 0x2; // RFC 1928: X'02' USERNAME/PASSWORD
-
-					io_context_send_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&ident_req_);
-					io_context_send_negotiate_.wsa_buf.len = sizeof(ident_req_);
-					io_context_recv_negotiate_.wsa_buf.buf = reinterpret_cast<char*>(&ident_resp_);
-					io_context_recv_negotiate_.wsa_buf.len = sizeof(socks5_ident_resp);
-
-					DWORD flags = 0;
-
-					if ((::WSASend(
-						tcp_proxy_socket<T>::remote_socket_,
-						&io_context_send_negotiate_.wsa_buf,
-						1,
-						nullptr,
-						0,
-						&io_context_send_negotiate_,
-						nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+					if (const auto* negotiate_context_ptr = dynamic_cast<negotiate_context_t*>(tcp_proxy_socket<
+						T>::negotiate_ctx_.get()); negotiate_context_ptr && negotiate_context_ptr->socks5_authenticated)
 					{
-						tcp_proxy_socket<T>::close_client(false, false);
+						// pre-authenticated connection from socks5_connection_pool
+						send_connect_request();
 					}
-
-					current_state_ = socks5_state::login_sent;
-
-					if ((::WSARecv(
-						tcp_proxy_socket<T>::remote_socket_,
-						&io_context_recv_negotiate_.wsa_buf,
-						1,
-						nullptr,
-						&flags,
-						&io_context_recv_negotiate_,
-						nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+					else if (negotiate_context_ptr && negotiate_context_ptr->socks5_pipelining)
 					{
-						tcp_proxy_socket<T>::close_client(true, false);
+						send_pipelined_request(*negotiate_context_ptr);
+					}
+					else
+					{
+						ident_req_.methods[0] = 0x0; // RFC 1928: X'00' NO AUTHENTICATION REQUIRED
+						ident_req_.methods[1] = 0x2; // RFC 1928: X'02' USERNAME/PASSWORD
+
+						post_negotiate_io(reinterpret_cast<char*>(&ident_req_), sizeof(ident_req_),
+						                  reinterpret_cast<char*>(&ident_resp_), sizeof(socks5_ident_resp),
+						                  socks5_state::login_sent);
 					}
 				}
 
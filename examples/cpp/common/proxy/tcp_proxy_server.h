@@ -1,4 +1,7 @@
 #pragma once
+
+#include <mswsock.h>
+
 namespace proxy
 {
 	template <typename T>
@@ -12,26 +15,86 @@ namespace proxy
 		using query_remote_peer_t = std::tuple<address_type_t, uint16_t, std::unique_ptr<negotiate_context_t>>(
 			address_type_t, uint16_t);
 
+		/// <summary>returns already connected (and possibly negotiated) socket to the remote peer or INVALID_SOCKET</summary>
+		using connected_socket_provider_t = SOCKET(const address_type_t&, uint16_t, negotiate_context_t&);
+
+		/// <summary>takes back the socket returned by the connected socket provider but left unused</summary>
+		using connected_socket_release_t = void(SOCKET);
+
+		/// <summary>default number of AcceptEx operations kept posted on the listening socket</summary>
+		constexpr static uint32_t default_preposted_accepts = 64;
+		/// <summary>number of threads querying the remote peers and connecting the accepted sockets</summary>
+		constexpr static uint32_t connect_threads = 4;
+
 	private:
-		constexpr static size_t connections_array_size = 64;
+		/// <summary>size of the AcceptEx address buffer for one (local or remote) address</summary>
+		constexpr static DWORD accept_address_length = sizeof(SOCKADDR_STORAGE) + 16;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// I/O context for the AcceptEx/ConnectEx operations. Reuses per_io_context_t so the
+		/// completion handler can dispatch on io_operation (proxy_socket_ptr is not used).
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct server_io_context : per_io_context_t
+		{
+			explicit server_io_context(const proxy_io_operation io_operation)
+				: per_io_context_t{io_operation, nullptr, true}
+			{
+			}
+
+			/// <summary>accepted (local) socket</summary>
+			SOCKET accepted_socket{INVALID_SOCKET};
+			/// <summary>socket connected to the remote host</summary>
+			SOCKET remote_socket{INVALID_SOCKET};
+			/// <summary>negotiate context returned by query_remote_peer_</summary>
+			std::unique_ptr<negotiate_context_t> negotiate_ctx;
+			/// <summary>AcceptEx local and remote addresses buffer</summary>
+			std::array<char, 2 * accept_address_length> address_buffer{};
+		};
 
 		uint16_t proxy_port_;
 		winsys::io_completion_port& completion_port_;
 		std::function<query_remote_peer_t> query_remote_peer_;
+		/// <summary>optional source of the pre-connected remote sockets (e.g. socks5_connection_pool)</summary>
+		std::function<connected_socket_provider_t> connected_socket_provider_;
+		/// <summary>optional owner of the unused pre-connected remote sockets</summary>
+		std::function<connected_socket_release_t> connected_socket_release_;
 
 		/// <summary>message logging function</summary>
 		std::function<void(const char*)> log_printer_;
 		/// <summary>logging level</summary>
 		netlib::log::log_level log_level_;
+		/// <summary>number of AcceptEx operations kept posted on the listening socket</summary>
+		uint32_t preposted_accepts_;
 
+		/// <summary>protects the containers below and server_socket_ (closed by stop() under the exclusive lock)</summary>
 		std::shared_mutex lock_;
 
-		std::thread proxy_server_;
 		std::thread check_clients_thread_;
-		std::thread connect_to_remote_host_thread_;
+
+		/// <summary>
+		/// accepted sockets waiting for the remote peer query and connection. The query and the
+		/// connected socket provider may block, so they run on connect_threads_ instead of the
+		/// completion port threads.
+		/// </summary>
+		std::deque<SOCKET> accepted_queue_;
+		std::mutex accepted_queue_lock_;
+		std::condition_variable accepted_queue_event_;
+		std::vector<std::thread> connect_threads_;
 
 		std::vector<std::unique_ptr<T>> proxy_sockets_;
-		std::vector<std::tuple<WSAEVENT, SOCKET, SOCKET, std::unique_ptr<negotiate_context_t>>> sock_array_events_;
+		/// <summary>preposted AcceptEx contexts (reused after each completion)</summary>
+		std::vector<std::unique_ptr<server_io_context>> accept_contexts_;
+		/// <summary>AcceptEx contexts which failed to (re)post, retried by clear_thread</summary>
+		std::vector<server_io_context*> idle_accept_contexts_;
+		/// <summary>ConnectEx contexts in progress</summary>
+		std::unordered_map<server_io_context*, std::unique_ptr<server_io_context>> pending_connects_;
+		/// <summary>number of posted AcceptEx/ConnectEx operations whose completion has not been processed yet</summary>
+		std::atomic<uint32_t> pending_operations_{0};
+
+		LPFN_ACCEPTEX accept_ex_{nullptr};
+		LPFN_CONNECTEX connect_ex_{nullptr};
 
 		std::atomic_bool end_server_{true}; // set to true on proxy termination
 		SOCKET server_socket_{INVALID_SOCKET};
@@ -41,11 +104,13 @@ namespace proxy
 	public:
 		tcp_proxy_server(const uint16_t proxy_port, winsys::io_completion_port& completion_port,
 		                 const std::function<query_remote_peer_t> query_remote_peer_fn,
-		                 std::function<void(const char*)> log_printer, const netlib::log::log_level log_level)
+		                 std::function<void(const char*)> log_printer, const netlib::log::log_level log_level,
+		                 const uint32_t preposted_accepts = default_preposted_accepts)
 			: proxy_port_(proxy_port),
 			  completion_port_(completion_port),
 			  query_remote_peer_(query_remote_peer_fn),
-			  log_printer_(std::move(log_printer)), log_level_(log_level)
+			  log_printer_(std::move(log_printer)), log_level_(log_level),
+			  preposted_accepts_(preposted_accepts ? preposted_accepts : default_preposted_accepts)
 		{
 			if (!create_server_socket())
 			{
@@ -55,15 +120,15 @@ namespace proxy
 
 		~tcp_proxy_server()
 		{
+			if (end_server_ == false)
+				stop();
+
 			if (server_socket_ != INVALID_SOCKET)
 			{
 				shutdown(server_socket_, SD_BOTH);
 				closesocket(server_socket_);
 				server_socket_ = INVALID_SOCKET;
 			}
-
-			if (end_server_ == false)
-				stop();
 		}
 
 		tcp_proxy_server(const tcp_proxy_server& other) = delete;
@@ -79,6 +144,23 @@ namespace proxy
 			return proxy_port_;
 		}
 
+		// ********************************************************************************
+		/// <summary>
+		/// Sets the source of the pre-connected remote sockets. When it returns a valid socket
+		/// ConnectEx is skipped and the proxy socket is started immediately. Must be called
+		/// before start().
+		/// </summary>
+		/// <param name="provider">connected socket provider</param>
+		/// <param name="release">optional callback taking back the provided socket the proxy
+		/// could not use (server is stopping), otherwise such socket is closed</param>
+		// ********************************************************************************
+		void set_connected_socket_provider(std::function<connected_socket_provider_t> provider,
+		                                   std::function<connected_socket_release_t> release = nullptr)
+		{
+			connected_socket_provider_ = std::move(provider);
+			connected_socket_release_ = std::move(release);
+		}
+
 		bool start()
 		{
 			if (end_server_ == false)
@@ -87,94 +169,131 @@ namespace proxy
 				return true;
 			}
 
-			end_server_ = false;
-
-			sock_array_events_.reserve(connections_array_size);
+			if (server_socket_ == INVALID_SOCKET)
+			{
+				return false;
+			}
 
-			sock_array_events_.push_back(std::make_tuple(WSACreateEvent(),
-			                                             WSASocket(address_type_t::af_type, SOCK_STREAM,
-			                                                       IPPROTO_TCP, nullptr, 0,
-			                                                       WSA_FLAG_OVERLAPPED), INVALID_SOCKET, nullptr));
+			accept_ex_ = load_extension_function<LPFN_ACCEPTEX>(WSAID_ACCEPTEX);
+			connect_ex_ = load_extension_function<LPFN_CONNECTEX>(WSAID_CONNECTEX);
 
-			if (std::get<1>(sock_array_events_[0]) != INVALID_SOCKET)
+			if (accept_ex_ == nullptr || connect_ex_ == nullptr)
 			{
-				auto [success, io_key] = completion_port_.associate_socket(
-					std::get<1>(sock_array_events_[0]),
-					[this](const DWORD num_bytes, OVERLAPPED* povlp, const BOOL status)
+				log_printer("start: failed to load AcceptEx/ConnectEx extension functions");
+				return false;
+			}
+
+			end_server_ = false;
+
+			auto [success, io_key] = completion_port_.associate_socket(
+				server_socket_,
+				[this](const DWORD num_bytes, OVERLAPPED* povlp, const BOOL status)
+				{
+					auto io_context = static_cast<per_io_context_t*>(povlp);
+
+					// AcceptEx/ConnectEx completions are processed even when stopping (the aborted ones
+					// release their sockets), stop() waits for them before freeing the contexts
+					switch (io_context->io_operation)
 					{
-						if (end_server_)
-							return false;
+					case proxy_io_operation::accept_io:
+						process_accept_complete(static_cast<server_io_context*>(io_context), status);
+						--pending_operations_;
+						return true;
+
+					case proxy_io_operation::connect_io:
+						process_connect_complete(static_cast<server_io_context*>(io_context), status);
+						--pending_operations_;
+						return true;
 
-						auto io_context = static_cast<per_io_context_t*>(povlp);
+					default:
+						break;
+					}
 
-						if (!status || (status && (num_bytes == 0)))
+					if (end_server_)
+						return false;
+
+					if (!status || (status && (num_bytes == 0)))
+					{
+						if ((io_context->io_operation == proxy_io_operation::relay_io_read) ||
+							(io_context->io_operation == proxy_io_operation::negotiate_io_read) ||
+							(io_context->io_operation == proxy_io_operation::relay_io_zero_read && !status))
 						{
-							if ((io_context->io_operation == proxy_io_operation::relay_io_read) ||
-								(io_context->io_operation == proxy_io_operation::negotiate_io_read))
-							{
-								io_context->proxy_socket_ptr->close_client(true, io_context->is_local);
-								return false;
-							}
-
-							if (!status)
-							{
-								io_context->proxy_socket_ptr->close_client(false, io_context->is_local);
-								return false;
-							}
+							io_context->proxy_socket_ptr->close_client(true, io_context->is_local);
+							return false;
 						}
 
-						switch (io_context->io_operation)
+						if (!status)
 						{
-						case proxy_io_operation::relay_io_read:
-							io_context->proxy_socket_ptr->process_receive_buffer_complete(num_bytes, io_context);
-							break;
-
-						case proxy_io_operation::relay_io_write:
-							io_context->proxy_socket_ptr->process_send_buffer_complete(num_bytes, io_context);
-							break;
-
-						case proxy_io_operation::negotiate_io_read:
-							io_context->proxy_socket_ptr->process_receive_negotiate_complete(num_bytes, io_context);
-							break;
-
-						case proxy_io_operation::negotiate_io_write:
-							io_context->proxy_socket_ptr->process_send_negotiate_complete(num_bytes, io_context);
-							break;
-
-						case proxy_io_operation::inject_io_write:
-							T::process_inject_buffer_complete(io_context);
-							break;
-						default: break; // NOLINT(clang-diagnostic-covered-switch-default)
+							io_context->proxy_socket_ptr->close_client(false, io_context->is_local);
+							return false;
 						}
-
-						return true;
-					});
-
-				if (success == true)
-				{
-					completion_key_ = io_key;
-				}
-				else
-				{
-					if (std::get<0>(sock_array_events_[0]) != INVALID_HANDLE_VALUE)
-					{
-						WSACloseEvent(std::get<0>(sock_array_events_[0]));
 					}
 
-					if (std::get<1>(sock_array_events_[0]) != INVALID_SOCKET)
+					switch (io_context->io_operation)
 					{
-						closesocket(std::get<1>(sock_array_events_[0]));
+					case proxy_io_operation::relay_io_read:
+						io_context->proxy_socket_ptr->process_receive_buffer_complete(num_bytes, io_context);
+						break;
+
+					case proxy_io_operation::relay_io_write:
+						io_context->proxy_socket_ptr->process_send_buffer_complete(num_bytes, io_context);
+						break;
+
+					case proxy_io_operation::relay_io_zero_read:
+						io_context->proxy_socket_ptr->process_zero_receive_complete(io_context);
+						break;
+
+					case proxy_io_operation::negotiate_io_read:
+						io_context->proxy_socket_ptr->process_receive_negotiate_complete(num_bytes, io_context);
+						break;
+
+					case proxy_io_operation::negotiate_io_write:
+						io_context->proxy_socket_ptr->process_send_negotiate_complete(num_bytes, io_context);
+						break;
+
+					case proxy_io_operation::inject_io_write:
+						T::process_inject_buffer_complete(io_context);
+						break;
+					default: break; // NOLINT(clang-diagnostic-covered-switch-default)
 					}
 
-					sock_array_events_.clear();
+					return true;
+				});
+
+			if (success == false)
+			{
+				end_server_ = true;
+				return false;
+			}
+
+			completion_key_ = io_key;
+
+			{
+				std::lock_guard lock(lock_);
+
+				accept_contexts_.reserve(preposted_accepts_);
+
+				for (uint32_t i = 0; i < preposted_accepts_; ++i)
+				{
+					accept_contexts_.push_back(std::make_unique<server_io_context>(proxy_io_operation::accept_io));
+
+					if (!post_accept(accept_contexts_.back().get()))
+						idle_accept_contexts_.push_back(accept_contexts_.back().get());
+				}
+
+				if (idle_accept_contexts_.size() == accept_contexts_.size())
+				{
 					end_server_ = true;
+					accept_contexts_.clear();
+					idle_accept_contexts_.clear();
 					return false;
 				}
 			}
 
-			proxy_server_ = std::thread(&tcp_proxy_server<T>::start_proxy_thread, this);
 			check_clients_thread_ = std::thread(&tcp_proxy_server<T>::clear_thread, this);
-			connect_to_remote_host_thread_ = std::thread(&tcp_proxy_server<T>::connect_to_remote_host_thread, this);
+
+			for (uint32_t i = 0; i < connect_threads; ++i)
+				connect_threads_.push_back(std::thread(&tcp_proxy_server<T>::connect_thread, this));
 
 			return true;
 		}
@@ -187,40 +306,74 @@ namespace proxy
 				return;
 			}
 
-			end_server_ = true;
+			{
+				// connect threads check end_server_ under the queue lock before waiting
+				std::lock_guard lock(accepted_queue_lock_);
+				end_server_ = true;
+			}
 
-			closesocket(server_socket_);
-			server_socket_ = INVALID_SOCKET;
+			accepted_queue_event_.notify_all();
 
 			{
-				std::shared_lock<std::shared_mutex> lock(lock_);
-				::WSASetEvent(std::get<0>(sock_array_events_[0]));
+				std::lock_guard lock(lock_);
+
+				// Cancel the preposted AcceptEx and in progress ConnectEx operations. The aborted completions
+				// are still delivered and close the sockets of their contexts.
+				CancelIoEx(reinterpret_cast<HANDLE>(server_socket_), nullptr);
+				closesocket(server_socket_);
+				server_socket_ = INVALID_SOCKET;
+
+				for (auto&& [key, context] : pending_connects_)
+				{
+					CancelIoEx(reinterpret_cast<HANDLE>(context->remote_socket), context.get());
+				}
 			}
 
-			if (proxy_server_.joinable())
+			// the connect threads close the queued sockets and post no ConnectEx once end_server_ is set
+			for (auto&& thread : connect_threads_)
 			{
-				proxy_server_.join();
+				if (thread.joinable())
+					thread.join();
 			}
 
+			connect_threads_.clear();
+
 			if (check_clients_thread_.joinable())
 			{
 				check_clients_thread_.join();
 			}
 
-			if (connect_to_remote_host_thread_.joinable())
-			{
-				connect_to_remote_host_thread_.join();
-			}
+			// The contexts can't be freed while their OVERLAPPEDs are owned by the system
+			using namespace std::chrono_literals;
 
-			if (!sock_array_events_.empty())
+			for (auto i = 0; i < 500 && pending_operations_; ++i)
 			{
-				sock_array_events_.clear();
+				std::this_thread::sleep_for(10ms);
 			}
 
-			if (!proxy_sockets_.empty())
+			std::lock_guard lock(lock_);
+
+			if (pending_operations_)
 			{
-				proxy_sockets_.clear();
+				// No completion is going to be delivered: the completion port threads were stopped before
+				// the proxy. Keep the remaining contexts alive instead of risking a late completion.
+				log_printer("stop: " + std::to_string(pending_operations_.load()) +
+					" AcceptEx/ConnectEx operations did not complete (the completion port was stopped before"
+					" the proxy), their contexts are leaked");
+
+				assert(pending_operations_ == 0 && "tcp_proxy_server must be stopped before the completion port");
+
+				for (auto&& context : accept_contexts_)
+					std::ignore = context.release();
+
+				for (auto&& [key, context] : pending_connects_)
+					std::ignore = context.release();
 			}
+
+			accept_contexts_.clear();
+			idle_accept_contexts_.clear();
+			pending_connects_.clear();
+			proxy_sockets_.clear();
 		}
 
 		std::vector<negotiate_context_t> query_current_sessions_ctx()
@@ -284,6 +437,70 @@ namespace proxy
 			return std::make_tuple(address_type_t{}, 0, nullptr);
 		}
 
+		// ********************************************************************************
+		/// <summary>
+		/// Fills socket address structure for the specified IP address and port
+		/// </summary>
+		/// <param name="address">IP address</param>
+		/// <param name="port">port in host byte order</param>
+		/// <param name="storage">socket address storage to fill</param>
+		/// <returns>length of the socket address</returns>
+		// ********************************************************************************
+		static int make_socket_address(const address_type_t& address, const uint16_t port, SOCKADDR_STORAGE& storage)
+		{
+			storage = SOCKADDR_STORAGE{};
+
+			if constexpr (address_type_t::af_type == AF_INET)
+			{
+				auto* const sa = reinterpret_cast<sockaddr_in*>(&storage);
+				sa->sin_family = address_type_t::af_type;
+				sa->sin_addr = address;
+				sa->sin_port = htons(port);
+				return sizeof(sockaddr_in);
+			}
+			else
+			{
+				auto* const sa = reinterpret_cast<sockaddr_in6*>(&storage);
+				sa->sin6_family = address_type_t::af_type;
+				sa->sin6_addr = address;
+				sa->sin6_port = htons(port);
+				return sizeof(sockaddr_in6);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Queries Winsock extension function pointer (AcceptEx, ConnectEx) for the
+		/// listening socket provider
+		/// </summary>
+		/// <param name="guid">extension function GUID</param>
+		/// <returns>function pointer or nullptr</returns>
+		// ********************************************************************************
+		template <typename F>
+		F load_extension_function(GUID guid) const
+		{
+			F function_ptr = nullptr;
+			DWORD bytes = 0;
+
+			if (WSAIoctl(server_socket_, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid),
+			             &function_ptr, sizeof(function_ptr), &bytes, nullptr, nullptr) == SOCKET_ERROR)
+			{
+				return nullptr;
+			}
+
+			return function_ptr;
+		}
+
+		static void close_socket(SOCKET& socket)
+		{
+			if (socket != INVALID_SOCKET)
+			{
+				shutdown(socket, SD_BOTH);
+				closesocket(socket);
+				socket = INVALID_SOCKET;
+			}
+		}
+
 		bool create_server_socket()
 		{
 			server_socket_ = WSASocket(address_type_t::af_type, SOCK_STREAM, IPPROTO_TCP, nullptr, 0,
@@ -294,65 +511,32 @@ namespace proxy
 				return false;
 			}
 
-			if constexpr (address_type_t::af_type == AF_INET)
-			{
-				sockaddr_in service{};
-				service.sin_family = address_type_t::af_type;
-				service.sin_addr.s_addr = INADDR_ANY;
-				service.sin_port = htons(proxy_port_);
+			SOCKADDR_STORAGE service{};
+			int name_length = make_socket_address(address_type_t{}, proxy_port_, service);
 
-				if (const auto status = bind(server_socket_, reinterpret_cast<SOCKADDR*>(&service), sizeof(service));
-					status == SOCKET_ERROR)
-				{
-					closesocket(server_socket_);
-					server_socket_ = INVALID_SOCKET;
-					return false;
-				}
+			if (const auto status = bind(server_socket_, reinterpret_cast<SOCKADDR*>(&service), name_length);
+				status == SOCKET_ERROR)
+			{
+				closesocket(server_socket_);
+				server_socket_ = INVALID_SOCKET;
+				return false;
+			}
 
-				if (proxy_port_ == 0)
+			if (proxy_port_ == 0)
+			{
+				if (0 == getsockname(server_socket_, reinterpret_cast<SOCKADDR*>(&service), &name_length))
 				{
-					int name_length = sizeof(service);
-					if (0 == getsockname(server_socket_, reinterpret_cast<SOCKADDR*>(&service), &name_length))
-					{
-						proxy_port_ = ntohs(service.sin_port);
-					}
+					if constexpr (address_type_t::af_type == AF_INET)
+						proxy_port_ = ntohs(reinterpret_cast<sockaddr_in*>(&service)->sin_port);
 					else
-					{
-						closesocket(server_socket_);
-						server_socket_ = INVALID_SOCKET;
-						return false;
-					}
+						proxy_port_ = ntohs(reinterpret_cast<sockaddr_in6*>(&service)->sin6_port);
 				}
-			}
-			else
-			{
-				sockaddr_in6 service{};
-				service.sin6_family = address_type_t::af_type;
-				service.sin6_addr = in6addr_any;
-				service.sin6_port = htons(proxy_port_);
-
-				if (const auto status = bind(server_socket_, reinterpret_cast<SOCKADDR*>(&service), sizeof(service));
-					status == SOCKET_ERROR)
+				else
 				{
 					closesocket(server_socket_);
 					server_socket_ = INVALID_SOCKET;
 					return false;
 				}
-
-				if (proxy_port_ == 0)
-				{
-					int name_length = sizeof(service);
-					if (0 == getsockname(server_socket_, reinterpret_cast<SOCKADDR*>(&service), &name_length))
-					{
-						proxy_port_ = ntohs(service.sin6_port);
-					}
-					else
-					{
-						closesocket(server_socket_);
-						server_socket_ = INVALID_SOCKET;
-						return false;
-					}
-				}
 			}
 
 			if (const auto status = listen(server_socket_, SOMAXCONN); status == SOCKET_ERROR)
@@ -365,216 +549,304 @@ namespace proxy
 			return true;
 		}
 
-		bool connect_to_remote_host(SOCKET accepted)
+		// ********************************************************************************
+		/// <summary>
+		/// Creates a new socket for the incoming connection and posts AcceptEx on the
+		/// listening socket using the provided context
+		/// </summary>
+		/// <param name="context">AcceptEx I/O context</param>
+		/// <returns>true if AcceptEx was posted</returns>
+		// ********************************************************************************
+		bool post_accept(server_io_context* context)
 		{
-			auto [remote_ip, remote_port, negotiate_ctx] = get_remote_peer(accepted);
+			context->accepted_socket = WSASocket(address_type_t::af_type, SOCK_STREAM, IPPROTO_TCP, nullptr, 0,
+			                                     WSA_FLAG_OVERLAPPED);
 
-			if (!remote_port)
+			if (context->accepted_socket == INVALID_SOCKET)
+			{
+				return false;
+			}
+
+			// accepted socket is associated in advance, relay I/O completions are routed
+			// to the same completion key as AcceptEx/ConnectEx ones
+			if (!completion_port_.associate_socket(context->accepted_socket, completion_key_))
+			{
+				close_socket(context->accepted_socket);
 				return false;
+			}
 
-			if (log_level_ > netlib::log::log_level::debug)
-				log_printer(std::string("connect_to_remote_host:  ") + std::string{remote_ip} + " : " +
-					std::to_string(remote_port));
+			static_cast<WSAOVERLAPPED&>(*context) = WSAOVERLAPPED{};
 
-			auto remote_socket = WSASocket(address_type_t::af_type, SOCK_STREAM, IPPROTO_TCP, nullptr, 0,
-			                               WSA_FLAG_OVERLAPPED);
+			DWORD bytes_received = 0;
 
-			if (remote_socket == INVALID_SOCKET)
+			++pending_operations_;
+
+			if (!accept_ex_(server_socket_, context->accepted_socket, context->address_buffer.data(), 0,
+			                accept_address_length, accept_address_length, &bytes_received, context) &&
+				(ERROR_IO_PENDING != WSAGetLastError()))
 			{
+				--pending_operations_;
+				close_socket(context->accepted_socket);
 				return false;
 			}
 
-			if constexpr (address_type_t::af_type == AF_INET)
-			{
-				sockaddr_in sa_local{};
-				sa_local.sin_family = address_type_t::af_type;
-				sa_local.sin_port = htons(0);
-				sa_local.sin_addr.s_addr = htonl(INADDR_ANY);
+			return true;
+		}
 
-				// bind socket's name
-				const auto status = bind(remote_socket, reinterpret_cast<sockaddr*>(&sa_local), sizeof(sockaddr));
+		// ********************************************************************************
+		/// <summary>
+		/// AcceptEx completion: reposts the accept and queues the accepted socket for the
+		/// connect threads
+		/// </summary>
+		/// <param name="context">AcceptEx I/O context</param>
+		/// <param name="status">I/O completion status</param>
+		// ********************************************************************************
+		void process_accept_complete(server_io_context* context, const BOOL status)
+		{
+			auto accepted = context->accepted_socket;
+			context->accepted_socket = INVALID_SOCKET;
 
-				if (status == SOCKET_ERROR)
-				{
-					shutdown(remote_socket, SD_BOTH);
-					closesocket(remote_socket);
+			auto reposted = true;
 
-					return false;
-				}
-			}
-			else
 			{
-				sockaddr_in6 sa_local{};
-				sa_local.sin6_family = address_type_t::af_type;
-				sa_local.sin6_port = htons(0);
-				sa_local.sin6_addr = in6addr_any;
-
-				// bind socket's name
-				const auto status = bind(remote_socket, reinterpret_cast<sockaddr*>(&sa_local), sizeof(sockaddr));
+				// stop() closes the listening socket under the exclusive lock
+				std::shared_lock lock(lock_);
 
-				if (status == SOCKET_ERROR)
+				if (end_server_)
 				{
-					shutdown(remote_socket, SD_BOTH);
-					closesocket(remote_socket);
+					close_socket(accepted);
+					return;
+				}
 
-					return false;
+				if (status)
+				{
+					setsockopt(accepted, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+					           reinterpret_cast<char*>(&server_socket_), sizeof(server_socket_));
 				}
-			}
 
-			// enable non-blocking mode
-			u_long mode = 1;
-			auto ret = ioctlsocket(remote_socket, FIONBIO, &mode);
+				// keep the number of pending accepts constant, the failed one is retried by clear_thread
+				reposted = post_accept(context);
+			}
 
-			// The client_service structure specifies the address family,
-			// IP address, and port of the server to be connected to.
+			if (!reposted)
 			{
-				std::lock_guard lock(lock_);
-
-				sock_array_events_.push_back(
-					std::make_tuple(WSACreateEvent(), accepted, remote_socket, std::move(negotiate_ctx)));
+				log_printer("process_accept_complete: failed to repost AcceptEx: " +
+					std::to_string(WSAGetLastError()));
 
-				WSAEventSelect(remote_socket, std::get<0>(sock_array_events_.back()), FD_CONNECT);
+				std::lock_guard lock(lock_);
+				idle_accept_contexts_.push_back(context);
+			}
 
-				WSASetEvent(std::get<0>(sock_array_events_[0]));
+			if (!status || !queue_accepted(accepted))
+			{
+				close_socket(accepted);
 			}
+		}
 
-			// connect to server
-			if constexpr (address_type_t::af_type == AF_INET)
+		// ********************************************************************************
+		/// <summary>
+		/// Hands the accepted socket over to the connect threads
+		/// </summary>
+		/// <param name="accepted">accepted socket</param>
+		/// <returns>false if the proxy is stopping or the socket can't be queued</returns>
+		// ********************************************************************************
+		bool queue_accepted(const SOCKET accepted)
+		{
+			try
 			{
-				sockaddr_in sa_service{};
-				sa_service.sin_family = address_type_t::af_type;
-				sa_service.sin_addr = remote_ip;
-				sa_service.sin_port = htons(remote_port);
+				std::lock_guard lock(accepted_queue_lock_);
 
-				if (connect(remote_socket, reinterpret_cast<SOCKADDR*>(&sa_service), sizeof(sa_service)) ==
-					SOCKET_ERROR)
-				{
-					if (WSAGetLastError() != WSAEWOULDBLOCK)
-					{
-						shutdown(remote_socket, SD_BOTH);
-						closesocket(remote_socket);
+				if (end_server_)
+					return false;
 
-						return false;
-					}
-				}
+				accepted_queue_.push_back(accepted);
 			}
-			else
+			catch (...)
 			{
-				sockaddr_in6 sa_service{};
-				sa_service.sin6_family = address_type_t::af_type;
-				sa_service.sin6_addr = remote_ip;
-				sa_service.sin6_port = htons(remote_port);
-
-				if (connect(remote_socket, reinterpret_cast<SOCKADDR*>(&sa_service), sizeof(sa_service)) ==
-					SOCKET_ERROR)
-				{
-					if (WSAGetLastError() != WSAEWOULDBLOCK)
-					{
-						shutdown(remote_socket, SD_BOTH);
-						closesocket(remote_socket);
-
-						return false;
-					}
-				}
+				return false;
 			}
 
+			accepted_queue_event_.notify_one();
+
 			return true;
 		}
 
-		void start_proxy_thread()
+		// ********************************************************************************
+		/// <summary>
+		/// Connect thread: queries the remote peer of each accepted socket and connects to
+		/// it (pooled socket or ConnectEx). Exits when the proxy is stopped, closing the
+		/// sockets left in the queue.
+		/// </summary>
+		// ********************************************************************************
+		void connect_thread()
 		{
-			while (end_server_ == false)
+			for (;;)
 			{
-				//
-				// loop accepting connections from clients until proxy shuts down
-				//
-				const auto accepted = WSAAccept(server_socket_, nullptr, nullptr, nullptr, 0);
+				auto accepted = INVALID_SOCKET;
 
-				if ((accepted == static_cast<UINT_PTR>(SOCKET_ERROR)) || end_server_)
 				{
-					break;
+					std::unique_lock lock(accepted_queue_lock_);
+
+					accepted_queue_event_.wait(lock, [this] { return end_server_ || !accepted_queue_.empty(); });
+
+					if (accepted_queue_.empty())
+						return;
+
+					accepted = accepted_queue_.front();
+					accepted_queue_.pop_front();
 				}
 
-				if (const auto connected = connect_to_remote_host(accepted); !connected)
+				if (end_server_ || !connect_to_remote_host(accepted))
 				{
-					closesocket(accepted);
+					close_socket(accepted);
 				}
 			}
 		}
 
-		void connect_to_remote_host_thread()
+		bool connect_to_remote_host(SOCKET accepted)
 		{
-			std::vector<WSAEVENT> wait_events;
-			wait_events.reserve(connections_array_size);
+			auto [remote_ip, remote_port, negotiate_ctx] = get_remote_peer(accepted);
 
-			while (end_server_ == false)
-			{
-				// initialize wait events array
-				wait_events.clear();
+			if (!remote_port)
+				return false;
+
+			if (log_level_ > netlib::log::log_level::debug)
+				log_printer(std::string("connect_to_remote_host:  ") + std::string{remote_ip} + " : " +
+					std::to_string(remote_port));
 
+			if (connected_socket_provider_ && negotiate_ctx)
+			{
+				if (auto remote_socket = connected_socket_provider_(remote_ip, remote_port, *negotiate_ctx);
+					remote_socket != INVALID_SOCKET)
 				{
-					std::shared_lock lock(lock_);
+					std::lock_guard lock(lock_);
+
+					// the socket is not associated with the completion port yet, so the provider
+					// can take it back and hand it out again
+					if (end_server_ || !completion_port_.associate_socket(remote_socket, completion_key_))
+					{
+						if (connected_socket_release_)
+							connected_socket_release_(remote_socket);
+						else
+							close_socket(remote_socket);
 
-					std::transform(sock_array_events_.cbegin(), sock_array_events_.cend(),
-					               std::back_inserter(wait_events), [](auto&& e)
-					               {
-						               return std::get<0>(e);
-					               });
+						return false;
+					}
+
+					start_proxy_socket(accepted, remote_socket, std::move(negotiate_ctx));
+					return true;
 				}
+			}
 
-				const auto event_index = wait_for_multiple_objects(static_cast<DWORD>(wait_events.size()),
-				                                                  wait_events.data(), INFINITE);
+			auto remote_socket = WSASocket(address_type_t::af_type, SOCK_STREAM, IPPROTO_TCP, nullptr, 0,
+			                               WSA_FLAG_OVERLAPPED);
 
-				if (end_server_ == true)
-					break;
+			if (remote_socket == INVALID_SOCKET)
+			{
+				return false;
+			}
 
-				if (event_index != 0)
-				{
-					std::lock_guard<std::shared_mutex> lock(lock_);
+			// ConnectEx requires the socket to be bound
+			SOCKADDR_STORAGE sa_local{};
+			const auto sa_local_length = make_socket_address(address_type_t{}, 0, sa_local);
 
-					WSACloseEvent(wait_events[event_index]);
+			if (bind(remote_socket, reinterpret_cast<sockaddr*>(&sa_local), sa_local_length) == SOCKET_ERROR ||
+				!completion_port_.associate_socket(remote_socket, completion_key_))
+			{
+				close_socket(remote_socket);
+				return false;
+			}
 
-					proxy_sockets_.push_back(std::make_unique<T>(
-						std::get<1>(sock_array_events_[event_index]),
-						std::get<2>(sock_array_events_[event_index]),
-						std::move(std::get<3>(sock_array_events_[event_index])),
-						log_printer_, log_level_));
+			auto context = std::make_unique<server_io_context>(proxy_io_operation::connect_io);
+			context->accepted_socket = accepted;
+			context->remote_socket = remote_socket;
+			context->negotiate_ctx = std::move(negotiate_ctx);
 
-					proxy_sockets_.back()->associate_to_completion_port(completion_key_, completion_port_);
-					proxy_sockets_.back()->start();
+			auto* const context_ptr = context.get();
 
-					sock_array_events_.erase(sock_array_events_.begin() + event_index);
-				}
-				else
-				{
-					WSAResetEvent(wait_events[event_index]);
-				}
+			SOCKADDR_STORAGE sa_service{};
+			const auto sa_service_length = make_socket_address(remote_ip, remote_port, sa_service);
+
+			// ConnectEx is posted under the lock, so stop() either finds it in pending_connects_ and cancels
+			// it or it is not posted at all. context_ptr can't be accessed after successful ConnectEx since
+			// completion may have already freed it.
+			std::lock_guard lock(lock_);
+
+			if (end_server_)
+			{
+				close_socket(remote_socket);
+				return false;
 			}
 
-			// cleanup on exit
-			std::shared_lock lock(lock_);
+			pending_connects_.emplace(context_ptr, std::move(context));
+			++pending_operations_;
 
-			for (auto&& a : sock_array_events_)
+			if (!connect_ex_(remote_socket, reinterpret_cast<SOCKADDR*>(&sa_service), sa_service_length,
+			                 nullptr, 0, nullptr, context_ptr) && (ERROR_IO_PENDING != WSAGetLastError()))
 			{
-				if (std::get<0>(a) != INVALID_HANDLE_VALUE)
-				{
-					WSACloseEvent(std::get<0>(a));
-				}
+				--pending_operations_;
+				pending_connects_.erase(context_ptr);
+				close_socket(remote_socket);
+				return false;
+			}
 
-				if (std::get<1>(a) != INVALID_SOCKET)
-				{
-					shutdown(std::get<1>(a), SD_BOTH);
-					closesocket(std::get<1>(a));
-					std::get<1>(a) = INVALID_SOCKET;
-				}
+			return true;
+		}
 
-				if (std::get<2>(a) != INVALID_SOCKET)
-				{
-					shutdown(std::get<2>(a), SD_BOTH);
-					closesocket(std::get<2>(a));
-					std::get<2>(a) = INVALID_SOCKET;
-				}
+		// ********************************************************************************
+		/// <summary>
+		/// ConnectEx completion: creates proxy socket and starts it
+		/// </summary>
+		/// <param name="context">ConnectEx I/O context</param>
+		/// <param name="status">I/O completion status</param>
+		// ********************************************************************************
+		void process_connect_complete(server_io_context* context, const BOOL status)
+		{
+			std::lock_guard lock(lock_);
+
+			const auto it = pending_connects_.find(context);
+
+			if (it == pending_connects_.end())
+				return;
+
+			const auto connect_context = std::move(it->second);
+			pending_connects_.erase(it);
+
+			if (!status || end_server_)
+			{
+				if (log_level_ > netlib::log::log_level::debug)
+					log_printer("process_connect_complete: failed to connect to the remote host");
+
+				close_socket(connect_context->accepted_socket);
+				close_socket(connect_context->remote_socket);
+				return;
 			}
+
+			setsockopt(connect_context->remote_socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0);
+
+			start_proxy_socket(connect_context->accepted_socket, connect_context->remote_socket,
+			                   std::move(connect_context->negotiate_ctx));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Creates proxy socket for the connected pair and starts it. Must be called under lock_.
+		/// </summary>
+		/// <param name="accepted">accepted (local) socket</param>
+		/// <param name="remote">socket connected to the remote host</param>
+		/// <param name="negotiate_ctx">negotiate context</param>
+		// ********************************************************************************
+		void start_proxy_socket(const SOCKET accepted, const SOCKET remote,
+		                        std::unique_ptr<negotiate_context_t> negotiate_ctx)
+		{
+			proxy_sockets_.push_back(std::make_unique<T>(
+				accepted,
+				remote,
+				std::move(negotiate_ctx),
+				log_printer_, log_level_));
+
+			proxy_sockets_.back()->set_established();
+			proxy_sockets_.back()->start();
 		}
 
 		void clear_thread()
@@ -588,6 +860,15 @@ namespace proxy
 					{
 						return a->is_ready_for_removal();
 					}), proxy_sockets_.end());
+
+					// restore the accept backlog depth
+					if (end_server_ == false)
+					{
+						idle_accept_contexts_.erase(
+							std::remove_if(idle_accept_contexts_.begin(), idle_accept_contexts_.end(),
+							               [this](auto* context) { return post_accept(context); }),
+							idle_accept_contexts_.end());
+					}
 				}
 
 				using namespace std::chrono_literals;
@@ -602,61 +883,5 @@ namespace proxy
 				log_printer_((std::string("tcp_proxy_server: ") + message).c_str());
 			}
 		}
-
-		/**
-		 * Function that waits for multiple objects (e.g. threads or processes)
-		 * @param count Number of objects to wait for
-		 * @param handles Array of handles to the objects
-		 * @param ms Maximum time to wait for, in milliseconds
-		 * @return WAIT_OBJECT_0 if the function succeeds, WAIT_TIMEOUT if the function times out
-		 */
-		static DWORD wait_for_multiple_objects(const DWORD count, const HANDLE* handles, const DWORD ms)
-		{
-			// Thread local seed for rand_r
-			static thread_local auto seed = static_cast<uint32_t>(time(nullptr));
-
-			// Initial result set to timeout
-			DWORD result = WAIT_TIMEOUT;
-
-			// If the number of objects is greater than the maximum allowed...
-			if (count >= MAXIMUM_WAIT_OBJECTS)
-			{
-				// Loop until a handle is signaled or until the timeout is reached if timeout is infinite
-				do
-				{
-					// Divide the number of handles in half
-					const DWORD split = count / 2;
-
-					// Divide the wait time in half, if timeout is infinite, use a default wait time of 2000ms
-					const DWORD wait = (ms == INFINITE ? 2000 : ms) / 2;
-					const int random = rand_s(&seed);
-
-					// Recurse on both halves in a random order until a handle is signaled or all handles are checked
-					for (short branch = 0; branch < 2 && result == WAIT_TIMEOUT; branch++)
-					{
-						if (random % 2 == branch)
-						{
-							// Wait for the lower half of handles
-							result = wait_for_multiple_objects(split, handles, wait);
-						}
-						else
-						{
-							// Wait for the upper half of handles, adjust result if a handle is signaled
-							result = wait_for_multiple_objects(count - split, handles + split, wait);
-							if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + split) result += split;
-						}
-					}
-				} while (ms == INFINITE && result == WAIT_TIMEOUT);
-			}
-			else
-			{
-				// If the number of handles is within limit, use the native win32 function
-				result = ::WaitForMultipleObjects(count, handles, FALSE, ms);
-			}
-
-			// Return the result
-			return result;
-		}
-
 	};
 }
@@ -33,6 +33,18 @@ namespace proxy
 	template <typename T>
 	class tcp_proxy_server;
 
+	// ********************************************************************************
+	/// <summary>
+	/// Shared pool of the relay buffers used by all tcp_proxy_socket instances
+	/// </summary>
+	/// <returns>buffer pool reference</returns>
+	// ********************************************************************************
+	inline tools::buffer_pool& relay_buffer_pool()
+	{
+		static tools::buffer_pool pool; // NOLINT(clang-diagnostic-exit-time-destructors)
+		return pool;
+	}
+
 	// ReSharper disable once CppClassCanBeFinal
 	template <typename T>
 	class tcp_proxy_socket
@@ -45,7 +57,75 @@ namespace proxy
 		using per_io_context_t = tcp_per_io_context<T>;
 
 	protected:
-		constexpr static size_t send_receive_buffer_size = 65536;
+		/// <summary>relay buffer size attached to the connection on the first data arrival</summary>
+		constexpr static uint32_t initial_relay_buffer_size = 16384;
+		/// <summary>relay buffer size lower bound (quiet flows)</summary>
+		constexpr static uint32_t min_relay_buffer_size = tools::buffer_pool::min_block_size;
+		/// <summary>relay buffer size upper bound (bulk flows)</summary>
+		constexpr static uint32_t max_relay_buffer_size = tools::buffer_pool::max_block_size;
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// One direction of the data relay. The buffer is taken from relay_buffer_pool()
+		/// only while there is data in flight, idle direction waits on zero-byte receive.
+		/// Data is received into [tail, size) and sent from [head, tail).
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct relay_channel
+		{
+			relay_channel(tcp_proxy_socket* socket, const bool from_local)
+				: recv_context{proxy_io_operation::relay_io_read, socket, from_local},
+				  zero_recv_context{proxy_io_operation::relay_io_zero_read, socket, from_local},
+				  send_context{proxy_io_operation::relay_io_write, socket, !from_local},
+				  from_local(from_local)
+			{
+			}
+
+			// ********************************************************************************
+			/// <summary>
+			/// Takes over the relay state (but not the I/O contexts) from another channel
+			/// </summary>
+			/// <param name="other">channel to move from</param>
+			// ********************************************************************************
+			void move_state_from(relay_channel& other) noexcept
+			{
+				buffer = std::move(other.buffer);
+				head = other.head;
+				tail = other.tail;
+				buffer_size = other.buffer_size;
+				recv_pending = other.recv_pending;
+				zero_recv_pending = other.zero_recv_pending;
+				send_pending = other.send_pending;
+				recv_buf = other.recv_buf;
+				send_buf = other.send_buf;
+			}
+
+			/// <summary>pooled buffer, empty when the direction is idle</summary>
+			tools::buffer_pool::buffer buffer;
+			/// <summary>offset of the first byte not yet sent</summary>
+			uint32_t head{0};
+			/// <summary>offset of the first free byte</summary>
+			uint32_t tail{0};
+			/// <summary>size of the buffer to attach next time (adapts to the flow)</summary>
+			uint32_t buffer_size{initial_relay_buffer_size};
+			/// <summary>buffered receive is in progress</summary>
+			bool recv_pending{false};
+			/// <summary>zero-byte receive is in progress</summary>
+			bool zero_recv_pending{false};
+			/// <summary>send is in progress</summary>
+			bool send_pending{false};
+
+			WSABUF recv_buf{0, nullptr};
+			WSABUF zero_recv_buf{0, nullptr};
+			WSABUF send_buf{0, nullptr};
+
+			per_io_context_t recv_context;
+			per_io_context_t zero_recv_context;
+			per_io_context_t send_context;
+
+			/// <summary>true if data is received from the local socket and sent to the remote one</summary>
+			bool from_local;
+		};
 
 		/// <summary>local connection socket</summary>
 		SOCKET local_socket_;
@@ -65,24 +145,10 @@ namespace proxy
 		std::mutex lock_;
 		connection_status connection_status_{connection_status::client_connected};
 
-		std::array<char, send_receive_buffer_size> from_local_to_remote_buffer_{};
-		std::array<char, send_receive_buffer_size> from_remote_to_local_buffer_{};
-
-		WSABUF local_recv_buf_{
-			static_cast<ULONG>(from_local_to_remote_buffer_.size()), from_local_to_remote_buffer_.data()
-		};
-		WSABUF local_send_buf_{0, nullptr};
-		WSABUF remote_recv_buf_{
-			static_cast<ULONG>(from_remote_to_local_buffer_.size()), from_remote_to_local_buffer_.data()
-		};
-		WSABUF remote_send_buf_{0, nullptr};
-
 		std::chrono::steady_clock::time_point timestamp_{ std::chrono::steady_clock::now() };
 
-		per_io_context_t io_context_recv_from_local_{proxy_io_operation::relay_io_read, this, true};
-		per_io_context_t io_context_recv_from_remote_{proxy_io_operation::relay_io_read, this, false};
-		per_io_context_t io_context_send_to_local_{proxy_io_operation::relay_io_write, this, true};
-		per_io_context_t io_context_send_to_remote_{proxy_io_operation::relay_io_write, this, false};
+		relay_channel from_local_to_remote_{this, true};
+		relay_channel from_remote_to_local_{this, false};
 
 	public:
 		tcp_proxy_socket(const SOCKET local_socket, const SOCKET remote_socket,
@@ -138,17 +204,9 @@ namespace proxy
 			log_level_ = other.log_level_;
 			is_disable_nagle_ = other.is_disable_nagle_;
 			connection_status_ = other.connection_status_;
-			from_local_to_remote_buffer_ = std::move(other.from_local_to_remote_buffer_);
-			from_remote_to_local_buffer_ = std::move(other.from_remote_to_local_buffer_);
-			local_recv_buf_ = std::move(other.local_recv_buf_);
-			local_send_buf_ = std::move(other.local_send_buf_);
-			remote_recv_buf_ = std::move(other.remote_recv_buf_);
-			remote_send_buf_ = std::move(other.remote_send_buf_);
 			timestamp_ = std::move(other.timestamp_);
-			io_context_recv_from_local_ = std::move(other.io_context_recv_from_local_);
-			io_context_recv_from_remote_ = std::move(other.io_context_recv_from_remote_);
-			io_context_send_to_local_ = std::move(other.io_context_send_to_local_);
-			io_context_send_to_remote_ = std::move(other.io_context_send_to_remote_);
+			from_local_to_remote_.move_state_from(other.from_local_to_remote_);
+			from_remote_to_local_.move_state_from(other.from_remote_to_local_);
 		}
 
 		// ReSharper disable once CppSpecialFunctionWithoutNoexceptSpecification
@@ -169,6 +227,17 @@ namespace proxy
 			return false;
 		}
 
+		// ********************************************************************************
+		/// <summary>
+		/// Marks connection as established when both sockets were associated with the
+		/// I/O completion port in advance (AcceptEx/ConnectEx path of tcp_proxy_server)
+		/// </summary>
+		// ********************************************************************************
+		void set_established() noexcept
+		{
+			connection_status_ = connection_status::client_established;
+		}
+
 		template <bool AlreadyLocked = false>
 		void close_client(const bool is_receive, const bool is_local)
 		{
@@ -179,6 +248,18 @@ namespace proxy
 				lock.lock();
 			}
 
+			// the failed/completed operation is not pending anymore
+			if (is_receive)
+			{
+				auto& channel = channel_for_receive(is_local);
+				channel.recv_pending = false;
+				channel.zero_recv_pending = false;
+			}
+			else
+			{
+				channel_for_send(is_local).send_pending = false;
+			}
+
 			if (is_local)
 			{
 				if (local_socket_ != INVALID_SOCKET)
@@ -189,15 +270,6 @@ namespace proxy
 					connection_status_ = connection_status::client_completed;
 				}
 
-				if (is_receive)
-				{
-					local_recv_buf_.len = 0;
-				}
-				else
-				{
-					local_send_buf_.len = 0;
-				}
-
 				if (remote_socket_ != INVALID_SOCKET)
 				{
 					shutdown(remote_socket_, SD_BOTH);
@@ -215,15 +287,6 @@ namespace proxy
 					connection_status_ = connection_status::client_completed;
 				}
 
-				if (is_receive)
-				{
-					remote_recv_buf_.len = 0;
-				}
-				else
-				{
-					remote_send_buf_.len = 0;
-				}
-
 				if (local_socket_ != INVALID_SOCKET)
 				{
 					shutdown(local_socket_, SD_BOTH);
@@ -242,10 +305,7 @@ namespace proxy
 			if ((remote_socket_ == INVALID_SOCKET) && 
 				(local_socket_ == INVALID_SOCKET))
 			{
-				if ((remote_send_buf_.len == 0 &&
-					local_send_buf_.len == 0 &&
-					remote_recv_buf_.len == 0 &&
-					local_recv_buf_.len == 0))
+				if (!is_io_pending(from_local_to_remote_) && !is_io_pending(from_remote_to_local_))
 				{
 					return true;
 				}
@@ -308,367 +368,118 @@ namespace proxy
 			timestamp_ = std::chrono::steady_clock::now();
 		}
 
-		virtual void process_receive_buffer_complete(const uint32_t io_size, per_io_context_t* io_context)
+		// ********************************************************************************
+		/// <summary>
+		/// Zero-byte receive completion: data is available on the socket, attaches the
+		/// relay buffer and receives it
+		/// </summary>
+		/// <param name="io_context">I/O context of the completed operation</param>
+		// ********************************************************************************
+		virtual void process_zero_receive_complete(per_io_context_t* io_context)
 		{
 			std::lock_guard lock(lock_);
 
 			timestamp_ = std::chrono::steady_clock::now();
 
-			switch (connection_status_)
+			auto& channel = channel_for_receive(io_context->is_local);
+			channel.zero_recv_pending = false;
+
+			if (connection_status_ == connection_status::client_established)
 			{
-			case connection_status::client_completed:
-				{
-					if (io_context->is_local)
-					{
-						local_recv_buf_.len = 0;
-					}
-					else
-					{
-						remote_recv_buf_.len = 0;
-					}
-
-					break;
-				}
-			case connection_status::client_established:
-				{
-					if (io_context->is_local)
-					{
-						if (log_level_ > netlib::log::log_level::debug)
-							log_printer(
-								std::string(
-									"process_receive_buffer_complete: data received from locally connected socket: ")
-								+ std::to_string(io_size));
-
-						// data received from locally connected socket
-						if (remote_send_buf_.len == 0)
-						{
-							// if there is no "send to remotely connected socket" in progress
-							// then forward the received data to remote host
-							remote_send_buf_.buf = local_recv_buf_.buf;
-							remote_send_buf_.len = io_size;
-
-							if (log_level_ > netlib::log::log_level::debug)
-								log_printer(
-									std::string(
-										"process_receive_buffer_complete: sending data to remotely connected socket: ")
-									+ std::to_string(io_size));
-
-							if ((::WSASend(
-								remote_socket_,
-								&remote_send_buf_,
-								1,
-								nullptr,
-								0,
-								&io_context_send_to_remote_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								// Close connection to remote peer in case of error
-								close_client<true>(false, false);
-							}
-						}
-
-						// shift the receive buffer for the amount of received data
-						// buffer is cyclic, adjust the available buffer size
-						// if end of the buffer is reached then go from the start
-						local_recv_buf_.buf += io_size;
-
-						if (local_recv_buf_.buf > remote_send_buf_.buf)
-						{
-							if (local_recv_buf_.buf < from_local_to_remote_buffer_.data() + from_local_to_remote_buffer_
-								.size())
-							{
-								local_recv_buf_.len = static_cast<ULONG>(from_local_to_remote_buffer_.data() +
-									from_local_to_remote_buffer_.size() - local_recv_buf_.buf);
-							}
-							else
-							{
-								local_recv_buf_.buf = from_local_to_remote_buffer_.data();
-								local_recv_buf_.len = static_cast<ULONG>(remote_send_buf_.buf -
-									from_local_to_remote_buffer_.data());
-							}
-						}
-						else
-						{
-							local_recv_buf_.len = static_cast<ULONG>(remote_send_buf_.buf - local_recv_buf_.buf);
-						}
-
-						// initiate the new receive if we have space in receive buffer
-						if (local_recv_buf_.len)
-						{
-							DWORD flags = 0;
-
-							if ((::WSARecv(
-								local_socket_,
-								&local_recv_buf_,
-								1,
-								nullptr,
-								&flags,
-								&io_context_recv_from_local_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								// Close connection to local peer in case of error
-								close_client<true>(true, true);
-							}
-						}
-					}
-					else
-					{
-						if (log_level_ > netlib::log::log_level::debug)
-							log_printer(
-								std::string(
-									"process_receive_buffer_complete: data received from remotely connected socket: ")
-								+ std::to_string(io_size));
-
-						// data received from remotely connected socket
-						if (local_send_buf_.len == 0)
-						{
-							// if there is no "send to locally connected socket" in progress
-							// then forward the received data to local host
-							local_send_buf_.buf = remote_recv_buf_.buf;
-							local_send_buf_.len = io_size;
-
-							if (log_level_ > netlib::log::log_level::debug)
-								log_printer(
-									std::string(
-										"process_receive_buffer_complete: sending data to locally connected socket: ")
-									+ std::to_string(io_size));
-
-							if ((::WSASend(
-								local_socket_,
-								&local_send_buf_,
-								1,
-								nullptr,
-								0,
-								&io_context_send_to_local_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								// Close connection to local peer in case of error
-								close_client<true>(false, true);
-							}
-						}
-
-						// shift the receive buffer for the amount of received data
-						// buffer is cyclic, adjust the available buffer size
-						// if end of the buffer is reached then go from the start
-						remote_recv_buf_.buf += io_size;
-
-						if (remote_recv_buf_.buf > local_send_buf_.buf)
-						{
-							if (remote_recv_buf_.buf < from_remote_to_local_buffer_.data() +
-								from_remote_to_local_buffer_.size())
-							{
-								remote_recv_buf_.len = static_cast<DWORD>(from_remote_to_local_buffer_.data() +
-									from_remote_to_local_buffer_.size() - remote_recv_buf_.buf
-								);
-							}
-							else
-							{
-								remote_recv_buf_.buf = from_remote_to_local_buffer_.data();
-								remote_recv_buf_.len = static_cast<DWORD>(local_send_buf_.buf -
-									from_remote_to_local_buffer_.data());
-							}
-						}
-						else
-						{
-							remote_recv_buf_.len = static_cast<DWORD>(local_send_buf_.buf - remote_recv_buf_.buf);
-						}
-
-						// initiate the new receive if we have space in receive buffer
-						if (remote_recv_buf_.len)
-						{
-							DWORD flags = 0;
-
-							if ((::WSARecv(
-								remote_socket_,
-								&remote_recv_buf_,
-								1,
-								nullptr,
-								&flags,
-								&io_context_recv_from_remote_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								// Close connection to remote peer in case of error
-								close_client<true>(true, false);
-							}
-						}
-					}
-
-					break;
-				}
-			case connection_status::client_no_change:
-			case connection_status::client_connected:
-				break;
+				post_receive(channel);
 			}
 		}
 
-		virtual void process_send_buffer_complete(const uint32_t io_size, per_io_context_t* io_context)
+		virtual void process_receive_buffer_complete(const uint32_t io_size, per_io_context_t* io_context)
 		{
 			std::lock_guard lock(lock_);
 
 			timestamp_ = std::chrono::steady_clock::now();
 
-			if (io_context->is_local)
-			{
-				if (log_level_ > netlib::log::log_level::debug)
-					log_printer(std::string("process_send_buffer_complete: send complete to locally connected socket: ")
-						+ std::to_string(io_size));
+			auto& channel = channel_for_receive(io_context->is_local);
+			channel.recv_pending = false;
 
-				if (connection_status_ != connection_status::client_completed)
-				{
-					if (remote_recv_buf_.len == 0)
-					{
-						DWORD flags = 0;
-
-						remote_recv_buf_.buf = local_send_buf_.buf;
-						remote_recv_buf_.len = io_size;
-
-						if (remote_recv_buf_.len > 0)
-						{
-							if ((::WSARecv(
-								remote_socket_,
-								&remote_recv_buf_,
-								1,
-								nullptr,
-								&flags,
-								&io_context_recv_from_remote_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								close_client<true>(true, false);
-							}
-						}
-					}
-				}
+			if (connection_status_ != connection_status::client_established)
+				return;
 
-				local_send_buf_.buf += io_size;
+			if (log_level_ > netlib::log::log_level::debug)
+				log_printer(
+					std::string("process_receive_buffer_complete: data received from ") +
+					(io_context->is_local ? "locally" : "remotely") + " connected socket: " +
+					std::to_string(io_size));
 
-				if (local_send_buf_.buf == from_remote_to_local_buffer_.data() + from_remote_to_local_buffer_.size())
-				{
-					local_send_buf_.buf = from_remote_to_local_buffer_.data();
-				}
+			// the whole free space was used, more data is likely waiting in the socket
+			const auto is_filled = (io_size == channel.recv_buf.len);
 
-				if (local_send_buf_.buf == remote_recv_buf_.buf)
-				{
-					if (connection_status_ == connection_status::client_completed)
-					{
-						close_client<true>(false, false);
-					}
+			channel.tail += io_size;
 
-					local_send_buf_.len = 0;
-				}
-				else
-				{
-					if (local_send_buf_.buf < remote_recv_buf_.buf)
-					{
-						local_send_buf_.len = static_cast<ULONG>(remote_recv_buf_.buf - local_send_buf_.buf);
-					}
-					else
-					{
-						local_send_buf_.len = static_cast<ULONG>(from_remote_to_local_buffer_.data() +
-							from_remote_to_local_buffer_.size() - local_send_buf_.buf);
-					}
-
-					if (local_send_buf_.len)
-					{
-						if (log_level_ > netlib::log::log_level::debug)
-							log_printer(
-								std::string("process_send_buffer_complete: sending data to locally connected socket: ")
-								+ std::to_string(io_size));
-
-						if ((::WSASend(
-							local_socket_,
-							&local_send_buf_,
-							1,
-							nullptr,
-							0,
-							&io_context_send_to_local_,
-							nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-						{
-							close_client<true>(false, true);
-						}
-					}
-				}
+			adjust_buffer_size(channel, io_size, is_filled);
+
+			// if there is no send in progress then forward the received data
+			if (!channel.send_pending)
+			{
+				post_send(channel);
+
+				if (connection_status_ != connection_status::client_established)
+					return;
 			}
+
+			// continue receiving into the buffer for the bulk flow, otherwise wait for the
+			// next portion of data without holding the buffer
+			if (is_filled)
+				post_receive(channel);
 			else
+				post_zero_receive(channel);
+		}
+
+		virtual void process_send_buffer_complete(const uint32_t io_size, per_io_context_t* io_context)
+		{
+			std::lock_guard lock(lock_);
+
+			timestamp_ = std::chrono::steady_clock::now();
+
+			auto& channel = channel_for_send(io_context->is_local);
+			channel.send_pending = false;
+			channel.head += io_size;
+
+			if (log_level_ > netlib::log::log_level::debug)
+				log_printer(std::string("process_send_buffer_complete: send complete to ") +
+					(io_context->is_local ? "locally" : "remotely") + " connected socket: " +
+					std::to_string(io_size));
+
+			if (channel.head < channel.tail)
 			{
-				if (log_level_ > netlib::log::log_level::debug)
-					log_printer(
-						std::string("process_send_buffer_complete: send complete to remotely connected socket: ")
-						+ std::to_string(io_size));
+				// send the rest of the buffered data
+				post_send(channel);
+				return;
+			}
 
-				if (connection_status_ != connection_status::client_completed)
-				{
-					if (local_recv_buf_.len == 0)
-					{
-						DWORD flags = 0;
-
-						local_recv_buf_.buf = remote_send_buf_.buf;
-						local_recv_buf_.len = io_size;
-
-						if (local_recv_buf_.len)
-						{
-							if ((::WSARecv(
-								local_socket_,
-								&local_recv_buf_,
-								1,
-								nullptr,
-								&flags,
-								&io_context_recv_from_local_,
-								nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-							{
-								close_client<true>(true, true);
-							}
-						}
-					}
-				}
+			if (connection_status_ == connection_status::client_completed)
+			{
+				close_client<true>(false, false);
+				return;
+			}
 
-				remote_send_buf_.buf += io_size;
+			if (channel.recv_pending)
+			{
+				// receive is still in progress into the tail of the buffer
+				return;
+			}
 
-				if (remote_send_buf_.buf == from_local_to_remote_buffer_.data() + from_local_to_remote_buffer_.size())
-				{
-					remote_send_buf_.buf = from_local_to_remote_buffer_.data();
-				}
+			channel.head = channel.tail = 0;
 
-				if (remote_send_buf_.buf == local_recv_buf_.buf)
-				{
-					if (connection_status_ == connection_status::client_completed)
-					{
-						close_client<true>(false, false);
-					}
+			// return the buffer to the pool if the direction became idle or the flow
+			// requires the buffer of the different size
+			if (channel.zero_recv_pending ||
+				channel.buffer.size() != tools::buffer_pool::block_size(channel.buffer_size))
+			{
+				channel.buffer.reset();
+			}
 
-					remote_send_buf_.len = 0;
-				}
-				else
-				{
-					if (remote_send_buf_.buf < local_recv_buf_.buf)
-					{
-						remote_send_buf_.len = static_cast<ULONG>(local_recv_buf_.buf - remote_send_buf_.buf);
-					}
-					else
-					{
-						remote_send_buf_.len = static_cast<ULONG>(from_local_to_remote_buffer_.data() +
-							from_local_to_remote_buffer_.size() - remote_send_buf_.buf);
-					}
-
-					if (remote_send_buf_.len)
-					{
-						if (log_level_ > netlib::log::log_level::debug)
-							log_printer(
-								std::string("process_send_buffer_complete: sending data to remotely connected socket: ")
-								+ std::to_string(io_size));
-
-						if ((::WSASend(
-							remote_socket_,
-							&remote_send_buf_,
-							1,
-							nullptr,
-							0,
-							&io_context_send_to_remote_,
-							nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
-						{
-							close_client<true>(false, false);
-						}
-					}
-				}
+			// receive was stalled on the full buffer
+			if (!channel.zero_recv_pending)
+			{
+				post_receive(channel);
 			}
 		}
 
@@ -792,35 +603,151 @@ namespace proxy
 			return true;
 		}
 
+
 		bool start_data_relay()
+		{
+			std::lock_guard lock(lock_);
+
+			// both directions start idle, relay buffers are attached on data arrival
+			post_zero_receive(from_local_to_remote_);
+
+			if (connection_status_ == connection_status::client_completed)
+				return false;
+
+			post_zero_receive(from_remote_to_local_);
+
+			return connection_status_ != connection_status::client_completed;
+		}
+
+		relay_channel& channel_for_receive(const bool is_local) noexcept
+		{
+			return is_local ? from_local_to_remote_ : from_remote_to_local_;
+		}
+
+		relay_channel& channel_for_send(const bool is_local) noexcept
+		{
+			return is_local ? from_remote_to_local_ : from_local_to_remote_;
+		}
+
+		static bool is_io_pending(const relay_channel& channel) noexcept
+		{
+			return channel.recv_pending || channel.zero_recv_pending || channel.send_pending;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Grows the relay buffer size for the bulk flow and shrinks it back when the flow
+		/// goes quiet. Applied next time the buffer is attached.
+		/// </summary>
+		/// <param name="channel">relay direction</param>
+		/// <param name="io_size">size of the received data</param>
+		/// <param name="is_filled">true if receive has used all available buffer space</param>
+		// ********************************************************************************
+		static void adjust_buffer_size(relay_channel& channel, const uint32_t io_size, const bool is_filled) noexcept
+		{
+			if (is_filled)
+			{
+				channel.buffer_size = std::min(channel.buffer_size * 2, max_relay_buffer_size);
+			}
+			else if (io_size < channel.buffer_size / 4)
+			{
+				channel.buffer_size = std::max(channel.buffer_size / 2, min_relay_buffer_size);
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Posts zero-byte receive, completes when data is available on the socket.
+		/// Must be called under lock_.
+		/// </summary>
+		/// <param name="channel">relay direction</param>
+		// ********************************************************************************
+		void post_zero_receive(relay_channel& channel)
 		{
 			DWORD flags = 0;
 
-			auto ret = WSARecv(local_socket_, &local_recv_buf_, 1,
-			                   nullptr, &flags, &io_context_recv_from_local_, nullptr);
+			channel.zero_recv_pending = true;
 
-			if (const auto wsa_error = WSAGetLastError(); ret == SOCKET_ERROR && (ERROR_IO_PENDING != wsa_error))
+			if ((::WSARecv(
+				channel.from_local ? local_socket_ : remote_socket_,
+				&channel.zero_recv_buf,
+				1,
+				nullptr,
+				&flags,
+				&channel.zero_recv_context,
+				nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
 			{
-				close_client(true, true);
+				close_client<true>(true, channel.from_local);
+			}
+		}
 
-				remote_recv_buf_.len = 0;
+		// ********************************************************************************
+		/// <summary>
+		/// Attaches the relay buffer if needed and receives into its free space.
+		/// Must be called under lock_.
+		/// </summary>
+		/// <param name="channel">relay direction</param>
+		// ********************************************************************************
+		void post_receive(relay_channel& channel)
+		{
+			if (!channel.buffer)
+			{
+				channel.buffer = relay_buffer_pool().acquire(channel.buffer_size);
+				channel.head = channel.tail = 0;
 
-				return false;
+				if (!channel.buffer)
+				{
+					close_client<true>(true, channel.from_local);
+					return;
+				}
 			}
 
-			ret = WSARecv(remote_socket_, &remote_recv_buf_, 1,
-			              nullptr, &flags, &io_context_recv_from_remote_, nullptr);
+			// buffer is full, receive is resumed when the data is sent
+			if (channel.tail == channel.buffer.size())
+				return;
 
-			if (const auto wsa_error = WSAGetLastError(); ret == SOCKET_ERROR && (ERROR_IO_PENDING != wsa_error))
-			{
-				closesocket(local_socket_);
+			DWORD flags = 0;
 
-				close_client(true, false);
+			channel.recv_buf.buf = channel.buffer.data() + channel.tail;
+			channel.recv_buf.len = channel.buffer.size() - channel.tail;
+			channel.recv_pending = true;
 
-				return false;
+			if ((::WSARecv(
+				channel.from_local ? local_socket_ : remote_socket_,
+				&channel.recv_buf,
+				1,
+				nullptr,
+				&flags,
+				&channel.recv_context,
+				nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+			{
+				close_client<true>(true, channel.from_local);
 			}
+		}
 
-			return true;
+		// ********************************************************************************
+		/// <summary>
+		/// Sends buffered data to the opposite socket. Must be called under lock_.
+		/// </summary>
+		/// <param name="channel">relay direction</param>
+		// ********************************************************************************
+		void post_send(relay_channel& channel)
+		{
+			channel.send_buf.buf = channel.buffer.data() + channel.head;
+			channel.send_buf.len = channel.tail - channel.head;
+			channel.send_pending = true;
+
+			if ((::WSASend(
+				channel.from_local ? remote_socket_ : local_socket_,
+				&channel.send_buf,
+				1,
+				nullptr,
+				0,
+				&channel.send_context,
+				nullptr) == SOCKET_ERROR) && (ERROR_IO_PENDING != WSAGetLastError()))
+			{
+				close_client<true>(false, !channel.from_local);
+			}
 		}
 
 	private:
@@ -0,0 +1,295 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace tools
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Thread-safe pool of power-of-two sized memory blocks. Released blocks are cached
+	/// per size class (up to the configured byte budget) and reused by the subsequent
+	/// acquisitions, so short-lived buffers don't hit the heap on every I/O.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class buffer_pool
+	{
+	public:
+		/// <summary>smallest block size served by the pool</summary>
+		static constexpr uint32_t min_block_size = 4096;
+		/// <summary>largest block size served by the pool</summary>
+		static constexpr uint32_t max_block_size = 262144;
+		/// <summary>number of power-of-two size classes between min_block_size and max_block_size</summary>
+		static constexpr size_t size_classes = 7;
+
+		static_assert((min_block_size << (size_classes - 1)) == max_block_size);
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Pool usage counters snapshot
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct statistics
+		{
+			/// <summary>number of blocks allocated from the heap</summary>
+			uint64_t allocations;
+			/// <summary>number of acquisitions served from the cache</summary>
+			uint64_t reuses;
+			/// <summary>number of blocks freed because the cache budget was exhausted</summary>
+			uint64_t trims;
+			/// <summary>number of failed acquisitions</summary>
+			uint64_t failures;
+			/// <summary>bytes currently handed out to the pool users</summary>
+			uint64_t bytes_in_use;
+			/// <summary>maximum of bytes_in_use observed</summary>
+			uint64_t peak_bytes_in_use;
+			/// <summary>bytes cached in the pool free lists</summary>
+			uint64_t bytes_cached;
+		};
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Move-only owner of the pooled memory block, returns the block to the pool on
+		/// destruction or reset
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		class buffer
+		{
+			friend buffer_pool;
+
+			buffer(buffer_pool* pool, char* data, const uint32_t size) noexcept
+				: pool_(pool), data_(data), size_(size)
+			{
+			}
+
+		public:
+			buffer() = default;
+
+			buffer(const buffer& other) = delete;
+
+			buffer(buffer&& other) noexcept
+				: pool_(other.pool_), data_(other.data_), size_(other.size_)
+			{
+				other.pool_ = nullptr;
+				other.data_ = nullptr;
+				other.size_ = 0;
+			}
+
+			buffer& operator=(const buffer& other) = delete;
+
+			buffer& operator=(buffer&& other) noexcept
+			{
+				if (this == &other)
+					return *this;
+
+				reset();
+
+				pool_ = other.pool_;
+				data_ = other.data_;
+				size_ = other.size_;
+				other.pool_ = nullptr;
+				other.data_ = nullptr;
+				other.size_ = 0;
+				return *this;
+			}
+
+			~buffer()
+			{
+				reset();
+			}
+
+			/// <summary>
+			/// Returns the block to the pool
+			/// </summary>
+			void reset() noexcept
+			{
+				if (data_ != nullptr && pool_ != nullptr)
+				{
+					pool_->release(data_, size_);
+				}
+
+				pool_ = nullptr;
+				data_ = nullptr;
+				size_ = 0;
+			}
+
+			[[nodiscard]] char* data() const noexcept { return data_; }
+
+			[[nodiscard]] uint32_t size() const noexcept { return size_; }
+
+			explicit operator bool() const noexcept { return data_ != nullptr; }
+
+		private:
+			buffer_pool* pool_{nullptr};
+			char* data_{nullptr};
+			uint32_t size_{0};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the pool
+		/// </summary>
+		/// <param name="cache_budget">maximum number of bytes kept in the free lists</param>
+		// ********************************************************************************
+		explicit buffer_pool(const uint64_t cache_budget = 64ull * 1024 * 1024) noexcept
+			: cache_budget_(cache_budget)
+		{
+		}
+
+		buffer_pool(const buffer_pool& other) = delete;
+		buffer_pool(buffer_pool&& other) = delete;
+		buffer_pool& operator=(const buffer_pool& other) = delete;
+		buffer_pool& operator=(buffer_pool&& other) = delete;
+
+		~buffer_pool()
+		{
+			for (auto&& size_class : free_lists_)
+			{
+				for (auto* block : size_class.blocks)
+				{
+					delete[] block;
+				}
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Rounds the requested size up to the pool size class
+		/// </summary>
+		/// <param name="size">requested size</param>
+		/// <returns>size of the block which would be returned by acquire</returns>
+		// ********************************************************************************
+		static constexpr uint32_t block_size(const uint32_t size) noexcept
+		{
+			return min_block_size << size_class_index(size);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Acquires the block of at least the requested size (capped by max_block_size)
+		/// </summary>
+		/// <param name="size">requested size</param>
+		/// <returns>buffer object, empty if memory allocation has failed</returns>
+		// ********************************************************************************
+		[[nodiscard]] buffer acquire(const uint32_t size)
+		{
+			const auto index = size_class_index(size);
+			const auto actual_size = min_block_size << index;
+			char* block = nullptr;
+
+			{
+				auto& size_class = free_lists_[index];
+				std::lock_guard lock(size_class.lock);
+
+				if (!size_class.blocks.empty())
+				{
+					block = size_class.blocks.back();
+					size_class.blocks.pop_back();
+				}
+			}
+
+			if (block != nullptr)
+			{
+				bytes_cached_.fetch_sub(actual_size, std::memory_order_relaxed);
+				reuses_.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				block = new(std::nothrow) char[actual_size];
+
+				if (block == nullptr)
+				{
+					failures_.fetch_add(1, std::memory_order_relaxed);
+					return {};
+				}
+
+				allocations_.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			const auto in_use = bytes_in_use_.fetch_add(actual_size, std::memory_order_relaxed) + actual_size;
+
+			auto peak = peak_bytes_in_use_.load(std::memory_order_relaxed);
+			while (in_use > peak && !peak_bytes_in_use_.compare_exchange_weak(peak, in_use, std::memory_order_relaxed))
+			{
+			}
+
+			return {this, block, actual_size};
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the snapshot of the pool usage counters
+		/// </summary>
+		/// <returns>statistics structure</returns>
+		// ********************************************************************************
+		[[nodiscard]] statistics get_statistics() const noexcept
+		{
+			return {
+				allocations_.load(std::memory_order_relaxed),
+				reuses_.load(std::memory_order_relaxed),
+				trims_.load(std::memory_order_relaxed),
+				failures_.load(std::memory_order_relaxed),
+				bytes_in_use_.load(std::memory_order_relaxed),
+				peak_bytes_in_use_.load(std::memory_order_relaxed),
+				bytes_cached_.load(std::memory_order_relaxed)
+			};
+		}
+
+	private:
+		struct free_list
+		{
+			std::mutex lock;
+			std::vector<char*> blocks;
+		};
+
+		static constexpr size_t size_class_index(const uint32_t size) noexcept
+		{
+			size_t index = 0;
+
+			while (index < size_classes - 1 && (min_block_size << index) < size)
+				++index;
+
+			return index;
+		}
+
+		void release(char* block, const uint32_t size) noexcept
+		{
+			bytes_in_use_.fetch_sub(size, std::memory_order_relaxed);
+
+			if (bytes_cached_.fetch_add(size, std::memory_order_relaxed) + size <= cache_budget_)
+			{
+				auto& size_class = free_lists_[size_class_index(size)];
+
+				try
+				{
+					std::lock_guard lock(size_class.lock);
+					size_class.blocks.push_back(block);
+					return;
+				}
+				catch (...)
+				{
+				}
+			}
+
+			bytes_cached_.fetch_sub(size, std::memory_order_relaxed);
+			trims_.fetch_add(1, std::memory_order_relaxed);
+			delete[] block;
+		}
+
+		/// <summary>maximum number of bytes kept in the free lists</summary>
+		uint64_t cache_budget_;
+		/// <summary>free lists per size class</summary>
+		std::array<free_list, size_classes> free_lists_;
+
+		std::atomic<uint64_t> allocations_{0};
+		std::atomic<uint64_t> reuses_{0};
+		std::atomic<uint64_t> trims_{0};
+		std::atomic<uint64_t> failures_{0};
+		std::atomic<uint64_t> bytes_in_use_{0};
+		std::atomic<uint64_t> peak_bytes_in_use_{0};
+		std::atomic<uint64_t> bytes_cached_{0};
+	};
+}
@@ -0,0 +1,294 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace tools
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Merkle-Damgard block buffering shared by md5 and sha256: the input is collected
+	/// into 64 byte blocks passed to H::transform, the final block is padded with the
+	/// message bit length in H::big_endian_length byte order.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	template <typename H>
+	class block_digest
+	{
+	public:
+		/// <summary>
+		/// Adds the data to the digest
+		/// </summary>
+		/// <param name="data">data pointer</param>
+		/// <param name="length">data length</param>
+		void update(const void* data, size_t length) noexcept
+		{
+			const auto* bytes = static_cast<const uint8_t*>(data);
+
+			total_length_ += length;
+
+			if (buffered_ != 0)
+			{
+				const auto part = (std::min)(length, block_.size() - buffered_);
+				std::memcpy(block_.data() + buffered_, bytes, part);
+				buffered_ += part;
+				bytes += part;
+				length -= part;
+
+				if (buffered_ < block_.size())
+					return;
+
+				static_cast<H*>(this)->transform(block_.data());
+				buffered_ = 0;
+			}
+
+			for (; length >= block_.size(); bytes += block_.size(), length -= block_.size())
+				static_cast<H*>(this)->transform(bytes);
+
+			std::memcpy(block_.data(), bytes, length);
+			buffered_ = length;
+		}
+
+	protected:
+		void pad() noexcept
+		{
+			const auto bit_length = total_length_ * 8;
+
+			block_[buffered_++] = 0x80;
+
+			if (buffered_ > block_.size() - sizeof(uint64_t))
+			{
+				std::memset(block_.data() + buffered_, 0, block_.size() - buffered_);
+				static_cast<H*>(this)->transform(block_.data());
+				buffered_ = 0;
+			}
+
+			std::memset(block_.data() + buffered_, 0, block_.size() - sizeof(uint64_t) - buffered_);
+
+			for (size_t i = 0; i < sizeof(uint64_t); ++i)
+			{
+				const auto shift = H::big_endian_length ? (7 - i) * 8 : i * 8;
+				block_[block_.size() - sizeof(uint64_t) + i] = static_cast<uint8_t>(bit_length >> shift);
+			}
+
+			static_cast<H*>(this)->transform(block_.data());
+			buffered_ = 0;
+		}
+
+		static constexpr uint32_t rotate_left(const uint32_t value, const int bits) noexcept
+		{
+			return (value << bits) | (value >> (32 - bits));
+		}
+
+		static constexpr uint32_t rotate_right(const uint32_t value, const int bits) noexcept
+		{
+			return (value >> bits) | (value << (32 - bits));
+		}
+
+	private:
+		std::array<uint8_t, 64> block_{};
+		size_t buffered_{0};
+		uint64_t total_length_{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Streaming MD5 (RFC 1321). Not for security purposes, used for the fingerprints
+	/// defined over MD5 (e.g. JA3).
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class md5 : public block_digest<md5>
+	{
+		friend block_digest;
+
+	public:
+		using digest_type = std::array<uint8_t, 16>;
+
+		/// <summary>length field of the padding is little-endian</summary>
+		static constexpr bool big_endian_length = false;
+
+		/// <summary>
+		/// Completes the digest, the object must not be updated afterwards
+		/// </summary>
+		/// <returns>16 byte digest</returns>
+		digest_type finish() noexcept
+		{
+			pad();
+
+			digest_type result{};
+
+			for (size_t i = 0; i < state_.size(); ++i)
+				for (size_t j = 0; j < 4; ++j)
+					result[i * 4 + j] = static_cast<uint8_t>(state_[i] >> (j * 8));
+
+			return result;
+		}
+
+	private:
+		void transform(const uint8_t* block) noexcept
+		{
+			static constexpr uint32_t k[64] = {
+				0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+				0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+				0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+				0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+				0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+				0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+				0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+				0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+			};
+
+			static constexpr int r[64] = {
+				7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+				5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+				4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+				6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+			};
+
+			uint32_t m[16];
+
+			for (size_t i = 0; i < 16; ++i)
+			{
+				m[i] = static_cast<uint32_t>(block[i * 4]) | static_cast<uint32_t>(block[i * 4 + 1]) << 8 |
+					static_cast<uint32_t>(block[i * 4 + 2]) << 16 | static_cast<uint32_t>(block[i * 4 + 3]) << 24;
+			}
+
+			auto a = state_[0];
+			auto b = state_[1];
+			auto c = state_[2];
+			auto d = state_[3];
+
+			for (size_t i = 0; i < 64; ++i)
+			{
+				uint32_t f;
+				size_t g;
+
+				if (i < 16)
+				{
+					f = (b & c) | (~b & d);
+					g = i;
+				}
+				else if (i < 32)
+				{
+					f = (d & b) | (~d & c);
+					g = (5 * i + 1) % 16;
+				}
+				else if (i < 48)
+				{
+					f = b ^ c ^ d;
+					g = (3 * i + 5) % 16;
+				}
+				else
+				{
+					f = c ^ (b | ~d);
+					g = (7 * i) % 16;
+				}
+
+				const auto temp = d;
+				d = c;
+				c = b;
+				b = b + rotate_left(a + f + k[i] + m[g], r[i]);
+				a = temp;
+			}
+
+			state_[0] += a;
+			state_[1] += b;
+			state_[2] += c;
+			state_[3] += d;
+		}
+
+		std::array<uint32_t, 4> state_{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Streaming SHA-256 (FIPS 180-4)
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class sha256 : public block_digest<sha256>
+	{
+		friend block_digest;
+
+	public:
+		using digest_type = std::array<uint8_t, 32>;
+
+		/// <summary>length field of the padding is big-endian</summary>
+		static constexpr bool big_endian_length = true;
+
+		/// <summary>
+		/// Completes the digest, the object must not be updated afterwards
+		/// </summary>
+		/// <returns>32 byte digest</returns>
+		digest_type finish() noexcept
+		{
+			pad();
+
+			digest_type result{};
+
+			for (size_t i = 0; i < state_.size(); ++i)
+				for (size_t j = 0; j < 4; ++j)
+					result[i * 4 + j] = static_cast<uint8_t>(state_[i] >> ((3 - j) * 8));
+
+			return result;
+		}
+
+	private:
+		void transform(const uint8_t* block) noexcept
+		{
+			static constexpr uint32_t k[64] = {
+				0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+				0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+				0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+				0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+				0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+				0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+				0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+				0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+			};
+
+			uint32_t w[64];
+
+			for (size_t i = 0; i < 16; ++i)
+			{
+				w[i] = static_cast<uint32_t>(block[i * 4]) << 24 | static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+					static_cast<uint32_t>(block[i * 4 + 2]) << 8 | static_cast<uint32_t>(block[i * 4 + 3]);
+			}
+
+			for (size_t i = 16; i < 64; ++i)
+			{
+				const auto s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				const auto s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			auto s = state_;
+
+			for (size_t i = 0; i < 64; ++i)
+			{
+				const auto s1 = rotate_right(s[4], 6) ^ rotate_right(s[4], 11) ^ rotate_right(s[4], 25);
+				const auto choice = (s[4] & s[5]) ^ (~s[4] & s[6]);
+				const auto temp1 = s[7] + s1 + choice + k[i] + w[i];
+				const auto s0 = rotate_right(s[0], 2) ^ rotate_right(s[0], 13) ^ rotate_right(s[0], 22);
+				const auto majority = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+				const auto temp2 = s0 + majority;
+
+				s[7] = s[6];
+				s[6] = s[5];
+				s[5] = s[4];
+				s[4] = s[3] + temp1;
+				s[3] = s[2];
+				s[2] = s[1];
+				s[1] = s[0];
+				s[0] = temp1 + temp2;
+			}
+
+			for (size_t i = 0; i < state_.size(); ++i)
+				state_[i] += s[i];
+		}
+
+		std::array<uint32_t, 8> state_{
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+	};
+}
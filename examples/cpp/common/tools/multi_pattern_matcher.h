@@ -0,0 +1,560 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__) || defined(__AVX__) || (defined(_MSC_VER) && defined(_M_X64))
+#include <tmmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// MSVC never defines __SSSE3__ and the x64 baseline is SSE2: the SSSE3 prefilter is
+// compiled for x64 and enabled when CPUID reports SSSE3
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__AVX__)
+#define MULTI_PATTERN_MATCHER_SSSE3 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define MULTI_PATTERN_MATCHER_SSSE3 1
+#define MULTI_PATTERN_MATCHER_SSSE3_CPUID 1
+#endif
+
+namespace tools
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Dependency-free multi-pattern matcher: the Aho-Corasick automaton stored in the
+	/// double array (base/check), so a transition is one indexed load and compare.
+	/// Input bytes are mapped to the compact alphabet of the pattern bytes (folded to
+	/// lowercase in the case-insensitive mode), any other byte leads to the root.
+	///
+	/// While the automaton is in the root state the input is skipped by the prefilter:
+	/// candidate first bytes are located 16 (SSSE3) or 32 (AVX2) bytes at a time with
+	/// the nibble lookup tables and confirmed by the exact first byte table and the
+	/// bitmap of the first two pattern bytes.
+	///
+	/// The stream_state carries the automaton state and the offset between the calls,
+	/// so patterns split across packets are found.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	class multi_pattern_matcher
+	{
+	public:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Matching state carried between the chunks of the stream
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct stream_state
+		{
+			/// <summary>automaton state</summary>
+			uint32_t state{root};
+			/// <summary>number of bytes scanned so far</summary>
+			uint64_t offset{0};
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Builds the automaton
+		/// </summary>
+		/// <param name="patterns">patterns, the index in the list is the pattern id</param>
+		/// <param name="case_insensitive">ASCII letters match regardless of the case</param>
+		/// <exception cref="std::invalid_argument">empty pattern</exception>
+		// ********************************************************************************
+		explicit multi_pattern_matcher(const std::vector<std::string_view>& patterns,
+		                               const bool case_insensitive = false)
+			: case_insensitive_(case_insensitive)
+		{
+			for (size_t i = 0; i < patterns.size(); ++i)
+			{
+				if (patterns[i].empty())
+					throw std::invalid_argument("multi_pattern_matcher: empty pattern");
+
+				pattern_lengths_.push_back(static_cast<uint32_t>(patterns[i].size()));
+			}
+
+			build_alphabet(patterns);
+			build_prefilter(patterns);
+			build_automaton(patterns);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Scans the next chunk of the stream and calls handler(uint32_t id, uint64_t end)
+		/// for each match, end is the stream offset just past the match. The handler
+		/// returns false to stop scanning.
+		/// </summary>
+		/// <param name="data">chunk</param>
+		/// <param name="length">chunk length</param>
+		/// <param name="stream">stream state, updated on return</param>
+		/// <param name="handler">match handler</param>
+		/// <returns>false if the handler stopped scanning</returns>
+		// ********************************************************************************
+		template <typename F>
+		bool scan(const char* data, const size_t length, stream_state& stream, F&& handler) const
+		{
+			const auto* const bytes = reinterpret_cast<const uint8_t*>(data);
+			const auto* const cells = cells_.data();
+			auto state = stream.state;
+
+			for (size_t i = 0; i < length;)
+			{
+				if (state == root)
+				{
+					i = skip(bytes, i, length);
+
+					if (i == length)
+						break;
+				}
+
+				const auto symbol = alphabet_[bytes[i++]];
+
+				for (;;)
+				{
+					if (const auto next = cells[state].base + symbol; cells[next].check == state && symbol != 0)
+					{
+						state = next;
+						break;
+					}
+
+					if (state == root)
+						break;
+
+					state = cells[state].fail;
+				}
+
+				if (const auto output = cells[state].output; output != 0)
+				{
+					for (auto id = output; outputs_[id] != end_of_output; ++id)
+					{
+						if (!handler(outputs_[id], stream.offset + i))
+						{
+							stream.state = state;
+							stream.offset += length;
+							return false;
+						}
+					}
+				}
+			}
+
+			stream.state = state;
+			stream.offset += length;
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Scans the standalone buffer and calls handler(uint32_t id, uint64_t end) for
+		/// each match. The handler returns false to stop scanning.
+		/// </summary>
+		/// <param name="data">buffer</param>
+		/// <param name="length">buffer length</param>
+		/// <param name="handler">match handler</param>
+		/// <returns>false if the handler stopped scanning</returns>
+		// ********************************************************************************
+		template <typename F>
+		bool scan(const char* data, const size_t length, F&& handler) const
+		{
+			stream_state stream;
+			return scan(data, length, stream, std::forward<F>(handler));
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Finds the first pattern occurrence in the buffer
+		/// </summary>
+		/// <param name="data">buffer</param>
+		/// <returns>id of the pattern ending first or npos if none matches</returns>
+		// ********************************************************************************
+		[[nodiscard]] uint32_t find(const std::string_view data) const
+		{
+			auto result = npos;
+
+			scan(data.data(), data.size(), [&result](const uint32_t id, uint64_t)
+			{
+				result = id;
+				return false;
+			});
+
+			return result;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Returns the length of the pattern
+		/// </summary>
+		/// <param name="id">pattern id</param>
+		// ********************************************************************************
+		[[nodiscard]] size_t pattern_length(const uint32_t id) const noexcept
+		{
+			return pattern_lengths_[id];
+		}
+
+		/// <summary>
+		/// Returns the number of patterns
+		/// </summary>
+		[[nodiscard]] size_t size() const noexcept
+		{
+			return pattern_lengths_.size();
+		}
+
+		/// <summary>
+		/// Returns the number of the double array cells
+		/// </summary>
+		[[nodiscard]] size_t cell_count() const noexcept
+		{
+			return cells_.size();
+		}
+
+		/// <summary>value returned by find when nothing matches</summary>
+		static constexpr uint32_t npos = UINT32_MAX;
+
+	private:
+		struct cell
+		{
+			uint32_t base;
+			uint32_t check;
+			uint32_t fail;
+			/// <summary>index of the output list in outputs_, 0 if the state has no output</summary>
+			uint32_t output;
+		};
+
+		/// <summary>
+		/// Trie node used while building the automaton
+		/// </summary>
+		struct trie_node
+		{
+			std::map<uint16_t, uint32_t> children;
+			std::vector<uint32_t> ids;
+			uint32_t fail{0};
+			uint32_t cell{0};
+		};
+
+		static constexpr uint32_t root = 0;
+		static constexpr uint32_t free_cell = UINT32_MAX;
+		static constexpr uint32_t end_of_output = UINT32_MAX;
+
+		uint8_t fold(const uint8_t c) const noexcept
+		{
+			return case_insensitive_ && c >= 'A' && c <= 'Z' ? static_cast<uint8_t>(c | 0x20) : c;
+		}
+
+		/// <summary>
+		/// Assigns the symbol codes 1..n to the (folded) pattern bytes, 0 to the others
+		/// </summary>
+		void build_alphabet(const std::vector<std::string_view>& patterns)
+		{
+			std::array<bool, 256> used{};
+
+			for (const auto& pattern : patterns)
+			{
+				for (const auto c : pattern)
+					used[fold(static_cast<uint8_t>(c))] = true;
+			}
+
+			for (size_t c = 0; c < used.size(); ++c)
+			{
+				if (used[c])
+					alphabet_[c] = ++alphabet_size_;
+			}
+
+			if (case_insensitive_)
+			{
+				for (auto c = 'A'; c <= 'Z'; ++c)
+					alphabet_[static_cast<uint8_t>(c)] = alphabet_[static_cast<uint8_t>(c | 0x20)];
+			}
+		}
+
+		/// <summary>
+		/// Fills the first byte table, the pair bitmap and the nibble tables
+		/// </summary>
+		void build_prefilter(const std::vector<std::string_view>& patterns)
+		{
+			pairs_.assign(65536 / 64, 0);
+
+			for (const auto& pattern : patterns)
+			{
+				const auto first = fold(static_cast<uint8_t>(pattern[0]));
+
+				for (const auto c : {first, upper(first)})
+				{
+					first_[c] = true;
+
+					// bucket by the high nibble, bytes sharing the bucket are confirmed by first_
+					const auto bucket = static_cast<uint8_t>(1u << ((c >> 4) & 7));
+					low_nibble_[c & 0x0F] |= bucket;
+					high_nibble_[c >> 4] |= bucket;
+
+					for (uint32_t second = 0; second < 256; ++second)
+					{
+						if (pattern.size() == 1 || alphabet_[second] == alphabet_[fold(static_cast<uint8_t>(pattern[1]))])
+							pairs_[(c << 8 | second) / 64] |= 1ull << ((c << 8 | second) % 64);
+					}
+				}
+			}
+		}
+
+		uint8_t upper(const uint8_t c) const noexcept
+		{
+			return case_insensitive_ && c >= 'a' && c <= 'z' ? static_cast<uint8_t>(c & ~0x20) : c;
+		}
+
+		/// <summary>
+		/// Builds the trie, the failure links and the output lists, then places the trie
+		/// into the double array in the breadth-first order
+		/// </summary>
+		void build_automaton(const std::vector<std::string_view>& patterns)
+		{
+			std::vector<trie_node> nodes(1);
+
+			for (uint32_t id = 0; id < patterns.size(); ++id)
+			{
+				uint32_t node = 0;
+
+				for (const auto c : patterns[id])
+				{
+					const auto symbol = alphabet_[static_cast<uint8_t>(c)];
+
+					if (const auto it = nodes[node].children.find(symbol); it != nodes[node].children.end())
+					{
+						node = it->second;
+					}
+					else
+					{
+						nodes[node].children.emplace(symbol, static_cast<uint32_t>(nodes.size()));
+						node = static_cast<uint32_t>(nodes.size());
+						nodes.emplace_back();
+					}
+				}
+
+				nodes[node].ids.push_back(id);
+			}
+
+			// failure links and the inherited outputs in the breadth-first order
+			std::vector<uint32_t> order{0};
+			order.reserve(nodes.size());
+
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				const auto node = order[i];
+
+				for (const auto [symbol, child] : nodes[node].children)
+				{
+					uint32_t fail = 0;
+
+					if (node != 0)
+					{
+						for (auto state = nodes[node].fail;; state = nodes[state].fail)
+						{
+							if (const auto it = nodes[state].children.find(symbol); it != nodes[state].children.end())
+							{
+								fail = it->second;
+								break;
+							}
+
+							if (state == 0)
+								break;
+						}
+					}
+
+					nodes[child].fail = fail;
+					nodes[child].ids.insert(nodes[child].ids.end(), nodes[fail].ids.begin(), nodes[fail].ids.end());
+					order.push_back(child);
+				}
+			}
+
+			// double array placement: base of each node is the first offset where all its
+			// children land in the free cells
+			cells_.assign(alphabet_size_ + 2, {0, free_cell, 0, 0});
+			cells_[root].check = root;
+
+			size_t first_free = 1;
+
+			for (const auto node : order)
+			{
+				auto& children = nodes[node].children;
+
+				if (children.empty())
+					continue;
+
+				while (first_free < cells_.size() && cells_[first_free].check != free_cell)
+					++first_free;
+
+				for (auto base = static_cast<uint32_t>((std::max)(first_free, static_cast<size_t>(children.begin()->
+					     first + 1)) - children.begin()->first);; ++base)
+				{
+					if (base + alphabet_size_ + 1 > cells_.size())
+						cells_.resize(base + alphabet_size_ + 1, {0, free_cell, 0, 0});
+
+					if (std::all_of(children.begin(), children.end(), [this, base](const auto& child)
+					{
+						return cells_[base + child.first].check == free_cell;
+					}))
+					{
+						cells_[nodes[node].cell].base = base;
+
+						for (const auto& [symbol, child] : children)
+						{
+							nodes[child].cell = base + symbol;
+							cells_[base + symbol].check = nodes[node].cell;
+						}
+
+						break;
+					}
+				}
+			}
+
+			// the leaves transition nowhere: keep base + symbol inside the array
+			cells_.resize(cells_.size() + alphabet_size_ + 1, {0, free_cell, 0, 0});
+
+			outputs_.push_back(end_of_output);
+
+			for (const auto node : order)
+			{
+				auto& target = cells_[nodes[node].cell];
+				target.fail = nodes[nodes[node].fail].cell;
+
+				if (!nodes[node].ids.empty())
+				{
+					target.output = static_cast<uint32_t>(outputs_.size());
+					outputs_.insert(outputs_.end(), nodes[node].ids.begin(), nodes[node].ids.end());
+					outputs_.push_back(end_of_output);
+				}
+			}
+		}
+
+		/// <summary>
+		/// Returns the first position at or after the offset where a pattern may start
+		/// </summary>
+		size_t skip(const uint8_t* data, size_t offset, const size_t length) const noexcept
+		{
+#if defined(__AVX2__)
+			const auto low_table = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(low_nibble_.data())));
+			const auto high_table = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(high_nibble_.data())));
+			const auto nibble_mask = _mm256_set1_epi8(0x0F);
+
+			for (; length - offset >= 32; offset += 32)
+			{
+				const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+				const auto low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(block, nibble_mask));
+				const auto high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(
+					                                      _mm256_srli_epi16(block, 4), nibble_mask));
+				const auto hit = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+
+				for (auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(hit)); mask != 0; mask &= mask - 1)
+				{
+					if (const auto position = offset + first_bit(mask); is_candidate(data, position, length))
+						return position;
+				}
+			}
+#endif
+#if defined(MULTI_PATTERN_MATCHER_SSSE3)
+#if defined(MULTI_PATTERN_MATCHER_SSSE3_CPUID)
+			if (!ssse3_)
+				return skip_bytes(data, offset, length);
+#endif
+			const auto low_table16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low_nibble_.data()));
+			const auto high_table16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high_nibble_.data()));
+			const auto nibble_mask16 = _mm_set1_epi8(0x0F);
+
+			for (; length - offset >= 16; offset += 16)
+			{
+				const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+				const auto low = _mm_shuffle_epi8(low_table16, _mm_and_si128(block, nibble_mask16));
+				const auto high = _mm_shuffle_epi8(high_table16, _mm_and_si128(_mm_srli_epi16(block, 4), nibble_mask16));
+				const auto hit = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+
+				for (auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(hit)) & 0xFFFF; mask != 0; mask &= mask - 1)
+				{
+					if (const auto position = offset + first_bit(mask); is_candidate(data, position, length))
+						return position;
+				}
+			}
+#endif
+			return skip_bytes(data, offset, length);
+		}
+
+		/// <summary>
+		/// Byte at a time tail of skip
+		/// </summary>
+		size_t skip_bytes(const uint8_t* data, size_t offset, const size_t length) const noexcept
+		{
+			for (; offset != length; ++offset)
+			{
+				if (is_candidate(data, offset, length))
+					return offset;
+			}
+
+			return length;
+		}
+
+		/// <summary>
+		/// The byte starts some pattern and, unless it is the last byte of the chunk, the
+		/// next byte may continue it
+		/// </summary>
+		bool is_candidate(const uint8_t* data, const size_t position, const size_t length) const noexcept
+		{
+			if (!first_[data[position]])
+				return false;
+
+			if (position + 1 == length)
+				return true;
+
+			const auto pair = static_cast<uint32_t>(data[position]) << 8 | data[position + 1];
+
+			return (pairs_[pair / 64] >> (pair % 64) & 1) != 0;
+		}
+
+#if defined(MULTI_PATTERN_MATCHER_SSSE3_CPUID)
+		static bool has_ssse3() noexcept
+		{
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & 1 << 9) != 0;
+		}
+#endif
+
+		static uint32_t first_bit(const uint32_t mask) noexcept
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+		}
+
+		bool case_insensitive_;
+#if defined(MULTI_PATTERN_MATCHER_SSSE3_CPUID)
+		bool ssse3_{has_ssse3()};
+#endif
+
+		/// <summary>byte to symbol code, 0 for the bytes not used by the patterns</summary>
+		std::array<uint16_t, 256> alphabet_{};
+		uint16_t alphabet_size_{0};
+
+		std::vector<cell> cells_;
+		/// <summary>pattern ids of the states, each list terminated by end_of_output</summary>
+		std::vector<uint32_t> outputs_;
+		std::vector<uint32_t> pattern_lengths_;
+
+		std::array<bool, 256> first_{};
+		/// <summary>bitmap of the first two pattern bytes (any second byte for one byte patterns)</summary>
+		std::vector<uint64_t> pairs_;
+		std::array<uint8_t, 16> low_nibble_{};
+		std::array<uint8_t, 16> high_nibble_{};
+	};
+}
@@ -0,0 +1,283 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace tools
+{
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// State of the slot reported by the classifier of seqlock_table::insert_or_update
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class seqlock_slot_state
+	{
+		/// <summary>slot was never used, the key can't be found past it</summary>
+		empty,
+		/// <summary>slot holds the aged out entry of the other key and may be reused</summary>
+		expired,
+		/// <summary>slot holds the live entry of the other key</summary>
+		occupied,
+		/// <summary>slot holds the key</summary>
+		match
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Result of seqlock_table::insert_or_update
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class seqlock_insert_result
+	{
+		/// <summary>key was found and left untouched</summary>
+		unchanged,
+		/// <summary>slot holding the key was rewritten</summary>
+		updated,
+		/// <summary>key was stored in the empty or expired slot</summary>
+		inserted,
+		/// <summary>no free slot in the probe range</summary>
+		full
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Open addressing hash table of the fixed size slots of Words 64 bit words with
+	/// linear probing. Each slot is protected by its own sequence lock: readers never
+	/// block or write shared memory, writers lock only the slot they modify and fail
+	/// if it has changed since it was read, so the caller decides again on the fresh
+	/// copy. The meaning of the words (key, value, occupied and expired entries) is
+	/// left to the owning container.
+	/// </summary>
+	/// <typeparam name="Words">number of 64 bit words in the slot</typeparam>
+	// --------------------------------------------------------------------------------
+	template <size_t Words>
+	class seqlock_table
+	{
+	public:
+		using words_t = std::array<uint64_t, Words>;
+
+		/// <summary>slots probed from the home slot before the table is considered full</summary>
+		static constexpr size_t max_probes = 32;
+		/// <summary>index value for the slot not found</summary>
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Consistent copy of the slot
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct entry
+		{
+			words_t words;
+			/// <summary>even sequence number the words were read at</summary>
+			uint32_t sequence;
+		};
+
+		// ********************************************************************************
+		/// <summary>
+		/// Constructs the table
+		/// </summary>
+		/// <param name="capacity">expected number of entries, the table keeps at least twice as many slots</param>
+		// ********************************************************************************
+		explicit seqlock_table(const size_t capacity)
+		{
+			size_t size = 64;
+
+			while (size < capacity * 2)
+				size *= 2;
+
+			slots_ = std::make_unique<slot[]>(size);
+			mask_ = size - 1;
+		}
+
+		/// <summary>
+		/// Slot index mask (number of slots - 1)
+		/// </summary>
+		[[nodiscard]] size_t mask() const noexcept { return mask_; }
+
+		/// <summary>
+		/// Address of the slot to prefetch
+		/// </summary>
+		[[nodiscard]] const void* address(const size_t index) const noexcept { return &slots_[index]; }
+
+		/// <summary>
+		/// Current sequence number of the slot, changes on every write
+		/// </summary>
+		[[nodiscard]] uint32_t sequence(const size_t index) const noexcept
+		{
+			return slots_[index].sequence.load(std::memory_order_acquire);
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Reads the consistent copy of the slot
+		/// </summary>
+		/// <param name="index">slot index</param>
+		/// <returns>slot words and the even sequence number they were read at</returns>
+		// ********************************************************************************
+		[[nodiscard]] entry read(const size_t index) const noexcept
+		{
+			const auto& current = slots_[index];
+			entry result;
+
+			for (;;)
+			{
+				result.sequence = current.sequence.load(std::memory_order_acquire);
+
+				if (result.sequence & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				for (size_t i = 0; i < Words; ++i)
+					result.words[i] = current.words[i].load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (current.sequence.load(std::memory_order_relaxed) == result.sequence)
+					return result;
+			}
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Writes the slot if it was not modified since it was read
+		/// </summary>
+		/// <param name="index">slot index</param>
+		/// <param name="sequence">sequence number the slot was read at</param>
+		/// <param name="words">new slot words</param>
+		/// <returns>false if the slot was modified by another thread</returns>
+		// ********************************************************************************
+		bool write(const size_t index, uint32_t sequence, const words_t& words) noexcept
+		{
+			auto& current = slots_[index];
+
+			if (!current.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_relaxed))
+				return false;
+
+			std::atomic_thread_fence(std::memory_order_release);
+
+			for (size_t i = 0; i < Words; ++i)
+				current.words[i].store(words[i], std::memory_order_relaxed);
+
+			current.sequence.store(sequence + 2, std::memory_order_release);
+
+			return true;
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Locates the key starting from its home slot
+		/// </summary>
+		/// <param name="home">home slot index</param>
+		/// <param name="classify">returns seqlock_slot_state of the entry read</param>
+		/// <returns>slot index (npos if not found) and the entry</returns>
+		// ********************************************************************************
+		template <typename F>
+		[[nodiscard]] std::pair<size_t, entry> find(const size_t home, F&& classify) const noexcept
+		{
+			for (size_t probe = 0; probe < max_probes; ++probe)
+			{
+				const auto index = (home + probe) & mask_;
+				const auto current = read(index);
+				const auto state = classify(current);
+
+				if (state == seqlock_slot_state::match)
+					return {index, current};
+
+				if (state == seqlock_slot_state::empty)
+					break;
+			}
+
+			return {npos, entry{}};
+		}
+
+		// ********************************************************************************
+		/// <summary>
+		/// Stores the entry of the key. The slot holding the key is rewritten only if
+		/// the update predicate accepts its current copy, otherwise the entry goes to
+		/// the first empty or expired slot of the probe range. The slots updated by the
+		/// other threads since they were read are looked at again.
+		/// </summary>
+		/// <param name="home">home slot index</param>
+		/// <param name="words">new slot words</param>
+		/// <param name="classify">returns seqlock_slot_state of the entry read</param>
+		/// <param name="update">returns true if the matching entry must be rewritten</param>
+		/// <returns>result and the previous copy of the matching entry (for updated and unchanged)</returns>
+		// ********************************************************************************
+		template <typename F, typename U>
+		std::pair<seqlock_insert_result, entry> insert_or_update(const size_t home, const words_t& words,
+		                                                         F&& classify, U&& update) noexcept
+		{
+			for (;;)
+			{
+				auto reusable = npos;
+				auto reusable_sequence = 0u;
+				auto retry = false;
+
+				for (size_t probe = 0; probe < max_probes; ++probe)
+				{
+					const auto index = (home + probe) & mask_;
+					const auto current = read(index);
+					const auto state = classify(current);
+
+					if (state == seqlock_slot_state::match)
+					{
+						if (!update(current))
+							return {seqlock_insert_result::unchanged, current};
+
+						if (write(index, current.sequence, words))
+							return {seqlock_insert_result::updated, current};
+
+						retry = true;
+						break;
+					}
+
+					if (state != seqlock_slot_state::occupied)
+					{
+						if (reusable == npos)
+						{
+							reusable = index;
+							reusable_sequence = current.sequence;
+						}
+
+						// the key can't be found past the empty slot
+						if (state == seqlock_slot_state::empty)
+							break;
+					}
+				}
+
+				if (retry)
+					continue;
+
+				if (reusable == npos)
+					return {seqlock_insert_result::full, entry{}};
+
+				// the slot was updated since it was read, look again
+				if (write(reusable, reusable_sequence, words))
+					return {seqlock_insert_result::inserted, entry{}};
+			}
+		}
+
+	private:
+		// --------------------------------------------------------------------------------
+		/// <summary>
+		/// Table slot. The sequence is odd while the slot is being written, readers
+		/// retry if it was odd or changed while they copied the words.
+		/// </summary>
+		// --------------------------------------------------------------------------------
+		struct alignas(Words <= 3 ? 32 : 64) slot
+		{
+			std::atomic<uint32_t> sequence{0};
+			std::array<std::atomic<uint64_t>, Words> words{};
+		};
+
+		/// <summary>slot index mask (number of slots - 1)</summary>
+		size_t mask_{0};
+		/// <summary>slots</summary>
+		std::unique_ptr<slot[]> slots_;
+	};
+}
@@ -13,24 +13,347 @@ void log_printer(const char* log)
 	std::cout << log << std::endl;
 }
 
-int main()
+// ********************************************************************************
+/// <summary>
+/// Builds the standard query for the A record of the name
+/// </summary>
+/// <param name="id">query ID</param>
+/// <param name="name">dotted name</param>
+/// <param name="edns">adds the OPT record</param>
+/// <param name="dnssec_ok">sets DO in the OPT record</param>
+/// <param name="checking_disabled">sets the CD flag</param>
+/// <returns>DNS message</returns>
+// ********************************************************************************
+std::vector<uint8_t> make_test_query(const uint16_t id, const std::string& name, const bool edns = false,
+                                     const bool dnssec_ok = false, const bool checking_disabled = false)
 {
+	std::vector<uint8_t> query = {
+		static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id), 0x01,
+		static_cast<uint8_t>(checking_disabled ? 0x10 : 0), 0, 1, 0, 0, 0, 0, 0, static_cast<uint8_t>(edns ? 1 : 0)
+	};
+
+	for (size_t start = 0; start < name.size();)
+	{
+		const auto end = (std::min)(name.find('.', start), name.size());
+
+		query.push_back(static_cast<uint8_t>(end - start));
+		query.insert(query.end(), name.begin() + start, name.begin() + end);
+		start = end + 1;
+	}
+
+	// root label, QTYPE A, QCLASS IN
+	query.insert(query.end(), {0, 0, 1, 0, 1});
+
+	// OPT: root name, TYPE 41, CLASS 4096 (UDP payload size), TTL with the DO bit, RDLENGTH 0
+	if (edns)
+		query.insert(query.end(), {0, 0, 41, 0x10, 0, 0, 0, static_cast<uint8_t>(dnssec_ok ? 0x80 : 0), 0, 0, 0});
+
+	return query;
+}
+
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Stand-in for the upstream DNS server used by the test mode. Answers the query
+/// with the configured reply, copying the ID, the CD flag, the question and the OPT
+/// record of the query.
+/// </summary>
+// --------------------------------------------------------------------------------
+struct test_upstream
+{
+	enum class reply_type
+	{
+		address,
+		name_error,
+		name_error_without_soa,
+		server_failure,
+		truncated
+	};
+
+	reply_type reply{reply_type::address};
+	/// <summary>TTL of the answer and of the SOA record</summary>
+	uint32_t ttl{60};
+	/// <summary>SOA MINIMUM field of the negative answers</summary>
+	uint32_t minimum{30};
+	/// <summary>last byte of the address, tells the cached responses apart</summary>
+	uint8_t tag{1};
+	/// <summary>answers the EDNS queries without the OPT record (server without EDNS support)</summary>
+	bool drop_opt{false};
+
+	[[nodiscard]] std::vector<uint8_t> answer(const std::vector<uint8_t>& query) const
+	{
+		net::dns_message message;
+		net::dns_question question;
+
+		if (message.parse(query.data(), query.size()) != net::dns_parse_result::success ||
+			!message.first_question(question))
+			return {};
+
+		std::vector<uint8_t> response(query.begin(),
+		                              query.begin() + static_cast<ptrdiff_t>(question.offset + question.length));
+
+		// QR, RD and CD as in the query, RA, all counts except QDCOUNT reset
+		response[2] |= 0x80;
+		response[3] = static_cast<uint8_t>((response[3] & 0x10) | 0x80);
+		response[7] = response[9] = response[11] = 0;
+
+		const auto push_uint32 = [&response](const uint32_t value)
+		{
+			response.insert(response.end(), {
+				                static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+				                static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)
+			                });
+		};
+
+		switch (reply)
+		{
+		case reply_type::truncated:
+			response[2] |= 0x02;
+			[[fallthrough]];
+		case reply_type::address:
+			// name pointer to the question, TYPE A, CLASS IN, TTL, RDLENGTH 4, 192.0.2.tag
+			response[7] = 1;
+			response.insert(response.end(), {0xC0, 0x0C, 0, 1, 0, 1});
+			push_uint32(ttl);
+			response.insert(response.end(), {0, 4, 192, 0, 2, tag});
+			break;
+		case reply_type::name_error:
+			// SOA with the root MNAME and RNAME: SERIAL, REFRESH, RETRY, EXPIRE, MINIMUM
+			response[3] |= net::dns_message::rcode_name_error;
+			response[9] = 1;
+			response.insert(response.end(), {0xC0, 0x0C, 0, 6, 0, 1});
+			push_uint32(ttl);
+			response.insert(response.end(), {0, 22, 0, 0});
+			push_uint32(1);
+			push_uint32(3600);
+			push_uint32(600);
+			push_uint32(86400);
+			push_uint32(minimum);
+			break;
+		case reply_type::name_error_without_soa:
+			response[3] |= net::dns_message::rcode_name_error;
+			break;
+		case reply_type::server_failure:
+			response[3] |= net::dns_message::rcode_server_failure;
+			break;
+		}
+
+		if (query[11] != 0 && !drop_opt)
+		{
+			response[11] = 1;
+			response.insert(response.end(), query.end() - 11, query.end());
+		}
+
+		return response;
+	}
+};
+
+// ********************************************************************************
+/// <summary>
+/// Runs net::dns_cache against the stand-in upstream server: TTL decrement, negative
+/// caching, collapsed queries, key separation by the DO, CD and EDNS bits, and the
+/// responses which must not be cached.
+/// </summary>
+/// <returns>process exit code, number of failed checks</returns>
+// ********************************************************************************
+int run_tests()
+{
+	using namespace std::chrono_literals;
+	using cache_t = net::dns_cache<std::vector<uint8_t>>;
+
+	const auto start = cache_t::clock::now();
+
+	auto failures = 0;
+
+	const auto check = [&failures](const bool condition, const char* name)
+	{
+		std::cout << (condition ? "PASS " : "FAIL ") << name << std::endl;
+		failures += condition ? 0 : 1;
+	};
+
+	std::array<uint8_t, 1500> buffer{};
+	size_t length = 0;
+
+	// looks the query up, a miss is forwarded to the upstream and its response stored
+	const auto resolve = [&buffer, &length](cache_t& cache, const test_upstream& upstream,
+	                                        const std::vector<uint8_t>& query, const cache_t::clock::time_point now)
+	{
+		const auto status = cache.query(query.data(), query.size(), buffer.data(), buffer.size(), length,
+		                                [&query] { return query; }, now);
+
+		if (status == net::dns_cache_status::miss)
+		{
+			const auto response = upstream.answer(query);
+			cache.update(response.data(), response.size(), now);
+		}
+
+		return status;
+	};
+
+	// TTL and the address tag of the first answer record in the buffer, tag is -1 if there is none
+	const auto first_answer = [&buffer, &length]
+	{
+		net::dns_message message;
+		std::pair<uint32_t, int> result{0, -1};
+
+		if (message.parse(buffer.data(), length) != net::dns_parse_result::success)
+			return result;
+
+		message.for_each_record([&result](const net::dns_section section, const net::dns_resource_record& record)
+		{
+			if (section == net::dns_section::answer && result.second < 0 && record.data_length == 4)
+				result = {record.ttl, record.data[3]};
+		});
+
+		return result;
+	};
+
+	{
+		cache_t cache;
+		const test_upstream upstream{test_upstream::reply_type::address, 60};
+
+		resolve(cache, upstream, make_test_query(1, "www.example.com"), start);
+
+		const auto query = make_test_query(2, "WWW.Example.COM");
+
+		check(resolve(cache, upstream, query, start + 10s) == net::dns_cache_status::hit &&
+		      first_answer().first == 50, "cached TTL is reduced by the time spent in the cache");
+		check(buffer[0] == 0 && buffer[1] == 2 && std::equal(query.begin() + 12, query.end(), buffer.begin() + 12),
+		      "answer takes the ID and the question spelling of the query");
+		check(resolve(cache, upstream, query, start + 60s) == net::dns_cache_status::miss &&
+		      cache.get_statistics().expired == 1, "response expires with its TTL");
+	}
+
+	{
+		cache_t cache;
+		const test_upstream upstream{test_upstream::reply_type::name_error, 300, 30};
+
+		resolve(cache, upstream, make_test_query(1, "missing.example.com"), start);
+
+		check(resolve(cache, upstream, make_test_query(2, "missing.example.com"), start + 10s) ==
+		      net::dns_cache_status::hit && cache.get_statistics().negative_hits == 1 &&
+		      (buffer[3] & 0x0F) == net::dns_message::rcode_name_error, "NXDOMAIN is answered from the cache");
+		check(resolve(cache, upstream, make_test_query(3, "missing.example.com"), start + 31s) ==
+		      net::dns_cache_status::miss, "NXDOMAIN lives for the SOA MINIMUM field");
+
+		const test_upstream without_soa{test_upstream::reply_type::name_error_without_soa};
+
+		resolve(cache, without_soa, make_test_query(4, "nosoa.example.com"), start);
+
+		check(resolve(cache, without_soa, make_test_query(5, "nosoa.example.com"), start) ==
+		      net::dns_cache_status::miss, "NXDOMAIN without SOA is not cached");
+	}
+
+	{
+		cache_t cache;
+		const test_upstream upstream;
+
+		const auto first = make_test_query(1, "www.example.com");
+		const auto second = make_test_query(2, "www.example.com");
+
+		cache.query(first.data(), first.size(), buffer.data(), buffer.size(), length, [&first] { return first; }, start);
+
+		check(cache.query(second.data(), second.size(), buffer.data(), buffer.size(), length,
+		                  [&second] { return second; }, start) == net::dns_cache_status::collapsed,
+		      "identical query in flight is collapsed");
+
+		const auto response = upstream.answer(first);
+		const auto waiters = cache.update(response.data(), response.size(), start);
+
+		check(waiters.size() == 1 && cache_t::make_response(response.data(), response.size(), waiters[0].data(),
+		                                                    waiters[0].size(), 0, buffer.data(), buffer.size(),
+		                                                    length) && buffer[1] == 2,
+		      "response releases the collapsed query with its own ID");
+	}
+
+	{
+		cache_t cache;
+
+		// no EDNS, EDNS, EDNS with DO, CD, EDNS with DO and CD
+		const std::array<std::array<bool, 3>, 5> variants = {
+			{{false, false, false}, {true, false, false}, {true, true, false}, {false, false, true}, {true, true, true}}
+		};
+
+		for (size_t i = 0; i < variants.size(); ++i)
+		{
+			test_upstream upstream;
+			upstream.tag = static_cast<uint8_t>(i + 1);
+
+			resolve(cache, upstream, make_test_query(1, "www.example.com", variants[i][0], variants[i][1], variants[i][2]),
+			        start);
+		}
+
+		auto separated = cache.size() == variants.size();
+
+		for (size_t i = 0; i < variants.size(); ++i)
+		{
+			separated = separated && resolve(cache, {}, make_test_query(2, "www.example.com", variants[i][0],
+			                                                            variants[i][1], variants[i][2]), start) ==
+				net::dns_cache_status::hit && first_answer().second == static_cast<int>(i + 1) &&
+				(buffer[11] != 0) == variants[i][0];
+		}
+
+		check(separated, "DO, CD and EDNS queries get their own responses, OPT only for EDNS queries");
+
+		test_upstream without_edns;
+		without_edns.drop_opt = true;
+
+		const auto first = make_test_query(3, "dnssec.example.com", true, true);
+		const auto second = make_test_query(4, "dnssec.example.com", true, true);
+
+		cache.query(first.data(), first.size(), buffer.data(), buffer.size(), length, [&first] { return first; }, start);
+		cache.query(second.data(), second.size(), buffer.data(), buffer.size(), length, [&second] { return second; },
+		            start);
+
+		const auto response = without_edns.answer(first);
+
+		check(cache.update(response.data(), response.size(), start).size() == 1 &&
+		      resolve(cache, without_edns, make_test_query(5, "dnssec.example.com", true, true), start) ==
+		      net::dns_cache_status::hit, "DO query answered without OPT releases its waiters");
+	}
+
+	{
+		cache_t cache;
+
+		resolve(cache, {test_upstream::reply_type::truncated}, make_test_query(1, "big.example.com"), start);
+		resolve(cache, {test_upstream::reply_type::server_failure}, make_test_query(2, "broken.example.com"), start);
+
+		check(cache.size() == 0 &&
+		      resolve(cache, {}, make_test_query(3, "big.example.com"), start) == net::dns_cache_status::miss &&
+		      resolve(cache, {}, make_test_query(4, "broken.example.com"), start) == net::dns_cache_status::miss,
+		      "truncated and SERVFAIL responses are not cached");
+	}
+
+	std::cout << (failures ? std::to_string(failures) + " check(s) failed" : "All checks passed") << std::endl;
+
+	return failures;
+}
+
+int main(const int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "test")
+		return run_tests();
+
 	try {
 		std::string dns_address;
 		std::cout << std::endl << "DNS server IP address to forward requests to: ";
 		std::cin >> dns_address;
 		auto dns_server_ip_address_v4 = net::ip_address_v4(dns_address);
 
-		// Redirects all DNS packet to dns_server_ip_address_v4:53
-		ndisapi::udp_proxy_server<ndisapi::udp_proxy_socket<net::ip_address_v4>> proxy([&dns_server_ip_address_v4](
+		using dns_socket_t = ndisapi::dns_cache_socket<net::ip_address_v4>;
+
+		// Answers shared by all proxy sockets
+		auto dns_cache = std::make_shared<dns_socket_t::cache_t>();
+
+		// Redirects all DNS packet to dns_server_ip_address_v4:53, repeated queries are answered from the cache
+		ndisapi::udp_proxy_server<dns_socket_t> proxy([&dns_server_ip_address_v4, &dns_cache](
 			const net::ip_address_v4 local_address, const uint16_t local_port, const net::ip_address_v4 remote_address, const uint16_t remote_port)->
-			std::tuple<net::ip_address_v4, uint16_t, std::unique_ptr<ndisapi::udp_proxy_server<ndisapi::
-			udp_proxy_socket<net::ip_address_v4>>::negotiate_context_t>>
+			std::tuple<net::ip_address_v4, uint16_t, std::unique_ptr<dns_socket_t::negotiate_context_t>>
 		{
 			if (remote_port == 53)
 			{
 				std::cout << "Redirecting DNS " << local_address << ":" << local_port << " -> " << remote_address << ":" << remote_port << " to " << dns_server_ip_address_v4 << ":53\n";
-				return std::make_tuple(dns_server_ip_address_v4, 53, nullptr);
+				return std::make_tuple(dns_server_ip_address_v4, 53,
+					std::make_unique<dns_socket_t::negotiate_context_t>(dns_server_ip_address_v4, 53, dns_cache));
 			}
 
 			return std::make_tuple(net::ip_address_v4{}, 0, nullptr);
@@ -42,6 +365,13 @@ int main()
 
 		std::ignore = _getch();
 
+		const auto statistics = dns_cache->get_statistics();
+
+		std::cout << "DNS cache: " << statistics.hits << " hits (" << statistics.negative_hits << " negative), " <<
+			statistics.misses << " misses, " << statistics.collapsed << " collapsed, " << statistics.bypassed <<
+			" bypassed, " << statistics.evicted << " evicted, " << statistics.expired << " expired, " << dns_cache->size() <<
+			" cached" << std::endl;
+
 		std::cout << "Exiting..." << std::endl;
 	}
 	catch(const std::exception& ex)
@@ -50,10 +50,15 @@
 #include "../common/net/ip_address.h"
 #include "../common/net/ipv6_helper.h"
 #include "../common/net/ip_subnet.h"
+#include "../common/net/ip_prefix_table.h"
+#include "../common/net/packet_batch.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/simple_packet_filter.h"
 #include "../common/proxy/proxy_common.h"
+#include "../common/net/dns_message.h"
+#include "../common/net/dns_cache.h"
 #include "../common/ndisapi/udp_proxy.h"
+#include "../common/ndisapi/dns_cache_socket.h"
 
 #endif //PCH_H
@@ -9,6 +9,15 @@
 
 const size_t maximum_packet_block = 510;
 
+// ICMPv6 Neighbor Discovery message types and link-layer address options (RFC 4861)
+constexpr uint8_t ndp_router_solicitation = 133;
+constexpr uint8_t ndp_router_advertisement = 134;
+constexpr uint8_t ndp_neighbor_solicitation = 135;
+constexpr uint8_t ndp_neighbor_advertisement = 136;
+constexpr uint8_t ndp_redirect = 137;
+constexpr uint8_t ndp_option_source_link_layer_address = 1;
+constexpr uint8_t ndp_option_target_link_layer_address = 2;
+
 bool ethernet_bridge::start_bridge(const std::vector<size_t>& interfaces)
 {
 	bridged_interfaces_ = interfaces;
@@ -18,8 +27,9 @@ bool ethernet_bridge::start_bridge(const std::vector<size_t>& interfaces)
 	const auto last = std::unique(bridged_interfaces_.begin(), bridged_interfaces_.end());
 	bridged_interfaces_.erase(last, bridged_interfaces_.end());
 
-	// We should have at least two network interfaces and network interfaces indexes must be in range
-	if ((bridged_interfaces_.size() < 2) ||
+	// We should have at least two and no more than maximum_bridged_interfaces network interfaces and network
+	// interfaces indexes must be in range
+	if ((bridged_interfaces_.size() < 2) || (bridged_interfaces_.size() > maximum_bridged_interfaces) ||
 		(*std::max_element(bridged_interfaces_.begin(), bridged_interfaces_.end()) >= network_interfaces_.size())
 	)
 		return false;
@@ -39,13 +49,53 @@ bool ethernet_bridge::start_bridge(const std::vector<size_t>& interfaces)
 		return false;
 	}
 
+	// The working threads get their own copy of the configuration, later set_port_vlan and set_storm_control
+	// calls take effect when the bridge is restarted
+	auto vlans = std::make_shared<vlan_state>();
+	vlans->vlan_aware = vlan_aware_;
+
+	// Bridged interfaces belonging to each VLAN: the access/native VLAN of the interface and the VLANs allowed on the trunk
+	if (vlans->vlan_aware)
+	{
+		vlans->native_vlans.reserve(vlan_ports_.size());
+
+		for (auto&& config : vlan_ports_)
+			vlans->native_vlans.push_back(config.vlan);
+
+		vlans->members.assign(net::vlan_helper::vlan_count, 0);
+
+		for (size_t p = 0; p < bridged_interfaces_.size(); ++p)
+		{
+			const auto& config = vlan_ports_[bridged_interfaces_[p]];
+
+			for (size_t vlan = 0; vlan < net::vlan_helper::vlan_count; ++vlan)
+			{
+				if (vlan == config.vlan || (config.mode == vlan_port_mode::trunk && config.allowed[vlan]))
+					vlans->members[vlan] |= port_mask_t{1} << p;
+			}
+		}
+	}
+
+#ifdef _DEBUG
+	// Single capture file for all interfaces, pcapng interface ID is the network interface index
+	std::vector<pcap::pcapng_async_writer::interface_description> capture_interfaces;
+	capture_interfaces.reserve(network_interfaces_.size());
+
+	for (auto&& adapter : network_interfaces_)
+		capture_interfaces.push_back({adapter->get_internal_name(), adapter->get_friendly_name()});
+
+	capture_.open("bridge.pcapng", capture_interfaces);
+#endif //_DEBUG
+
 	for (auto&& adapter : interfaces)
 	{
 		working_threads_.push_back(
 			std::thread(
 				&ethernet_bridge::bridge_working_thread,
 				this,
-				adapter
+				adapter,
+				vlans,
+				storm_control_[adapter]
 			)
 		);
 	}
@@ -69,6 +119,44 @@ void ethernet_bridge::stop_bridge()
 
 	// Release working threads objects
 	working_threads_.clear();
+
+#ifdef _DEBUG
+	capture_.close();
+#endif //_DEBUG
+}
+
+bool ethernet_bridge::set_port_vlan(const size_t index, const vlan_port_config& config)
+{
+	if (index >= network_interfaces_.size() || config.vlan > net::vlan_helper::max_vlan)
+		return false;
+
+	vlan_ports_[index] = config;
+	vlan_aware_ = true;
+
+	return true;
+}
+
+bool ethernet_bridge::set_storm_control(const size_t index, const storm_control_config& config)
+{
+	if (index >= network_interfaces_.size())
+		return false;
+
+	storm_control_[index] = config;
+
+	return true;
+}
+
+ethernet_bridge::storm_statistics ethernet_bridge::get_storm_statistics(const size_t index) const
+{
+	if (index >= network_interfaces_.size())
+		return {};
+
+	const auto& drops = storm_drops_[index];
+
+	return {
+		drops.broadcast.load(std::memory_order_relaxed), drops.multicast.load(std::memory_order_relaxed),
+		drops.unknown_unicast.load(std::memory_order_relaxed)
+	};
 }
 
 std::vector<std::pair<string, string>> ethernet_bridge::get_interface_list()
@@ -84,33 +172,260 @@ std::vector<std::pair<string, string>> ethernet_bridge::get_interface_list()
 	return result;
 }
 
-std::optional<std::size_t> ethernet_bridge::find_target_adapter_by_mac(const net::mac_address& address)
+std::optional<std::size_t> ethernet_bridge::find_target_adapter_by_mac(const net::mac_address& address,
+                                                                       const uint16_t vlan,
+                                                                       const net::mac_table::time_point_t now,
+                                                                       net::mac_table::lookup_cache& cache) const
+{
+	return mac_table_.lookup(address, vlan, now, cache);
+}
+
+bool ethernet_bridge::update_target_adapter_by_mac(const std::size_t index, const net::mac_address& address,
+                                                   const uint16_t vlan, const net::mac_table::time_point_t now)
+{
+	const auto result = mac_table_.learn(address, vlan, index, now);
+
+	return result == net::mac_learn_result::learned || result == net::mac_learn_result::moved;
+}
+
+uint16_t ethernet_bridge::classify_vlan(const vlan_state& vlans, const std::size_t index, INTERMEDIATE_BUFFER& packet)
 {
-	std::shared_lock<std::shared_mutex> lock(mac_table_lock_);
-	if (mac_table_.count(address))
-		return mac_table_[address];
-	return {};
+	// VLAN unaware bridge forwards the tags as received and only learns addresses per VLAN
+	if (!vlans.vlan_aware)
+		return net::vlan_helper::get_vlan(packet);
+
+	net::vlan_helper::move_tag_out_of_band(packet);
+
+	// Untagged and priority tagged frames belong to the access/native VLAN of the interface
+	const auto vlan = net::vlan_helper::vlan_of_8021q_info(packet.m_8021q);
+
+	return vlan == net::vlan_helper::untagged ? vlans.native_vlans[index] : vlan;
 }
 
-bool ethernet_bridge::update_target_adapter_by_mac(const std::size_t index, const net::mac_address& address)
+void ethernet_bridge::translate_from_wlan(const network_adapter& adapter, INTERMEDIATE_BUFFER* packets,
+                                         const size_t count, const network_adapter::time_point_t now,
+                                         neighbour_batch<net::ip_address_v4>& arp_batch,
+                                         neighbour_batch<net::ip_address_v6>& ndp_batch)
 {
-	bool result = false;
+	arp_batch.clear();
+	ndp_batch.clear();
+
+	// Collect destination IP addresses of the block to resolve them at once
+	for (size_t i = 0; i < count; ++i)
 	{
-		std::shared_lock<std::shared_mutex> lock(mac_table_lock_);
+		const auto ether_header = reinterpret_cast<ether_header_ptr>(packets[i].m_IBuffer);
 
-		if (mac_table_.count(address) && mac_table_[address] == index)
+		if (packets[i].m_Length < ETHER_HEADER_LENGTH)
+			continue;
+
+		switch (ntohs(ether_header->h_proto))
 		{
-			return result;
+		case ETH_P_IP:
+			if (packets[i].m_Length >= ETHER_HEADER_LENGTH + sizeof(iphdr))
+				arp_batch.push_back(reinterpret_cast<iphdr_ptr>(packets[i].m_IBuffer + ETHER_HEADER_LENGTH)->ip_dst, i);
+			break;
+
+		case ETH_P_ARP:
+			if (const auto arp_hdr = reinterpret_cast<ether_arp_ptr>(packets[i].m_IBuffer + ETHER_HEADER_LENGTH);
+				packets[i].m_Length >= ETHER_HEADER_LENGTH + sizeof(ether_arp) &&
+				ntohs(arp_hdr->ea_hdr.ar_op) != ARPOP_REQUEST)
+			{
+				arp_batch.push_back(*reinterpret_cast<net::ip_address_v4*>(arp_hdr->arp_tpa), i);
+			}
+			break;
+
+		case ETH_P_IPV6:
+			// Multicast destinations keep their multicast MAC address
+			if (const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(packets[i].m_IBuffer + ETHER_HEADER_LENGTH);
+				packets[i].m_Length >= ETHER_HEADER_LENGTH + sizeof(ipv6hdr) && ip_header->ip6_dst.u.Byte[0] != 0xFF)
+			{
+				ndp_batch.push_back(ip_header->ip6_dst, i);
+			}
+			break;
+
+		default:
+			break;
 		}
-		result = true;
 	}
 
+	if (!arp_batch.addresses.empty() &&
+		adapter.get_mac_by_ip(arp_batch.addresses.data(), arp_batch.addresses.size(), now, arp_batch.macs.data()))
 	{
-		std::unique_lock<std::shared_mutex> lock(mac_table_lock_);
-		mac_table_[address] = index;
+		for (size_t k = 0; k < arp_batch.addresses.size(); ++k)
+		{
+			if (!arp_batch.macs[k])
+				continue;
+
+			const auto& dest_mac = arp_batch.macs[k].value();
+			auto& packet = packets[arp_batch.packets[k]];
+			const auto ether_header = reinterpret_cast<ether_header_ptr>(packet.m_IBuffer);
+
+			memcpy(ether_header->h_dest, &dest_mac[0], ETH_ALEN);
+
+			if (ntohs(ether_header->h_proto) == ETH_P_ARP)
+			{
+				const auto arp_hdr = reinterpret_cast<ether_arp_ptr>(packet.m_IBuffer + ETHER_HEADER_LENGTH);
+				memcpy(arp_hdr->arp_tha, &dest_mac[0], ETH_ALEN);
+			}
+		}
 	}
 
-	return result;
+	if (!ndp_batch.addresses.empty() &&
+		adapter.get_mac_by_ip(ndp_batch.addresses.data(), ndp_batch.addresses.size(), now, ndp_batch.macs.data()))
+	{
+		for (size_t k = 0; k < ndp_batch.addresses.size(); ++k)
+		{
+			if (ndp_batch.macs[k])
+			{
+				memcpy(reinterpret_cast<ether_header_ptr>(packets[ndp_batch.packets[k]].m_IBuffer)->h_dest,
+				       &ndp_batch.macs[k].value()[0], ETH_ALEN);
+			}
+		}
+	}
+}
+
+void ethernet_bridge::translate_to_wlan(network_adapter& adapter, INTERMEDIATE_BUFFER& packet,
+                                        const network_adapter::time_point_t now)
+{
+	const auto ether_header = reinterpret_cast<ether_header_ptr>(packet.m_IBuffer);
+
+	if (packet.m_Length < ETHER_HEADER_LENGTH)
+		return;
+
+	//
+	// ARP processing. Here we save pairs of IP and MAC addresses for future use
+	//
+	if (ntohs(ether_header->h_proto) == ETH_P_ARP && packet.m_Length >= ETHER_HEADER_LENGTH + sizeof(ether_arp))
+	{
+		const auto arp_hdr = reinterpret_cast<ether_arp_ptr>(packet.m_IBuffer + ETHER_HEADER_LENGTH);
+
+		// Save pair of IP and MAC (both ARP request and reply)
+		adapter.set_mac_for_ip(
+			*reinterpret_cast<net::ip_address_v4*>(arp_hdr->arp_spa),
+			&arp_hdr->arp_sha[0],
+			now
+		);
+
+		// Replace source MAC in ARP request/reply to WLAN adapter one
+		memmove(&arp_hdr->arp_sha[0], &adapter.get_hw_address()[0], ETH_ALEN);
+	}
+
+	if (ntohs(ether_header->h_proto) == ETH_P_IP && packet.m_Length >= ETHER_HEADER_LENGTH + sizeof(iphdr))
+	{
+		const auto ip_header = reinterpret_cast<iphdr_ptr>(packet.m_IBuffer + ETHER_HEADER_LENGTH);
+
+		// Save pair of source IP and MAC, so that the replies to the hosts (and the routed
+		// traffic through the gateways) behind the bridge are delivered before any ARP is seen
+		if (const net::ip_address_v4 source = ip_header->ip_src; source.S_un.S_addr != 0)
+			adapter.set_mac_for_ip(source, ether_header->h_source, now);
+
+		//
+		// DHCP requests preprocessing (there is no sense to send UNI-CAST DHCP requests if we use MAC NAT)
+		//
+		if (ip_header->ip_p == IPPROTO_UDP)
+		{
+			if (const auto udp_header = reinterpret_cast<udphdr_ptr>(reinterpret_cast<PUCHAR>(ip_header) +
+				sizeof(DWORD) * ip_header->ip_hl); ntohs(udp_header->th_dport) == IPPORT_DHCPS)
+			{
+				if (const auto dhcp = reinterpret_cast<dhcp_packet*>(udp_header + 1); (dhcp->op == BOOTREQUEST) &&
+					(dhcp->flags == 0)
+				)
+				{
+					// Change DHCP flags to broadcast 
+					dhcp->flags = htons(0x8000);
+					RecalculateUDPChecksum(&packet);
+					RecalculateIPChecksum(&packet);
+				}
+			}
+		}
+	}
+
+	//
+	// IPv6 and NDP processing. Link-layer address options carry the MAC addresses of the
+	// hosts behind the bridge, save them and replace with the WLAN adapter one
+	//
+	if (ntohs(ether_header->h_proto) == ETH_P_IPV6)
+	{
+		const auto ip_header = reinterpret_cast<ipv6hdr_ptr>(packet.m_IBuffer + ETHER_HEADER_LENGTH);
+
+		if (net::ipv6_packet_info info; net::ipv6_helper::parse(packet, info))
+		{
+			// Duplicate address detection is sent from the unspecified address
+			if (const net::ip_address_v6 source = ip_header->ip6_src; !IN6_IS_ADDR_UNSPECIFIED(&source))
+				adapter.set_mac_for_ip(source, ether_header->h_source, now);
+
+			if (info.protocol == IPPROTO_ICMPV6 && info.transport != nullptr && translate_ndp(
+				adapter, *ip_header, static_cast<uint8_t*>(info.transport), info.transport_length, now))
+			{
+				net::ipv6_helper::recalculate_tcp_udp_checksum(&packet);
+			}
+		}
+	}
+
+	// Replace source MAC in Ethernet header
+	memmove(&ether_header->h_source, &adapter.get_hw_address()[0], ETH_ALEN);
+}
+
+bool ethernet_bridge::translate_ndp(network_adapter& adapter, const ipv6hdr& ip_header, uint8_t* message,
+                                    const size_t length, const network_adapter::time_point_t now)
+{
+	if (length < sizeof(icmpv6hdr))
+		return false;
+
+	// Offset of the options and presence of the target address depend on the message type
+	size_t options;
+	auto has_target = false;
+
+	switch (reinterpret_cast<icmpv6hdr_ptr>(message)->type)
+	{
+	case ndp_router_solicitation:
+		options = 8;
+		break;
+	case ndp_router_advertisement:
+		options = 16;
+		break;
+	case ndp_neighbor_solicitation:
+	case ndp_neighbor_advertisement:
+		options = 24;
+		has_target = true;
+		break;
+	case ndp_redirect:
+		options = 40;
+		has_target = true;
+		break;
+	default:
+		return false;
+	}
+
+	auto modified = false;
+
+	// Every option is length * 8 octets long, zero length is invalid
+	while (options + 2 <= length && message[options + 1] != 0 && options + message[options + 1] * 8 <= length)
+	{
+		const auto type = message[options];
+		const auto link_layer_address = message + options + 2;
+
+		if (type == ndp_option_source_link_layer_address || type == ndp_option_target_link_layer_address)
+		{
+			if (type == ndp_option_source_link_layer_address && !IN6_IS_ADDR_UNSPECIFIED(&ip_header.ip6_src))
+			{
+				adapter.set_mac_for_ip(ip_header.ip6_src, link_layer_address, now);
+			}
+			else if (type == ndp_option_target_link_layer_address && has_target)
+			{
+				net::ip_address_v6 target;
+				memcpy(&target, message + 8, sizeof(in6_addr));
+				adapter.set_mac_for_ip(target, link_layer_address, now);
+			}
+
+			memcpy(link_layer_address, &adapter.get_hw_address()[0], ETH_ALEN);
+			modified = true;
+		}
+
+		options += message[options + 1] * 8;
+	}
+
+	return modified;
 }
 
 void ethernet_bridge::initialize_network_interfaces()
@@ -139,20 +454,19 @@ void ethernet_bridge::initialize_network_interfaces()
 			network_interfaces_.push_back(std::move(adapter));
 		}
 	}
+
+	vlan_ports_.resize(network_interfaces_.size());
+	storm_control_.resize(network_interfaces_.size());
+	storm_drops_ = std::make_unique<storm_counters[]>(network_interfaces_.size());
 }
 
-void ethernet_bridge::bridge_working_thread(const size_t index)
+void ethernet_bridge::bridge_working_thread(const size_t index, const std::shared_ptr<const vlan_state> vlans,
+                                            const storm_control_config storm_control)
 {
 	const auto packet_buffer = std::make_unique<INTERMEDIATE_BUFFER[]>(maximum_packet_block);
 
-#ifdef _DEBUG
-	using namespace std::string_literals;
-	pcap::pcap_file_storage capture_in("bridge_in_"s + std::to_string(index) + ".pcap"s);
-	std::map<std::size_t, pcap::pcap_file_storage> capture_out;
-	for (auto&& a : bridged_interfaces_)
-		capture_out[a] = pcap::pcap_file_storage(
-			"bridge_"s + std::to_string(index) + "_to_"s + std::to_string(a) + ".pcap"s);
-#endif //_DEBUG
+	// Hot destination MAC addresses of this thread
+	net::mac_table::lookup_cache mac_cache;
 
 	//
 	// Thread reads packets from the network interface and duplicates non-local packets to the second
@@ -160,6 +474,81 @@ void ethernet_bridge::bridge_working_thread(const size_t index)
 
 	auto& adapters = network_interfaces_;
 
+	//
+	// Forwarding decisions keep one bit per bridged interface in the order of bridged_interfaces_
+	//
+
+	port_mask_t other_ports = 0;
+	std::vector<port_mask_t> port_bits(adapters.size(), 0);
+
+	for (size_t p = 0; p < bridged_interfaces_.size(); ++p)
+	{
+		port_bits[bridged_interfaces_[p]] = port_mask_t{1} << p;
+
+		if (bridged_interfaces_[p] != index)
+			other_ports |= port_mask_t{1} << p;
+	}
+
+	// Bridged interfaces to forward the frames of the VLAN to, none if the VLAN is not allowed on this interface
+	auto find_ports_by_vlan = [&members = vlans->members, own_port = port_bits[index], other_ports](const uint16_t vlan)
+	{
+		return members[vlan] & own_port ? members[vlan] & other_ports : port_mask_t{0};
+	};
+
+	// Bridged interfaces with the supplied hardware address
+	auto find_ports_by_mac = [this, &adapters](unsigned char* address)
+	{
+		port_mask_t result = 0;
+
+		for (size_t p = 0; p < bridged_interfaces_.size(); ++p)
+		{
+			if (adapters[bridged_interfaces_[p]]->is_local(address))
+				result |= port_mask_t{1} << p;
+		}
+
+		return result;
+	};
+
+	// Destinations to send to, the ones rewriting packets (WLAN) go last
+	std::vector<size_t> destinations;
+	destinations.reserve(bridged_interfaces_.size());
+
+	for (auto wlan : {false, true})
+	{
+		for (size_t p = 0; p < bridged_interfaces_.size(); ++p)
+		{
+			if (bridged_interfaces_[p] != index && adapters[bridged_interfaces_[p]]->is_wlan() == wlan)
+				destinations.push_back(p);
+		}
+	}
+
+	// Clones are needed only if more than one destination rewrites packets
+	const auto rewriting_destinations = std::count_if(destinations.cbegin(), destinations.cend(), [&](auto p)
+	{
+		return adapters[bridged_interfaces_[p]]->is_wlan();
+	});
+
+	const auto clone_buffer = rewriting_destinations > 1
+		                          ? std::make_unique<INTERMEDIATE_BUFFER[]>(maximum_packet_block)
+		                          : std::unique_ptr<INTERMEDIATE_BUFFER[]>();
+
+	std::vector<forwarding_decision> decisions(maximum_packet_block);
+
+	// Storm control buckets of this interface, refilled once per packet block
+	const auto started = net::token_bucket::clock_t::now();
+
+	net::token_bucket broadcast_bucket(storm_control.broadcast.rate, storm_control.broadcast.burst, started);
+	net::token_bucket multicast_bucket(storm_control.multicast.rate, storm_control.multicast.burst, started);
+	net::token_bucket unknown_unicast_bucket(storm_control.unknown_unicast.rate, storm_control.unknown_unicast.burst,
+	                                         started);
+
+	const auto storm_control_enabled = broadcast_bucket.is_enabled() || multicast_bucket.is_enabled() ||
+		unknown_unicast_bucket.is_enabled();
+
+	// Destination IP addresses of the block for WLAN MAC NAT
+	neighbour_batch<net::ip_address_v4> arp_batch;
+	neighbour_batch<net::ip_address_v6> ndp_batch;
+
 	//
 	// Initialize Requests
 	//
@@ -223,16 +612,33 @@ void ethernet_bridge::bridge_working_thread(const size_t index)
 
 		while (ReadPackets(read_request))
 		{
+			// MAC table entries are learned and aged with the time the block was read
+			const auto now = net::mac_table::clock_t::now();
+
+#ifdef _DEBUG
+			// packets of the batch share the timestamp taken when they were read
+			const auto timestamp = pcap::timestamp_now();
+#endif //_DEBUG
+
 			for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
 			{
 #ifdef _DEBUG
-				capture_in << *read_request->EthPacket[i].Buffer;
+				capture_.write(static_cast<uint32_t>(index), *read_request->EthPacket[i].Buffer, timestamp);
 #endif //_DEBUG
-				if (packet_buffer[i].m_dwDeviceFlags == PACKET_FLAG_ON_RECEIVE)
+				const auto vlan = classify_vlan(*vlans, index, packet_buffer[i]);
+
+				// Packets stay within their VLAN, the ones of VLANs not allowed on this interface are dropped
+				const auto domain = vlans->vlan_aware ? find_ports_by_vlan(vlan) : other_ports;
+
+				decisions[i] = {
+					domain, domain, vlan, net::vlan_helper::priority_of_8021q_info(packet_buffer[i].m_8021q)
+				};
+
+				if (domain && packet_buffer[i].m_dwDeviceFlags == PACKET_FLAG_ON_RECEIVE)
 				{
 					auto ether_header = reinterpret_cast<ether_header_ptr>(read_request->EthPacket[i].Buffer->
 						m_IBuffer);
-					update_target_adapter_by_mac(index, net::mac_address(ether_header->h_source));
+					update_target_adapter_by_mac(index, net::mac_address(ether_header->h_source), vlan, now);
 				}
 			}
 
@@ -244,169 +650,160 @@ void ethernet_bridge::bridge_working_thread(const size_t index)
 				// Process packets from WLAN:
 				// Need to lookup correct MAC address for each packet by its IP address
 				// and replace destination MAC address
-				for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
+				translate_from_wlan(*adapters[index], packet_buffer.get(), read_request->dwPacketsSuccess, now,
+				                    arp_batch, ndp_batch);
+			}
+
+			storm_statistics storm_drops{};
+
+			if (storm_control_enabled)
+			{
+				broadcast_bucket.refill(now);
+				multicast_bucket.refill(now);
+				unknown_unicast_bucket.refill(now);
+			}
+
+			//
+			// Decide the destinations of each packet in a single pass
+			//
+			for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
+			{
+				auto& decision = decisions[i];
+
+				// Both masks start as the interfaces of the packet VLAN
+				const auto domain = decision.adapter_mask;
+
+				if (!domain)
+					continue;
+
+				const auto ether_header = reinterpret_cast<ether_header_ptr>(packet_buffer[i].m_IBuffer);
+
+				if (packet_buffer[i].m_dwDeviceFlags == PACKET_FLAG_ON_SEND)
 				{
-					auto ether_header = reinterpret_cast<ether_header_ptr>(read_request->EthPacket[i].Buffer->
-						m_IBuffer);
-					if (ntohs(ether_header->h_proto) == ETH_P_IP)
-					{
-						const auto ip_hdr = reinterpret_cast<iphdr*>(read_request->EthPacket[i].Buffer->m_IBuffer +
-							ETHER_HEADER_LENGTH);
+					// For outgoing packets forward only originated from the current interface or the bridged ones (to skip possible loopback indications)
+					decision.adapter_mask = adapters[index]->is_local(ether_header->h_source)
+						                        ? domain
+						                        : find_ports_by_mac(ether_header->h_source) & domain;
+				}
+				else
+				{
+					// For incoming packets don't forward packets destined to local interface (they are not supposed to be bridged anythere else)
+					decision.adapter_mask = adapters[index]->is_local(ether_header->h_dest) ? 0 : domain;
+				}
 
-						if (auto dest_mac = adapters[index]->get_mac_by_ip(ip_hdr->ip_dst); static_cast<bool>(dest_mac))
-						{
-							memcpy(ether_header->h_dest, &dest_mac[0], ETH_ALEN);
-						}
-					}
+				// Known unicast destination is forwarded to its network interface only, the rest is flooded
+				auto flooded = false;
 
-					if (ntohs(ether_header->h_proto) == ETH_P_ARP)
+				if (decision.adapter_mask)
+				{
+					if (auto destination = find_target_adapter_by_mac(
+						static_cast<net::mac_address>(ether_header->h_dest), decision.vlan, now, mac_cache); destination)
+						decision.adapter_mask &= port_bits[destination.value()];
+					else
+						flooded = true;
+				}
+
+				// For local indications add only directed or broadcast/multi-cast
+				decision.mstcp_mask = (ether_header->h_dest[0] & 0x01)
+					                      ? domain
+					                      : find_ports_by_mac(ether_header->h_dest) & domain;
+
+				// Storm control: broadcast and multicast frames over the limit are dropped, unknown unicast ones
+				// over the limit are not flooded
+				if (flooded && storm_control_enabled)
+				{
+					if (!(ether_header->h_dest[0] & 0x01))
 					{
-						if (auto arp_hdr = reinterpret_cast<ether_arp_ptr>(read_request->EthPacket[i].Buffer->m_IBuffer
-							+ ETHER_HEADER_LENGTH); ntohs(arp_hdr->ea_hdr.ar_op) == ARPOP_REQUEST)
+						if (!unknown_unicast_bucket.try_consume())
 						{
+							decision.adapter_mask = 0;
+							++storm_drops.unknown_unicast;
 						}
-						else
+					}
+					else if (static_cast<net::mac_address>(ether_header->h_dest).is_broadcast())
+					{
+						if (!broadcast_bucket.try_consume())
 						{
-							if (auto dest_mac = adapters[index]->get_mac_by_ip(
-								*reinterpret_cast<net::ip_address_v4*>(arp_hdr->arp_tpa)); static_cast<bool>(dest_mac))
-							{
-								memcpy(ether_header->h_dest, &dest_mac[0], ETH_ALEN);
-								memcpy(arp_hdr->arp_tha, &dest_mac[0], ETH_ALEN);
-							}
+							decision.adapter_mask = decision.mstcp_mask = 0;
+							++storm_drops.broadcast;
 						}
 					}
+					else if (!multicast_bucket.try_consume())
+					{
+						decision.adapter_mask = decision.mstcp_mask = 0;
+						++storm_drops.multicast;
+					}
 				}
 			}
 
-			for (auto&& a : bridged_interfaces_)
+			if (storm_drops.broadcast || storm_drops.multicast || storm_drops.unknown_unicast)
 			{
-				if (a == index)
-					continue;
+				storm_drops_[index].broadcast.fetch_add(storm_drops.broadcast, std::memory_order_relaxed);
+				storm_drops_[index].multicast.fetch_add(storm_drops.multicast, std::memory_order_relaxed);
+				storm_drops_[index].unknown_unicast.fetch_add(storm_drops.unknown_unicast, std::memory_order_relaxed);
+			}
 
-				if (adapters[a]->is_wlan())
+			//
+			// Build and send the requests of each destination
+			//
+			for (size_t d = 0; d < destinations.size(); ++d)
+			{
+				const auto a = bridged_interfaces_[destinations[d]];
+				const auto port_bit = port_mask_t{1} << destinations[d];
+
+				// Process packets to WLAN:
+				// Need to change source MAC to WLAN adapter MAC. Destinations rewriting packets go last,
+				// all but the last one rewrite clones so that the remaining ones get the packets as read.
+				const auto translate = adapters[a]->is_wlan();
+				const auto clone = translate && (d + 1 < destinations.size());
+				size_t clones = 0;
+
+				for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
 				{
-					// Process packets to WLAN:
-					// Need to change source MAC to WLAN adapter MAC 
-					// and save pair IP->MAC for the future
-					for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
-					{
-						auto ether_header = reinterpret_cast<ether_header_ptr>(read_request->EthPacket[i].Buffer->
-							m_IBuffer);
+					const auto& [adapter_mask, mstcp_mask, vlan, priority] = decisions[i];
 
-						//
-						// ARP processing. Here we save pairs of IP and MAC addresses for future use
-						//
-						if (ntohs(ether_header->h_proto) == ETH_P_ARP)
-						{
-							if (auto arp_hdr = reinterpret_cast<ether_arp_ptr>(read_request->EthPacket[i].Buffer->
-								m_IBuffer + ETHER_HEADER_LENGTH); ntohs(arp_hdr->ea_hdr.ar_op) == ARPOP_REQUEST)
-							{
-								// ARP request
-
-								// Save pair of IP and MAC
-								adapters[a]->set_mac_for_ip(
-									*reinterpret_cast<net::ip_address_v4*>(arp_hdr->arp_spa),
-									&arp_hdr->arp_sha[0]
-								);
-
-								// Replace source MAC in ARP request to WLAN adapter one
-								memmove(&arp_hdr->arp_sha[0], &adapters[a]->get_hw_address()[0], ETH_ALEN);
-							}
-							else
-							{
-								// ARP reply
-
-								// Save pair of IP and MAC
-								adapters[a]->set_mac_for_ip(
-									*reinterpret_cast<net::ip_address_v4*>(arp_hdr->arp_spa),
-									&arp_hdr->arp_sha[0]
-								);
-
-								// Replace source MAC in ARP reply to WLAN adapter one
-								memmove(&arp_hdr->arp_sha[0], &adapters[a]->get_hw_address()[0], ETH_ALEN);
-							}
-						}
+					if (!((adapter_mask | mstcp_mask) & port_bit))
+						continue;
+
+					auto buffer = &packet_buffer[i];
 
-						//
-						// DHCP requests preprocessing (there is no sense to send UNI-CAST DHCP requests if we use MAC NAT)
-						//
-						if (ntohs(ether_header->h_proto) == ETH_P_IP)
+					if (translate)
+					{
+						if (clone)
 						{
-							if (const auto ip_header = reinterpret_cast<iphdr_ptr>(read_request->EthPacket[i].Buffer->
-								m_IBuffer + ETHER_HEADER_LENGTH); ip_header->ip_p == IPPROTO_UDP)
-							{
-								if (const auto udp_header = reinterpret_cast<udphdr_ptr>(reinterpret_cast<PUCHAR>(
-										ip_header) + sizeof(DWORD) * ip_header->ip_hl); ntohs(udp_header->th_dport) ==
-									IPPORT_DHCPS)
-								{
-									if (const auto dhcp = reinterpret_cast<dhcp_packet*>(udp_header + 1); (dhcp->op ==
-											BOOTREQUEST) &&
-										(dhcp->flags == 0)
-									)
-									{
-										// Change DHCP flags to broadcast 
-										dhcp->flags = htons(0x8000);
-										RecalculateUDPChecksum(read_request->EthPacket[i].Buffer);
-										RecalculateIPChecksum(read_request->EthPacket[i].Buffer);
-									}
-								}
-							}
+							buffer = &clone_buffer[clones++];
+							memcpy(buffer, &packet_buffer[i],
+							       offsetof(INTERMEDIATE_BUFFER, m_IBuffer) + packet_buffer[i].m_Length);
 						}
 
-						// Replace source MAC in Ethernet header
-						memmove(&ether_header->h_source, &adapters[a]->get_hw_address()[0], ETH_ALEN);
+						translate_to_wlan(*adapters[a], *buffer, now);
 					}
-				}
 
-				for (size_t i = 0; i < read_request->dwPacketsSuccess; ++i)
-				{
-					if (auto ether_header = reinterpret_cast<ether_header_ptr>(read_request->EthPacket[i].Buffer->
-						m_IBuffer); packet_buffer[i].m_dwDeviceFlags == PACKET_FLAG_ON_SEND)
+					// The access/native VLAN leaves untagged, the rest is tagged out-of-band. Packet buffers shared
+					// by the destinations are retagged for each of them as the requests are sent one at a time.
+					if (vlans->vlan_aware)
 					{
-						// For outgoing packets add to list only originated from the current interface (to skip possible loopback indications)
-						if (adapters[index]->is_local(packet_buffer[i].m_IBuffer + ETH_ALEN) ||
-							(adapters[a]->is_local(packet_buffer[i].m_IBuffer + ETH_ALEN)))
-						{
-							if (auto destination = find_target_adapter_by_mac(
-								static_cast<net::mac_address>(ether_header->h_dest)); destination && (destination.
-								value() != a))
-								continue;
-
-							bridge_request->EthPacket[bridge_request->dwPacketsNumber].Buffer = &packet_buffer[i];
-#ifdef _DEBUG
-							capture_out[a] << *bridge_request->EthPacket[bridge_request->dwPacketsNumber].Buffer;
-#endif //_DEBUG
-							++bridge_request->dwPacketsNumber;
-						}
+						buffer->m_8021q = vlan == vlans->native_vlans[a]
+							                  ? 0
+							                  : net::vlan_helper::make_8021q_info(vlan, priority);
 					}
-					else
-					{
-						// For incoming packets don't add to list packets destined to local interface (they are not supposed to be bridged anythere else)
-						if (!adapters[index]->is_local(packet_buffer[i].m_IBuffer))
-						{
-							if (auto destination = find_target_adapter_by_mac(
-								static_cast<net::mac_address>(ether_header->h_dest)); destination && (destination.
-								value() != a))
-								continue;
 
-							bridge_request->EthPacket[bridge_request->dwPacketsNumber].Buffer = &packet_buffer[i];
+					if (adapter_mask & port_bit)
+					{
+						bridge_request->EthPacket[bridge_request->dwPacketsNumber].Buffer = buffer;
 #ifdef _DEBUG
-							capture_out[a] << *bridge_request->EthPacket[bridge_request->dwPacketsNumber].Buffer;
+						capture_.write(static_cast<uint32_t>(a), *buffer, timestamp,
+						               pcap::packet_direction::outbound);
 #endif //_DEBUG
-							++bridge_request->dwPacketsNumber;
-						}
+						++bridge_request->dwPacketsNumber;
 					}
 
-					// For local indications add only directed or broadcast/multi-cast
-					if ((packet_buffer[i].m_IBuffer[0] & 0x01)
-						|| adapters[a]->is_local(packet_buffer[i].m_IBuffer)
-					)
+					if (mstcp_mask & port_bit)
 					{
-						mstcp_bridge_request->EthPacket[mstcp_bridge_request->dwPacketsNumber].Buffer = &packet_buffer[
-							i];
+						mstcp_bridge_request->EthPacket[mstcp_bridge_request->dwPacketsNumber].Buffer = buffer;
 #ifdef _DEBUG
-						capture_out[a] << *mstcp_bridge_request->EthPacket[mstcp_bridge_request->dwPacketsNumber].
-							Buffer;
+						capture_.write(static_cast<uint32_t>(a), *buffer, timestamp,
+						               pcap::packet_direction::inbound);
 #endif //_DEBUG
 						++mstcp_bridge_request->dwPacketsNumber;
 					}
@@ -70,6 +70,106 @@ public:
 	ethernet_bridge() noexcept : CNdisApi() { initialize_network_interfaces(); }
 	virtual ~ethernet_bridge() { stop_bridge(); }
 
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// 802.1Q mode of the bridged interface
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	enum class vlan_port_mode
+	{
+		/// <summary>carries the allowed VLANs tagged and the native VLAN untagged</summary>
+		trunk,
+		/// <summary>carries a single VLAN untagged</summary>
+		access
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// 802.1Q configuration of the bridged interface. The default one (trunk of all VLANs
+	/// with native VLAN 0) passes the tags through as received.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct vlan_port_config
+	{
+		/// <summary>port mode</summary>
+		vlan_port_mode mode{vlan_port_mode::trunk};
+		/// <summary>access VLAN or native VLAN of the trunk, untagged frames belong to it</summary>
+		uint16_t vlan{net::vlan_helper::untagged};
+		/// <summary>VLANs allowed on the trunk</summary>
+		std::bitset<net::vlan_helper::vlan_count> allowed{std::bitset<net::vlan_helper::vlan_count>().set()};
+	};
+
+	// ********************************************************************************
+	/// <summary>
+	/// Sets 802.1Q configuration of the network interface, takes effect when the bridge
+	/// is started. Once any interface is configured the bridge keeps the VLANs apart.
+	/// </summary>
+	/// <param name="index">network interface index</param>
+	/// <param name="config">802.1Q configuration</param>
+	/// <returns>false if the network interface index or VLAN identifier is out of range</returns>
+	// ********************************************************************************
+	bool set_port_vlan(size_t index, vlan_port_config const& config);
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Storm control packet rate limit
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct storm_limit
+	{
+		/// <summary>packets per second, 0 disables the limit</summary>
+		uint32_t rate{0};
+		/// <summary>packets admitted at once after an idle period</summary>
+		uint32_t burst{0};
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Storm control of the bridged interface: limits of the frames read from the
+	/// interface and flooded to the other bridged interfaces. Broadcast and multicast
+	/// frames over the limit are dropped, unknown unicast frames over the limit are
+	/// not flooded.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct storm_control_config
+	{
+		storm_limit broadcast;
+		storm_limit multicast;
+		storm_limit unknown_unicast;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Numbers of frames dropped by the storm control
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct storm_statistics
+	{
+		uint64_t broadcast;
+		uint64_t multicast;
+		uint64_t unknown_unicast;
+	};
+
+	// ********************************************************************************
+	/// <summary>
+	/// Sets storm control of the network interface, takes effect when the bridge is
+	/// started
+	/// </summary>
+	/// <param name="index">network interface index</param>
+	/// <param name="config">storm control limits</param>
+	/// <returns>false if the network interface index is out of range</returns>
+	// ********************************************************************************
+	bool set_storm_control(size_t index, storm_control_config const& config);
+
+	// ********************************************************************************
+	/// <summary>
+	/// Queries storm control statistics of the network interface
+	/// </summary>
+	/// <param name="index">network interface index</param>
+	/// <returns>numbers of frames read from the network interface and dropped by the storm control</returns>
+	// ********************************************************************************
+	storm_statistics get_storm_statistics(size_t index) const;
+
 	// ********************************************************************************
 	/// <summary>
 	/// Starts bridging for the selected interfaces
@@ -95,6 +195,14 @@ public:
 	// ********************************************************************************
 	std::vector<std::pair<string, string>> get_interface_list();
 
+	// ********************************************************************************
+	/// <summary>
+	/// Queries MAC learning statistics
+	/// </summary>
+	/// <returns>number of learned and moved addresses and addresses not learned because the table was full</returns>
+	// ********************************************************************************
+	net::mac_table::statistics get_mac_table_statistics() const { return mac_table_.get_statistics(); }
+
 private:
 	// ********************************************************************************
 	/// <summary>
@@ -102,9 +210,14 @@ private:
 	/// destination MAC address
 	/// </summary>
 	/// <param name="address">MAC address reference</param>
-	/// <returns></returns>
+	/// <param name="vlan">VLAN of the packet</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <param name="cache">MAC table lookup cache of the calling thread</param>
+	/// <returns>network interface index or std::nullopt if the address is unknown</returns>
 	// ********************************************************************************
-	std::optional<std::size_t> find_target_adapter_by_mac(net::mac_address const& address);
+	std::optional<std::size_t> find_target_adapter_by_mac(net::mac_address const& address, uint16_t vlan,
+	                                                      net::mac_table::time_point_t now,
+	                                                      net::mac_table::lookup_cache& cache) const;
 
 	// ********************************************************************************
 	/// <summary>
@@ -112,17 +225,117 @@ private:
 	/// </summary>
 	/// <param name="index">index of the network interface</param>
 	/// <param name="address">MAC address to store behind the interface index</param>
-	/// <returns></returns>
+	/// <param name="vlan">VLAN of the packet</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <returns>true if the address was learned or has moved to the interface</returns>
+	// ********************************************************************************
+	bool update_target_adapter_by_mac(std::size_t index, net::mac_address const& address, uint16_t vlan,
+	                                  net::mac_table::time_point_t now);
+
+	/// <summary>802.1Q configuration snapshot of the running bridge</summary>
+	struct vlan_state;
+
 	// ********************************************************************************
-	bool update_target_adapter_by_mac(std::size_t index, net::mac_address const& address);
+	/// <summary>
+	/// Assigns the packet read from the network interface to VLAN. If the bridge is
+	/// VLAN aware the in-band tag is moved into m_8021q and untagged frames get the
+	/// access/native VLAN of the interface.
+	/// </summary>
+	/// <param name="vlans">802.1Q configuration of the running bridge</param>
+	/// <param name="index">network interface index the packet was read from</param>
+	/// <param name="packet">packet to classify</param>
+	/// <returns>VLAN identifier</returns>
+	// ********************************************************************************
+	static uint16_t classify_vlan(const vlan_state& vlans, std::size_t index, INTERMEDIATE_BUFFER& packet);
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Destination IP addresses of the packet block resolved by the WLAN MAC NAT at once
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	template <typename T>
+	struct neighbour_batch
+	{
+		/// <summary>destination IP addresses</summary>
+		std::vector<T> addresses;
+		/// <summary>index of the packet in the block for each address</summary>
+		std::vector<size_t> packets;
+		/// <summary>resolved MAC addresses</summary>
+		std::vector<std::optional<net::mac_address>> macs;
+
+		void push_back(const T& address, const size_t packet)
+		{
+			addresses.push_back(address);
+			packets.push_back(packet);
+			macs.emplace_back();
+		}
+
+		void clear() noexcept
+		{
+			addresses.clear();
+			packets.clear();
+			macs.clear();
+		}
+	};
+
+	// ********************************************************************************
+	/// <summary>
+	/// MAC NAT for the packet block received from WLAN: replaces the destination MAC
+	/// address (and ARP target hardware address) with the one stored for the destination
+	/// IPv4/IPv6 address. Destinations of the whole block are resolved by one batch
+	/// lookup per address family.
+	/// </summary>
+	/// <param name="adapter">WLAN network interface the packets were read from</param>
+	/// <param name="packets">packets to translate in place</param>
+	/// <param name="count">number of packets</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <param name="arp_batch">IPv4 lookup storage of the calling thread</param>
+	/// <param name="ndp_batch">IPv6 lookup storage of the calling thread</param>
+	// ********************************************************************************
+	static void translate_from_wlan(const network_adapter& adapter, INTERMEDIATE_BUFFER* packets, size_t count,
+	                                network_adapter::time_point_t now,
+	                                neighbour_batch<net::ip_address_v4>& arp_batch,
+	                                neighbour_batch<net::ip_address_v6>& ndp_batch);
+
+	// ********************************************************************************
+	/// <summary>
+	/// MAC NAT for the packet forwarded to WLAN: stores IP to MAC association from ARP,
+	/// NDP and the source of IPv4/IPv6 packets, replaces the source MAC address (and the
+	/// ARP/NDP link-layer addresses) with the WLAN adapter one and turns DHCP requests
+	/// into broadcast ones
+	/// </summary>
+	/// <param name="adapter">WLAN network interface the packet is forwarded to</param>
+	/// <param name="packet">packet to translate in place</param>
+	/// <param name="now">time the packet block was read</param>
+	// ********************************************************************************
+	static void translate_to_wlan(network_adapter& adapter, INTERMEDIATE_BUFFER& packet,
+	                              network_adapter::time_point_t now);
+
+	// ********************************************************************************
+	/// <summary>
+	/// Stores the link-layer addresses of the Neighbor Discovery message and replaces
+	/// them with the WLAN adapter MAC address
+	/// </summary>
+	/// <param name="adapter">WLAN network interface the packet is forwarded to</param>
+	/// <param name="ip_header">IPv6 header of the packet</param>
+	/// <param name="message">ICMPv6 message</param>
+	/// <param name="length">ICMPv6 message length</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <returns>true if the message was modified and the checksum has to be recalculated</returns>
+	// ********************************************************************************
+	static bool translate_ndp(network_adapter& adapter, const ipv6hdr& ip_header, uint8_t* message, size_t length,
+	                          network_adapter::time_point_t now);
 
 	// ********************************************************************************
 	/// <summary>
 	/// Packet reading and forwarding thread
 	/// </summary>
 	/// <param name="index">network interface index to read packets from</param>
+	/// <param name="vlans">802.1Q configuration snapshot taken by start_bridge</param>
+	/// <param name="storm_control">storm control limits of the network interface taken by start_bridge</param>
 	// ********************************************************************************
-	void bridge_working_thread(size_t index);
+	void bridge_working_thread(size_t index, std::shared_ptr<const vlan_state> vlans,
+	                           storm_control_config storm_control);
 
 	// ********************************************************************************
 	/// <summary>
@@ -131,6 +344,29 @@ private:
 	// ********************************************************************************
 	void initialize_network_interfaces();
 
+	/// <summary>bit mask of bridged interfaces, bit position is the index in bridged_interfaces_</summary>
+	using port_mask_t = uint64_t;
+
+	/// <summary>maximum number of bridged interfaces representable by port_mask_t</summary>
+	static constexpr size_t maximum_bridged_interfaces = sizeof(port_mask_t) * 8;
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Destinations of the packet read from the network interface
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct forwarding_decision
+	{
+		/// <summary>bridged interfaces to send the packet to</summary>
+		port_mask_t adapter_mask;
+		/// <summary>bridged interfaces to indicate the packet to the protocol stack of</summary>
+		port_mask_t mstcp_mask;
+		/// <summary>VLAN of the packet</summary>
+		uint16_t vlan;
+		/// <summary>802.1p user priority of the packet</summary>
+		uint8_t priority;
+	};
+
 	/// <summary>Bridge running flag</summary>
 	std::atomic_flag is_running_ = ATOMIC_FLAG_INIT;
 
@@ -143,9 +379,53 @@ private:
 	/// <summary>vector of bridged network interfaces</summary>
 	std::vector<std::size_t> bridged_interfaces_;
 	
-	/// <summary>has table to store MAC address -> adapter index association</summary>
-	std::unordered_map<net::mac_address, std::size_t> mac_table_;
+	/// <summary>MAC address -> adapter index association with aging, shared by the working threads</summary>
+	net::mac_table mac_table_;
+
+	/// <summary>802.1Q configuration of the network interfaces, indexed as network_interfaces_</summary>
+	std::vector<vlan_port_config> vlan_ports_;
+
+	/// <summary>true once any network interface has 802.1Q configuration</summary>
+	bool vlan_aware_{false};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// 802.1Q configuration of the running bridge. start_bridge builds it from the
+	/// interface settings and hands it to the working threads, so set_port_vlan never
+	/// changes the state the threads are reading.
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct vlan_state
+	{
+		/// <summary>the bridge keeps the VLANs apart</summary>
+		bool vlan_aware{false};
+		/// <summary>access/native VLAN of the network interfaces, indexed as network_interfaces_</summary>
+		std::vector<uint16_t> native_vlans;
+		/// <summary>bridged interfaces (port_mask_t) belonging to each VLAN</summary>
+		std::vector<port_mask_t> members;
+	};
+
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Storm control drop counters of the network interface, updated by its working
+	/// thread once per packet block
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct storm_counters
+	{
+		std::atomic<uint64_t> broadcast{0};
+		std::atomic<uint64_t> multicast{0};
+		std::atomic<uint64_t> unknown_unicast{0};
+	};
+
+	/// <summary>storm control limits of the network interfaces, indexed as network_interfaces_, copied to the working threads by start_bridge</summary>
+	std::vector<storm_control_config> storm_control_;
+
+	/// <summary>storm control drop counters of the network interfaces, indexed as network_interfaces_</summary>
+	std::unique_ptr<storm_counters[]> storm_drops_;
 
-	/// <summary>synchronization lock for the hash table above</summary>
-	std::shared_mutex mac_table_lock_;
+#ifdef _DEBUG
+	/// <summary>capture of the bridged traffic, one pcapng interface per network interface</summary>
+	pcap::pcapng_async_writer capture_;
+#endif //_DEBUG
 };
@@ -42,23 +42,26 @@ void network_adapter::set_mode(const unsigned flags)
 	api_.SetAdapterMode(&current_mode_);
 }
 
-void network_adapter::set_mac_for_ip(const net::ip_address_v4& ip, unsigned char* mac)
+void network_adapter::set_mac_for_ip(const net::ip_address_v4& ip, const unsigned char* mac, const time_point_t now)
 {
-	std::lock_guard<std::mutex> guard(ip_to_mac_mutex_);
-
-	ip_to_mac_[ip] = net::mac_address(mac);
+	arp_cache_.learn(ip, net::mac_address(mac), now);
 }
 
-net::mac_address network_adapter::get_mac_by_ip(const net::ip_address_v4& ip)
+void network_adapter::set_mac_for_ip(const net::ip_address_v6& ip, const unsigned char* mac, const time_point_t now)
 {
-	std::lock_guard<std::mutex> guard(ip_to_mac_mutex_);
+	ndp_cache_.learn(ip, net::mac_address(mac), now);
+}
 
-	if (const auto search = ip_to_mac_.find(ip); search != ip_to_mac_.end())
-	{
-		return search->second;
-	}
+size_t network_adapter::get_mac_by_ip(const net::ip_address_v4* ip, const size_t count, const time_point_t now,
+                                      std::optional<net::mac_address>* macs) const
+{
+	return arp_cache_.lookup(ip, count, now, macs);
+}
 
-	return net::mac_address();
+size_t network_adapter::get_mac_by_ip(const net::ip_address_v6* ip, const size_t count, const time_point_t now,
+                                      std::optional<net::mac_address>* macs) const
+{
+	return ndp_cache_.lookup(ip, count, now, macs);
 }
 
 void network_adapter::initialize_interface() noexcept
@@ -14,6 +14,8 @@
 // --------------------------------------------------------------------------------
 class network_adapter {
 public:
+	using time_point_t = std::chrono::steady_clock::time_point;
+
 	network_adapter(
 		CNdisApi& api,
 		HANDLE adapter,
@@ -148,22 +150,51 @@ public:
 
 	// ********************************************************************************
 	/// <summary>
-	/// Returns MAC address by the supplied IP address
+	/// Returns MAC addresses by the supplied IPv4 addresses (whole packet block at once)
+	/// </summary>
+	/// <param name="ip">IPv4 addresses</param>
+	/// <param name="count">number of addresses</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <param name="macs">receives MAC addresses associated with IP above if available,
+	/// std::nullopt otherwise</param>
+	/// <returns>number of addresses resolved</returns>
+	// ********************************************************************************
+	size_t get_mac_by_ip(const net::ip_address_v4* ip, size_t count, time_point_t now,
+	                     std::optional<net::mac_address>* macs) const;
+
+	// ********************************************************************************
+	/// <summary>
+	/// Returns MAC addresses by the supplied IPv6 addresses (whole packet block at once)
+	/// </summary>
+	/// <param name="ip">IPv6 addresses</param>
+	/// <param name="count">number of addresses</param>
+	/// <param name="now">time the packet block was read</param>
+	/// <param name="macs">receives MAC addresses associated with IP above if available,
+	/// std::nullopt otherwise</param>
+	/// <returns>number of addresses resolved</returns>
+	// ********************************************************************************
+	size_t get_mac_by_ip(const net::ip_address_v6* ip, size_t count, time_point_t now,
+	                     std::optional<net::mac_address>* macs) const;
+
+	// ********************************************************************************
+	/// <summary>
+	/// Stores IPv4 to MAC address association
 	/// </summary>
 	/// <param name="ip">IP address</param>
-	/// <returns>MAC address associated with IP above if available, zero initialized
-	/// otherwise</returns>
+	/// <param name="mac">pointer to 6 bytes of MAC address</param>
+	/// <param name="now">time the packet block was read</param>
 	// ********************************************************************************
-	net::mac_address get_mac_by_ip (net::ip_address_v4 const& ip);
+	void set_mac_for_ip(net::ip_address_v4 const& ip, const unsigned char* mac, time_point_t now);
 
 	// ********************************************************************************
 	/// <summary>
-	/// Stores IP to MAC address association
+	/// Stores IPv6 to MAC address association
 	/// </summary>
 	/// <param name="ip">IP address</param>
 	/// <param name="mac">pointer to 6 bytes of MAC address</param>
+	/// <param name="now">time the packet block was read</param>
 	// ********************************************************************************
-	void set_mac_for_ip(net::ip_address_v4 const& ip, unsigned char* mac);
+	void set_mac_for_ip(net::ip_address_v6 const& ip, const unsigned char* mac, time_point_t now);
 
 private:
 	/// <summary>Driver interface reference</summary>
@@ -182,8 +213,8 @@ private:
 	ADAPTER_MODE current_mode_;		
 	/// <summary>True for WLAN media type</summary>
 	bool is_wlan_ = false;	
-	/// <summary>ARP table</summary>
-	std::unordered_map<net::ip_address_v4, net::mac_address> ip_to_mac_;			
-	/// <summary>Synchronization object to control access to ARP table</summary>
-	std::mutex ip_to_mac_mutex_;		
+	/// <summary>IPv4 neighbours learned from ARP and IPv4 traffic (lock-free reads)</summary>
+	net::neighbour_cache<net::ip_address_v4> arp_cache_;
+	/// <summary>IPv6 neighbours learned from NDP and IPv6 traffic (lock-free reads)</summary>
+	net::neighbour_cache<net::ip_address_v6> ndp_cache_;
 };
@@ -7,8 +7,125 @@
 
 #include "stdafx.h"
 
+// ********************************************************************************
+/// <summary>
+/// Measures the MAC learning path of the bridge threads: each thread learns the
+/// source (one of the hosts behind its port) and looks up the destination (any host)
+/// of every packet. Compares net::mac_table with the unordered_map under shared_mutex
+/// which the bridge used before.
+/// </summary>
+/// <returns>process exit code</returns>
+// ********************************************************************************
+int run_benchmark()
+{
+	constexpr size_t threads = 4;
+	constexpr size_t hosts = 1000;
+	constexpr size_t packets = 2'000'000;
+
+	using clock_t = std::chrono::steady_clock;
+
+	const auto make_address = [](const size_t host)
+	{
+		net::mac_address address;
+		address.data = {0x02, 0x00, 0x00, static_cast<unsigned char>(host >> 16),
+			static_cast<unsigned char>(host >> 8), static_cast<unsigned char>(host)};
+		return address;
+	};
+
+	// runs the packet loop on the bridge threads and returns nanoseconds per packet
+	const auto measure = [](auto&& thread_routine)
+	{
+		std::vector<std::thread> workers;
+		std::atomic<size_t> found{0};
+		const auto start = clock_t::now();
+
+		for (size_t index = 0; index < threads; ++index)
+		{
+			workers.emplace_back([&thread_routine, &found, index]
+			{
+				found += thread_routine(index);
+			});
+		}
+
+		for (auto& worker : workers)
+			worker.join();
+
+		return std::chrono::duration<double, std::nano>(clock_t::now() - start).count() / (packets * threads);
+	};
+
+	// the bridge before net::mac_table
+	std::unordered_map<net::mac_address, size_t> map;
+	std::shared_mutex map_lock;
+
+	const auto map_time = measure([&](const size_t index)
+	{
+		std::mt19937 random(static_cast<uint32_t>(index));
+		size_t found = 0;
+
+		for (size_t i = 0; i < packets; ++i)
+		{
+			const auto source = make_address(random() % (hosts / threads) * threads + index);
+			const auto destination = make_address(random() % hosts);
+
+			auto known = false;
+
+			{
+				std::shared_lock lock(map_lock);
+
+				const auto it = map.find(source);
+				known = it != map.end() && it->second == index;
+			}
+
+			if (!known)
+			{
+				std::unique_lock lock(map_lock);
+				map[source] = index;
+			}
+
+			std::shared_lock lock(map_lock);
+			found += map.find(destination) != map.end() ? 1 : 0;
+		}
+
+		return found;
+	});
+
+	net::mac_table table;
+
+	const auto table_time = measure([&](const size_t index)
+	{
+		std::mt19937 random(static_cast<uint32_t>(index));
+		net::mac_table::lookup_cache cache;
+		size_t found = 0;
+		auto now = clock_t::now();
+
+		for (size_t i = 0; i < packets; ++i)
+		{
+			// the bridge takes the time once per packet block
+			if (i % 256 == 0)
+				now = clock_t::now();
+
+			const auto source = make_address(random() % (hosts / threads) * threads + index);
+			const auto destination = make_address(random() % hosts);
+
+			table.learn(source, 0, index, now);
+			found += table.lookup(destination, 0, now, cache) ? 1 : 0;
+		}
+
+		return found;
+	});
+
+	cout << threads << " threads, " << hosts << " hosts, learn and lookup per packet" << endl;
+	cout << "unordered_map + shared_mutex: " << std::fixed << std::setprecision(1) << map_time << " ns/packet" << endl;
+	cout << "net::mac_table:               " << table_time << " ns/packet" << endl;
+
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
+	if (argc > 1 && std::string(argv[1]) == "benchmark")
+		return run_benchmark();
+
 	ethernet_bridge ether_bridge;
 	size_t num, index = 0;
 
@@ -41,6 +158,55 @@ int main(int argc, char* argv[])
 		interfaces.push_back(index - 1);
 	}
 
+	cout << "Configure VLANs (y/n)? ";
+	char answer = 'n';
+	cin >> answer;
+
+	if (answer == 'y' || answer == 'Y')
+	{
+		for (auto interface_index : interfaces)
+		{
+			size_t mode = 0, vlan = 0;
+
+			cout << "Interface " << interface_index + 1 << " mode (0 - trunk, 1 - access): ";
+			cin >> mode;
+			cout << "Interface " << interface_index + 1 << (mode ? " access VLAN: " : " native VLAN: ");
+			cin >> vlan;
+
+			ethernet_bridge::vlan_port_config config;
+			config.mode = mode ? ethernet_bridge::vlan_port_mode::access : ethernet_bridge::vlan_port_mode::trunk;
+			config.vlan = static_cast<uint16_t>((std::min)(vlan, size_t{0xFFFF}));
+
+			if (!ether_bridge.set_port_vlan(interface_index, config))
+				cout << "Invalid VLAN configuration for interface " << interface_index + 1 << endl;
+		}
+	}
+
+	cout << "Configure storm control (y/n)? ";
+	answer = 'n';
+	cin >> answer;
+
+	if (answer == 'y' || answer == 'Y')
+	{
+		for (auto interface_index : interfaces)
+		{
+			auto read_limit = [interface_index](const char* name, ethernet_bridge::storm_limit& limit)
+			{
+				cout << "Interface " << interface_index + 1 << " " << name <<
+					" rate and burst (packets per second, 0 - unlimited): ";
+				cin >> limit.rate >> limit.burst;
+			};
+
+			ethernet_bridge::storm_control_config config;
+			read_limit("broadcast", config.broadcast);
+			read_limit("multicast", config.multicast);
+			read_limit("unknown unicast", config.unknown_unicast);
+
+			if (!ether_bridge.set_storm_control(interface_index, config))
+				cout << "Invalid storm control configuration for interface " << interface_index + 1 << endl;
+		}
+	}
+
 	try
 	{
 		if (ether_bridge.start_bridge(interfaces))
@@ -60,6 +226,19 @@ int main(int argc, char* argv[])
 
 	std::ignore = _getch();
 
+	const auto [learned, moved, full] = ether_bridge.get_mac_table_statistics();
+
+	cout << "MAC addresses learned: " << learned << ", moved: " << moved << ", not learned (table full): " << full <<
+		endl;
+
+	for (auto interface_index : interfaces)
+	{
+		const auto [broadcast, multicast, unknown_unicast] = ether_bridge.get_storm_statistics(interface_index);
+
+		cout << "Interface " << interface_index + 1 << " storm control drops: broadcast " << broadcast <<
+			", multicast " << multicast << ", unknown unicast " << unknown_unicast << endl;
+	}
+
 	printf("Exiting... \n");
 
 	return 0;
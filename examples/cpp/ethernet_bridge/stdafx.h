@@ -18,6 +18,7 @@
 #include <utility>
 #include <vector>
 #include <array>
+#include <bitset>
 #include <unordered_map>
 #include <memory>
 #include <tuple>
@@ -30,8 +31,12 @@
 #include <shared_mutex>
 #include <optional>
 #include <map>
+#include <deque>
 #include <fstream>
+#include <chrono>
 #include <charconv>
+#include <random>
+#include <iomanip>
 #include <gsl/gsl>
 
 using namespace std;
@@ -41,11 +46,19 @@ using namespace std;
 #include "../common/iphlp.h"
 #include "../common/dhcp_typedefs.h"
 #include "../common/net/ip_address.h"
+#include "../common/net/ipv6_helper.h"
 #include "../common/net/mac_address.h"
+#include "../common/tools/seqlock_table.h"
+#include "../common/net/mac_table.h"
+#include "../common/net/neighbour_cache.h"
+#include "../common/net/token_bucket.h"
+#include "../common/net/vlan.h"
 #include "../common/winsys/object.h"
 #include "../common/winsys/event.h"
 #include "../common/pcap/pcap.h"
 #include "../common/pcap/pcap_file_storage.h"
+#include "../common/pcap/async_file_writer.h"
+#include "../common/pcap/pcapng_async_writer.h"
 #include "NetworkAdapter.h"
 #include "EthernetBridge.h"
 
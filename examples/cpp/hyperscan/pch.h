@@ -40,6 +40,9 @@
 #include <charconv>
 #include <shared_mutex>
 #include <queue>
+#include <random>
+#include <unordered_map>
+#include <sstream>
 #include <gsl/gsl>
 #include <hs/hs.h>
 #include <llhttp.h>
@@ -53,8 +56,12 @@
 #include "../common/net/ip_address.h"
 #include "../common/net/ip_subnet.h"
 #include "../common/net/ip_endpoint.h"
+#include "../common/net/ipv6_helper.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/queued_packet_filter.h"
+#include "../common/tools/buffer_pool.h"
+#include "../common/net/tcp_reassembler.h"
+#include "../common/net/hs_inspector.h"
 
 #endif //PCH_H
@@ -4,98 +4,377 @@
 #include "pch.h"
 #include <iostream>
 
-class ipv6_parser
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Session hash used before the seeded mixing, kept for the benchmark: the IPv6
+/// address is folded into 32 bits by XOR, the endpoint hash is XORed with the port,
+/// and both ports are XORed in once more, which cancels them out.
+/// </summary>
+// --------------------------------------------------------------------------------
+struct legacy_session_hash
 {
-public:
-	// ********************************************************************************
-	/// <summary>
-	/// parses IP headers until the transport payload
-	/// </summary>
-	/// <param name="ip_header">pointer to IP header</param>
-	/// <param name="packet_size">size of IP packet in octets</param>
-	/// <returns>pointer to IP packet payload (TCP, UDP, ICMPv6 and etc..) and protocol</returns>
-	// ********************************************************************************
-	static std::pair<void*, unsigned char> find_transport_header(
-		ipv6hdr* ip_header,
-		const unsigned packet_size
-	)
+	size_t operator()(const net::ip_session<net::ip_address_v6>& session) const noexcept
 	{
-		unsigned char next_proto = 0;
+		const auto endpoint_hash = [](const net::ip_endpoint<net::ip_address_v6>& endpoint)
+		{
+			return std::hash<size_t>{}(std::hash<uint32_t>{}(static_cast<uint32_t>(endpoint.ip)) ^
+				static_cast<unsigned long>(endpoint.port));
+		};
+
+		return std::hash<size_t>{}(endpoint_hash(session.local) ^ static_cast<unsigned long>(session.local.port) ^
+			endpoint_hash(session.remote) ^ static_cast<unsigned long>(session.remote.port));
+	}
+};
+
+// ********************************************************************************
+/// <summary>
+/// Prints the quality of the session hash (distinct values and the longest bucket
+/// chain of the unordered_map) and the lookup time of the table built with it
+/// </summary>
+/// <param name="name">hash name</param>
+/// <param name="sessions">session keys</param>
+// ********************************************************************************
+template <typename Hash>
+void measure_session_hash(const char* name, const std::vector<net::ip_session<net::ip_address_v6>>& sessions)
+{
+	constexpr size_t rounds = 4;
+
+	std::unordered_set<size_t> values;
+	std::unordered_map<net::ip_session<net::ip_address_v6>, size_t, Hash> table;
+	table.reserve(sessions.size());
+
+	for (const auto& session : sessions)
+	{
+		values.insert(Hash{}(session));
+		table.emplace(session, table.size());
+	}
+
+	size_t longest_chain = 0;
+
+	for (size_t bucket = 0; bucket < table.bucket_count(); ++bucket)
+		longest_chain = (std::max)(longest_chain, table.bucket_size(bucket));
+
+	size_t found = 0;
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		for (const auto& session : sessions)
+			found += table.count(session);
+	}
+
+	const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << std::setw(10) << name << std::setw(12) << values.size() << std::setw(16) << longest_chain <<
+		std::setw(14) << std::fixed << std::setprecision(1) << elapsed / static_cast<double>(found) << std::endl;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Compares the ip_session hash with the one used before the seeded mixing on the
+/// keys process_lookup sees: many connections of one host to one server, hosts of one
+/// /64 network, and random privacy addresses.
+/// </summary>
+// ********************************************************************************
+void benchmark_session_hash()
+{
+	constexpr size_t sessions_count = 8192;
 
-		//
-		// Parse IPv6 headers
-		//
+	const auto make_address = [](const uint64_t prefix, const uint64_t interface_id)
+	{
+		uint8_t bytes[16];
 
-		// Check if this IPv6 packet
-		if (ip_header->ip6_v != 6)
+		for (size_t i = 0; i < 8; ++i)
 		{
-			return {nullptr, next_proto};
+			bytes[i] = static_cast<uint8_t>(prefix >> (56 - i * 8));
+			bytes[i + 8] = static_cast<uint8_t>(interface_id >> (56 - i * 8));
 		}
 
-		// Find the first header
-		next_proto = ip_header->ip6_next;
-		auto* next_header = reinterpret_cast<ipv6ext_ptr>(ip_header + 1);
+		return net::ip_address_v6(bytes);
+	};
+
+	constexpr uint64_t prefix = 0x20010db800000001ull;
+	const auto server = make_address(0x20010db8ffff0000ull, 0x10);
+
+	std::mt19937_64 random(12345);
+	std::vector<std::pair<const char*, std::vector<net::ip_session<net::ip_address_v6>>>> key_sets(3);
 
-		// Loop until we find the last IP header
-		while (TRUE)
+	key_sets[0].first = "one host, source ports";
+	key_sets[1].first = "hosts of one /64";
+	key_sets[2].first = "privacy addresses";
+
+	for (size_t i = 0; i < sessions_count; ++i)
+	{
+		key_sets[0].second.emplace_back(make_address(prefix, 0x100), server, static_cast<uint16_t>(49152 + i % 16384),
+		                                443);
+		key_sets[1].second.emplace_back(make_address(prefix, i + 1), server, 50000, 443);
+		key_sets[2].second.emplace_back(make_address(prefix, random()), make_address(0x20010db8ffff0000ull, random() % 16),
+		                                static_cast<uint16_t>(49152 + random() % 16384), 443);
+	}
+
+	for (const auto& [name, sessions] : key_sets)
+	{
+		std::cout << sessions.size() << " sessions, " << name << std::endl;
+		std::cout << std::setw(10) << "hash" << std::setw(12) << "distinct" << std::setw(16) << "longest chain" <<
+			std::setw(14) << "ns/lookup" << std::endl;
+
+		measure_session_hash<legacy_session_hash>("legacy", sessions);
+		measure_session_hash<std::hash<net::ip_session<net::ip_address_v6>>>("seeded", sessions);
+
+		std::cout << std::endl;
+	}
+}
+
+// --------------------------------------------------------------------------------
+/// <summary>
+/// IPv6 extension header walk used before ipv6_helper::parse, kept for the benchmark:
+/// a switch per header with the single bounds check, the AH header is taken for the
+/// upper layer header and the fragment header ends the walk.
+/// </summary>
+// --------------------------------------------------------------------------------
+std::pair<void*, unsigned char> legacy_find_transport_header(const ipv6hdr* ip_header, const unsigned packet_size)
+{
+	unsigned char next_proto = 0;
+
+	if (ip_header->ip6_v != 6)
+		return {nullptr, next_proto};
+
+	next_proto = ip_header->ip6_next;
+	auto* next_header = reinterpret_cast<const ipv6ext*>(ip_header + 1);
+
+	while (true)
+	{
+		if (reinterpret_cast<const char*>(next_header) > reinterpret_cast<const char*>(ip_header) + packet_size -
+			sizeof(ipv6ext))
+			return {nullptr, next_proto};
+
+		switch (next_proto)
 		{
-			// Ensure that current header is still within the packet
-			if (reinterpret_cast<char*>(next_header) > reinterpret_cast<char*>(ip_header) + packet_size - sizeof(
-				ipv6ext))
+		case IPPROTO_FRAGMENT:
 			{
-				return {nullptr, next_proto};
+				const auto frag = reinterpret_cast<const ipv6ext_frag*>(next_header);
+
+				next_proto = frag->ip6_next;
+
+				if ((frag->ip6_offlg & 0xFC) != 0)
+					return {nullptr, next_proto};
+
+				next_header = reinterpret_cast<const ipv6ext*>(reinterpret_cast<const char*>(next_header) + sizeof(
+					ipv6ext_frag));
+
+				return {const_cast<void*>(static_cast<const void*>(next_header)), next_proto};
 			}
 
-			switch (next_proto)
-			{
-				// Fragmentation
-			case IPPROTO_FRAGMENT:
-				{
-					auto* const frag = reinterpret_cast<ipv6ext_frag_ptr>(next_header);
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+			next_proto = next_header->ip6_next;
+			next_header = reinterpret_cast<const ipv6ext*>(reinterpret_cast<const char*>(next_header) + 8 +
+				static_cast<ULONG_PTR>(next_header->ip6_len) * 8);
+			break;
 
-					// If this isn't the FIRST fragment, there won't be a TCP/UDP header anyway
-					if ((frag->ip6_offlg & 0xFC) != 0)
-					{
-						// The offset is non-zero
-						next_proto = frag->ip6_next;
+		default:
+			return {const_cast<void*>(static_cast<const void*>(next_header)), next_proto};
+		}
+	}
+}
 
-						return {nullptr, next_proto};
-					}
+// ********************************************************************************
+/// <summary>
+/// Builds the Ethernet frame with the IPv6 packet carrying the extension header chain
+/// </summary>
+/// <param name="chain">next header values in order, the last one is the upper layer protocol</param>
+/// <param name="fragment_offset">fragment offset in octets for the fragment header</param>
+/// <param name="truncated">the last extension header claims more octets than the packet has</param>
+/// <returns>frame</returns>
+// ********************************************************************************
+INTERMEDIATE_BUFFER make_ipv6_frame(const std::vector<uint8_t>& chain, const uint16_t fragment_offset = 0,
+                                    const bool truncated = false)
+{
+	INTERMEDIATE_BUFFER buffer{};
 
-					// Otherwise it's either an entire segment or the first fragment
-					next_proto = frag->ip6_next;
+	auto* const ethernet_header = reinterpret_cast<ether_header_ptr>(buffer.m_IBuffer);
+	ethernet_header->h_proto = htons(ETH_P_IPV6);
 
-					// Return next octet following the fragmentation header
-					next_header = reinterpret_cast<ipv6ext_ptr>(reinterpret_cast<char*>(next_header) + sizeof(
-						ipv6ext_frag));
+	auto* const ip_header = reinterpret_cast<ipv6hdr_ptr>(ethernet_header + 1);
+	ip_header->ip6_v = 6;
+	ip_header->ip6_next = chain.front();
+	ip_header->ip6_hops = 64;
 
-					return {next_header, next_proto};
-				}
+	auto* position = reinterpret_cast<uint8_t*>(ip_header + 1);
 
-				// Headers we just skip over
-			case IPPROTO_HOPOPTS:
-			case IPPROTO_ROUTING:
-			case IPPROTO_DSTOPTS:
-				next_proto = next_header->ip6_next;
+	for (size_t i = 0; i + 1 < chain.size(); ++i)
+	{
+		position[0] = chain[i + 1];
+
+		if (chain[i] == IPPROTO_FRAGMENT)
+		{
+			reinterpret_cast<ipv6ext_frag*>(position)->ip6_offlg = htons(static_cast<uint16_t>(fragment_offset | 1));
+			position += sizeof(ipv6ext_frag);
+		}
+		else if (chain[i] == IPPROTO_AH)
+		{
+			// payload length in 4 octet units minus 2: 24 octets
+			position[1] = 4;
+			position += 24;
+		}
+		else
+		{
+			position[1] = truncated && i + 2 == chain.size() ? 7 : 0;
+			position += 8;
+		}
+	}
 
-				// As per RFC 2460 : ip6ext_len specifies the extended
-				// header length, in units of 8 octets *not including* the
-				// first 8 octets.
+	// upper layer header and 32 octets of data
+	position += (chain.back() == IPPROTO_TCP ? sizeof(tcphdr) : sizeof(udphdr)) + 32;
 
-				next_header = reinterpret_cast<ipv6ext_ptr>(reinterpret_cast<char*>(next_header) + 8 + (next_header->
-					ip6_len) * 8);
-				break;
+	buffer.m_Length = static_cast<DWORD>(position - buffer.m_IBuffer);
+	ip_header->ip6_len = htons(static_cast<uint16_t>(position - reinterpret_cast<uint8_t*>(ip_header + 1)));
 
-			default:
-				// No more IPv6 headers to skip
-				return {next_header, next_proto};
-			}
+	return buffer;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Compares ipv6_helper::parse, per packet and in the batch mode, with the walk used
+/// before it on the packets with the mixed extension header chains, and counts the
+/// packets where the upper layer header found differs
+/// </summary>
+// ********************************************************************************
+void benchmark_header_walk()
+{
+	constexpr size_t packets_count = 1024;
+	constexpr size_t rounds = 2000;
+
+	struct traffic
+	{
+		const char* name;
+		std::vector<INTERMEDIATE_BUFFER> frames;
+	};
+
+	std::vector<traffic> traffic_cases = {
+		{"TCP", {make_ipv6_frame({IPPROTO_TCP})}},
+		{"UDP", {make_ipv6_frame({IPPROTO_UDP})}},
+		{"Hop-by-Hop, UDP", {make_ipv6_frame({IPPROTO_HOPOPTS, IPPROTO_UDP})}},
+		{"Dest, Routing, TCP", {make_ipv6_frame({IPPROTO_DSTOPTS, IPPROTO_ROUTING, IPPROTO_TCP})}},
+		{"first fragment, UDP", {make_ipv6_frame({IPPROTO_FRAGMENT, IPPROTO_UDP})}},
+		{"fragment at 8, UDP", {make_ipv6_frame({IPPROTO_FRAGMENT, IPPROTO_UDP}, 8)}},
+		{"AH, TCP", {make_ipv6_frame({IPPROTO_AH, IPPROTO_TCP})}},
+		{"truncated Dest", {make_ipv6_frame({IPPROTO_DSTOPTS, IPPROTO_TCP}, 0, true)}}
+	};
+
+	// every case repeated, then all cases shuffled together
+	traffic mixed{"mixed", {}};
+
+	for (auto& [name, frames] : traffic_cases)
+	{
+		mixed.frames.insert(mixed.frames.end(), packets_count / traffic_cases.size(), frames.front());
+		frames.resize(packets_count, frames.front());
+	}
+
+	std::shuffle(mixed.frames.begin(), mixed.frames.end(), std::mt19937(12345));
+	traffic_cases.push_back(std::move(mixed));
+
+	std::cout << std::setw(22) << "packets" << std::setw(12) << "legacy ns" << std::setw(12) << "walker ns" <<
+		std::setw(12) << "batch ns" << std::setw(12) << "differ" << std::endl;
+
+	for (const auto& [name, frames] : traffic_cases)
+	{
+		std::vector<PINTERMEDIATE_BUFFER> packets;
+		std::vector<net::ipv6_packet_info> info(frames.size());
+
+		for (const auto& frame : frames)
+			packets.push_back(const_cast<PINTERMEDIATE_BUFFER>(&frame));
+
+		const auto legacy_walk = [](const INTERMEDIATE_BUFFER& frame)
+		{
+			if (ntohs(reinterpret_cast<const ether_header*>(frame.m_IBuffer)->h_proto) != ETH_P_IPV6)
+				return std::pair<void*, unsigned char>{nullptr, 0};
+
+			return legacy_find_transport_header(reinterpret_cast<const ipv6hdr*>(frame.m_IBuffer + ETHER_HEADER_LENGTH),
+			                                    frame.m_Length - ETHER_HEADER_LENGTH);
+		};
+
+		// the result differs if the upper layer header or its protocol is not the same
+		size_t differ = 0;
+
+		for (size_t i = 0; i < frames.size(); ++i)
+		{
+			const auto [header, protocol] = legacy_walk(frames[i]);
+			net::ipv6_helper::parse(frames[i], info[i]);
+
+			if (header != info[i].transport || (header != nullptr && protocol != info[i].protocol))
+				++differ;
 		}
+
+		// time per packet of the measured walk repeated over all packets
+		const auto measure = [&frames](auto&& walk)
+		{
+			size_t found = 0;
+			const auto start = std::chrono::steady_clock::now();
+
+			for (size_t round = 0; round < rounds; ++round)
+				found += walk();
+
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).
+				count();
+
+			// keeps the walk from being optimized out
+			static volatile size_t sink;
+			sink = found;
+
+			return elapsed / static_cast<double>(rounds * frames.size());
+		};
+
+		const auto legacy_ns = measure([&frames, &legacy_walk]
+		{
+			size_t found = 0;
+
+			for (const auto& frame : frames)
+				found += legacy_walk(frame).first != nullptr ? 1 : 0;
+
+			return found;
+		});
+
+		const auto walker_ns = measure([&frames, &info]
+		{
+			size_t found = 0;
+
+			for (size_t i = 0; i < frames.size(); ++i)
+				found += net::ipv6_helper::parse(frames[i], info[i]) && info[i].transport != nullptr ? 1 : 0;
+
+			return found;
+		});
+
+		const auto batch_ns = measure([&packets, &info]
+		{
+			return net::ipv6_helper::parse(packets.data(), packets.size(), info.data());
+		});
+
+		std::cout << std::setw(22) << name << std::fixed << std::setprecision(1) << std::setw(12) << legacy_ns <<
+			std::setw(12) << walker_ns << std::setw(12) << batch_ns << std::setw(12) << differ << std::endl;
 	}
-};
+}
 
-int main()
+// ********************************************************************************
+/// <summary>
+/// Runs the session hash and the extension header walk benchmarks
+/// </summary>
+/// <returns>process exit code</returns>
+// ********************************************************************************
+int run_benchmark()
 {
+	benchmark_session_hash();
+	benchmark_header_walk();
+
+	return 0;
+}
+
+int main(const int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "benchmark")
+		return run_benchmark();
+
 	try
 	{
 		auto ndis_api = std::make_unique<ndisapi::fastio_packet_filter>(
@@ -106,7 +385,7 @@ int main()
 				{
 					auto* const ip_header = reinterpret_cast<ipv6hdr_ptr>(ethernet_header + 1);
 
-					if (const auto [header, protocol] = ipv6_parser::find_transport_header(
+					if (const auto [header, protocol] = net::ipv6_helper::find_transport_header(
 						ip_header, buffer.m_Length - ETHER_HEADER_LENGTH); header && protocol == IPPROTO_TCP)
 					{
 						auto* const tcp_header = static_cast<tcphdr_ptr>(header);
@@ -148,7 +427,7 @@ int main()
 				{
 					auto* const ip_header = reinterpret_cast<ipv6hdr_ptr>(ethernet_header + 1);
 
-					if (const auto [header, protocol] = ipv6_parser::find_transport_header(
+					if (const auto [header, protocol] = net::ipv6_helper::find_transport_header(
 						ip_header, buffer.m_Length - ETHER_HEADER_LENGTH); header && protocol == IPPROTO_TCP)
 					{
 						auto* const tcp_header = static_cast<tcphdr_ptr>(header);
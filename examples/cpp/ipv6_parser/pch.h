@@ -38,6 +38,9 @@
 #include <bitset>
 #include <optional>
 #include <charconv>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
 #include <gsl/gsl>
 
 #include "../../../include/common.h"
@@ -49,6 +52,7 @@
 #include "../common/net/ip_address.h"
 #include "../common/net/ip_subnet.h"
 #include "../common/net/ip_endpoint.h"
+#include "../common/net/ipv6_helper.h"
 #include "../common/iphelper/process_lookup.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
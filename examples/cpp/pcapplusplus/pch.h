@@ -48,6 +48,9 @@
 #include "../common/net/mac_address.h"
 #include "../common/net/ip_address.h"
 #include "../common/net/ip_subnet.h"
+#include "../common/net/ipv6_helper.h"
+#include "../common/net/ip_prefix_table.h"
+#include "../common/net/packet_batch.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/simple_packet_filter.h"
@@ -21,6 +21,8 @@
 #include <memory>
 #include <iostream>
 #include <iomanip>
+#include <random>
+#include <cstring>
 #include <chrono>
 #include <thread>
 #include <limits>
@@ -31,6 +33,7 @@
 #include <cassert>
 #include <array>
 #include <map>
+#include <tuple>
 #include <cctype>
 #include <variant>
 #include <bitset>
@@ -38,6 +41,7 @@
 #include <algorithm>
 #include <mutex>
 #include <charconv>
+#include <string_view>
 #include <gsl/gsl>
 
 #include "../../../include/common.h"
@@ -48,6 +52,12 @@
 #include "../common/net/mac_address.h"
 #include "../common/net/ip_address.h"
 #include "../common/net/ip_subnet.h"
+#include "../common/tools/buffer_pool.h"
+#include "../common/net/tcp_reassembler.h"
+#include "../common/tools/digest.h"
+#include "../common/tools/multi_pattern_matcher.h"
+#include "../common/net/tls_client_hello.h"
+#include "../common/net/http_request_scanner.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/fastio_packet_filter.h"
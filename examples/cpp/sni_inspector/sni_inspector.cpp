@@ -5,319 +5,977 @@
 #include <iostream>
 #include <optional>
 
-class tls_parser
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Reassembles the client to server TCP streams until the first TLS record (the
+/// ClientHello) is complete, so the ClientHello split across several segments,
+/// retransmitted or reordered is still inspected
+/// </summary>
+// --------------------------------------------------------------------------------
+class client_hello_collector
 {
-	static constexpr auto server_name_len = 256;
-	static constexpr auto tls_header_len = 5;
-	static constexpr auto tls_handshake_content_type = 0x16;
-	static constexpr auto tls_handshake_type_client_hello = 0x01;
-
-	static std::optional<std::string> parse_server_name_extension(const uint8_t* data, const size_t length)
+	/// <summary>maximum number of tracked connections</summary>
+	static constexpr size_t max_flows = 4096;
+	/// <summary>maximum TLS record size (header and 16 KiB fragment)</summary>
+	static constexpr size_t max_record_size = 5 + 16384;
+	/// <summary>connection without progress for this long is dropped when the table is full</summary>
+	static constexpr std::chrono::seconds flow_timeout{10};
+	/// <summary>reassembly window covering the largest TLS record</summary>
+	static constexpr uint32_t record_window_size = 32768;
+
+	/// <summary>source address, destination address, source port, destination port</summary>
+	using flow_key = std::tuple<uint32_t, uint32_t, uint16_t, uint16_t>;
+
+	struct flow_state
 	{
-		size_t position = 2; // skip server name list length
-
-		while (position + 3 < length)
+		explicit flow_state(tools::buffer_pool& pool)
+			: stream(pool, {record_window_size, 16, true, true}),
+			  pool(&pool)
 		{
-			const auto len = (static_cast<size_t>(data[position + 1]) << 8) + static_cast<size_t>(data[position + 2]);
-
-			if (position + 3 + len > length)
-			{
-				std::cout << "Invalid TLS client hello" << "\n";
-				return std::nullopt;
-			}
-
-			switch (data[position]) // name type
-			{
-			case 0x00: // host_name
-				return std::string(reinterpret_cast<const char*>(data + position + 3), len);
-			default:
-				std::cout << "Unknown server name extension name type: " << data[position] << "\n";
-				break;
-			}
-			position += 3 + len;
 		}
 
-		// Check we ended where we expected to
-		if (position != length)
+		// ********************************************************************************
+		/// <summary>
+		/// Appends the reassembled data to the record, moving it to the larger pooled
+		/// block when it doesn't fit
+		/// </summary>
+		/// <param name="data">reassembled data</param>
+		/// <param name="length">data length</param>
+		/// <returns>false if the record is too large or no memory is available</returns>
+		// ********************************************************************************
+		bool append(const uint8_t* data, const uint32_t length)
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
-		}
+			const auto required = record_length + length;
 
-		std::cout << "No Host header included in this request" << "\n";
-		return std::nullopt;
-	}
+			if (required > max_record_size)
+				return false;
 
-	static std::optional<std::string> parse_extensions(const uint8_t* data, const size_t length)
-	{
-		size_t position = 0;
+			if (required > record.size())
+			{
+				auto larger = pool->acquire(static_cast<uint32_t>(required));
 
-		// Parse each 4 bytes for the extension header
-		while (position + 4 <= length)
-		{
-			// Extension Length
-			const auto len = (static_cast<size_t>(data[position + 2]) << 8) + static_cast<size_t>(data[position + 3]);
+				if (!larger)
+					return false;
 
-			// Check if it's a server name extension
-			if (data[position] == 0x00 && data[position + 1] == 0x00)
-			{
-				// There can be only one extension of each type, so we break our state and move p to beginning of the extension here
-				if (position + 4 + len > length)
-				{
-					std::cout << "Invalid TLS client hello" << "\n";
-					return std::nullopt;
-				}
+				if (record_length != 0)
+					std::memcpy(larger.data(), record.data(), record_length);
 
-				return parse_server_name_extension(data + position + 4, len);
+				record = std::move(larger);
 			}
-			position += 4 + len; // Advance to the next extension header
+
+			std::memcpy(record.data() + record_length, data, length);
+			record_length = required;
+
+			return true;
 		}
 
-		// Check we ended where we expected to
-		if (position != length)
+		[[nodiscard]] const uint8_t* record_data() const noexcept
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
+			return reinterpret_cast<const uint8_t*>(record.data());
 		}
 
-		std::cout << "No Host header included in this request" << "\n";
-		return std::nullopt;
-	}
+		net::tcp_stream_reassembler stream;
+		tools::buffer_pool* pool;
+		/// <summary>first TLS record collected so far, the block is taken when the first data arrives</summary>
+		tools::buffer_pool::buffer record;
+		size_t record_length{0};
+		std::chrono::steady_clock::time_point last_seen;
+		bool failed{false};
+	};
+
+	tools::buffer_pool pool_{4ull * 1024 * 1024};
+	std::map<flow_key, flow_state> flows_;
 
 public:
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Complete first TLS record of the connection in the pooled block
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct tls_record
+	{
+		tools::buffer_pool::buffer buffer;
+		size_t length;
+
+		[[nodiscard]] const uint8_t* data() const noexcept { return reinterpret_cast<const uint8_t*>(buffer.data()); }
+		[[nodiscard]] size_t size() const noexcept { return length; }
+	};
+
 	// ********************************************************************************
 	/// <summary>
-	/// Parse a TLS packet for the Server Name Indication extension in the client
-	/// hello handshake, returning the first server name found
+	/// Processes the client to server segment
 	/// </summary>
-	/// <param name="data">SSL packet pointer</param>
-	/// <param name="length">SSL packet size</param>
-	/// <returns>optional string with SNI found </returns>
+	/// <param name="ip_header">IPv4 header</param>
+	/// <param name="tcp_header">TCP header</param>
+	/// <param name="payload">TCP payload</param>
+	/// <param name="payload_length">TCP payload length</param>
+	/// <returns>complete first TLS record of the connection once it is available</returns>
 	// ********************************************************************************
-	static std::optional<std::string> parse_tls_header(const uint8_t* data, size_t length)
+	std::optional<tls_record> process(const iphdr* ip_header, const tcphdr* tcp_header, const uint8_t* payload,
+	                                  const uint32_t payload_length)
 	{
-		size_t position = tls_header_len;
+		const flow_key key{
+			ip_header->ip_src.S_un.S_addr, ip_header->ip_dst.S_un.S_addr, tcp_header->th_sport, tcp_header->th_dport
+		};
 
-		// Check that our TCP payload is at least large enough for a TLS header
-		if (length < tls_header_len)
+		const auto syn = (tcp_header->th_flags & TH_SYN) != 0;
+		const auto now = std::chrono::steady_clock::now();
+
+		auto it = flows_.find(key);
+
+		if (tcp_header->th_flags & TH_RST)
 		{
-			std::cout << "Incomplete TLS client hello" << "\n";
+			if (it != flows_.end())
+				flows_.erase(it);
+
 			return std::nullopt;
 		}
 
-		// SSL 2.0 compatible Client Hello
-		// High bit of first byte (length) and content type is Client Hello
-		// See RFC5246 Appendix E.2
-		if (data[0] & 0x80 && data[2] == 1)
+		if (it == flows_.end())
 		{
-			std::cout << "Received SSL 2.0 Client Hello which can not support SNI." << "\n";
-			return std::nullopt;
+			// start on SYN or on the segment which looks like the beginning of the TLS record
+			if (!syn && (payload_length == 0 || payload[0] != 0x16))
+				return std::nullopt;
+
+			if (flows_.size() >= max_flows)
+				expire(now);
+
+			if (flows_.size() >= max_flows)
+				return std::nullopt;
+
+			it = flows_.try_emplace(key, pool_).first;
 		}
 
-		if (const auto tls_content_type = data[0]; tls_content_type != tls_handshake_content_type)
+		auto& flow = it->second;
+		flow.last_seen = now;
+
+		flow.stream.segment(ntohl(tcp_header->th_seq), payload, payload_length, syn,
+		                    (tcp_header->th_flags & TH_FIN) != 0,
+		                    [&flow](const uint8_t* data, const uint32_t length)
+		                    {
+			                    if (!flow.failed && (data == nullptr || !flow.append(data, length)))
+				                    flow.failed = true;
+		                    });
+
+		if (flow.record_length >= 5)
 		{
-			std::cout << "Request did not begin with TLS handshake." << "\n";
-			return std::nullopt;
+			const auto* const record = flow.record_data();
+
+			if (record[0] != 0x16)
+				flow.failed = true;
+
+			if (const auto record_size = 5 + ((static_cast<size_t>(record[3]) << 8) | record[4]);
+				!flow.failed && flow.record_length >= record_size)
+			{
+				tls_record result{std::move(flow.record), record_size};
+				flows_.erase(it);
+				return result;
+			}
 		}
 
-		const auto tls_version_major = data[1];
-		const auto tls_version_minor = data[2];
-		if (tls_version_major < 3)
+		if (flow.failed || flow.stream.is_finished())
+			flows_.erase(it);
+
+		return std::nullopt;
+	}
+
+private:
+	void expire(const std::chrono::steady_clock::time_point now)
+	{
+		for (auto it = flows_.begin(); it != flows_.end();)
 		{
-			std::cout << "Received SSL " << tls_version_major << "." << tls_version_minor <<
-				" handshake which can not support SNI." << "\n";
-			return std::nullopt;
+			if (now - it->second.last_seen > flow_timeout)
+				it = flows_.erase(it);
+			else
+				++it;
 		}
+	}
+};
 
-		// TLS record length
-		auto len = (static_cast<size_t>(data[3]) << 8) + static_cast<size_t>(data[4]) + tls_header_len;
-		length = min(length, len);
+// ********************************************************************************
+/// <summary>
+/// Returns the note naming the keyword found in the host name
+/// </summary>
+/// <param name="keywords">keyword matcher</param>
+/// <param name="names">keywords</param>
+/// <param name="host">SNI or HTTP host name</param>
+/// <returns>note to append to the output line or an empty string</returns>
+// ********************************************************************************
+std::string keyword_note(const tools::multi_pattern_matcher& keywords, const std::vector<std::string_view>& names,
+                         const std::string_view host)
+{
+	if (const auto id = keywords.find(host); id != tools::multi_pattern_matcher::npos)
+		return " KEYWORD: " + std::string(names[id]);
 
-		// Check we received entire TLS record length
-		if (length < len)
-			return std::nullopt;
+	return {};
+}
+
+// ********************************************************************************
+/// <summary>
+/// Computes the TCP payload length from the IP total length, so the Ethernet padding
+/// of the short frames is not taken for the stream data
+/// </summary>
+/// <param name="buffer">frame</param>
+/// <param name="ip_header">IPv4 header in the frame</param>
+/// <param name="tcp_header">TCP header in the frame</param>
+/// <returns>payload length or std::nullopt if the headers don't fit into the IP packet
+/// or the IP packet doesn't fit into the frame</returns>
+// ********************************************************************************
+std::optional<uint32_t> tcp_payload_length(const INTERMEDIATE_BUFFER& buffer, const iphdr& ip_header,
+                                           const tcphdr& tcp_header)
+{
+	const auto ip_length = static_cast<uint32_t>(ntohs(ip_header.ip_len));
+	const auto headers_length = 4u * ip_header.ip_hl + 4u * tcp_header.th_off;
+
+	if (ip_header.ip_hl < 5 || tcp_header.th_off < 5 || ip_length < headers_length ||
+		sizeof(ether_header) + ip_length > buffer.m_Length)
+		return std::nullopt;
+
+	return ip_length - headers_length;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Compares the keyword matcher with the strstr loop over the keywords. Both find
+/// every occurrence of the random lowercase keywords in the 1460 byte payloads made of
+/// the frequent text characters, so the prefilter is exercised on the realistic input.
+/// </summary>
+/// <returns>process exit code</returns>
+// ********************************************************************************
+int run_benchmark()
+{
+	constexpr size_t payload_size = 1460;
+	constexpr size_t payloads = 64;
+
+	std::mt19937 random(12345);
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	const std::string_view alphabet = " etaoinshrdluETAOIN/=:.\r\n";
+	std::vector<std::string> texts(payloads);
+
+	for (auto& text : texts)
+	{
+		text.resize(payload_size);
+		for (auto& c : text)
+			c = alphabet[random() % alphabet.size()];
+	}
+
+	std::cout << std::setw(10) << "patterns" << std::setw(16) << "strstr MB/s" << std::setw(16) << "matcher MB/s" <<
+		std::setw(16) << "nocase MB/s" << std::setw(10) << "speedup" << std::endl;
+
+	for (const size_t count : {10, 100, 1000})
+	{
+		std::vector<std::string> patterns(count);
 
-		// Handshake
-		if (position + 1 > length)
+		for (auto& pattern : patterns)
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
+			pattern.resize(6 + random() % 10);
+			for (auto& c : pattern)
+				c = static_cast<char>(letter(random));
 		}
 
-		if (data[position] != tls_handshake_type_client_hello)
+		const std::vector<std::string_view> views(patterns.begin(), patterns.end());
+		const tools::multi_pattern_matcher matcher(views, false);
+		const tools::multi_pattern_matcher matcher_nocase(views, true);
+
+		// runs the scan over the payloads until a quarter of a second has passed
+		const auto measure = [&texts](auto&& scan)
 		{
-			std::cout << "Not a client hello" << "\n";
-			return std::nullopt;
-		}
+			size_t bytes = 0;
+			volatile size_t matches = 0;
+			const auto start = std::chrono::steady_clock::now();
+			auto elapsed = 0.0;
 
-		// Skip past fixed length records:
-		//   1	Handshake Type
-		//   3	Length
-		//   2	Version (again)
-		//   32	Random
-		//   to	Session ID Length
+			do
+			{
+				for (const auto& text : texts)
+				{
+					matches = matches + scan(text);
+					bytes += text.size();
+				}
+
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			while (elapsed < 0.25);
 
-		position += 38;
+			return static_cast<double>(bytes) / elapsed / 1e6;
+		};
 
-		// Session ID
-		if (position + 1 > length)
+		const auto strstr_all = [&patterns](const std::string& text)
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
-		}
+			size_t matches = 0;
+
+			for (const auto& pattern : patterns)
+			{
+				for (auto* position = std::strstr(text.c_str(), pattern.c_str()); position != nullptr;
+				     position = std::strstr(position + 1, pattern.c_str()))
+					++matches;
+			}
 
-		len = static_cast<size_t>(data[position]);
-		position += 1 + len;
+			return matches;
+		};
 
-		// Cipher Suites
-		if (position + 2 > length)
+		const auto scan_all = [](const tools::multi_pattern_matcher& keywords)
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
-		}
+			return [&keywords](const std::string& text)
+			{
+				size_t matches = 0;
 
-		len = (static_cast<size_t>(data[position]) << 8) + static_cast<size_t>(data[position + 1]);
-		position += 2 + len;
+				keywords.scan(text.data(), text.size(), [&matches](uint32_t, uint64_t)
+				{
+					++matches;
+					return true;
+				});
 
-		// Compression Methods
-		if (position + 1 > length)
-		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
-		}
+				return matches;
+			};
+		};
 
-		len = static_cast<size_t>(data[position]);
-		position += 1 + len;
+		// both must report the same occurrences
+		size_t expected = 0;
+		size_t found = 0;
 
-		if (position == length && tls_version_major == 3 && tls_version_minor == 0)
+		for (const auto& text : texts)
 		{
-			std::cout << "Received SSL 3.0 handshake without extensions" << "\n";
-			return std::nullopt;
+			expected += strstr_all(text);
+			found += scan_all(matcher)(text);
 		}
 
-		// Extensions
-		if (position + 2 > length)
+		if (expected != found)
 		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
+			std::cout << "ERROR: " << found << " matches found, strstr finds " << expected << std::endl;
+			return 1;
 		}
 
-		len = (static_cast<size_t>(data[position]) << 8) + static_cast<size_t>(data[position + 1]);
-		position += 2;
+		const auto strstr_rate = measure(strstr_all);
+		const auto matcher_rate = measure(scan_all(matcher));
+		const auto nocase_rate = measure(scan_all(matcher_nocase));
 
-		if (position + len > length)
-		{
-			std::cout << "Invalid TLS client hello" << "\n";
-			return std::nullopt;
-		}
+		std::cout << std::setw(10) << count << std::fixed << std::setprecision(1)
+			<< std::setw(16) << strstr_rate << std::setw(16) << matcher_rate << std::setw(16) << nocase_rate
+			<< std::setw(9) << matcher_rate / strstr_rate << "x" << std::endl;
+	}
+
+	return 0;
+}
+
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Counts the failed checks of the self tests
+/// </summary>
+// --------------------------------------------------------------------------------
+struct test_results
+{
+	int failures{0};
 
-		return parse_extensions(data + position, len);
+	void check(const bool condition, const char* name)
+	{
+		std::cout << (condition ? "PASS " : "FAIL ") << name << std::endl;
+		failures += condition ? 0 : 1;
 	}
 };
 
-class http_parser
+// ********************************************************************************
+/// <summary>
+/// Checks the stream reassembler on the reordered, retransmitted, overlapping and
+/// out of window segments, and the ClientHello collector on the split and the
+/// truncated records
+/// </summary>
+/// <param name="results">test results</param>
+// ********************************************************************************
+void test_tcp_reassembler(test_results& results)
 {
-	static constexpr auto server_name_len = 256;
-	static constexpr auto http_request_min_len = 26;
+	tools::buffer_pool pool;
+	std::string stream;
 
-	static size_t next_header(const char** data, size_t* length)
+	// collects the delivered data, the skipped bytes are written as '?'
+	const auto collect = [&stream](const uint8_t* data, const uint32_t length)
 	{
-		// walk data stream until the end of the header
-		while (*length > 2 && (*data)[0] != '\r' && (*data)[1] != '\n')
-		{
-			(*length)--;
-			(*data)++;
-		}
+		if (data == nullptr)
+			stream.append(length, '?');
+		else
+			stream.append(reinterpret_cast<const char*>(data), length);
+	};
 
-		// advanced past the <CR><LF> pair
-		*data += 2;
-		*length -= 2;
+	const auto bytes = [](const char* text)
+	{
+		return reinterpret_cast<const uint8_t*>(text);
+	};
 
-		// Find the length of the next header
-		size_t header_length = 0;
-		while (*length > header_length + 1
-			&& (*data)[header_length] != '\r'
-			&& (*data)[header_length + 1] != '\n')
-		{
-			header_length++;
-		}
+	{
+		net::tcp_stream_reassembler reassembler(pool);
+
+		reassembler.segment(1000, nullptr, 0, true, false, collect);
+		reassembler.segment(1007, bytes("world"), 5, false, false, collect);
+		reassembler.segment(1001, bytes("hello "), 6, false, false, collect);
+		reassembler.segment(1012, bytes("!"), 1, false, false, collect);
+
+		results.check(stream == "hello world!" && reassembler.get_statistics().out_of_order_segments == 1 &&
+		              reassembler.buffered_bytes() == 0, "reassembler: reordered segments");
+
+		reassembler.segment(1001, bytes("hello "), 6, false, false, collect);
+		reassembler.segment(1010, bytes("ld!?"), 4, false, false, collect);
+
+		results.check(stream == "hello world!?" && reassembler.get_statistics().retransmitted_bytes == 9,
+		              "reassembler: retransmitted data is delivered once");
+	}
+
+	for (const auto policy : { net::tcp_overlap_policy::keep_first, net::tcp_overlap_policy::keep_last })
+	{
+		net::tcp_stream_reassembler reassembler(pool, {}, policy);
+		stream.clear();
+
+		reassembler.segment(0, bytes("ab"), 2, false, false, collect);
+		reassembler.segment(4, bytes("efgh"), 4, false, false, collect);
+		reassembler.segment(2, bytes("cdEFg"), 5, false, false, collect);
+
+		results.check(stream == (policy == net::tcp_overlap_policy::keep_first ? "abcdefgh" : "abcdEFgh") &&
+		              reassembler.get_statistics().overlapping_bytes == 3 &&
+		              reassembler.get_statistics().conflicting_bytes == 2,
+		              policy == net::tcp_overlap_policy::keep_first
+			              ? "reassembler: overlap keeps the first data"
+			              : "reassembler: overlap keeps the last data");
+	}
+
+	{
+		net::tcp_stream_reassembler reassembler(pool, {4096, 16, false, true});
+		stream.clear();
 
-		return header_length;
+		reassembler.segment(0, bytes("a"), 1, false, false, collect);
+		reassembler.segment(5000, bytes("0123456789"), 10, false, false, collect);
+
+		results.check(stream == "a" && reassembler.get_statistics().dropped_bytes == 10 &&
+		              reassembler.buffered_bytes() == 0, "reassembler: segment beyond the window is dropped");
 	}
 
-	static std::optional<std::string> get_header(const char* header, const char* data, size_t length)
 	{
-		size_t len;
+		net::tcp_stream_reassembler reassembler(pool, {4096, 2, true, true});
+		stream.clear();
+
+		reassembler.segment(0, bytes("a"), 1, false, false, collect);
+		reassembler.segment(2, bytes("c"), 1, false, false, collect);
+		reassembler.segment(4, bytes("e"), 1, false, false, collect);
+		reassembler.segment(6, bytes("g"), 1, false, false, collect);
+
+		results.check(stream == "a?c" && reassembler.get_statistics().skipped_bytes == 1,
+		              "reassembler: first hole is given up when the ranges cap is reached");
+
+		reassembler.flush(collect);
+
+		results.check(stream == "a?c?e?g" && reassembler.buffered_bytes() == 0, "reassembler: flush skips the holes");
+	}
+
+	{
+		net::tcp_stream_reassembler reassembler(pool, {4096, 16, true, false});
+		stream.clear();
+
+		reassembler.segment(0xfffffff8, bytes("cd"), 2, false, false, collect);
+
+		results.check(stream.empty() && !reassembler.is_initialized(), "reassembler: midstream data is ignored");
+
+		reassembler.segment(0xfffffffb, nullptr, 0, true, false, collect);
+		reassembler.segment(0x00000000, bytes("efgh"), 4, false, true, collect);
+		reassembler.segment(0xfffffffc, bytes("abcd"), 4, false, false, collect);
+
+		results.check(stream == "abcdefgh" && reassembler.is_finished(),
+		              "reassembler: sequence number wraparound and FIN");
+	}
+
+	results.check(pool.get_statistics().bytes_in_use == 0, "reassembler: windows are returned to the pool");
 
-		auto header_len = strlen(header);
+	// first TLS record: handshake, TLS 1.0 record version, 600 bytes of the body
+	std::vector<uint8_t> record(5 + 600);
+	record[0] = 0x16;
+	record[1] = 0x03;
+	record[2] = 0x01;
+	record[3] = 600 >> 8;
+	record[4] = 600 & 0xff;
 
-		// loop through headers stopping at first blank line
-		while ((len = next_header(&data, &length)) != 0)
+	for (size_t i = 5; i < record.size(); ++i)
+		record[i] = static_cast<uint8_t>(i);
+
+	iphdr ip_header{};
+	ip_header.ip_src.S_un.S_addr = htonl(0x0a000001);
+	ip_header.ip_dst.S_un.S_addr = htonl(0x0a000002);
+
+	tcphdr tcp_header{};
+	tcp_header.th_sport = htons(50000);
+	tcp_header.th_dport = htons(443);
+
+	// feeds the client to server segment to the collector
+	const auto send = [&ip_header, &tcp_header](client_hello_collector& collector, const uint32_t sequence,
+	                                            const uint8_t flags, const uint8_t* payload,
+	                                            const uint32_t payload_length)
+	{
+		tcp_header.th_seq = htonl(sequence);
+		tcp_header.th_flags = flags;
+
+		return collector.process(&ip_header, &tcp_header, payload, payload_length);
+	};
+
+	{
+		client_hello_collector collector;
+
+		send(collector, 1000, TH_SYN, nullptr, 0);
+		const auto second = send(collector, 1301, 0, record.data() + 300, 305);
+		const auto retransmitted = send(collector, 1301, 0, record.data() + 300, 305);
+		const auto first = send(collector, 1001, 0, record.data(), 300);
+
+		results.check(!second && !retransmitted && first && first->size() == record.size() &&
+		              std::memcmp(first->data(), record.data(), record.size()) == 0,
+		              "collector: reordered and retransmitted ClientHello");
+	}
+
+	{
+		client_hello_collector collector;
+
+		send(collector, 1000, TH_SYN, nullptr, 0);
+		const auto truncated = send(collector, 1001, TH_FIN, record.data(), 300);
+		const auto after_fin = send(collector, 1301, 0, record.data() + 300, 305);
+
+		results.check(!truncated && !after_fin, "collector: ClientHello truncated by FIN is not reported");
+	}
+
+	{
+		client_hello_collector collector;
+
+		const auto request = "GET / HTTP/1.1\r\n\r\n";
+		const auto http = send(collector, 1, 0, bytes(request), static_cast<uint32_t>(std::strlen(request)));
+
+		// the record length field claims more than the largest TLS record
+		auto oversized = record;
+		oversized[3] = 0xff;
+		oversized[4] = 0xff;
+
+		send(collector, 1000, TH_SYN, nullptr, 0);
+		auto result = send(collector, 1001, 0, oversized.data(), static_cast<uint32_t>(oversized.size()));
+
+		const std::vector<uint8_t> continuation(1000, 0);
+
+		for (uint32_t sequence = 1001 + static_cast<uint32_t>(oversized.size()); !result && sequence < 1001 + 20000;
+		     sequence += static_cast<uint32_t>(continuation.size()))
+			result = send(collector, sequence, 0, continuation.data(), static_cast<uint32_t>(continuation.size()));
+
+		results.check(!http && !result, "collector: non-TLS and oversized records are not reported");
+	}
+}
+
+// ********************************************************************************
+/// <summary>
+/// Builds the TLS record with the ClientHello of the FoxIO JA4 example (Chrome,
+/// TLS 1.3, GREASE values, SNI example.com, ALPN h2 and http/1.1)
+/// </summary>
+/// <returns>TLS record</returns>
+// ********************************************************************************
+std::vector<uint8_t> make_test_client_hello()
+{
+	std::vector<uint8_t> record;
+
+	const auto put8 = [&record](const uint32_t value) { record.push_back(static_cast<uint8_t>(value)); };
+	const auto put16 = [&put8](const uint32_t value)
+	{
+		put8(value >> 8);
+		put8(value);
+	};
+
+	// writes the 16 bit length prefixed block
+	const auto block16 = [&record, &put16](auto&& body)
+	{
+		const auto position = record.size();
+		put16(0);
+		body();
+		const auto length = record.size() - position - 2;
+		record[position] = static_cast<uint8_t>(length >> 8);
+		record[position + 1] = static_cast<uint8_t>(length);
+	};
+
+	const auto extension = [&put16, &block16](const uint32_t type, auto&& body)
+	{
+		put16(type);
+		block16(body);
+	};
+
+	const auto put_text = [&put8](const std::string_view text)
+	{
+		for (const auto c : text)
+			put8(static_cast<uint8_t>(c));
+	};
+
+	put8(0x16);
+	put16(0x0301);
+
+	block16([&]
+	{
+		// handshake type and 24 bit length, filled in below
+		put8(0x01);
+		const auto message = record.size();
+		put8(0);
+		put16(0);
+
+		put16(0x0303);
+
+		for (uint32_t i = 0; i < 32; ++i)
+			put8(i);
+
+		put8(32);
+
+		for (uint32_t i = 0; i < 32; ++i)
+			put8(0xe0 + i);
+
+		block16([&]
 		{
-			if (len > header_len && _strnicmp(header, data, header_len) == 0)
-			{
-				// skip leading whitespace
-				while (header_len < len && isblank(data[header_len]))
-					header_len++;
+			for (const auto suite : {
+				     0x1a1a, 0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c, 0xc030, 0xcca9, 0xcca8, 0xc013, 0xc014,
+				     0x009c, 0x009d, 0x002f, 0x0035
+			     })
+				put16(suite);
+		});
 
-				return std::string(data + header_len, len - header_len);
-			}
-		}
+		put8(1);
+		put8(0);
 
-		// if there is no data left after reading all the headers then we do not
-		// have a complete HTTP request, there must be a blank line
-		if (length == 0)
+		block16([&]
 		{
-			std::cout << "Incomplete HTTP request" << "\n";
-			return std::nullopt;
-		}
+			extension(0x2a2a, [] {});
+			extension(0, [&]
+			{
+				block16([&]
+				{
+					put8(0);
+					block16([&] { put_text("example.com"); });
+				});
+			});
+			extension(23, [] {});
+			extension(65281, [&] { put8(0); });
+			extension(10, [&]
+			{
+				block16([&]
+				{
+					for (const auto group : {0x4a4a, 29, 23, 24})
+						put16(group);
+				});
+			});
+			extension(11, [&]
+			{
+				put8(1);
+				put8(0);
+			});
+			extension(35, [] {});
+			extension(16, [&]
+			{
+				block16([&]
+				{
+					put8(2);
+					put_text("h2");
+					put8(8);
+					put_text("http/1.1");
+				});
+			});
+			extension(5, [&]
+			{
+				put8(1);
+				put16(0);
+				put16(0);
+			});
+			extension(13, [&]
+			{
+				block16([&]
+				{
+					for (const auto algorithm : {0x0403, 0x0804, 0x0401, 0x0503, 0x0805, 0x0501, 0x0806, 0x0601})
+						put16(algorithm);
+				});
+			});
+			extension(18, [] {});
+			extension(51, [&] { put16(0); });
+			extension(45, [&]
+			{
+				put8(1);
+				put8(1);
+			});
+			extension(43, [&]
+			{
+				put8(6);
+				put16(0x3a3a);
+				put16(0x0304);
+				put16(0x0303);
+			});
+			extension(27, [&]
+			{
+				put8(2);
+				put16(2);
+			});
+			extension(17513, [] {});
+			extension(0x3a3a, [&] { put8(0); });
+			extension(21, [&] { put16(0); });
+		});
+
+		const auto length = record.size() - message - 3;
+		record[message] = static_cast<uint8_t>(length >> 16);
+		record[message + 1] = static_cast<uint8_t>(length >> 8);
+		record[message + 2] = static_cast<uint8_t>(length);
+	});
+
+	return record;
+}
 
-		std::cout << "No Host header included in HTTP request" << "\n";
-		return std::nullopt;
+// ********************************************************************************
+/// <summary>
+/// Checks the ClientHello parser and the JA3/JA4 fingerprints on the known record,
+/// on all of its truncations, on the inconsistent length fields and on the randomly
+/// corrupted copies
+/// </summary>
+/// <param name="results">test results</param>
+// ********************************************************************************
+void test_client_hello(test_results& results)
+{
+	const auto record = make_test_client_hello();
+
+	net::tls_client_hello hello;
+
+	results.check(hello.parse(record.data(), record.size()) == net::tls_parse_result::success &&
+	              hello.server_name() == "example.com" && hello.first_alpn() == "h2" && hello.max_version() == 0x0304,
+	              "ClientHello: SNI, ALPN and version");
+	results.check(std::string_view(hello.ja3().data()) == "cd08e31494f9531f560d64c695473da9",
+	              "ClientHello: JA3 fingerprint");
+	results.check(std::string_view(hello.ja4().data()) == "t13d1516h2_8daaf6152771_e5627efa2ab1",
+	              "ClientHello: JA4 fingerprint");
+
+	auto truncated_result = true;
+
+	for (size_t length = 0; length < record.size(); ++length)
+	{
+		if (hello.parse(record.data(), length) != net::tls_parse_result::incomplete)
+			truncated_result = false;
 	}
 
-public:
-	// ********************************************************************************
-	/// <summary>
-	/// Parses a HTTP request for the Host: header
-	/// </summary>
-	/// <param name="data">HTTP payload pointer</param>
-	/// <param name="length">HTTP payload data size</param>
-	/// <returns>Optional string from the Host: header</returns>
-	// ********************************************************************************
-	static std::optional<std::string> parse_http_header(const char* data, const size_t length)
+	results.check(truncated_result, "ClientHello: every truncated record is incomplete");
+
+	// the handshake message claims more than the record carries
+	auto corrupted = record;
+	corrupted[7] = static_cast<uint8_t>(corrupted[7] + 1);
+
+	results.check(hello.parse(corrupted.data(), corrupted.size()) == net::tls_parse_result::incomplete,
+	              "ClientHello: handshake message longer than the record is incomplete");
+
+	corrupted = record;
+	corrupted[0] = 0x17;
+	auto not_handshake = hello.parse(corrupted.data(), corrupted.size()) == net::tls_parse_result::not_handshake;
+
+	// SSL 2.0 compatible hello
+	corrupted = record;
+	corrupted[0] = 0x80;
+	not_handshake = not_handshake && hello.parse(corrupted.data(), corrupted.size()) ==
+		net::tls_parse_result::not_handshake;
+
+	corrupted = record;
+	corrupted[5] = 0x02;
+
+	results.check(not_handshake && hello.parse(corrupted.data(), corrupted.size()) ==
+	              net::tls_parse_result::not_client_hello, "ClientHello: other records and handshake messages");
+
+	// record header, handshake header, legacy_version, random, session ID
+	constexpr size_t cipher_suites_offset = 5 + 4 + 2 + 32 + 1 + 32;
+	const auto extensions_offset = cipher_suites_offset + 2 + (record[cipher_suites_offset] << 8 | record[
+		cipher_suites_offset + 1]) + 2;
+
+	const auto is_malformed = [&hello](std::vector<uint8_t> data, const size_t offset)
 	{
-		if (length < http_request_min_len)
-			return std::nullopt;
+		data[offset + 1] = static_cast<uint8_t>(data[offset + 1] + 1);
+		return hello.parse(data.data(), data.size()) == net::tls_parse_result::malformed;
+	};
+
+	const std::string_view host = "example.com";
+	const auto name_offset = static_cast<size_t>(std::search(record.begin(), record.end(), host.begin(), host.end())
+		- record.begin()) - 2;
+
+	results.check(is_malformed(record, cipher_suites_offset) && is_malformed(record, extensions_offset) &&
+	              is_malformed(record, name_offset), "ClientHello: inconsistent length fields are malformed");
+
+	// the views of the successfully parsed corrupted records must stay inside the record
+	std::mt19937 random(12345);
+	auto views_inside = true;
 
-		auto host = get_header("Host:", data, length);
+	for (size_t i = 0; i < 20000; ++i)
+	{
+		corrupted = record;
 
-		if (!host.has_value())
-			return host;
+		for (size_t j = 0, changes = 1 + random() % 4; j < changes; ++j)
+			corrupted[random() % corrupted.size()] = static_cast<uint8_t>(random());
 
-		// Trim the port if it follows the hostname
+		if (hello.parse(corrupted.data(), corrupted.size()) != net::tls_parse_result::success)
+			continue;
 
-		for (auto i = host.value().size() - 1; i > 0; --i)
+		const auto inside = [&corrupted](const std::string_view view)
 		{
-			if (host.value()[i] == ':')
+			const auto* begin = reinterpret_cast<const char*>(corrupted.data());
+			return view.empty() || (view.data() >= begin && view.data() + view.size() <= begin + corrupted.size());
+		};
+
+		hello.for_each_alpn([&](const std::string_view protocol) { views_inside = views_inside && inside(protocol); });
+		views_inside = views_inside && inside(hello.server_name()) && inside(hello.session_id()) &&
+			std::strlen(hello.ja3().data()) == 32 && hello.ja4()[10] == '_';
+	}
+
+	results.check(views_inside, "ClientHello: corrupted records are parsed within the bounds");
+}
+
+// ********************************************************************************
+/// <summary>
+/// Checks the HTTP request head scanner on the complete head, on all of its
+/// truncations, on the non-HTTP and malformed input, on the header names which only
+/// match when the non-letters are case folded, and on the randomly corrupted copies
+/// </summary>
+/// <param name="results">test results</param>
+// ********************************************************************************
+void test_http_scanner(test_results& results)
+{
+	// the lines are longer than 32 bytes, so the vector paths of the scanner are used
+	const std::string request =
+		"GET /index.html?query=parameter&another=value HTTP/1.1\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml\r\n"
+		"uSeR-AgEnT:  Mozilla/5.0 (Windows NT 10.0; Win64; x64) \r\n"
+		"HOST: www.example.com:8080\r\n"
+		"X-Forwarded-For: 192.0.2.1\r\n"
+		"\r\n"
+		"body";
+
+	net::http_request_head head;
+	size_t headers = 0;
+
+	const auto result = net::http_request_scanner::scan(request.data(), request.size(), head,
+	                                                    [&headers](std::string_view, std::string_view)
+	                                                    {
+		                                                    ++headers;
+	                                                    });
+
+	results.check(result == net::http_scan_result::success && head.method == "GET" &&
+	              head.uri == "/index.html?query=parameter&another=value" && head.version == "HTTP/1.1" &&
+	              head.host == "www.example.com:8080" && head.user_agent ==
+	              "Mozilla/5.0 (Windows NT 10.0; Win64; x64)" && head.length == request.size() - 4 && headers == 4,
+	              "HTTP: request line and headers");
+	results.check(net::http_request_scanner::strip_port(head.host) == "www.example.com" &&
+	              net::http_request_scanner::strip_port("[::1]:80") == "[::1]" &&
+	              net::http_request_scanner::strip_port("[::1") == "[::1", "HTTP: port is stripped from the host");
+
+	auto truncated_result = true;
+
+	for (size_t length = 0; length < request.size() - 4; ++length)
+	{
+		if (net::http_request_scanner::scan(request.data(), length, head) != net::http_scan_result::incomplete)
+			truncated_result = false;
+	}
+
+	results.check(truncated_result, "HTTP: every truncated head is incomplete");
+
+	const auto scan = [&head](const std::string_view text)
+	{
+		return net::http_request_scanner::scan(text.data(), text.size(), head);
+	};
+
+	results.check(scan("GET / HTTP/1.0\nHost: a\n\n") == net::http_scan_result::success && head.host == "a",
+	              "HTTP: bare line feeds");
+	results.check(scan("\x16\x03\x01\x02") == net::http_scan_result::not_http &&
+	              scan("get / HTTP/1.1\r\n\r\n") == net::http_scan_result::not_http &&
+	              scan("GET / SSH-2.0\r\n\r\n") == net::http_scan_result::not_http &&
+	              scan("GET /\r\n\r\n") == net::http_scan_result::not_http, "HTTP: not a request line");
+	results.check(scan("GET / HTTP/1.1\r\nBad Header\r\n\r\n") == net::http_scan_result::malformed &&
+	              scan("GET / HTTP/1.1\r\n: value\r\n\r\n") == net::http_scan_result::malformed &&
+	              scan("GET / HTTP/1.1\r\nHost : a\r\n\r\n") == net::http_scan_result::malformed,
+	              "HTTP: header without the name or the colon");
+
+	// '\r' | 0x20 is '-' and '@' | 0x20 is '`', only the letters may be case folded
+	results.check(scan("GET / HTTP/1.1\r\nUser\rAgent: a\r\nHOST: b\r\n\r\n") == net::http_scan_result::success &&
+	              head.user_agent.empty() && head.host == "b" &&
+	              !net::http_request_scanner::equals_lowercase("USER\rAGENT", "user-agent") &&
+	              !net::http_request_scanner::equals_lowercase("@", "`") &&
+	              net::http_request_scanner::equals_lowercase("CONTENT-LENGTH", "content-length"),
+	              "HTTP: only letters are case folded in the header names");
+
+	// the vector search must agree with the byte loop at every alignment and length
+	auto find_result = true;
+
+	for (size_t offset = 0; offset < 32; ++offset)
+	{
+		for (size_t length = 0; offset + length <= request.size(); ++length)
+		{
+			const auto* begin = request.data() + offset;
+
+			for (const auto value : {'\n', ':', ' ', '#'})
 			{
-				host.value().erase(i);
-				break;
+				if (net::http_request_scanner::find_byte(begin, begin + length, value) !=
+					std::find(begin, begin + length, value))
+					find_result = false;
 			}
+		}
+	}
 
-			if (!isdigit(host.value()[i]))
-				break;
+	results.check(find_result, "HTTP: vector byte search matches the byte loop");
+
+	// the views of the corrupted and truncated copies must stay inside the data
+	std::mt19937 random(12345);
+	auto views_inside = true;
+
+	for (size_t i = 0; i < 100000; ++i)
+	{
+		auto corrupted = request;
+
+		for (size_t j = 0, changes = 1 + random() % 4; j < changes; ++j)
+			corrupted[random() % corrupted.size()] = static_cast<char>(random());
+
+		const auto length = random() % (corrupted.size() + 1);
+
+		net::http_request_scanner::scan(corrupted.data(), length, head);
+
+		for (const auto view : {head.method, head.uri, head.version, head.host, head.user_agent})
+		{
+			if (!view.empty() && (view.data() < corrupted.data() || view.data() + view.size() > corrupted.data() +
+				length))
+				views_inside = false;
 		}
 
-		return host;
+		if (head.length > length)
+			views_inside = false;
 	}
-};
 
-int main()
+	results.check(views_inside, "HTTP: corrupted heads are scanned within the bounds");
+}
+
+// ********************************************************************************
+/// <summary>
+/// Runs the self tests on the valid, malformed and truncated input
+/// </summary>
+/// <returns>process exit code: number of the failed checks</returns>
+// ********************************************************************************
+int run_tests()
+{
+	test_results results;
+
+	test_tcp_reassembler(results);
+	test_client_hello(results);
+	test_http_scanner(results);
+
+	std::cout << (results.failures == 0 ? "All tests passed" : "Some tests failed") << std::endl;
+
+	return results.failures;
+}
+
+int main(const int argc, char* argv[])
 {
+	if (argc > 1 && std::string_view(argv[1]) == "--benchmark")
+		return run_benchmark();
+
+	if (argc > 1 && std::string_view(argv[1]) == "--test")
+		return run_tests();
+
+	// optional keywords are matched against the SNI and HTTP host names ignoring the case
+	const std::vector<std::string_view> names(argv + 1, argv + argc);
+	const tools::multi_pattern_matcher keywords(names, true);
+
+	client_hello_collector client_hellos;
+
 	auto ndis_api = std::make_unique<ndisapi::fastio_packet_filter>(
 		nullptr,
-		[](HANDLE, INTERMEDIATE_BUFFER& buffer)
+		[&client_hellos, &keywords, &names](HANDLE, INTERMEDIATE_BUFFER& buffer)
 		{
 			if (auto* const ethernet_header = reinterpret_cast<ether_header_ptr>(buffer.m_IBuffer); ntohs(
 				ethernet_header->h_proto) == ETH_P_IP)
@@ -325,48 +983,56 @@ int main()
 				if (auto* const ip_header = reinterpret_cast<iphdr_ptr>(ethernet_header + 1); ip_header->ip_p ==
 					IPPROTO_TCP)
 				{
-					if (auto* const tcp_header = reinterpret_cast<tcphdr_ptr>(reinterpret_cast<PUCHAR>(ip_header) +
-						sizeof(DWORD) * ip_header->ip_hl); ntohs(tcp_header->th_dport) == 443)
-					{
-						auto* const payload = reinterpret_cast<unsigned char*>(tcp_header) + 4 * tcp_header->th_off;
-						const auto payload_length = buffer.m_Length - (sizeof(ether_header) + 4 * ip_header->ip_hl + 4 *
-							tcp_header->th_off);
+					auto* const tcp_header = reinterpret_cast<tcphdr_ptr>(reinterpret_cast<PUCHAR>(ip_header) +
+						sizeof(DWORD) * ip_header->ip_hl);
+					const auto tcp_payload = tcp_payload_length(buffer, *ip_header, *tcp_header);
+
+					if (!tcp_payload)
+						return ndisapi::fastio_packet_filter::packet_action::pass;
 
-						if ((payload[0] == 0x16) && (payload[5] == 0x1))
+					auto* const payload = reinterpret_cast<unsigned char*>(tcp_header) + 4 * tcp_header->th_off;
+					const auto payload_length = *tcp_payload;
+
+					if (ntohs(tcp_header->th_dport) == 443)
+					{
+						if (const auto record = client_hellos.process(ip_header, tcp_header, payload, payload_length);
+							record.has_value())
 						{
-							std::cout << net::ip_address_v4(ip_header->ip_src) << ":" << ntohs(tcp_header->th_sport) <<
-								" --> " <<
-								net::ip_address_v4(ip_header->ip_dst) << ":" << ntohs(tcp_header->th_dport) << " SNI: ";
+							if (net::tls_client_hello hello; hello.parse(record->data(), record->size()) ==
+								net::tls_parse_result::success)
+							{
+								const auto server_name = hello.server_name();
+								const auto alpn = hello.first_alpn();
 
-							std::cout << tls_parser::parse_tls_header(payload, payload_length).value_or("no SNI") <<
-								std::endl;
+								std::cout << net::ip_address_v4(ip_header->ip_src) << ":" << ntohs(tcp_header->th_sport) <<
+									" --> " <<
+									net::ip_address_v4(ip_header->ip_dst) << ":" << ntohs(tcp_header->th_dport) <<
+									" SNI: " << (server_name.empty() ? "no SNI" : server_name) <<
+									" ALPN: " << (alpn.empty() ? "none" : alpn) <<
+									" JA3: " << hello.ja3().data() << " JA4: " << hello.ja4().data() <<
+									keyword_note(keywords, names, server_name) << std::endl;
+							}
 						}
 					}
 					else if (ntohs(tcp_header->th_dport) == 80)
 					{
-						auto* const payload = reinterpret_cast<unsigned char*>(tcp_header) + 4 * tcp_header->th_off;
-
-						if (const auto payload_length = buffer.m_Length - (sizeof(ether_header) + 4 * ip_header->ip_hl +
-							4 * tcp_header->th_off); payload_length > 26)
+						if (net::http_request_head head; payload_length != 0 && net::http_request_scanner::scan(
+							reinterpret_cast<const char*>(payload), payload_length, head) != net::http_scan_result::not_http)
 						{
-							if (auto host = http_parser::parse_http_header(
-								reinterpret_cast<char*>(payload), payload_length); host.has_value())
+							std::cout << net::ip_address_v4(ip_header->ip_src) << ":" << ntohs(tcp_header->th_sport)
+								<< " --> " <<
+								net::ip_address_v4(ip_header->ip_dst) << ":" << ntohs(tcp_header->th_dport);
+
+							if (!head.host.empty())
 							{
-								std::cout << net::ip_address_v4(ip_header->ip_src) << ":" << ntohs(tcp_header->th_sport)
-									<< " --> " <<
-									net::ip_address_v4(ip_header->ip_dst) << ":" << ntohs(tcp_header->th_dport) <<
-									" Host: ";
+								const auto host = net::http_request_scanner::strip_port(head.host);
 
-								std::cout << host.value() << std::endl;
+								std::cout << " Host: " << host << " " << head.method << " " << head.uri <<
+									keyword_note(keywords, names, host) << std::endl;
 							}
 							else
 							{
-								std::cout << net::ip_address_v4(ip_header->ip_src) << ":" << ntohs(tcp_header->th_sport)
-									<< " --> " <<
-									net::ip_address_v4(ip_header->ip_dst) << ":" << ntohs(tcp_header->th_dport) <<
-									" length: ";
-
-								std::cout << payload_length << std::endl;
+								std::cout << " length: " << payload_length << std::endl;
 							}
 						}
 					}
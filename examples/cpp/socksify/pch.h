@@ -39,6 +39,8 @@
 #include <bitset>
 #include <optional>
 #include <charconv>
+#include <deque>
+#include <condition_variable>
 #include <gsl/gsl>
 
 #include "../../../include/common.h"
@@ -50,8 +52,12 @@
 #include "../common/net/mac_address.h"
 #include "../common/net/ip_address.h"
 #include "../common/net/ip_subnet.h"
+#include "../common/net/ipv6_helper.h"
+#include "../common/net/ip_prefix_table.h"
+#include "../common/net/packet_batch.h"
 #include "../common/net/ip_endpoint.h"
 #include "../common/log/log.h"
+#include "../common/tools/buffer_pool.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/simple_packet_filter.h"
@@ -60,6 +66,7 @@
 #include "../common/proxy/tcp_proxy_socket.h"
 #include "../common/proxy/socks5_common.h"
 #include "../common/proxy/socks5_tcp_proxy_socket.h"
+#include "../common/proxy/socks5_connection_pool.h"
 #include "../common/proxy/tcp_proxy_server.h"
 #include "../common/iphelper/process_lookup.h"
 
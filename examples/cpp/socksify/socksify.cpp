@@ -4,7 +4,620 @@
 #include "pch.h"
 #include <iostream>
 
-int main()
+// --------------------------------------------------------------------------------
+/// <summary>
+/// Loopback stand-in for the SOCKS5 server used by the test mode. Supports NO
+/// AUTHENTICATION REQUIRED and USERNAME/PASSWORD methods and the CONNECT command for
+/// IPv4 addresses. After the CONNECT reply it echoes the received data back.
+/// </summary>
+// --------------------------------------------------------------------------------
+class socks5_test_server
+{
+public:
+	// --------------------------------------------------------------------------------
+	/// <summary>
+	/// Stand-in server behaviour
+	/// </summary>
+	// --------------------------------------------------------------------------------
+	struct options
+	{
+		/// <summary>required USERNAME/PASSWORD, NO AUTHENTICATION REQUIRED if not set</summary>
+		std::optional<std::pair<std::string, std::string>> credentials;
+		/// <summary>send every reply byte in a separate segment</summary>
+		bool fragment_replies{false};
+	};
+
+private:
+	options options_;
+	SOCKET listen_socket_{INVALID_SOCKET};
+	uint16_t port_{0};
+	std::thread accept_thread_;
+	std::atomic_bool end_server_{false};
+
+	std::mutex lock_;
+	/// <summary>accepted connections, closed by close_connections only</summary>
+	std::vector<SOCKET> connections_;
+	std::vector<std::thread> connection_threads_;
+
+	/// <summary>length of the first segment received on the last accepted connection</summary>
+	std::atomic<size_t> first_segment_length_{0};
+	/// <summary>number of accepted CONNECT requests</summary>
+	std::atomic<uint32_t> connects_{0};
+
+public:
+	explicit socks5_test_server(options options)
+		: options_(std::move(options))
+	{
+	}
+
+	~socks5_test_server()
+	{
+		stop();
+	}
+
+	socks5_test_server(const socks5_test_server& other) = delete;
+	socks5_test_server(socks5_test_server&& other) noexcept = delete;
+	socks5_test_server& operator=(const socks5_test_server& other) = delete;
+	socks5_test_server& operator=(socks5_test_server&& other) noexcept = delete;
+
+	[[nodiscard]] uint16_t port() const
+	{
+		return port_;
+	}
+
+	[[nodiscard]] size_t first_segment_length() const
+	{
+		return first_segment_length_;
+	}
+
+	[[nodiscard]] uint32_t connects() const
+	{
+		return connects_;
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Listens on the ephemeral loopback port and starts accepting connections
+	/// </summary>
+	/// <returns>true if started</returns>
+	// ********************************************************************************
+	bool start()
+	{
+		listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+		if (listen_socket_ == INVALID_SOCKET)
+			return false;
+
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int address_length = sizeof(address);
+
+		if (bind(listen_socket_, reinterpret_cast<sockaddr*>(&address), address_length) == SOCKET_ERROR ||
+			listen(listen_socket_, SOMAXCONN) == SOCKET_ERROR ||
+			getsockname(listen_socket_, reinterpret_cast<sockaddr*>(&address), &address_length) == SOCKET_ERROR)
+		{
+			closesocket(listen_socket_);
+			listen_socket_ = INVALID_SOCKET;
+			return false;
+		}
+
+		port_ = ntohs(address.sin_port);
+
+		accept_thread_ = std::thread(&socks5_test_server::accept_thread, this);
+
+		return true;
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Stops accepting, closes all connections and waits for their threads
+	/// </summary>
+	// ********************************************************************************
+	void stop()
+	{
+		if (end_server_.exchange(true) || listen_socket_ == INVALID_SOCKET)
+			return;
+
+		closesocket(listen_socket_);
+
+		if (accept_thread_.joinable())
+			accept_thread_.join();
+
+		close_connections();
+
+		for (auto& connection_thread : connection_threads_)
+			connection_thread.join();
+
+		connection_threads_.clear();
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Closes all accepted connections, e.g. the idle ones kept by the connection pool
+	/// </summary>
+	// ********************************************************************************
+	void close_connections()
+	{
+		std::lock_guard lock(lock_);
+
+		for (const auto connection : connections_)
+			closesocket(connection);
+
+		connections_.clear();
+	}
+
+private:
+	void accept_thread()
+	{
+		while (end_server_ == false)
+		{
+			const auto connection = accept(listen_socket_, nullptr, nullptr);
+
+			if (connection == INVALID_SOCKET)
+				continue;
+
+			BOOL no_delay = TRUE;
+			setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay),
+			           sizeof(no_delay));
+
+			std::lock_guard lock(lock_);
+			connections_.push_back(connection);
+			connection_threads_.emplace_back(&socks5_test_server::serve, this, connection);
+		}
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Sends the reply, one byte per segment if fragment_replies is set
+	/// </summary>
+	// ********************************************************************************
+	[[nodiscard]] bool reply(const SOCKET connection, const unsigned char* data, const int length) const
+	{
+		using namespace std::chrono_literals;
+
+		const auto step = options_.fragment_replies ? 1 : length;
+
+		for (auto sent = 0; sent < length; sent += step)
+		{
+			if (send(connection, reinterpret_cast<const char*>(data) + sent, step, 0) != step)
+				return false;
+
+			if (options_.fragment_replies)
+				std::this_thread::sleep_for(20ms);
+		}
+
+		return true;
+	}
+
+	// ********************************************************************************
+	/// <summary>
+	/// Serves one SOCKS5 client. The connection is shut down for sending on failure, the
+	/// socket itself is closed by close_connections.
+	/// </summary>
+	// ********************************************************************************
+	void serve(const SOCKET connection)
+	{
+		std::string buffer;
+		size_t offset = 0;
+
+		// returns the next length bytes of the client stream or nullopt if the connection is closed
+		const auto read = [this, connection, &buffer, &offset](const size_t length) -> std::optional<std::string>
+		{
+			while (buffer.size() - offset < length)
+			{
+				char segment[1024];
+				const auto received = recv(connection, segment, sizeof(segment), 0);
+
+				if (received <= 0)
+					return std::nullopt;
+
+				if (buffer.empty())
+					first_segment_length_ = received;
+
+				buffer.append(segment, received);
+			}
+
+			offset += length;
+			return buffer.substr(offset - length, length);
+		};
+
+		const auto negotiate = [this, connection, &read]
+		{
+			// RFC 1928: VER | NMETHODS | METHODS
+			const auto greeting = read(2);
+
+			if (!greeting || (*greeting)[0] != proxy::socks5_protocol_version)
+				return false;
+
+			const auto methods = read(static_cast<unsigned char>((*greeting)[1]));
+
+			if (!methods)
+				return false;
+
+			const unsigned char method = options_.credentials ? 0x2 : 0x0;
+			const auto offered = methods->find(static_cast<char>(method)) != std::string::npos;
+			const unsigned char method_reply[] = {
+				proxy::socks5_protocol_version, offered ? method : static_cast<unsigned char>(0xFF)
+			};
+
+			if (!reply(connection, method_reply, sizeof(method_reply)) || !offered)
+				return false;
+
+			if (options_.credentials)
+			{
+				// RFC 1929: VER | ULEN | UNAME | PLEN | PASSWD
+				const auto header = read(2);
+
+				if (!header || (*header)[0] != proxy::socks5_username_auth_version)
+					return false;
+
+				const auto username = read(static_cast<unsigned char>((*header)[1]));
+				const auto password_length = username ? read(1) : std::nullopt;
+				const auto password = password_length
+					                      ? read(static_cast<unsigned char>((*password_length)[0]))
+					                      : std::nullopt;
+
+				if (!password)
+					return false;
+
+				const unsigned char status = *username == options_.credentials->first &&
+				                             *password == options_.credentials->second
+					                             ? 0
+					                             : 1;
+				const unsigned char auth_reply[] = {proxy::socks5_username_auth_version, status};
+
+				if (!reply(connection, auth_reply, sizeof(auth_reply)) || status != 0)
+					return false;
+			}
+
+			// VER | CMD | RSV | ATYP | DST.ADDR | DST.PORT, only CONNECT to IPv4 address is supported
+			const auto request = read(10);
+
+			if (!request || (*request)[0] != proxy::socks5_protocol_version || (*request)[1] != 1 ||
+				(*request)[3] != 1)
+				return false;
+
+			constexpr unsigned char connect_reply[10] = {proxy::socks5_protocol_version, 0, 0, 1};
+
+			if (!reply(connection, connect_reply, sizeof(connect_reply)))
+				return false;
+
+			++connects_;
+			return true;
+		};
+
+		if (negotiate())
+		{
+			// data sent right after the CONNECT request is already in the buffer
+			auto echo = offset == buffer.size() || send(connection, buffer.data() + offset,
+			                                            static_cast<int>(buffer.size() - offset), 0) ==
+				static_cast<int>(buffer.size() - offset);
+
+			char segment[4096];
+
+			for (auto received = 0; echo && (received = recv(connection, segment, sizeof(segment), 0)) > 0;)
+				echo = send(connection, segment, received, 0) == received;
+		}
+
+		shutdown(connection, SD_SEND);
+	}
+};
+
+// ********************************************************************************
+/// <summary>
+/// Connects to the loopback port, sends the payload and waits until it is echoed back
+/// </summary>
+/// <param name="port">loopback port to connect</param>
+/// <param name="payload">data to send</param>
+/// <returns>true if the payload was echoed back within 5 seconds</returns>
+// ********************************************************************************
+bool echo_through(const uint16_t port, const std::string& payload)
+{
+	const auto client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (client == INVALID_SOCKET)
+		return false;
+
+	DWORD timeout = 5000;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+
+	auto success = connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != SOCKET_ERROR &&
+		send(client, payload.data(), static_cast<int>(payload.size()), 0) == static_cast<int>(payload.size());
+
+	std::string echo(payload.size(), '\0');
+
+	for (size_t received = 0; success && received < echo.size();)
+	{
+		const auto result = recv(client, echo.data() + received, static_cast<int>(echo.size() - received), 0);
+
+		success = result > 0;
+		received += success ? result : 0;
+	}
+
+	closesocket(client);
+
+	return success && echo == payload;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Runs the SOCKS5 negotiation of socks5_tcp_proxy_socket and socks5_connection_pool
+/// against the loopback stand-in SOCKS5 server: pipelined request, fragmented replies,
+/// authentication failure and pooled connections closed by the server.
+/// </summary>
+/// <returns>process exit code, number of failed checks</returns>
+// ********************************************************************************
+int run_tests()
+{
+	using namespace std::chrono_literals;
+	using proxy_server_t = proxy::tcp_proxy_server<proxy::socks5_tcp_proxy_socket<net::ip_address_v4>>;
+	using negotiate_context_t = proxy::socks5_tcp_proxy_socket<net::ip_address_v4>::negotiate_context_t;
+
+	const net::ip_address_v4 loopback{std::string("127.0.0.1")};
+	const std::string username = "user";
+	const std::string password = "secret";
+	const std::string payload = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+
+	auto failures = 0;
+
+	const auto check = [&failures](const bool condition, const char* name)
+	{
+		std::cout << (condition ? "PASS " : "FAIL ") << name << std::endl;
+		failures += condition ? 0 : 1;
+	};
+
+	winsys::io_completion_port io_port;
+
+	io_port.start_thread_pool();
+
+	// relays the payload through tcp_proxy_server and the stand-in SOCKS5 server
+	const auto relay = [&](const socks5_test_server& server, const std::optional<std::string>& user,
+	                       const std::optional<std::string>& secret, const bool pipelining,
+	                       proxy::socks5_connection_pool<net::ip_address_v4>* pool = nullptr)
+	{
+		proxy_server_t proxy(
+			0, io_port,
+			[&](net::ip_address_v4, uint16_t)-> std::tuple<net::ip_address_v4, uint16_t, std::unique_ptr<
+				                                  proxy_server_t::negotiate_context_t>>
+			{
+				// the destination is never connected, the stand-in server only echoes
+				auto negotiate_ctx = std::make_unique<negotiate_context_t>(
+					net::ip_address_v4{std::string("192.0.2.1")}, 80, user, secret);
+				negotiate_ctx->socks5_pipelining = pipelining;
+
+				return std::make_tuple(loopback, server.port(), std::move(negotiate_ctx));
+			}, nullptr, netlib::log::log_level::error);
+
+		if (pool)
+		{
+			proxy.set_connected_socket_provider(
+				[pool](const net::ip_address_v4& address, const uint16_t port, negotiate_context_t& negotiate_ctx)
+				{
+					return pool->acquire(address, port, negotiate_ctx);
+				},
+				[pool](const SOCKET socket)
+				{
+					pool->release(socket);
+				});
+		}
+
+		if (!proxy.start())
+			return false;
+
+		const auto result = echo_through(proxy.proxy_port(), payload);
+
+		proxy.stop();
+
+		return result;
+	};
+
+	// waits up to 5 seconds for the pool to have the given number of connections ready
+	const auto wait_for_pool = [](const proxy::socks5_connection_pool<net::ip_address_v4>& pool,
+	                              const uint64_t available)
+	{
+		for (auto i = 0; i < 50 && pool.get_statistics().available < available; ++i)
+			std::this_thread::sleep_for(100ms);
+
+		return pool.get_statistics().available >= available;
+	};
+
+	{
+		socks5_test_server server({std::make_pair(username, password), false});
+		server.start();
+
+		check(relay(server, username, password, true), "pipelined negotiation relays data");
+		// VER NMETHODS METHOD | VER ULEN UNAME PLEN PASSWD | VER CMD RSV ATYP DST.ADDR DST.PORT
+		check(server.first_segment_length() == 3 + 3 + username.size() + password.size() + 10,
+		      "pipelined greeting, authentication and CONNECT arrive in one write");
+		check(relay(server, username, password, false), "step by step negotiation relays data");
+		check(!relay(server, username, "wrong", false), "authentication failure closes the client");
+		check(!relay(server, username, "wrong", true), "pipelined authentication failure closes the client");
+	}
+
+	{
+		socks5_test_server server({std::make_pair(username, password), true});
+		server.start();
+
+		check(relay(server, username, password, false), "step by step negotiation with fragmented replies");
+		check(relay(server, username, password, true), "pipelined negotiation with fragmented replies");
+	}
+
+	{
+		socks5_test_server server({std::nullopt, true});
+		server.start();
+
+		check(relay(server, std::nullopt, std::nullopt, false), "no authentication with fragmented replies");
+	}
+
+	{
+		socks5_test_server server({std::make_pair(username, password), true});
+		server.start();
+
+		proxy::socks5_connection_pool<net::ip_address_v4> rejected_pool(
+			loopback, server.port(), username, "wrong", 2, nullptr, netlib::log::log_level::error);
+		rejected_pool.start();
+		std::this_thread::sleep_for(500ms);
+		rejected_pool.stop();
+
+		const auto rejected = rejected_pool.get_statistics();
+		check(rejected.created == 0 && rejected.failed != 0, "pool does not keep connections failed to authenticate");
+
+		proxy::socks5_connection_pool<net::ip_address_v4> pool(
+			loopback, server.port(), username, password, 2, nullptr, netlib::log::log_level::error);
+		pool.start();
+
+		check(wait_for_pool(pool, 2), "pool authenticates with fragmented replies");
+		check(relay(server, username, password, false, &pool) && pool.get_statistics().hits == 1,
+		      "pooled connection relays data after the CONNECT request only");
+
+		check(wait_for_pool(pool, 2), "pool is refilled after checkout");
+		server.close_connections();
+		std::this_thread::sleep_for(100ms);
+
+		// both pooled connections are closed by the server, either acquire or the refill thread drops them
+		check(relay(server, username, password, false, &pool) && pool.get_statistics().expired == 2,
+		      "pool discards connections closed by the server");
+
+		const auto hits = pool.get_statistics().hits;
+
+		check(wait_for_pool(pool, 1) && relay(server, username, password, false, &pool) &&
+		      pool.get_statistics().hits == hits + 1, "pool serves new connections after the server closed idle ones");
+
+		pool.stop();
+	}
+
+	io_port.stop_thread_pool();
+
+	std::cout << (failures ? std::to_string(failures) + " check(s) failed" : "All checks passed") << std::endl;
+
+	return failures;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Measures how fast tcp_proxy_server relays many simultaneous connections through the
+/// stand-in SOCKS5 server. All clients connect before any of them is served, so the
+/// pending accepts and SOCKS5 server connects go well past the 64 handles a
+/// WaitForMultipleObjects based server could wait for.
+/// </summary>
+/// <returns>process exit code</returns>
+// ********************************************************************************
+int run_benchmark()
+{
+	using clock_t = std::chrono::steady_clock;
+	using proxy_server_t = proxy::tcp_proxy_server<proxy::socks5_tcp_proxy_socket<net::ip_address_v4>>;
+	using negotiate_context_t = proxy::socks5_tcp_proxy_socket<net::ip_address_v4>::negotiate_context_t;
+
+	const net::ip_address_v4 loopback{std::string("127.0.0.1")};
+	const std::string payload = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+
+	socks5_test_server server({std::nullopt, false});
+
+	if (!server.start())
+	{
+		std::cout << "Failed to start the stand-in SOCKS5 server" << std::endl;
+		return 1;
+	}
+
+	winsys::io_completion_port io_port;
+
+	io_port.start_thread_pool();
+
+	proxy_server_t proxy(
+		0, io_port,
+		[&loopback, &server](net::ip_address_v4, uint16_t)-> std::tuple<net::ip_address_v4, uint16_t, std::unique_ptr<
+			                                                     proxy_server_t::negotiate_context_t>>
+		{
+			auto negotiate_ctx = std::make_unique<negotiate_context_t>(
+				net::ip_address_v4{std::string("192.0.2.1")}, 80, std::nullopt, std::nullopt);
+			negotiate_ctx->socks5_pipelining = true;
+
+			return std::make_tuple(loopback, server.port(), std::move(negotiate_ctx));
+		}, nullptr, netlib::log::log_level::error);
+
+	if (!proxy.start())
+	{
+		std::cout << "Failed to start the proxy" << std::endl;
+		return 1;
+	}
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(proxy.proxy_port());
+
+	for (const size_t connections : {64, 256, 1024})
+	{
+		std::vector<SOCKET> clients;
+		clients.reserve(connections);
+
+		const auto started = clock_t::now();
+
+		// all clients connect and send the request first, then the responses are collected
+		for (size_t i = 0; i < connections; ++i)
+		{
+			const auto client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+			if (client == INVALID_SOCKET)
+				break;
+
+			DWORD timeout = 10000;
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+			clients.push_back(client);
+
+			if (connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+				send(client, payload.data(), static_cast<int>(payload.size()), 0) != static_cast<int>(payload.size()))
+				break;
+		}
+
+		size_t relayed = 0;
+		std::string echo(payload.size(), '\0');
+
+		for (const auto client : clients)
+		{
+			auto received = 0;
+
+			while (received < static_cast<int>(echo.size()))
+			{
+				const auto result = recv(client, echo.data() + received, static_cast<int>(echo.size()) - received, 0);
+
+				if (result <= 0)
+					break;
+
+				received += result;
+			}
+
+			relayed += received == static_cast<int>(echo.size()) && echo == payload ? 1 : 0;
+		}
+
+		const auto elapsed = std::chrono::duration<double>(clock_t::now() - started).count();
+
+		for (const auto client : clients)
+			closesocket(client);
+
+		std::cout << std::setw(5) << connections << " simultaneous connections: " << relayed << " relayed in " <<
+			std::fixed << std::setprecision(1) << elapsed * 1000 << " ms, " << std::setprecision(0) << relayed /
+			elapsed << " connections/s" << std::endl;
+
+		// the proxy sockets of the closed clients are released by the proxy in the background
+		server.close_connections();
+	}
+
+	proxy.stop();
+	server.stop();
+	io_port.stop_thread_pool();
+
+	return 0;
+}
+
+int main(const int argc, char* argv[])
 {
 	try
 	{
@@ -15,6 +628,8 @@ int main()
 		net::ip_address_v4 socks5_server_address;
 		std::string socks5_username;
 		std::string socks5_password;
+		size_t socks5_pool_size = 0;
+		std::string socks5_pipelining_str;
 		std::unordered_map<unsigned short, std::pair<net::ip_address_v4, unsigned short>> mapper;
 		std::mutex mapper_lock;
 
@@ -26,6 +641,13 @@ int main()
 			return 1;
 		}
 
+		if (argc > 1 && (std::string(argv[1]) == "test" || std::string(argv[1]) == "benchmark"))
+		{
+			const auto result = std::string(argv[1]) == "test" ? run_tests() : run_benchmark();
+			WSACleanup();
+			return result;
+		}
+
 		auto ndis_api = std::make_unique<ndisapi::simple_packet_filter>(
 			nullptr,
 			[&app_name_w, &local_proxy_port, &mapper, &mapper_lock](HANDLE adapter_handle, INTERMEDIATE_BUFFER& buffer)
@@ -152,6 +774,19 @@ int main()
 			username_auth = false;
 		}
 
+		std::cout << std::endl << "Number of pre-authenticated SOCKS5 connections to keep ready (0 to disable): ";
+		std::cin >> socks5_pool_size;
+
+		std::cout << std::endl << "Pipeline SOCKS5 negotiation requests (y/n): ";
+		std::cin >> socks5_pipelining_str;
+		const auto socks5_pipelining = !socks5_pipelining_str.empty() && std::tolower(socks5_pipelining_str[0]) == 'y';
+
+		proxy::socks5_connection_pool<net::ip_address_v4> socks5_pool(
+			socks5_server_address, socks5_server_port,
+			username_auth ? std::optional(socks5_username) : std::nullopt,
+			username_auth ? std::optional(socks5_password) : std::nullopt,
+			socks5_pool_size, nullptr, netlib::log::log_level::error);
+
 		winsys::io_completion_port io_port;
 
 		io_port.start_thread_pool();
@@ -159,7 +794,7 @@ int main()
 		proxy::tcp_proxy_server<proxy::socks5_tcp_proxy_socket<net::ip_address_v4>> proxy(
 			local_proxy_port, io_port,
 			[&socks5_server_address, &socks5_server_port, &socks5_username, &socks5_password, &mapper, &mapper_lock,
-				username_auth](
+				username_auth, socks5_pipelining](
 			net::ip_address_v4 address,
 			const uint16_t port)-> std::tuple<net::ip_address_v4, uint16_t, std::unique_ptr<proxy::tcp_proxy_server<
 				                                  proxy::
@@ -177,17 +812,33 @@ int main()
 
 					mapper.erase(it);
 
-					return std::make_tuple(socks5_server_address, socks5_server_port,
-					                       std::make_unique<proxy::socks5_tcp_proxy_socket<
-						                       net::ip_address_v4>::negotiate_context_t>(
-						                       remote_address, remote_port,
-						                       username_auth ? std::optional(socks5_username) : std::nullopt,
-						                       username_auth ? std::optional(socks5_password) : std::nullopt));
+					auto negotiate_ctx = std::make_unique<proxy::socks5_tcp_proxy_socket<
+						net::ip_address_v4>::negotiate_context_t>(
+						remote_address, remote_port,
+						username_auth ? std::optional(socks5_username) : std::nullopt,
+						username_auth ? std::optional(socks5_password) : std::nullopt);
+					negotiate_ctx->socks5_pipelining = socks5_pipelining;
+
+					return std::make_tuple(socks5_server_address, socks5_server_port, std::move(negotiate_ctx));
 				}
 
 				return std::make_tuple(net::ip_address_v4{}, 0, nullptr);
 			}, nullptr, netlib::log::log_level::error);
 
+		if (socks5_pool.start())
+		{
+			proxy.set_connected_socket_provider(
+				[&socks5_pool](const net::ip_address_v4& address, const uint16_t port,
+				               proxy::socks5_negotiate_context<net::ip_address_v4>& negotiate_ctx)
+				{
+					return socks5_pool.acquire(address, port, negotiate_ctx);
+				},
+				[&socks5_pool](const SOCKET socket)
+				{
+					socks5_pool.release(socket);
+				});
+		}
+
 		ndis_api->start_filter(index - 1);
 
 		proxy.start();
@@ -196,8 +847,29 @@ int main()
 
 		std::ignore = _getch();
 
+		if (socks5_pool_size != 0)
+		{
+			const auto [hits, misses, created, failed, expired, available] = socks5_pool.get_statistics();
+
+			std::cout << "SOCKS5 connection pool hits: " << hits << ", misses: " << misses << ", created: " << created <<
+				", failed: " << failed << ", expired: " << expired << ", available: " << available << std::endl;
+		}
+
+		// the proxy waits for its AcceptEx/ConnectEx completions, so it is stopped while the
+		// completion port threads are still running
+		proxy.stop();
+
+		socks5_pool.stop();
+
 		io_port.stop_thread_pool();
 
+		const auto [allocations, reuses, trims, failures, bytes_in_use, peak_bytes_in_use, bytes_cached] =
+			proxy::relay_buffer_pool().get_statistics();
+
+		std::cout << "Relay buffers allocated: " << allocations << ", reused: " << reuses << ", trimmed: " << trims <<
+			", failed: " << failures << ", bytes in use: " << bytes_in_use << " (peak " << peak_bytes_in_use <<
+			"), bytes cached: " << bytes_cached << std::endl;
+
 		WSACleanup();
 
 		std::cout << "Exiting..." << std::endl;
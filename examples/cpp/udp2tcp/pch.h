@@ -40,6 +40,7 @@
 #include <algorithm>
 #include <fstream>
 #include <charconv>
+#include <random>
 #include <gsl/gsl>
 
 #include "../../../include/common.h"
@@ -52,6 +53,9 @@
 #include "../common/pcap/pcap.h"
 #include "../common/pcap/pcap_file_storage.h"
 #include "../common/net/ip_subnet.h"
+#include "../common/net/ipv6_helper.h"
+#include "../common/net/ip_prefix_table.h"
+#include "../common/net/packet_batch.h"
 #include "../common/iphelper/network_adapter_info.h"
 #include "../common/ndisapi/network_adapter.h"
 #include "../common/ndisapi/simple_packet_filter.h"
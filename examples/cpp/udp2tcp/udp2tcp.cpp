@@ -84,11 +84,492 @@ bool load_filters(const CNdisApi& api, const bool is_server, const uint16_t port
 	return api.SetPacketFilterTable(filter_table);
 }
 
-int main()
+// ********************************************************************************
+/// <summary>
+/// Builds the random prefix list: IPv4 prefixes are /8 to /32, IPv6 prefixes are /16
+/// to /64 within 2000::/8, the value of the prefix is its index in the list
+/// </summary>
+/// <param name="count">number of prefixes</param>
+/// <param name="random">random number generator</param>
+/// <returns>prefix list</returns>
+// ********************************************************************************
+template <typename T>
+typename net::ip_prefix_table<T>::prefix_list_t make_random_prefixes(const size_t count, std::mt19937& random)
 {
+	constexpr auto is_v4 = sizeof(T) == 4;
+	std::uniform_int_distribution<uint32_t> length_distribution(is_v4 ? 8 : 16, is_v4 ? 32 : 64);
+
+	typename net::ip_prefix_table<T>::prefix_list_t prefixes;
+	prefixes.reserve(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		T address{};
+		T mask{};
+		auto* address_bytes = reinterpret_cast<uint8_t*>(&address);
+		auto* mask_bytes = reinterpret_cast<uint8_t*>(&mask);
+		const auto length = length_distribution(random);
+
+		for (uint32_t bit = 0; bit < length; ++bit)
+			mask_bytes[bit / 8] |= static_cast<uint8_t>(0x80 >> (bit % 8));
+
+		for (size_t j = 0; j < sizeof(T); ++j)
+			address_bytes[j] = static_cast<uint8_t>(random()) & mask_bytes[j];
+
+		if constexpr (!is_v4)
+			address_bytes[0] = 0x20;
+
+		prefixes.emplace_back(net::ip_subnet<T>(address, mask), static_cast<uint32_t>(i));
+	}
+
+	return prefixes;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Looks up the random addresses (half of them inside one of the prefixes) with the
+/// linear ip_subnet::address_in_subnet scan and with the ip_prefix_table snapshot,
+/// prints the time per lookup and counts the addresses where the results differ
+/// </summary>
+/// <param name="prefixes_count">number of prefixes</param>
+/// <param name="random">random number generator</param>
+/// <returns>number of mismatched lookups</returns>
+// ********************************************************************************
+template <typename T>
+size_t measure_prefix_lookup(const size_t prefixes_count, std::mt19937& random)
+{
+	constexpr size_t addresses_count = 4096;
+	constexpr size_t table_rounds = 64;
+
+	const auto prefixes = make_random_prefixes<T>(prefixes_count, random);
+
+	std::vector<T> addresses(addresses_count);
+
+	for (size_t i = 0; i < addresses_count; ++i)
+	{
+		auto* bytes = reinterpret_cast<uint8_t*>(&addresses[i]);
+
+		for (size_t j = 0; j < sizeof(T); ++j)
+			bytes[j] = static_cast<uint8_t>(random());
+
+		if (i % 2 == 0)
+		{
+			// host bits of the random prefix, so the address matches at least this prefix
+			const auto& subnet = prefixes[random() % prefixes.size()].first;
+			const auto* address_bytes = reinterpret_cast<const uint8_t*>(&subnet.address);
+			const auto* mask_bytes = reinterpret_cast<const uint8_t*>(&subnet.mask);
+
+			for (size_t j = 0; j < sizeof(T); ++j)
+				bytes[j] = static_cast<uint8_t>((address_bytes[j] & mask_bytes[j]) | (bytes[j] & ~mask_bytes[j]));
+		}
+	}
+
+	// linear scan: every subnet is checked, the longest match wins (the last one for the same length)
+	std::vector<uint8_t> prefix_lengths;
+	prefix_lengths.reserve(prefixes.size());
+
+	for (const auto& [subnet, value] : prefixes)
+		prefix_lengths.push_back(subnet.get_prefix());
+
+	std::vector<std::optional<uint32_t>> linear_results(addresses_count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < addresses_count; ++i)
+	{
+		int longest = -1;
+
+		for (size_t j = 0; j < prefixes.size(); ++j)
+		{
+			if (prefix_lengths[j] >= longest && prefixes[j].first.address_in_subnet(addresses[i]))
+			{
+				longest = prefix_lengths[j];
+				linear_results[i] = prefixes[j].second;
+			}
+		}
+	}
+
+	const auto linear_elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	const net::ip_prefix_table<T> table(prefixes);
+	const auto snapshot = table.get_snapshot();
+
+	size_t found = 0;
+	start = std::chrono::steady_clock::now();
+
+	for (size_t round = 0; round < table_rounds; ++round)
+	{
+		for (const auto& address : addresses)
+			found += snapshot->lookup(address) != nullptr;
+	}
+
+	const auto table_elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	size_t mismatches = 0;
+
+	for (size_t i = 0; i < addresses_count; ++i)
+	{
+		const auto* value = snapshot->lookup(addresses[i]);
+
+		if (value ? linear_results[i] != *value : linear_results[i].has_value())
+			++mismatches;
+	}
+
+	std::cout << std::setw(6) << (sizeof(T) == 4 ? "IPv4" : "IPv6") << std::setw(10) << prefixes_count <<
+		std::setw(10) << found / table_rounds << std::setw(14) << std::fixed << std::setprecision(1) <<
+		linear_elapsed / addresses_count << std::setw(12) << table_elapsed / (addresses_count * table_rounds) <<
+		std::setw(14) << snapshot->memory_usage() / 1024 << std::setw(12) << mismatches << std::endl;
+
+	return mismatches;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Fills the frame with the random packet of the mix the filter sees: IPv4 and IPv6
+/// TCP and UDP to or from the tunneled port and the other ports, IPv4 fragments and
+/// options, IPv6 fragment headers, 802.1Q tagged frames, ICMP, ARP, runt and truncated
+/// frames
+/// </summary>
+/// <param name="buffer">frame to fill</param>
+/// <param name="port">tunneled port</param>
+/// <param name="random">random number generator</param>
+// ********************************************************************************
+void make_random_frame(INTERMEDIATE_BUFFER& buffer, const uint16_t port, std::mt19937& random)
+{
+	buffer = {};
+	buffer.m_dwDeviceFlags = random() % 2 ? PACKET_FLAG_ON_SEND : PACKET_FLAG_ON_RECEIVE;
+
+	auto* const ethernet_header = reinterpret_cast<ether_header_ptr>(buffer.m_IBuffer);
+	auto* ip_packet = reinterpret_cast<uint8_t*>(ethernet_header + 1);
+	const auto kind = random() % 16;
+
+	if (kind == 0)
+	{
+		ethernet_header->h_proto = htons(ETH_P_ARP);
+		buffer.m_Length = ETHER_HEADER_LENGTH + sizeof(ether_arp);
+		return;
+	}
+
+	if (kind == 1)
+	{
+		ethernet_header->h_proto = htons(ETH_P_IP);
+		buffer.m_Length = random() % (ETHER_HEADER_LENGTH + sizeof(iphdr));
+		return;
+	}
+
+	if (kind == 2)
+	{
+		auto* const vlan_header = reinterpret_cast<vlan_ether_header_ptr>(buffer.m_IBuffer);
+		vlan_header->h_vlan_proto = htons(ETH_P_8021Q);
+		vlan_header->h_vlan_tci = htons(static_cast<uint16_t>(random() % 8));
+		vlan_header->h_proto = htons(ETH_P_IP);
+		ip_packet = reinterpret_cast<uint8_t*>(vlan_header + 1);
+	}
+	else
+	{
+		ethernet_header->h_proto = htons(kind < 12 ? ETH_P_IP : ETH_P_IPV6);
+	}
+
+	const uint8_t protocol = random() % 8 == 0 ? IPPROTO_ICMP : random() % 2 ? IPPROTO_TCP : IPPROTO_UDP;
+	const uint32_t addresses[] = {htonl(0x0a000001), htonl(0xc0a80101), htonl(0x08080808), static_cast<uint32_t>(random())};
+	const uint16_t ports[] = {port, 443, 53, static_cast<uint16_t>(random())};
+	const auto payload_length = random() % 1400;
+	uint8_t* transport_header;
+
+	if (kind >= 12)
+	{
+		auto* const ip_header = reinterpret_cast<ipv6hdr_ptr>(ip_packet);
+		ip_header->ip6_v = 6;
+		ip_header->ip6_hops = 64;
+
+		auto* const source = reinterpret_cast<uint8_t*>(&ip_header->ip6_src);
+		auto* const destination = reinterpret_cast<uint8_t*>(&ip_header->ip6_dst);
+		source[0] = 0x20;
+		source[1] = random() % 2 ? 0x01 : 0x02;
+		source[15] = static_cast<uint8_t>(random());
+		destination[0] = 0xfe;
+		destination[1] = 0x80;
+		destination[15] = static_cast<uint8_t>(random());
+
+		transport_header = reinterpret_cast<uint8_t*>(ip_header + 1);
+
+		if (random() % 4 == 0)
+		{
+			// first or non-first fragment
+			auto* const fragment_header = reinterpret_cast<ipv6ext_frag_ptr>(transport_header);
+			ip_header->ip6_next = IPPROTO_FRAGMENT;
+			fragment_header->ip6_next = protocol;
+			fragment_header->ip6_offlg = htons(random() % 2 ? 1 : 0x100);
+			transport_header += sizeof(ipv6ext_frag);
+		}
+		else
+		{
+			ip_header->ip6_next = protocol;
+		}
+
+		ip_header->ip6_len = htons(static_cast<uint16_t>(transport_header - reinterpret_cast<uint8_t*>(ip_header + 1) +
+			sizeof(tcphdr) + payload_length));
+	}
+	else
+	{
+		auto* const ip_header = reinterpret_cast<iphdr_ptr>(ip_packet);
+		ip_header->ip_v = 4;
+		ip_header->ip_hl = random() % 8 == 0 ? 6 : 5;
+		ip_header->ip_ttl = 64;
+		ip_header->ip_p = protocol;
+		ip_header->ip_off = random() % 8 == 0 ? htons(static_cast<uint16_t>(IP_MF | random() % 2 * 100)) : 0;
+		ip_header->ip_src.S_un.S_addr = addresses[random() % 4];
+		ip_header->ip_dst.S_un.S_addr = addresses[random() % 4];
+		ip_header->ip_len = htons(static_cast<uint16_t>(ip_header->ip_hl * 4 + sizeof(tcphdr) + payload_length));
+
+		transport_header = ip_packet + ip_header->ip_hl * 4;
+	}
+
+	// TCP and UDP headers start with the same port fields
+	auto* const tcp_header = reinterpret_cast<tcphdr_ptr>(transport_header);
+	tcp_header->th_sport = htons(ports[random() % 4]);
+	tcp_header->th_dport = htons(ports[random() % 4]);
+	tcp_header->th_off = TCP_NO_OPTIONS;
+
+	buffer.m_Length = static_cast<ULONG>(transport_header - buffer.m_IBuffer + sizeof(tcphdr) + payload_length);
+
+	if (random() % 16 == 0)
+		buffer.m_Length = random() % buffer.m_Length;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Loads the packets into the batch and classifies them, with the AVX2 paths of
+/// packet_batch if enabled is set, with the scalar ones otherwise
+/// </summary>
+/// <param name="classifier">packet classifier</param>
+/// <param name="packets">contiguous packet array</param>
+/// <param name="count">number of packets</param>
+/// <param name="enabled">use the AVX2 paths</param>
+/// <param name="batch">receives the packet columns</param>
+/// <param name="mask">receives the selection</param>
+// ********************************************************************************
+void classify_batch(const net::packet_batch_classifier& classifier, const INTERMEDIATE_BUFFER* packets,
+                    const size_t count, const bool enabled, net::packet_batch& batch, net::packet_batch_mask& mask)
+{
+#if defined(PACKET_BATCH_AVX2)
+	net::packet_batch_avx2_enabled = enabled;
+#else
+	std::ignore = enabled;
+#endif
+	classifier.classify(packets, count, batch, mask);
+}
+
+// ********************************************************************************
+/// <summary>
+/// Classifies the random batches of 1 to 510 packets (the ReadPackets block of
+/// simple_packet_filter) with the AVX2 and the scalar paths and counts the packets
+/// where the columns of packet_batch or the selections differ
+/// </summary>
+/// <param name="classifiers">packet classifiers</param>
+/// <param name="port">tunneled port</param>
+/// <param name="random">random number generator</param>
+/// <returns>number of the differing packets</returns>
+// ********************************************************************************
+size_t compare_batch_paths(const std::vector<net::packet_batch_classifier>& classifiers, const uint16_t port,
+                           std::mt19937& random)
+{
+	constexpr size_t batches_count = 2000;
+	constexpr size_t batch_size = ndisapi::simple_packet_filter::maximum_packet_block;
+
+	std::vector<INTERMEDIATE_BUFFER> frames(batch_size);
+	net::packet_batch avx2_batch;
+	net::packet_batch scalar_batch;
+	net::packet_batch_mask avx2_mask;
+	net::packet_batch_mask scalar_mask;
+	size_t packets = 0;
+	size_t differ = 0;
+
+	for (size_t i = 0; i < batches_count; ++i)
+	{
+		const auto count = 1 + random() % batch_size;
+		const auto& classifier = classifiers[i % classifiers.size()];
+
+		for (size_t j = 0; j < count; ++j)
+			make_random_frame(frames[j], port, random);
+
+		classify_batch(classifier, frames.data(), count, true, avx2_batch, avx2_mask);
+		classify_batch(classifier, frames.data(), count, false, scalar_batch, scalar_mask);
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			const auto same_column = [j](const uint32_t* avx2, const uint32_t* scalar) { return avx2[j] == scalar[j]; };
+
+			const auto same = avx2_mask.test(j) == scalar_mask.test(j) &&
+				same_column(avx2_batch.flags(), scalar_batch.flags()) &&
+				same_column(avx2_batch.ethertype(), scalar_batch.ethertype()) &&
+				same_column(avx2_batch.protocol(), scalar_batch.protocol()) &&
+				same_column(avx2_batch.source_v4(), scalar_batch.source_v4()) &&
+				same_column(avx2_batch.destination_v4(), scalar_batch.destination_v4()) &&
+				same_column(avx2_batch.source_port(), scalar_batch.source_port()) &&
+				same_column(avx2_batch.destination_port(), scalar_batch.destination_port()) &&
+				same_column(avx2_batch.vlan(), scalar_batch.vlan()) &&
+				(!(scalar_batch.flags()[j] & net::packet_batch::flag_ipv6) ||
+					(avx2_batch.source_v6()[j] == scalar_batch.source_v6()[j] &&
+						avx2_batch.destination_v6()[j] == scalar_batch.destination_v6()[j]));
+
+			differ += same ? 0 : 1;
+		}
+
+		packets += count;
+	}
+
+	std::cout << batches_count << " batches, " << packets << " packets, AVX2 and scalar results differ for " << differ
+		<< " packets" << std::endl;
+
+	return differ;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Prints the rate of packet_batch_classifier (batch load and classification) on the
+/// full ReadPackets blocks of the random packets
+/// </summary>
+/// <param name="name">classifier name</param>
+/// <param name="classifier">packet classifier</param>
+/// <param name="frames">packets of one block</param>
+/// <param name="enabled">use the AVX2 paths</param>
+// ********************************************************************************
+void measure_classifier_rate(const char* name, const net::packet_batch_classifier& classifier,
+                             const std::vector<INTERMEDIATE_BUFFER>& frames, const bool enabled)
+{
+	constexpr size_t rounds = 4000;
+
+	net::packet_batch batch;
+	net::packet_batch_mask mask;
+	size_t selected = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		classify_batch(classifier, frames.data(), frames.size(), enabled, batch, mask);
+		selected += mask.count();
+	}
+
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const auto packets = static_cast<double>(rounds * frames.size());
+
+	std::cout << std::setw(12) << name << std::setw(8) << (enabled ? "AVX2" : "scalar") << std::setw(10) <<
+		selected / rounds << std::setw(12) << std::fixed << std::setprecision(1) << elapsed * 1e9 / packets <<
+		std::setw(10) << packets / elapsed / 1e6 << std::endl;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Checks that the AVX2 and the scalar paths of packet_batch and
+/// packet_batch_classifier give the same results and prints the classification rate
+/// of both for the udp2tcp filter (TCP or UDP to or from the port) and for the
+/// subnet filter (TCP within two IPv4 and one IPv6 subnet)
+/// </summary>
+/// <returns>number of the differing packets</returns>
+// ********************************************************************************
+size_t benchmark_batch_classifier()
+{
+	constexpr uint16_t port = 5000;
+
+	std::mt19937 random(12345);
+	std::vector<net::packet_batch_classifier> classifiers(2);
+
+	classifiers[0].add_protocol(IPPROTO_TCP);
+	classifiers[0].add_protocol(IPPROTO_UDP);
+	classifiers[0].add_port(port);
+
+	uint8_t prefix[net::ip_address_v6::ipv6_address_max_length] = {0x20, 0x01};
+	uint8_t prefix_mask[net::ip_address_v6::ipv6_address_max_length] = {0xff, 0xff};
+
+	classifiers[1].add_protocol(IPPROTO_TCP);
+	classifiers[1].add_subnet(net::ip_subnet<net::ip_address_v4>(net::ip_address_v4(htonl(0x0a000000)),
+	                                                             net::ip_address_v4(htonl(0xff000000))));
+	classifiers[1].add_subnet(net::ip_subnet<net::ip_address_v4>(net::ip_address_v4(htonl(0xc0a80000)),
+	                                                             net::ip_address_v4(htonl(0xffff0000))),
+	                          net::packet_batch_classifier::endpoint::destination);
+	classifiers[1].add_subnet(net::ip_subnet<net::ip_address_v6>(net::ip_address_v6(prefix),
+	                                                             net::ip_address_v6(prefix_mask)));
+
+	std::cout << std::endl << "Packet batch classifier" << std::endl;
+
+#if defined(PACKET_BATCH_AVX2)
+	const auto avx2 = net::packet_batch_avx2();
+	const auto differ = avx2 ? compare_batch_paths(classifiers, port, random) : 0;
+
+	if (!avx2)
+		std::cout << "AVX2 is not supported by the CPU, only the scalar paths are measured" << std::endl;
+#else
+	constexpr auto avx2 = false;
+	constexpr size_t differ = 0;
+	std::cout << "AVX2 paths are not compiled in, only the scalar paths are measured" << std::endl;
+#endif
+
+	std::vector<INTERMEDIATE_BUFFER> frames(ndisapi::simple_packet_filter::maximum_packet_block);
+
+	for (auto& frame : frames)
+		make_random_frame(frame, port, random);
+
+	std::cout << std::setw(12) << "classifier" << std::setw(8) << "path" << std::setw(10) << "selected" <<
+		std::setw(12) << "ns/packet" << std::setw(10) << "Mpps" << std::endl;
+
+	const char* names[] = {"udp2tcp", "subnets"};
+
+	for (size_t i = 0; i < classifiers.size(); ++i)
+	{
+		if (avx2)
+			measure_classifier_rate(names[i], classifiers[i], frames, true);
+
+		measure_classifier_rate(names[i], classifiers[i], frames, false);
+	}
+
+#if defined(PACKET_BATCH_AVX2)
+	net::packet_batch_avx2_enabled = true;
+#endif
+
+	return differ;
+}
+
+// ********************************************************************************
+/// <summary>
+/// Compares the longest prefix match of ip_prefix_table with the linear scan over the
+/// ip_subnet list for 10 to 10000 random IPv4 and IPv6 prefixes, then the AVX2 and
+/// the scalar paths of packet_batch_classifier
+/// </summary>
+/// <returns>process exit code: 0 if the lookups and both classifier paths returned the same values</returns>
+// ********************************************************************************
+int run_benchmark()
+{
+	std::mt19937 random(12345);
+	size_t mismatches = 0;
+
+	std::cout << "Longest prefix match, 4096 random addresses" << std::endl;
+	std::cout << std::setw(6) << "family" << std::setw(10) << "prefixes" << std::setw(10) << "matched" <<
+		std::setw(14) << "linear ns" << std::setw(12) << "table ns" << std::setw(14) << "table KB" <<
+		std::setw(12) << "mismatches" << std::endl;
+
+	for (const size_t prefixes_count : { 10, 100, 1000, 10000 })
+	{
+		mismatches += measure_prefix_lookup<net::ip_address_v4>(prefixes_count, random);
+		mismatches += measure_prefix_lookup<net::ip_address_v6>(prefixes_count, random);
+	}
+
+	mismatches += benchmark_batch_classifier();
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+int main(const int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "benchmark")
+		return run_benchmark();
+
 	auto is_server = false;
 	uint16_t port = 0;
 	pcap::pcap_file_storage file_stream ("capture.pcap");
+	net::packet_batch batch;
+	net::packet_batch_classifier classifier;
 	
 	auto ndis_api = std::make_unique<ndisapi::simple_packet_filter>(
 		[&is_server, &port, &file_stream](HANDLE, INTERMEDIATE_BUFFER& buffer)
@@ -206,6 +687,17 @@ int main()
 		return 0;
 	}
 
+	// only the tunneled flow reaches the packet routines
+	classifier.add_protocol(IPPROTO_TCP);
+	classifier.add_protocol(IPPROTO_UDP);
+	classifier.add_port(port);
+
+	ndis_api->set_batch_classifier(
+		[&classifier, &batch](const INTERMEDIATE_BUFFER* packets, const size_t count, net::packet_batch_mask& mask)
+		{
+			classifier.classify(packets, count, batch, mask);
+		});
+
 	load_filters(*ndis_api, is_server, port);
 
 	ndis_api->start_filter(index - 1);